@@ -0,0 +1,60 @@
+#!/bin/luix
+-- Allocation-heavy workloads: many small tables, strings,
+-- closures and upvalues that live briefly, plus a growing
+-- set of survivors to keep the heap populated.
+--
+--	luix bench/alloc.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+
+local function bench(name, f)
+	collectgarbage()
+	local t0 = os.clock()
+	f(scale)
+	print(string.format("%-12s %8.3f s", name, os.clock() - t0))
+end
+
+bench("tables", function(n)
+	local keep = {}
+	for i = 1, 200000 * n do
+		local t = {i, i + 1, x = i}
+		if i % 100 == 0 then keep[#keep + 1] = t end
+	end
+end)
+
+bench("strings", function(n)
+	local keep = {}
+	for i = 1, 200000 * n do
+		local s = "key" .. i
+		if i % 100 == 0 then keep[#keep + 1] = s end
+	end
+end)
+
+bench("closures", function(n)
+	local s = 0
+	for i = 1, 200000 * n do
+		local function f() s = s + i end
+		f()
+	end
+end)
+
+bench("coroutines", function(n)
+	for i = 1, 20000 * n do
+		local co = coroutine.wrap(function(a) return a end)
+		co(i)
+	end
+end)
+
+bench("mixed", function(n)
+	local cache = {}
+	for i = 1, 100000 * n do
+		local k = "k" .. (i % 5000)
+		local v = cache[k]
+		if not v then
+			v = {name = k, list = {}}
+			cache[k] = v
+		end
+		v.list[#v.list + 1] = {i}
+		if #v.list > 8 then v.list = {} end
+	end
+end)
@@ -0,0 +1,40 @@
+#!/bin/luix
+-- Loading a large module file with loadfile, which reads it from the
+-- cache of compiled chunks when luix is given one. Run it once as is
+-- and once with a cache directory to compare.
+--
+--	luix bench/cache.lua [scale]
+--	luix -C /tmp/luixcache bench/cache.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+
+local t = {"local M = {}\n"}
+for i = 1, 2000 do
+	t[#t + 1] = string.format([[
+function M.f%d(t, n)
+	local s = 0
+	for i = 1, n do
+		if t[i] and t[i] > %d then s = s + t[i] * 2 else s = s - 1 end
+	end
+	return s, "f%d"
+end
+]], i, i, i)
+end
+t[#t + 1] = "return M\n"
+
+local file = "/tmp/benchcache.lua"
+local f = assert(io.open(file, "w"))
+f:write(table.concat(t))
+f:close()
+
+assert(loadfile(file))	-- fill the cache, if any
+collectgarbage()
+local t0 = os.clock()
+local n = 50 * scale
+for i = 1, n do
+	local M = assert(loadfile(file))()
+	assert(M.f7({1, 2, 3}, 3) == -3)
+end
+local t = os.clock() - t0
+print(string.format("loadfile %8.3f s %8.2f ms/load", t, t / n * 1e3))
+os.remove(file)
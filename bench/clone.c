@@ -0,0 +1,113 @@
+#include <u.h>
+#include <libc.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+/*
+ * Cost of a fresh interpreter for each request: one set
+ * up the way luamain in luix.c does it, then warmed up by
+ * requiring modules, against a copy of such a state made
+ * with luaL_clonestate.
+ *
+ *	mk bench; 6.clonebench [count]
+ */
+
+extern int luaopen_p9(lua_State*);
+extern int luaopen_p9_marshal(lua_State*);
+extern int luaopen_p9_note(lua_State*);
+extern int luaopen_p9_thread(lua_State*);
+extern int luaopen_lpeg(lua_State*);
+
+luaL_Reg preloadlibs[] = {
+	{"p9", luaopen_p9},
+	{"p9.marshal", luaopen_p9_marshal},
+	{"p9.note", luaopen_p9_note},
+	{"p9.thread", luaopen_p9_thread},
+	{"lpeg", luaopen_lpeg},
+	{nil, nil}
+};
+
+/* what a request handler would load before serving */
+char warmup[] =
+	"local lpeg = require 'lpeg'\n"
+	"local marshal = require 'p9.marshal'\n"
+	"local space = lpeg.S(' \\t')^0\n"
+	"local word = lpeg.C((1 - lpeg.S(' \\t'))^1)\n"
+	"words = lpeg.Ct((space * word)^0)\n"
+	"handlers = {}\n"
+	"for _, m in ipairs{'get', 'put', 'post', 'delete', 'head'} do\n"
+	"	handlers[m] = function(req)\n"
+	"		local w = words:match(req.line)\n"
+	"		return marshal.encode{method = m, path = w[2], n = #w}\n"
+	"	end\n"
+	"end\n"
+	"mimetypes = {}\n"
+	"for i = 1, 200 do mimetypes['ext' .. i] = 'type/' .. i end\n";
+
+lua_State*
+newstate(void)
+{
+	lua_State *L;
+
+	if((L = luaL_newstate()) == nil)
+		sysfatal("out of memory");
+	/* as in luamain */
+	lua_gc(L, LUA_GCGEN, 0, 0);
+	lua_pushboolean(L, 1);
+	lua_setfield(L, LUA_REGISTRYINDEX, "LUA_NOENV");
+	luaL_openlibs(L);
+	luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+	for(luaL_Reg *lib = preloadlibs; lib->func; lib++){
+		lua_pushcfunction(L, lib->func);
+		lua_setfield(L, -2, lib->name);
+	}
+	lua_pop(L, 1);
+	if(luaL_dostring(L, warmup) != LUA_OK)
+		sysfatal("warmup: %s", lua_tostring(L, -1));
+	return L;
+}
+
+lua_State*
+clone(lua_State *L)
+{
+	lua_State *C;
+
+	if((C = luaL_clonestate(L)) == nil)
+		sysfatal("clone: %s", lua_tostring(L, -1));
+	return C;
+}
+
+/* checks that a state can serve a request */
+void
+serve(lua_State *L)
+{
+	if(luaL_dostring(L, "return handlers.get{line = 'GET /index.html HTTP/1.1'}") != LUA_OK)
+		sysfatal("serve: %s", lua_tostring(L, -1));
+}
+
+void
+main(int argc, char *argv[])
+{
+	lua_State *L, *C;
+	vlong t0, t1, t2;
+	int i, n;
+
+	n = argc > 1 ? atoi(argv[1]) : 1000;
+	L = newstate();
+	t0 = nsec();
+	for(i = 0; i < n; i++)
+		lua_close(newstate());
+	t1 = nsec();
+	for(i = 0; i < n; i++)
+		lua_close(clone(L));
+	t2 = nsec();
+	C = clone(L);
+	serve(C);
+	lua_close(C);
+	print("%-8s %8.1f µs\n", "fresh", (t1 - t0) / 1000.0 / n);
+	print("%-8s %8.1f µs\n", "clone", (t2 - t1) / 1000.0 / n);
+	lua_close(L);
+	exits(nil);
+}
@@ -0,0 +1,58 @@
+#!/bin/luix
+-- Coroutine switches: a generator handing out numbers one at a
+-- time, a ping-pong between two coroutines, and a generator
+-- yielding from a few calls down.
+--
+--	luix bench/coro.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+
+local function bench(name, f)
+	collectgarbage()
+	local t0 = os.clock()
+	local n = f(1000000 * scale)
+	local t = os.clock() - t0
+	print(string.format("%-10s %8.3f s %8.1f ns/switch", name, t, t / n * 1e9))
+end
+
+local yield, resume, wrap = coroutine.yield, coroutine.resume, coroutine.wrap
+
+bench("generator", function(n)
+	local gen = wrap(function()
+		for i = 1, n do yield(i) end
+	end)
+	local s = 0
+	for i = 1, n do s = s + gen() end
+	assert(s == n * (n + 1) // 2)
+	return 2 * n
+end)
+
+bench("pingpong", function(n)
+	local ping, pong
+	ping = coroutine.create(function(v)
+		while true do v = yield(v + 1) end
+	end)
+	pong = coroutine.create(function(v)
+		while true do
+			local _, r = resume(ping, v)
+			v = yield(r)
+		end
+	end)
+	local v = 0
+	for i = 1, n do
+		local _
+		_, v = resume(pong, v)
+	end
+	assert(v == n)
+	return 4 * n
+end)
+
+bench("nested", function(n)
+	local function leaf(i) yield(i) end
+	local function walk(i) leaf(i) end
+	local co = wrap(function()
+		for i = 1, n do walk(i) end
+	end)
+	for i = 1, n do co() end
+	return 2 * n
+end)
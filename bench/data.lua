@@ -0,0 +1,61 @@
+#!/bin/luix
+-- Loading a large table literal as a chunk compiled and run ("t")
+-- and as a data chunk built directly into its value ("d"). Memory is
+-- the smallest limit, found by bisection, under which the load works.
+--
+--	luix bench/data.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+
+local t = {"return {\n"}
+for i = 1, 20000 * scale do
+	t[#t + 1] = string.format(
+		'\t["key%d"] = {id = %d, name = "item%d", price = %.2f, tags = {"a", "b", %d}},\n',
+		i, i, i, i * 1.25, i % 7)
+end
+t[#t + 1] = "}\n"
+local records = table.concat(t)
+
+t = {"return {\n"}
+for i = 1, 100000 * scale do
+	t[#t + 1] = string.format("%d, %.3f,\n", i, i / 7)
+end
+t[#t + 1] = "}\n"
+local numbers = table.concat(t)
+t = nil
+
+local src
+local function get(mode)
+	return assert(load(src, "=data", mode))()
+end
+
+local function peak(mode)
+	local lo, hi = 0, 1024 * 1024
+	while hi - lo > 64 do
+		local mid = (lo + hi) // 2
+		collectgarbage()
+		collectgarbage("limit", collectgarbage("count") // 1 + mid)
+		local ok = pcall(get, mode)
+		collectgarbage("limit", 0)
+		if ok then hi = mid else lo = mid end
+	end
+	return hi
+end
+
+local function bench(name, chunk, mode)
+	src = chunk
+	collectgarbage()
+	local t0 = os.clock()
+	local n = 10
+	for i = 1, n do
+		get(mode)
+	end
+	local t = os.clock() - t0
+	print(string.format("%-12s %8.2f ms/load  %7d KB peak", name, t / n * 1e3,
+		peak(mode)))
+end
+
+bench("records code", records, "t")
+bench("records data", records, "d")
+bench("numbers code", numbers, "t")
+bench("numbers data", numbers, "d")
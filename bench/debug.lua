@@ -0,0 +1,55 @@
+#!/bin/luix
+-- Memory held by a large precompiled chunk loaded in place, whose names
+-- of locals and upvalues are only read from the chunk once something
+-- asks for them, before and after asking for all of them.
+--
+--	luix bench/debug.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+
+local t = {"local M = {}\nlocal limit, label = 100, 'f'\n"}
+for i = 1, 2000 do
+	t[#t + 1] = string.format([[
+function M.f%d(values, count)
+	local total, largest, smallest = 0, -math.huge, math.huge
+	for index = 1, count do
+		local value = values[index]
+		if value > largest then largest = value end
+		if value < smallest then smallest = value end
+		total = total + value
+	end
+	return total > limit and label .. %d or smallest, largest
+end
+]], i, i)
+end
+t[#t + 1] = "return M\n"
+local bc = string.dump(assert(load(table.concat(t), "=debug")))
+
+local function held(f)
+	collectgarbage()
+	collectgarbage()
+	local k0 = collectgarbage("count")
+	local v = f()
+	collectgarbage()
+	return collectgarbage("count") - k0, v
+end
+
+print(string.format("chunk of %d KB", #bc // 1024))
+local n = 10 * scale
+local t0 = os.clock()
+local lazy, eager = 0, 0
+for i = 1, n do
+	local kb, M = held(function() return assert(load(bc, "=debug", "b"))() end)
+	lazy = lazy + kb
+	kb = held(function()
+		for _, f in pairs(M) do
+			assert(debug.getlocal(f, 1) == "values")
+			assert(debug.getupvalue(f, 1))
+		end
+	end)
+	eager = eager + kb
+	M = nil
+end
+print(string.format("names in the chunk %6.0f KB held", lazy / n))
+print(string.format("names loaded       %6.0f KB more", eager / n))
+print(string.format("%8.2f ms/round", (os.clock() - t0) / n * 1e3))
@@ -0,0 +1,104 @@
+#!/bin/luix
+-- Collection time with chains through weak-key tables, as built
+-- by layers of memoization keyed on objects: the value cached for
+-- one key is the key of the next cache. Only full collections are
+-- timed, as convergence of ephemerons happens in their atomic phase.
+--
+--	luix bench/ephemeron.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+
+-- 'build' returns what to keep alive and, optionally, a function
+-- to run before each collection, which is not timed
+local function bench(name, build)
+	local keep, before = build(scale)
+	collectgarbage()
+	local t = 0
+	for i = 1, 5 do
+		if before then
+			before()
+		end
+		local t0 = os.clock()
+		collectgarbage()
+		t = t + os.clock() - t0
+	end
+	print(string.format("%-12s %8.3f s", name, t))
+	return keep
+end
+
+-- a long chain inside one table, links in random order
+bench("shuffled", function(n)
+	local m = 20000 * n
+	local keys = {}
+	for i = 1, m + 1 do
+		keys[i] = {}
+	end
+	local order = {}
+	for i = 1, m do
+		order[i] = i
+	end
+	math.randomseed(42)
+	for i = m, 2, -1 do
+		local j = math.random(i)
+		order[i], order[j] = order[j], order[i]
+	end
+	local cache = setmetatable({}, {__mode = "k"})
+	for _, i in ipairs(order) do
+		cache[keys[i]] = keys[i + 1]
+	end
+	return {cache, keys[1]}
+end)
+
+-- a long chain inside a few tables, links spread among them
+bench("spread", function(n)
+	local caches = {}
+	for i = 1, 8 do
+		caches[i] = setmetatable({}, {__mode = "k"})
+	end
+	local k = {}
+	local first = k
+	for i = 1, 20000 * n do
+		local v = {}
+		caches[i % 8 + 1][k] = v
+		k = v
+	end
+	return {caches, first}
+end)
+
+-- many short chains, most of them garbage
+bench("memo", function(n)
+	local cache = setmetatable({}, {__mode = "k"})
+	local live = {}
+	for i = 1, 50000 * n do
+		local k = {}
+		local v = {}
+		cache[k] = v
+		cache[v] = {i}
+		if i % 10 == 0 then live[#live + 1] = k end
+	end
+	return {cache, live}
+end)
+
+-- a chain through tables, each reached only through a value of the
+-- previous one and with its key found only after it, and with dead
+-- entries keeping every table in the ephemeron list
+bench("tables", function(n)
+	local mt = {__mode = "k"}
+	local anchor = {}
+	local first = setmetatable({}, mt)
+	local t = first
+	for i = 1, 4000 * n do
+		local k = {}
+		local nt = setmetatable({}, mt)
+		t[anchor] = {key = k}
+		t[k] = {next = nt}
+		t = nt
+	end
+	return {first, anchor}, function()
+		local t = first
+		while t[anchor] do
+			t[{}] = {}
+			t = t[t[anchor].key].next
+		end
+	end
+end)
@@ -0,0 +1,55 @@
+#!/bin/luix
+-- Loading a large precompiled chunk held in a string, in place (its
+-- code and line information used where they are in the string) and
+-- through a reader function, which copies them out of each piece.
+--
+--	luix bench/image.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+
+local t = {"local M = {}\n"}
+for i = 1, 2000 do
+	t[#t + 1] = string.format([[
+function M.f%d(t, n)
+	local s = 0
+	for i = 1, n do
+		if t[i] and t[i] > %d then s = s + t[i] * 2 else s = s - 1 end
+	end
+	local r = {}
+	for k, v in pairs(t) do r[#r + 1] = tostring(k) .. "=" .. tostring(v) end
+	return s, table.concat(r, ",")
+end
+]], i, i)
+end
+t[#t + 1] = "return M\n"
+local bc = string.dump(assert(load(table.concat(t), "=image")))
+
+local function reader()
+	local pos = 1
+	return function()
+		local s = bc:sub(pos, pos + 8191)
+		pos = pos + 8192
+		return s
+	end
+end
+
+local function bench(name, get)
+	collectgarbage()
+	collectgarbage()
+	local k0 = collectgarbage("count")
+	local M = assert(load(get(), "=image", "b"))()
+	collectgarbage()
+	local kb = collectgarbage("count") - k0
+	M = nil
+	local t0 = os.clock()
+	local n = 50 * scale
+	for i = 1, n do
+		assert(load(get(), "=image", "b"))
+	end
+	local t = os.clock() - t0
+	print(string.format("%-10s %8.2f ms/load  %6.0f KB held", name, t / n * 1e3, kb))
+end
+
+print(string.format("chunk of %d KB", #bc // 1024))
+bench("in place", function() return bc end)
+bench("reader", reader)
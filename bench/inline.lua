@@ -0,0 +1,39 @@
+#!/bin/luix
+-- Calls to small local helpers in a hot loop, compiled as is and
+-- with the "--!inline" pragma, which has the compiler copy the
+-- helpers' bodies into their callers.
+--
+--	luix bench/inline.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+
+local src = [[
+local function clamp(x, lo, hi)
+	if x < lo then return lo elseif x > hi then return hi end
+	return x
+end
+local function lerp(a, b, t) return a + (b - a) * t end
+local function sq(x) return x * x end
+
+return function(n)
+	local s = 0
+	for i = 1, n do
+		local t = clamp(i % 100 / 50 - 0.5, 0, 1)
+		s = s + sq(lerp(1, 3, t))
+	end
+	return s
+end
+]]
+
+local function bench(name, chunk)
+	local f = assert(load(chunk, "=inline"))()
+	collectgarbage()
+	local t0 = os.clock()
+	local n = 1000000 * scale
+	local s = f(n)
+	local t = os.clock() - t0
+	print(string.format("%-10s %8.3f s %8.1f ns/iter  %.0f", name, t, t / n * 1e9, s))
+end
+
+bench("call", src)
+bench("inlined", "--!inline\n" .. src)
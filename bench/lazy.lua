@@ -0,0 +1,41 @@
+#!/bin/luix
+-- Loading a large module of which only a few functions are used,
+-- compiled as is and with the "--!lazy" pragma, which has the
+-- compiler put off each function body until its first call.
+--
+--	luix bench/lazy.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+
+local t = {"local M = {}\n"}
+for i = 1, 2000 do
+	t[#t + 1] = string.format([[
+function M.f%d(t, n)
+	local s = 0
+	for i = 1, n do
+		if t[i] and t[i] > %d then s = s + t[i] * 2 else s = s - 1 end
+	end
+	local r = {}
+	for k, v in pairs(t) do r[#r + 1] = tostring(k) .. "=" .. tostring(v) end
+	return s, table.concat(r, ",")
+end
+]], i, i)
+end
+t[#t + 1] = "return M\n"
+local src = table.concat(t)
+
+local function bench(name, chunk)
+	collectgarbage()
+	local t0 = os.clock()
+	local n = 20 * scale
+	local s = 0
+	for i = 1, n do
+		local M = assert(load(chunk, "=lazy"))()
+		for j = 1, 10 do s = s + M["f" .. j * 7]({1, 2, 3}, 3) end
+	end
+	local t = os.clock() - t0
+	print(string.format("%-10s %8.3f s %8.2f ms/load  %d", name, t, t / n * 1e3, s))
+end
+
+bench("eager", src)
+bench("lazy", "--!lazy\n" .. src)
@@ -0,0 +1,67 @@
+#!/bin/luix
+-- Compiling a large generated data file, a large module and a file
+-- of long comments and strings, which stresses the lexer.
+--
+--	luix bench/lex.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+
+local t = {"return {\n"}
+for i = 1, 20000 do
+	t[#t + 1] = string.format(
+		'\t{id = %d, name = "item%d", price = %.2f, tags = {"a", "b"}},\n',
+		i, i, i * 1.25)
+end
+t[#t + 1] = "}\n"
+local data = table.concat(t)
+
+t = {"local M = {}\n"}
+for i = 1, 2000 do
+	t[#t + 1] = string.format([[
+-- Function number %d.
+function M.f%d(list, limit)
+	local total, count = 0, 0
+	for _, item in ipairs(list) do
+		if item.price and item.price > limit then
+			total = total + item.price * 0.5
+			count = count + 1
+		end
+	end
+	return total, count, "f%d"
+end
+]], i, i, i)
+end
+t[#t + 1] = "return M\n"
+local code = table.concat(t)
+
+t = {"local doc = {}\n"}
+for i = 1, 2000 do
+	t[#t + 1] = string.format([==[
+--[[
+	Entry %d. Long comments and long strings are skipped or
+	copied as a whole, without looking at each character.
+]]
+doc[%d] = [[
+	Text of entry %d, as it would appear in a help screen, with
+	enough words to make it worth reading in place.
+]]
+]==], i, i, i)
+end
+t[#t + 1] = "return doc\n"
+local text = table.concat(t)
+
+local function bench(name, src)
+	collectgarbage()
+	local t0 = os.clock()
+	local n = 10 * scale
+	for i = 1, n do
+		assert(load(src, "=" .. name))
+	end
+	local t = os.clock() - t0
+	print(string.format("%-10s %8.3f s %8.2f ms/load  %6.1f MB/s", name, t,
+		t / n * 1e3, #src * n / t / 1e6))
+end
+
+bench("data", data)
+bench("code", code)
+bench("text", text)
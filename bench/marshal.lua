@@ -0,0 +1,90 @@
+#!/bin/luix
+-- Round trips of a table of records through p9.marshal, and
+-- through Lua source written with string.format("%q") and read
+-- back with load(), the way data was exchanged before.
+--
+--	luix bench/marshal.lua [scale]
+
+local marshal = require "p9.marshal"
+
+local scale = tonumber(arg and arg[1]) or 1
+
+local function bench(name, f)
+	collectgarbage()
+	local t0 = os.clock()
+	local size = f(scale)
+	print(string.format("%-12s %8.3f s %10d bytes", name, os.clock() - t0, size))
+end
+
+local function records(n)
+	local t = {}
+	for i = 1, 20000 * n do
+		t[i] = {
+			id = i,
+			name = "user" .. i,
+			score = i / 7,
+			active = i % 3 == 0,
+			tags = {"red", "green", "blue"},
+		}
+	end
+	return t
+end
+
+local function serialize(v, out)
+	if type(v) == "table" then
+		out[#out + 1] = "{"
+		for k, x in pairs(v) do
+			out[#out + 1] = "["
+			serialize(k, out)
+			out[#out + 1] = "]="
+			serialize(x, out)
+			out[#out + 1] = ","
+		end
+		out[#out + 1] = "}"
+	else
+		out[#out + 1] = string.format("%q", v)
+	end
+end
+
+local data = records(scale)
+
+bench("text", function()
+	local size = 0
+	for i = 1, 5 do
+		local out = {"return "}
+		serialize(data, out)
+		local s = table.concat(out)
+		size = #s
+		assert(#load(s)() == #data)
+	end
+	return size
+end)
+
+bench("marshal", function()
+	local size = 0
+	for i = 1, 5 do
+		local s = marshal.encode(data)
+		size = #s
+		assert(#marshal.decode(s) == #data)
+	end
+	return size
+end)
+
+bench("streamed", function()
+	local size = 0
+	for i = 1, 5 do
+		local pieces = {}
+		marshal.write(data, function(s) pieces[#pieces + 1] = s end)
+		local n = 0
+		size = 0
+		local t = marshal.read(function()
+			n = n + 1
+			if pieces[n] then
+				size = size + #pieces[n]
+			end
+			return pieces[n]
+		end)
+		assert(#t == #data)
+	end
+	return size
+end)
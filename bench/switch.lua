@@ -0,0 +1,63 @@
+#!/bin/luix
+-- A dispatcher written as chains of comparisons of one variable
+-- with constants, which the compiler, asked to by the comment
+-- below, turns into jump tables.
+--
+--	luix bench/switch.lua [scale]
+
+--!optimize
+
+local scale = tonumber(arg and arg[1]) or 1
+
+local ops = {"add", "sub", "mul", "div", "mod", "pow", "min", "max", "neg", "abs", "nop", "hlt"}
+
+local function exec(op, a, b)
+	if op == "add" then return a + b
+	elseif op == "sub" then return a - b
+	elseif op == "mul" then return a * b
+	elseif op == "div" then return a // b
+	elseif op == "mod" then return a % b
+	elseif op == "pow" then return a * a
+	elseif op == "min" then return a < b and a or b
+	elseif op == "max" then return a > b and a or b
+	elseif op == "neg" then return -a
+	elseif op == "abs" then return a < 0 and -a or a
+	elseif op == "nop" then return a
+	else return 0
+	end
+end
+
+local function days(m)
+	if m == 2 then return 28
+	elseif m == 4 then return 30
+	elseif m == 6 then return 30
+	elseif m == 9 then return 30
+	elseif m == 11 then return 30
+	end
+	return 31
+end
+
+local function bench(name, f)
+	collectgarbage()
+	local t0 = os.clock()
+	local n = 1000000 * scale
+	local s = f(n)
+	local t = os.clock() - t0
+	print(string.format("%-8s %8.3f s %8.1f ns/iter  %d", name, t, t / n * 1e9, s))
+end
+
+bench("strings", function(n)
+	local s = 0
+	for i = 1, n do
+		s = s + exec(ops[i % #ops + 1], i % 97, 7) % 1000
+	end
+	return s
+end)
+
+bench("ints", function(n)
+	local s = 0
+	for i = 1, n do
+		s = s + days(i % 12 + 1)
+	end
+	return s
+end)
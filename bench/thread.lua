@@ -0,0 +1,50 @@
+#!/bin/luix
+-- Starting and joining threads that run a function with a few
+-- hundred nested ones, given as the function itself, which the
+-- new state gets as a shared chunk, and as its source, which the
+-- new state compiles. Times are real ones, as the work is done
+-- by other processes.
+--
+--	luix bench/thread.lua [scale]
+
+local p9 = require "p9"
+local thread = require "p9.thread"
+
+local scale = tonumber(arg and arg[1]) or 1
+
+local t = {"function(n)\n\tlocal M = {}\n"}
+for i = 1, 300 do
+	t[#t + 1] = string.format([[
+	M[%d] = function(t, k)
+		local s = 0
+		for i = 1, k do
+			if t[i] and t[i] > %d then s = s + t[i] * 2 else s = s - %d end
+		end
+		return s, "f%d"
+	end
+]], i, i, i, i)
+end
+t[#t + 1] = [[
+	local s = 0
+	for i = 1, n do s = s + M[i]({1, 2, 3}, 3) end
+	return s
+end]]
+local body = table.concat(t)
+local f = assert(load("return " .. body, "=thread"))()
+
+local function bench(name, chunk)
+	collectgarbage()
+	local t0 = p9.nsec()
+	local n = 200 * scale
+	local s = 0
+	for i = 1, n do
+		local ok, r = thread.start(chunk, 10):join()
+		assert(ok, r)
+		s = s + r
+	end
+	local t = (p9.nsec() - t0) / 1e9
+	print(string.format("%-10s %8.3f s %8.3f ms/thread  %d", name, t, t / n * 1e3, s))
+end
+
+bench("function", f)
+bench("source", "return (" .. body .. ")(...)")
@@ -0,0 +1,57 @@
+#!/bin/luix
+-- Size of the process while a heap of small objects and large
+-- strings is built, after it is dropped and collected, and after
+-- another full collection. The collection gives free slabs back
+-- to malloc, and malloc gives them to the system where it can
+-- (Plan 9's never does: there the size stays, and only the
+-- kilobytes released to malloc go up).
+--
+--	luix bench/trim.lua [scale]
+
+local scale = tonumber(arg and arg[1]) or 1
+
+-- kilobytes of memory of this process
+local function procsize()
+	local f = io.open("/proc/self/status")
+	if f then	-- Linux
+		local s = f:read("a")
+		f:close()
+		return tonumber(s:match("VmRSS:%s*(%d+)"))
+	end
+	f = io.open("/dev/pid")
+	if f == nil then
+		return 0
+	end
+	local pid = tonumber(f:read("a"))
+	f:close()
+	f = io.open("/proc/" .. pid .. "/status")
+	if f == nil then
+		return 0
+	end
+	local s = f:read("a")
+	f:close()
+	-- name, user and state take 28 bytes each, then 6 times of 12
+	return tonumber(s:sub(3*28 + 6*12 + 1, 3*28 + 7*12)) or 0
+end
+
+local function report(what)
+	print(string.format("%-10s %8d KB process %8.0f KB heap %8.0f KB released",
+		what, procsize(), collectgarbage("count"),
+		collectgarbage("released")))
+end
+
+collectgarbage()
+report("start")
+local t = {}
+for i = 1, 400000 * scale do
+	t[i] = {i, tostring(i)}
+	if i % 100 == 0 then
+		t[-i] = string.rep("x", 4096 + i % 1024)
+	end
+end
+report("built")
+t = nil
+collectgarbage()
+report("collected")
+collectgarbage()
+report("again")
@@ -475,6 +475,9 @@ void realloccode (lua_State *L, Pattern *p, int nsize) {
                                   nsize * sizeof(Instruction));
   if (newblock == NULL && nsize > 0)
     luaL_error(L, "not enough memory");
+  /* the block bypasses Lua's accounting; report it to the collector */
+  lua_adjustexternal(L, ((ptrdiff_t)nsize - p->codesize) *
+                        (ptrdiff_t)sizeof(Instruction));
   p->code = (Instruction *)newblock;
   p->codesize = nsize;
 }
@@ -1217,6 +1217,19 @@ int lp_gc (lua_State *L) {
 }
 
 
+/*
+** The copy of a pattern in a clone of the state (see 'lua_clonestate')
+** drops the code block, which belongs to the original state; it is
+** compiled again when first used.
+*/
+static int lp_clone (lua_State *L) {
+  Pattern *p = getpattern(L, 1);
+  p->code = NULL;
+  p->codesize = 0;
+  return 0;
+}
+
+
 static void createcat (lua_State *L, const char *catname, int (catf) (int)) {
   TTree *t = newcharset(L);
   int i;
@@ -1293,6 +1306,7 @@ static struct luaL_Reg metareg[] = {
   {"__add", lp_choice},
   {"__pow", lp_star},
   {"__gc", lp_gc},
+  {"__clone", lp_clone},
   {"__len", lp_and},
   {"__div", lp_divcapture},
   {"__unm", lp_not},
@@ -81,7 +81,8 @@ static TValue *index2value (lua_State *L, int idx) {
                                       : &G(L)->nilvalue;
     }
     else {  /* light C function or Lua function (through a hook)?) */
-      api_check(L, ttislcf(s2v(ci->func.p)), "caller not a C function");
+      api_check(L, ttislcf(s2v(ci->func.p)) || ttisleaf(s2v(ci->func.p)),
+                   "caller not a C function");
       return &G(L)->nilvalue;  /* no upvalues */
     }
   }
@@ -296,7 +297,7 @@ LUA_API const char *lua_typename (lua_State *L, int t) {
 
 LUA_API int lua_iscfunction (lua_State *L, int idx) {
   const TValue *o = index2value(L, idx);
-  return (ttislcf(o) || (ttisCclosure(o)));
+  return (ttislcf(o) || ttisleaf(o) || (ttisCclosure(o)));
 }
 
 
@@ -437,7 +438,7 @@ LUA_API lua_Unsigned lua_rawlen (lua_State *L, int idx) {
 
 LUA_API lua_CFunction lua_tocfunction (lua_State *L, int idx) {
   const TValue *o = index2value(L, idx);
-  if (ttislcf(o)) return fvalue(o);
+  if (ttislcf(o) || ttisleaf(o)) return fvalue(o);
   else if (ttisCclosure(o))
     return clCvalue(o)->f;
   else return NULL;  /* not a C function */
@@ -475,7 +476,8 @@ LUA_API lua_State *lua_tothread (lua_State *L, int idx) {
 LUA_API const void *lua_topointer (lua_State *L, int idx) {
   const TValue *o = index2value(L, idx);
   switch (ttypetag(o)) {
-    case LUA_VLCF: return cast_voidp(cast_sizet(fvalue(o)));
+    case LUA_VLCF: case LUA_VLEAF:
+      return cast_voidp(cast_sizet(fvalue(o)));
     case LUA_VUSERDATA: case LUA_VLIGHTUSERDATA:
       return touserdata(o);
     default: {
@@ -602,6 +604,20 @@ LUA_API void lua_pushcclosure (lua_State *L, lua_CFunction fn, int n) {
 }
 
 
+/*
+** Push a leaf C function: one that always returns exactly one value
+** and never calls Lua functions, yields or changes hooks. The VM can
+** call it with less bookkeeping than other C functions (see 'callC' in
+** lvm.c). It is still a light C function for the rest of the API.
+*/
+LUA_API void lua_pushleaf (lua_State *L, lua_CFunction fn) {
+  lua_lock(L);
+  setleafvalue(s2v(L->top.p), fn);
+  api_incr_top(L);
+  lua_unlock(L);
+}
+
+
 LUA_API void lua_pushboolean (lua_State *L, int b) {
   lua_lock(L);
   if (b)
@@ -1084,6 +1100,46 @@ LUA_API int lua_pcallk (lua_State *L, int nargs, int nresults, int errfunc,
 }
 
 
+/*
+** Set the global table as the 1st upvalue (may be LUA_ENV) of a
+** newly loaded function
+*/
+static void setenvupval (lua_State *L, LClosure *f) {
+  if (f->nupvalues >= 1) {  /* does it have an upvalue? */
+    /* get global table from registry */
+    const TValue *gt = getGtable(L);
+    setobj(L, f->upvals[0]->v.p, gt);
+    luaC_barrier(L, f->upvals[0], gt);
+  }
+}
+
+
+/*
+** Function loaded from a data chunk (mode 'd'): it returns the value
+** read from the chunk.
+*/
+static int datavalue (lua_State *L) {
+  lua_pushvalue(L, lua_upvalueindex(1));
+  return 1;
+}
+
+
+/*
+** Finish a successful load, with what was loaded on the top.
+*/
+static void finishload (lua_State *L) {
+  if (ttisLclosure(s2v(L->top.p - 1)))
+    setenvupval(L, clLvalue(s2v(L->top.p - 1)));
+  else {  /* value of a data chunk; make it a function returning it */
+    CClosure *cl = luaF_newCclosure(L, 1);
+    cl->f = datavalue;
+    setobj2n(L, &cl->upvalue[0], s2v(L->top.p - 1));
+    setclCvalue(L, s2v(L->top.p - 1), cl);
+    luaC_checkGC(L);
+  }
+}
+
+
 LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
                       const char *chunkname, const char *mode) {
   ZIO z;
@@ -1092,16 +1148,39 @@ LUA_API int lua_load (lua_State *L, lua_Reader reader, void *data,
   if (!chunkname) chunkname = "?";
   luaZ_init(L, &z, reader, data);
   status = luaD_protectedparser(L, &z, chunkname, mode);
-  if (status == LUA_OK) {  /* no errors? */
-    LClosure *f = clLvalue(s2v(L->top.p - 1));  /* get new function */
-    if (f->nupvalues >= 1) {  /* does it have an upvalue? */
-      /* get global table from registry */
-      const TValue *gt = getGtable(L);
-      /* set global table as 1st upvalue of 'f' (may be LUA_ENV) */
-      setobj(L, f->upvals[0]->v.p, gt);
-      luaC_barrier(L, f->upvals[0], gt);
-    }
-  }
+  if (status == LUA_OK)  /* no errors? */
+    finishload(L);
+  lua_unlock(L);
+  return status;
+}
+
+
+/*
+** Load the chunk in the 'sz' bytes at 'buff', as 'lua_load' does,
+** replacing the string or full userdata on the top of the stack, which
+** keeps those bytes alive (holding them or, say, a mapping of them),
+** with the result. The code and line information of a binary chunk are
+** used where they are, and that value is kept alive while any of them
+** is in use.
+*/
+LUA_API int lua_loadimage (lua_State *L, const char *buff, size_t sz,
+                                         const char *chunkname,
+                                         const char *mode) {
+  ZIO z;
+  int status;
+  TValue *o;
+  lua_lock(L);
+  api_checknelems(L, 1);
+  o = s2v(L->top.p - 1);
+  api_check(L, ttisstring(o) || ttisfulluserdata(o),
+                "string or userdata expected");
+  if (!chunkname) chunkname = "?";
+  luaZ_initimage(L, &z, gcvalue(o), buff, sz);
+  status = luaD_protectedparser(L, &z, chunkname, mode);
+  if (status == LUA_OK)  /* no errors? */
+    finishload(L);
+  setobjs2s(L, L->top.p - 2, L->top.p - 1);  /* result replaces image */
+  L->top.p--;
   lua_unlock(L);
   return status;
 }
@@ -1122,6 +1201,49 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
 }
 
 
+/*
+** Copy the prototypes of the Lua function on the top of the stack into
+** a chunk allocated with 'f', which any state can load without
+** compiling it again. Returns NULL if the value is not a Lua function
+** or there is no memory for the chunk. The caller owns one reference
+** to the chunk; each state loading it holds another until closed.
+*/
+LUA_API lua_Chunk *lua_sharechunk (lua_State *L, lua_Alloc f, void *ud) {
+  lua_Chunk *c = NULL;
+  TValue *o;
+  lua_lock(L);
+  api_checknelems(L, 1);
+  o = s2v(L->top.p - 1);
+  if (isLfunction(o)) {
+    luaU_loaddebug(L, getproto(o), 1);  /* a chunk keeps no image */
+    c = luaU_share(getproto(o), f, ud);
+  }
+  lua_unlock(L);
+  return c;
+}
+
+
+LUA_API void lua_loadchunk (lua_State *L, lua_Chunk *c) {
+  lua_lock(L);
+  setenvupval(L, luaU_loadshared(L, c));
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_releasechunk (lua_Chunk *c) {
+  luaU_releasechunk(c);
+}
+
+
+LUA_API int lua_snapshot (lua_State *L, lua_Writer writer, void *data) {
+  int status;
+  lua_lock(L);
+  status = luaC_snapshot(L, writer, data);
+  lua_unlock(L);
+  return status;
+}
+
+
 LUA_API int lua_status (lua_State *L) {
   return L->status;
 }
@@ -1196,6 +1318,29 @@ LUA_API int lua_gc (lua_State *L, int what, ...) {
       res = gcrunning(g);
       break;
     }
+    case LUA_GCLIMIT: {
+      int data = va_arg(argp, int);
+      res = cast_int(g->memlimit >> 10);
+      if (data >= 0)  /* negative only queries the limit */
+        g->memlimit = cast(lu_mem, data) << 10;
+      break;
+    }
+    case LUA_GCTRIM: {
+      int data = va_arg(argp, int);
+      res = cast_int(g->gctrim >> 10);
+      if (data >= 0)  /* negative only queries the threshold */
+        g->gctrim = cast(lu_mem, data) << 10;
+      break;
+    }
+    case LUA_GCRELEASED: {
+      /* GC values are expressed in Kbytes: #bytes/2^10 */
+      res = cast_int(g->released >> 10);
+      break;
+    }
+    case LUA_GCRELEASEDB: {
+      res = cast_int(g->released & 0x3ff);
+      break;
+    }
     case LUA_GCGEN: {
       int minormul = va_arg(argp, int);
       int majormul = va_arg(argp, int);
@@ -1320,6 +1465,115 @@ LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
   lua_lock(L);
   G(L)->ud = ud;
   G(L)->frealloc = f;
+  G(L)->trimf = NULL;  /* it belonged to the old allocator */
+  G(L)->slabmax = 0;
+  lua_unlock(L);
+}
+
+
+LUA_API void lua_settrimf (lua_State *L, lua_Trim f) {
+  lua_lock(L);
+  G(L)->trimf = f;
+  lua_unlock(L);
+}
+
+
+/*
+** Tell that the allocator serves blocks up to 'max' bytes from memory
+** of its own, not from 'malloc', so they cannot be tagged with
+** 'setmalloctag'.
+*/
+LUA_API void lua_setslabmax (lua_State *L, size_t max) {
+  lua_lock(L);
+  G(L)->slabmax = max;
+  lua_unlock(L);
+}
+
+
+LUA_API size_t lua_getslabmax (lua_State *L) {
+  size_t max;
+  lua_lock(L);
+  max = G(L)->slabmax;
+  lua_unlock(L);
+  return max;
+}
+
+
+/*
+** Register the C function implementing 'select', so that calls
+** 'select(n, ...)' reaching it can be answered by the VM without
+** pushing the varargs.
+*/
+LUA_API void lua_setselectf (lua_State *L, lua_CFunction f) {
+  lua_lock(L);
+  G(L)->selectf = f;
+  lua_unlock(L);
+}
+
+
+/*
+** Turn on or off the inlining of small local functions in the chunks
+** that 'L' compiles from now on. Returns the previous setting; a
+** negative 'on' leaves it as it is.
+*/
+LUA_API int lua_setinline (lua_State *L, int on) {
+  int old;
+  lua_lock(L);
+  old = G(L)->inlinecode;
+  if (on >= 0)
+    G(L)->inlinecode = (on != 0);
+  lua_unlock(L);
+  return old;
+}
+
+
+/*
+** Set the optimization level of the chunks that 'L' compiles from now
+** on: 0 (the default) for the code of the stock compiler, 1 to thread
+** jumps, make jump tables and remove dead code, 2 to also reuse loaded
+** upvalues, propagate copies of registers and remove stores overwritten.
+** Returns the previous level; a negative 'level' leaves it as it is.
+*/
+LUA_API int lua_setoptimize (lua_State *L, int level) {
+  int old;
+  lua_lock(L);
+  old = G(L)->optcode;
+  if (level >= 0)
+    G(L)->optcode = cast_byte(level < 2 ? level : 2);
+  lua_unlock(L);
+  return old;
+}
+
+
+/*
+** Turn on or off the lazy compilation of function bodies, put off until
+** their first call, in the chunks that 'L' compiles from now on. Returns
+** the previous setting; a negative 'on' leaves it as it is.
+*/
+LUA_API int lua_setlazy (lua_State *L, int on) {
+  int old;
+  lua_lock(L);
+  old = G(L)->lazycode;
+  if (on >= 0)
+    G(L)->lazycode = (on != 0);
+  lua_unlock(L);
+  return old;
+}
+
+
+/*
+** Account for 'delta' bytes of memory owned outside the Lua heap (such
+** as buffers held by userdata) as if Lua had allocated them, so that
+** the collector paces itself by them too. Memory given back must be
+** reported with a negative 'delta'.
+*/
+LUA_API void lua_adjustexternal (lua_State *L, ptrdiff_t delta) {
+  global_State *g;
+  lua_lock(L);
+  g = G(L);
+  g->GCdebt += delta;
+  if (delta > 0)
+    luaC_checkGC(L);
   lua_unlock(L);
 }
 
@@ -1354,8 +1608,8 @@ LUA_API void *lua_newuserdatauv (lua_State *L, size_t size, int nuvalue) {
 
 
 
-static const char *aux_upvalue (TValue *fi, int n, TValue **val,
-                                GCObject **owner) {
+static const char *aux_upvalue (lua_State *L, TValue *fi, int n,
+                                TValue **val, GCObject **owner) {
   switch (ttypetag(fi)) {
     case LUA_VCCL: {  /* C closure */
       CClosure *f = clCvalue(fi);
@@ -1373,6 +1627,7 @@ static const char *aux_upvalue (TValue *fi, int n, TValue **val,
         return NULL;  /* 'n' not in [1, p->sizeupvalues] */
       *val = f->upvals[n-1]->v.p;
       if (owner) *owner = obj2gco(f->upvals[n - 1]);
+      luaU_checkdebug(L, p);
       name = p->upvalues[n-1].name;
       return (name == NULL) ? "(no name)" : getstr(name);
     }
@@ -1385,7 +1640,7 @@ LUA_API const char *lua_getupvalue (lua_State *L, int funcindex, int n) {
   const char *name;
   TValue *val = NULL;  /* to avoid warnings */
   lua_lock(L);
-  name = aux_upvalue(index2value(L, funcindex), n, &val, NULL);
+  name = aux_upvalue(L, index2value(L, funcindex), n, &val, NULL);
   if (name) {
     setobj2s(L, L->top.p, val);
     api_incr_top(L);
@@ -1403,7 +1658,7 @@ LUA_API const char *lua_setupvalue (lua_State *L, int funcindex, int n) {
   lua_lock(L);
   fi = index2value(L, funcindex);
   api_checknelems(L, 1);
-  name = aux_upvalue(fi, n, &val, &owner);
+  name = aux_upvalue(L, fi, n, &val, &owner);
   if (name) {
     L->top.p--;
     setobj(L, val, s2v(L->top.p));
@@ -1440,7 +1695,7 @@ LUA_API void *lua_upvalueid (lua_State *L, int fidx, int n) {
         return &f->upvalue[n - 1];
       /* else */
     }  /* FALLTHROUGH */
-    case LUA_VLCF:
+    case LUA_VLCF: case LUA_VLEAF:
       return NULL;  /* light C functions have no upvalues */
     default: {
       api_check(L, 0, "function expected");
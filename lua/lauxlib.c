@@ -781,12 +781,338 @@ static int skipcomment (FILE *f, int *cp) {
 }
 
 
+/*
+** Files opened while loading are kept in a box, a userdata that closes
+** its file when collected, so that an error raised while the file is
+** open (such as a memory error) does not leave it open for good.
+*/
+static int closefbox (FILE **pf) {
+  int res = 0;
+  if (*pf != NULL) {
+    res = fclose(*pf);
+    *pf = NULL;
+  }
+  return res;
+}
+
+
+static int fboxgc (lua_State *L) {
+  closefbox((FILE **)lua_touserdata(L, 1));
+  return 0;
+}
+
+
+/* push a new box and open file 'name' in it */
+static FILE **openfbox (lua_State *L, const char *name, const char *mode) {
+  FILE **pf = (FILE **)lua_newuserdatauv(L, sizeof(FILE *), 0);
+  *pf = NULL;
+  if (luaL_newmetatable(L, "_FBOX*")) {  /* creating metatable? */
+    lua_pushcfunction(L, fboxgc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  *pf = fopen(name, mode);
+  return pf;
+}
+
+
+/*
+** l_mapfile maps the first 'n' bytes of file 'f' into memory, read only,
+** returning NULL when that cannot be done; l_unmapfile undoes it. Plan
+** 9 cannot map files, so there images are read into the heap.
+*/
+#if !defined(l_mapfile)	/* { */
+
+#if defined(LUA_USE_POSIX)
+
+#include <sys/mman.h>
+
+static void *l_mapfile (FILE *f, size_t n) {
+  void *p = mmap(NULL, n, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+  return (p == MAP_FAILED) ? NULL : p;
+}
+
+#define l_unmapfile(p,n)	((void)munmap(p, n))
+
+#else
+
+#define l_mapfile(f,n)	((void)(f), (void)(n), NULL)
+#define l_unmapfile(p,n)	((void)(p), (void)(n))
+
+#endif
+
+#endif				/* } */
+
+
+typedef struct FMap {
+  void *p;  /* mapping, or NULL */
+  size_t n;  /* its size */
+} FMap;
+
+
+static int fmapgc (lua_State *L) {
+  FMap *m = (FMap *)lua_touserdata(L, 1);
+  if (m->p != NULL) {
+    l_unmapfile(m->p, m->n);
+    m->p = NULL;
+  }
+  return 0;
+}
+
+
+/*
+** Push a full userdata with the rest of file 'f', after its first
+** character 'c', so that a binary chunk in it can be loaded in place,
+** and return that rest and its size. Where files can be mapped, the
+** userdata holds a mapping of the file, undone when it is collected;
+** otherwise it holds a copy of that rest. Returns NULL, pushing
+** nothing, when the size of what is left cannot be told, as for pipes.
+*/
+static const char *readimage (lua_State *L, FILE *f, int c, size_t *size) {
+  long pos = ftell(f);
+  long end;
+  size_t n, got;
+  char *b;
+  FMap *m;
+  if (pos < 1 || fseek(f, 0, SEEK_END) != 0 || (end = ftell(f)) < pos ||
+      fseek(f, pos, SEEK_SET) != 0)
+    return NULL;
+  n = (size_t)(end - pos);
+  m = (FMap *)lua_newuserdatauv(L, sizeof(FMap), 0);
+  m->p = NULL;
+  if (luaL_newmetatable(L, "_FMAP*")) {  /* creating metatable? */
+    lua_pushcfunction(L, fmapgc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+  m->p = l_mapfile(f, (size_t)end);
+  if (m->p != NULL) {  /* 'c' is already in the mapping */
+    m->n = (size_t)end;
+    *size = n + 1;
+    return (const char *)m->p + pos - 1;
+  }
+  lua_pop(L, 1);  /* no mapping; read it all */
+  b = (char *)lua_newuserdatauv(L, n + 1, 0);
+  b[0] = (char)c;
+  got = fread(b + 1, 1, n, f);
+  memset(b + 1 + got, 0, n - got);  /* clear what could not be read */
+  *size = n + 1;
+  return b;
+}
+
+
+/*
+** {------------------------------------------------------
+** Cache of compiled chunks: with a cache directory set, the code
+** compiled from a text file is dumped there, and later loads of the
+** same file read that code back instead of compiling the file again.
+** A cache file is named after its source path and file, and starts
+** with a key made of those and of the file's version, modification
+** time and length, so that any change to the source misses it.
+** -------------------------------------------------------
+*/
+
+/* key in the registry for the cache directory */
+static const char *const CACHEDIR = "_CACHEDIR";
+
+
+/*
+** l_fileid fills 'id' with the identity of the regular file 'f': its
+** device, file, version (if any), modification time and length; it
+** returns false for other kinds of files or where that cannot be told,
+** leaving them out of the cache. Where the version does not change with
+** each write, the times, in seconds, cannot tell apart two versions of
+** the same length written in the same second; so a file changed in the
+** last couple of seconds is left out too, and any later change gets a
+** later time than the one in a cache file.
+*/
+#if !defined(l_fileid)	/* { */
+
+#if defined(LUA_USE_PLAN9)
+
+#define l_getpid()	getpid()
+
+static int l_fileid (FILE *f, lua_Integer *id) {
+  Dir *d = dirfstat(fileno(f));
+  int ok = (d != NULL && d->type == 'M' && d->qid.type == QTFILE);
+  if (ok) {
+    id[0] = ((lua_Integer)d->type << 32) | d->dev;
+    id[1] = (lua_Integer)d->qid.path;
+    id[2] = d->qid.vers;
+    id[3] = d->mtime;
+    id[4] = d->length;
+  }
+  free(d);
+  return ok;
+}
+
+#elif defined(LUA_USE_POSIX)
+
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define l_getpid()	getpid()
+
+static int l_fileid (FILE *f, lua_Integer *id) {
+  struct stat st;
+  time_t now = time(NULL);
+  if (fstat(fileno(f), &st) != 0 || !S_ISREG(st.st_mode) ||
+      st.st_mtime >= now - 1 || st.st_ctime >= now - 1)  /* too recent? */
+    return 0;
+  id[0] = (lua_Integer)st.st_dev;
+  id[1] = (lua_Integer)st.st_ino;
+  id[2] = (lua_Integer)st.st_ctime;
+  id[3] = (lua_Integer)st.st_mtime;
+  id[4] = (lua_Integer)st.st_size;
+  return 1;
+}
+
+#else
+
+#define l_fileid(f,id)	((void)(f), (void)(id), 0)
+
+#endif
+
+#endif				/* } */
+
+
+#if !defined(l_getpid)
+#define l_getpid()	0
+#endif
+
+
+LUALIB_API void luaL_setcachedir (lua_State *L, const char *dir) {
+  lua_pushstring(L, dir);  /* nil when 'dir' is NULL */
+  lua_setfield(L, LUA_REGISTRYINDEX, CACHEDIR);
+}
+
+
+/*
+** If a cache directory is set and the file 'f' can be cached when
+** loaded with 'mode', pushes the name of its cache file and the key
+** it must start with, and returns true. Otherwise pushes nothing. The
+** name comes from the path alone, so that a changed file replaces its
+** cache file instead of leaving it behind; the key tells whether the
+** cache file is stale.
+*/
+static int cachekey (lua_State *L, FILE *f, const char *filename,
+                                            const char *mode) {
+  lua_Integer id[5];
+  unsigned int h = 2166136261u;  /* FNV-1a hash of the path */
+  const char *s;
+  int inl, opt;
+  if (mode != NULL && (strchr(mode, 't') == NULL || strchr(mode, 'd')))
+    return 0;  /* text not allowed or a data chunk */
+  if (lua_getfield(L, LUA_REGISTRYINDEX, CACHEDIR) != LUA_TSTRING ||
+      !l_fileid(f, id)) {
+    lua_pop(L, 1);
+    return 0;
+  }
+  for (s = filename; *s; s++)
+    h = (h ^ (unsigned char)*s) * 16777619u;
+  lua_pushfstring(L, "%s" LUA_DIRSEP "%I.luac", lua_tostring(L, -1),
+                     (lua_Integer)h);
+  lua_replace(L, -2);  /* name replaces directory */
+  inl = lua_setinline(L, -1);  /* inlining changes the code */
+  opt = lua_setoptimize(L, -1);  /* and so does optimization */
+  lua_pushfstring(L, "%s %I %I %I %I %I %d %d", filename,
+                     id[0], id[1], id[2], id[3], id[4], inl, opt);
+  return 1;
+}
+
+
+/*
+** Loads the chunk cached under the name at index 'idx', if it starts
+** with the key at 'idx + 1', naming it 'chunkname'. Returns true with
+** the function on the stack, or false with nothing pushed for a
+** missing, stale or broken cache file.
+*/
+static int loadcache (lua_State *L, LoadF *lf, int idx,
+                                   const char *chunkname) {
+  size_t kl, size;
+  const char *key = lua_tolstring(L, idx + 1, &kl);
+  const char *image;
+  FILE **pf = openfbox(L, lua_tostring(L, idx), "rb");
+  FILE *f = *pf;
+  int ok = 0;
+  if (f != NULL && kl < sizeof(lf->buff) &&
+      fread(lf->buff, 1, kl + 1, f) == kl + 1 &&
+      memcmp(lf->buff, key, kl + 1) == 0 &&  /* key with its '\0' */
+      (image = readimage(L, f, getc(f), &size)) != NULL) {
+    ok = (lua_loadimage(L, image, size, chunkname, "b") == LUA_OK);
+    if (!ok) lua_pop(L, 1);  /* remove error message */
+  }
+  closefbox(pf);
+  lua_remove(L, -1 - ok);  /* remove box */
+  return ok;
+}
+
+
+static int writeF (lua_State *L, const void *p, size_t size, void *ud) {
+  (void)L;  /* not used */
+  return (fwrite(p, 1, size, (FILE *)ud) != size);
+}
+
+
+/* dump function 1 to file 2, in protected mode (as it may compile) */
+static int dumpcache (lua_State *L) {
+  FILE *f = (FILE *)lua_touserdata(L, 2);
+  lua_settop(L, 1);
+  lua_pushboolean(L, lua_dump(L, writeF, f, 0) == 0);
+  return 1;
+}
+
+
+/*
+** Writes the function on the top of the stack to the cache file named
+** at index 'idx', after the key at 'idx + 1'. The dump goes through a
+** temporary file renamed over the old one when complete, so that other
+** processes never read a partial cache file. Any failure just leaves
+** the file out of the cache.
+*/
+static void savecache (lua_State *L, int idx) {
+  const char *name = lua_tostring(L, idx);
+  size_t kl;
+  const char *key = lua_tolstring(L, idx + 1, &kl);
+  const char *tmp = lua_pushfstring(L, "%s.%d", name, (int)l_getpid());
+  FILE *f = fopen(tmp, "wb");
+  int ok;
+  if (f == NULL) {
+    lua_pop(L, 1);
+    return;
+  }
+  ok = (fwrite(key, 1, kl + 1, f) == kl + 1);
+  if (ok) {
+    lua_pushcfunction(L, dumpcache);
+    lua_pushvalue(L, -3);  /* function */
+    lua_pushlightuserdata(L, f);
+    ok = (lua_pcall(L, 2, 1, 0) == LUA_OK && lua_toboolean(L, -1));
+    lua_pop(L, 1);
+  }
+  ok = (fclose(f) == 0 && ok);
+  if (ok && rename(tmp, name) != 0) {  /* cannot rename over old file? */
+    remove(name);
+    ok = (rename(tmp, name) == 0);
+  }
+  if (!ok)
+    remove(tmp);
+  lua_pop(L, 1);  /* remove 'tmp' */
+}
+
+/* }------------------------------------------------------ */
+
+
 LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
                                              const char *mode) {
   LoadF lf;
   int status, readstatus;
   int c;
+  const char *image;
+  size_t size;
+  int cached = 0;  /* cache name and key pushed above the file box? */
   int fnameindex = lua_gettop(L) + 1;  /* index of filename on the stack */
+  FILE **pf = NULL;  /* box of the file, just above its name */
   if (filename == NULL) {
     lua_pushliteral(L, "=stdin");
     lf.f = stdin;
@@ -794,31 +1120,62 @@ LUALIB_API int luaL_loadfilex (lua_State *L, const char *filename,
   else {
     lua_pushfstring(L, "@%s", filename);
     errno = 0;
-    lf.f = fopen(filename, "r");
-    if (lf.f == NULL) return errfile(L, "open", fnameindex);
+    pf = openfbox(L, filename, "r");
+    if (*pf == NULL) {
+      lua_pop(L, 1);  /* remove box */
+      return errfile(L, "open", fnameindex);
+    }
+    lf.f = *pf;
+    cached = cachekey(L, lf.f, filename, mode);
+    if (cached && loadcache(L, &lf, fnameindex + 2,
+                                   lua_tostring(L, fnameindex))) {
+      closefbox(pf);
+      lua_rotate(L, fnameindex, 1);  /* function below name, box and key */
+      lua_settop(L, fnameindex);  /* remove them */
+      return LUA_OK;
+    }
   }
   lf.n = 0;
   if (skipcomment(lf.f, &c))  /* read initial portion */
     lf.buff[lf.n++] = '\n';  /* add newline to correct line numbers */
   if (c == LUA_SIGNATURE[0]) {  /* binary file? */
     lf.n = 0;  /* remove possible newline */
+    if (cached) {  /* binary files are not cached */
+      lua_pop(L, 2);
+      cached = 0;
+    }
     if (filename) {  /* "real" file? */
       errno = 0;
-      lf.f = freopen(filename, "rb", lf.f);  /* reopen in binary mode */
-      if (lf.f == NULL) return errfile(L, "reopen", fnameindex);
+      lf.f = *pf = freopen(filename, "rb", lf.f);  /* reopen in binary mode */
+      if (lf.f == NULL) {
+        lua_settop(L, fnameindex);  /* remove box */
+        return errfile(L, "reopen", fnameindex);
+      }
       skipcomment(lf.f, &c);  /* re-read initial portion */
     }
   }
-  if (c != EOF)
-    lf.buff[lf.n++] = c;  /* 'c' is the first character of the stream */
   errno = 0;
-  status = lua_load(L, getF, &lf, lua_tostring(L, -1), mode);
+  if (c == LUA_SIGNATURE[0] && filename &&
+      (image = readimage(L, lf.f, c, &size)) != NULL)
+    status = lua_loadimage(L, image, size, lua_tostring(L, fnameindex), mode);
+  else {
+    if (c != EOF)
+      lf.buff[lf.n++] = c;  /* 'c' is the first character of the stream */
+    status = lua_load(L, getF, &lf, lua_tostring(L, fnameindex), mode);
+  }
   readstatus = ferror(lf.f);
-  if (filename) fclose(lf.f);  /* close file (even in case of errors) */
+  if (filename) closefbox(pf);  /* close file (even in case of errors) */
   if (readstatus) {
     lua_settop(L, fnameindex);  /* ignore results from 'lua_load' */
     return errfile(L, "read", fnameindex);
   }
+  if (cached) {
+    if (status == LUA_OK)
+      savecache(L, fnameindex + 2);
+    lua_rotate(L, fnameindex + 2, 1);  /* result below name and key */
+    lua_pop(L, 2);
+  }
+  if (filename) lua_remove(L, fnameindex + 1);  /* remove box */
   lua_remove(L, fnameindex);
   return status;
 }
@@ -956,6 +1313,26 @@ LUALIB_API void luaL_setfuncs (lua_State *L, const luaL_Reg *l, int nup) {
 }
 
 
+/*
+** turn the light C functions named in 'names' (ending with NULL) in
+** the table at the top into leaf functions (see 'lua_pushleaf');
+** other values are left alone.
+*/
+LUALIB_API void luaL_setleaves (lua_State *L, const char *const *names) {
+  int top = lua_gettop(L);
+  for (; *names != NULL; names++) {
+    lua_CFunction f;
+    lua_getfield(L, top, *names);
+    f = lua_tocfunction(L, -1);
+    if (f != NULL && lua_getupvalue(L, -1, 1) == NULL) {  /* light? */
+      lua_pushleaf(L, f);
+      lua_setfield(L, top, *names);
+    }
+    lua_settop(L, top);
+  }
+}
+
+
 /*
 ** ensure that stack[idx][fname] has a table and push that table
 ** into the stack
@@ -1023,6 +1400,15 @@ LUALIB_API const char *luaL_gsub (lua_State *L, const char *s,
 }
 
 
+/*
+** {======================================================
+** Slab allocator
+** =======================================================
+*/
+
+/*
+** Plain allocator, also used for memory shared by several states
+*/
 static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
   (void)ud; (void)osize;  /* not used */
   if (nsize == 0) {
@@ -1033,6 +1419,381 @@ static void *l_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
     return realloc(ptr, nsize);
 }
 
+#if defined(LUAL_SLABALLOC)
+
+/*
+** Most objects allocated by Lua are small and come in a handful of
+** sizes (tables, short strings, closures, upvalues, CallInfos), so
+** blocks up to SLABMAX bytes are served from slabs: SLABSIZE-aligned
+** areas holding blocks of a single size class, each with its own
+** list of free blocks. Larger blocks go to 'malloc'. As Lua always
+** gives the real size of a block being freed or reallocated, that
+** size alone tells where the block came from; finding the slab of a
+** small block is just a matter of masking its address.
+**
+** Slabs are carved out of chunks of SLABCHUNK slabs got from 'malloc'.
+** Slabs left without blocks in use go to a list of empty slabs, to be
+** reused by any size class; after a major collection, 'l_slabtrim'
+** gives back to 'malloc' the chunks whose slabs are all empty and then,
+** if that and the large blocks freed since the last trim add up to
+** more than it was asked to keep, lets 'malloc' give its free memory
+** back to the system ('l_trimheap'), where the platform allows.  The
+** first block of an arena holds the state; 'lua_close' frees it last,
+** and then the arena frees itself along with all its chunks, even if
+** some C library left blocks of its own in them.
+*/
+
+/*
+** l_trimheap asks 'malloc' to give back to the system its free memory,
+** keeping 'keep' bytes at the top of the heap. glibc does that with
+** 'malloc_trim', which also releases free pages inside the heap.
+*/
+#if !defined(l_trimheap)	/* { */
+
+#if defined(__GLIBC__)
+
+#include <malloc.h>
+
+#define l_trimheap(keep)	((void)malloc_trim(keep))
+
+#else
+
+#define l_trimheap(keep)	((void)(keep))
+
+#endif
+
+#endif				/* } */
+
+
+#define SLABSIZE	4096	/* size and alignment of a slab */
+
+
+/*
+** l_chunkalloc allocates the memory for a chunk of slabs, with CHUNKPAD
+** extra bytes to align it to SLABSIZE, and l_freepages gives back to
+** the system the pages of a chunk about to be freed. The malloc of
+** Plan 9 never shrinks the process, so there chunks are allocated
+** aligned, their slabs being whole pages, and 'segfree' releases them
+** (they come back zeroed if 'malloc' reuses them); large blocks freed
+** stay with 'malloc', to be reused for later blocks.
+*/
+#if !defined(l_chunkalloc)	/* { */
+
+#if defined(LUA_USE_PLAN9)
+
+#define CHUNKPAD	0
+#define l_chunkalloc(sz)	mallocalign(sz, SLABSIZE, 0, 0)
+#define l_freepages(p,sz)	((void)segfree(p, sz))
+
+#else
+
+#define CHUNKPAD	SLABSIZE
+#define l_chunkalloc(sz)	malloc(sz)
+#define l_freepages(p,sz)	((void)(p), (void)(sz))
+
+#endif
+
+#endif				/* } */
+
+#define SLABCHUNK	16	/* number of slabs allocated at once */
+#define SLABGRAIN	16	/* granularity of size classes */
+#define SLABMAX		256	/* largest block served from slabs */
+
+#define NSLABCLASSES	(SLABMAX / SLABGRAIN)
+
+/* size class for a (non zero) block size and size of a class */
+#define slabclass(sz)	((int)(((sz) - 1) / SLABGRAIN))
+#define classsize(c)	((size_t)((c) + 1) * SLABGRAIN)
+
+#define issmall(sz)	((sz) <= SLABMAX)
+
+#define slabof(p)  \
+  ((Slab *)((size_t)(p) & ~(size_t)(SLABSIZE - 1)))
+
+/* space for the slab header, keeping blocks aligned */
+#define SLABHEADER  \
+  ((sizeof(Slab) + SLABGRAIN - 1) / SLABGRAIN * SLABGRAIN)
+
+
+typedef struct SlabChunk {
+  struct SlabChunk *next;
+  void *mem;  /* block got from 'malloc' */
+  int nempty;  /* number of its slabs in the list of empty slabs */
+} SlabChunk;
+
+
+typedef struct Slab {
+  struct Slab *next, *prev;  /* links in list of slabs with free blocks */
+  void *free;  /* list of free blocks */
+  char *unused;  /* first block never used in this slab */
+  SlabChunk *chunk;  /* chunk this slab belongs to */
+  unsigned int nused;  /* number of blocks in use */
+  int sc;  /* size class of its blocks */
+} Slab;
+
+
+typedef struct SlabArena {
+  Slab *partial[NSLABCLASSES];  /* slabs with free blocks, per class */
+  Slab *empty;  /* slabs with no blocks in use */
+  SlabChunk *chunks;  /* all chunks of slabs */
+  void *main;  /* first block, holding the state */
+  size_t nempty;  /* number of slabs in list 'empty' */
+  size_t bigfree;  /* bytes of large blocks freed since last trim */
+} SlabArena;
+
+
+/* true if slab 's' has no room for another block */
+#define slabfull(s)  \
+  ((s)->free == NULL &&  \
+   (s)->unused + classsize((s)->sc) > (char *)(s) + SLABSIZE)
+
+
+static void linkslab (Slab **list, Slab *s) {
+  s->prev = NULL;
+  s->next = *list;
+  if (*list != NULL)
+    (*list)->prev = s;
+  *list = s;
+}
+
+
+static void unlinkslab (Slab **list, Slab *s) {
+  if (s->prev != NULL)
+    s->prev->next = s->next;
+  else
+    *list = s->next;
+  if (s->next != NULL)
+    s->next->prev = s->prev;
+}
+
+
+/*
+** Get a new chunk of slabs from 'malloc' and add them to the list of
+** empty slabs.
+*/
+static int newchunk (SlabArena *a) {
+  int i;
+  char *p;
+  SlabChunk *c = (SlabChunk *)malloc(sizeof(SlabChunk));
+  if (c == NULL)
+    return 0;
+  c->mem = l_chunkalloc(SLABCHUNK * SLABSIZE + CHUNKPAD);
+  if (c->mem == NULL) {
+    free(c);
+    return 0;
+  }
+  c->next = a->chunks;
+  c->nempty = SLABCHUNK;
+  a->chunks = c;
+  a->nempty += SLABCHUNK;
+  p = (char *)slabof((char *)c->mem + SLABSIZE - 1);
+  for (i = 0; i < SLABCHUNK; i++, p += SLABSIZE) {
+    Slab *s = (Slab *)p;
+    s->chunk = c;
+    s->next = a->empty;
+    a->empty = s;
+  }
+  return 1;
+}
+
+
+static Slab *newslab (SlabArena *a, int sc) {
+  Slab *s;
+  if (a->empty == NULL && !newchunk(a))
+    return NULL;
+  s = a->empty;
+  a->empty = s->next;
+  a->nempty--;
+  s->chunk->nempty--;
+  s->free = NULL;
+  s->unused = (char *)s + SLABHEADER;
+  s->nused = 0;
+  s->sc = sc;
+  linkslab(&a->partial[sc], s);
+  return s;
+}
+
+
+static void *slabmalloc (SlabArena *a, int sc) {
+  Slab *s = a->partial[sc];
+  void *b;
+  if (s == NULL && (s = newslab(a, sc)) == NULL)
+    return NULL;
+  if (s->free != NULL) {  /* reuse a free block? */
+    b = s->free;
+    s->free = *(void **)b;
+  }
+  else {  /* take a new block from the end of the slab */
+    b = s->unused;
+    s->unused += classsize(sc);
+  }
+  s->nused++;
+  if (slabfull(s))
+    unlinkslab(&a->partial[sc], s);  /* no more room */
+  return b;
+}
+
+
+static void slabfree (SlabArena *a, void *b) {
+  Slab *s = slabof(b);
+  int wasfull = slabfull(s);
+  *(void **)b = s->free;
+  s->free = b;
+  s->nused--;
+  if (wasfull)  /* has room again? */
+    linkslab(&a->partial[s->sc], s);
+  if (s->nused == 0) {  /* no blocks in use? */
+    unlinkslab(&a->partial[s->sc], s);
+    s->next = a->empty;
+    a->empty = s;
+    a->nempty++;
+    s->chunk->nempty++;
+  }
+}
+
+
+#define CHUNKSIZE	(SLABCHUNK * SLABSIZE + CHUNKPAD + sizeof(SlabChunk))
+
+
+static void freechunk (SlabChunk *c) {
+  l_freepages(slabof((char *)c->mem + SLABSIZE - 1), SLABCHUNK * SLABSIZE);
+  free(c->mem);
+  free(c);
+}
+
+/*
+** Give back to 'malloc' chunks with all their slabs empty, as long as
+** more than 'keep' bytes stay in empty slabs. Chunks to be freed are
+** marked with a negative 'nempty' while their slabs are removed from
+** the list of empty slabs.
+*/
+static size_t freechunks (SlabArena *a, size_t keep) {
+  SlabChunk **pc, *c;
+  Slab **ps;
+  size_t released = 0;
+  size_t n = a->nempty;
+  for (c = a->chunks; c != NULL && n * SLABSIZE > keep; c = c->next) {
+    if (c->nempty == SLABCHUNK) {
+      c->nempty = -1;
+      n -= SLABCHUNK;
+    }
+  }
+  if (n == a->nempty)
+    return 0;  /* nothing to release */
+  a->nempty = n;
+  for (ps = &a->empty; *ps != NULL; ) {
+    if ((*ps)->chunk->nempty < 0)
+      *ps = (*ps)->next;  /* remove slab from the list */
+    else
+      ps = &(*ps)->next;
+  }
+  for (pc = &a->chunks; (c = *pc) != NULL; ) {
+    if (c->nempty < 0) {
+      *pc = c->next;
+      freechunk(c);
+      released += CHUNKSIZE;
+    }
+    else
+      pc = &c->next;
+  }
+  return released;
+}
+
+
+/*
+** Free empty chunks and, if enough memory went back to 'malloc' since
+** the last trim, let it give its free memory back to the system.
+** Returns the number of bytes of chunks given back to 'malloc'.
+*/
+static size_t l_slabtrim (void *ud, size_t keep) {
+  SlabArena *a = (SlabArena *)ud;
+  size_t released = freechunks(a, keep);
+  if (released + a->bigfree > keep)
+    l_trimheap(keep);
+  a->bigfree = 0;
+  return released;
+}
+
+
+static SlabArena *newarena (void) {
+  int i;
+  SlabArena *a = (SlabArena *)malloc(sizeof(SlabArena));
+  if (a == NULL)
+    return NULL;
+  for (i = 0; i < NSLABCLASSES; i++)
+    a->partial[i] = NULL;
+  a->empty = NULL;
+  a->chunks = NULL;
+  a->main = NULL;
+  a->nempty = 0;
+  a->bigfree = 0;
+  return a;
+}
+
+
+static void freearena (SlabArena *a) {
+  SlabChunk *c, *next;
+  for (c = a->chunks; c != NULL; c = next) {
+    next = c->next;
+    freechunk(c);
+  }
+  free(a);
+}
+
+
+static void freeblock (SlabArena *a, void *ptr, size_t osize) {
+  if (issmall(osize))
+    slabfree(a, ptr);
+  else {
+    a->bigfree += osize;
+    free(ptr);
+  }
+}
+
+
+static void *l_slaballoc (void *ud, void *ptr, size_t osize, size_t nsize) {
+  SlabArena *a = (SlabArena *)ud;
+  void *newptr;
+  if (ptr == NULL)
+    osize = 0;  /* 'osize' is a type tag for new blocks */
+  if (nsize == 0) {
+    if (ptr != NULL) {
+      int closed = (ptr == a->main);  /* freeing the state? */
+      freeblock(a, ptr, osize);
+      if (closed)
+        freearena(a);
+    }
+    return NULL;
+  }
+  if (ptr != NULL) {
+    if (issmall(osize) && issmall(nsize))
+      if (slabclass(osize) == slabclass(nsize))
+        return ptr;  /* block is already large enough */
+    if (!issmall(osize) && !issmall(nsize)) {
+      if (nsize < osize)
+        a->bigfree += osize - nsize;
+      return realloc(ptr, nsize);
+    }
+  }
+  newptr = issmall(nsize) ? slabmalloc(a, slabclass(nsize)) : malloc(nsize);
+  if (newptr == NULL) {
+    if (a->main == NULL)  /* could not create the state? */
+      freearena(a);
+    return NULL;
+  }
+  if (ptr != NULL) {  /* move block between slabs and 'malloc' */
+    memcpy(newptr, ptr, (osize < nsize) ? osize : nsize);
+    freeblock(a, ptr, osize);
+  }
+  else if (a->main == NULL)
+    a->main = newptr;
+  return newptr;
+}
+
+#endif
+
+/* }====================================================== */
+
 
 /*
 ** Standard panic funcion just prints an error message. The test
@@ -1106,8 +1867,17 @@ static void warnfon (void *ud, const char *message, int tocont) {
 
 
 LUALIB_API lua_State *luaL_newstate (void) {
+#if defined(LUAL_SLABALLOC)
+  SlabArena *a = newarena();
+  lua_State *L = (a == NULL) ? NULL : lua_newstate(l_slaballoc, a);
+#else
   lua_State *L = lua_newstate(l_alloc, NULL);
+#endif
   if (l_likely(L)) {
+#if defined(LUAL_SLABALLOC)
+    lua_settrimf(L, l_slabtrim);
+    lua_setslabmax(L, SLABMAX);
+#endif
     lua_atpanic(L, &panic);
     lua_setwarnf(L, warnfoff, L);  /* default is warnings off */
   }
@@ -1115,6 +1885,39 @@ LUALIB_API lua_State *luaL_newstate (void) {
 }
 
 
+/*
+** Copy of state 'L' with an allocator of its own, set up as by
+** 'luaL_newstate'; see 'lua_clonestate'.
+*/
+LUALIB_API lua_State *luaL_clonestate (lua_State *L) {
+#if defined(LUAL_SLABALLOC)
+  SlabArena *a = newarena();
+  lua_State *L1 = (a == NULL) ? NULL : lua_clonestate(L, l_slaballoc, a);
+  if (a == NULL)
+    lua_pushliteral(L, "not enough memory");
+#else
+  lua_State *L1 = lua_clonestate(L, l_alloc, NULL);
+#endif
+  if (l_likely(L1)) {
+#if defined(LUAL_SLABALLOC)
+    lua_settrimf(L1, l_slabtrim);
+    lua_setslabmax(L1, SLABMAX);
+#endif
+    lua_setwarnf(L1, warnfoff, L1);  /* default is warnings off */
+  }
+  return L1;
+}
+
+
+/*
+** Share the Lua function on the top of the stack with other states;
+** see 'lua_sharechunk'.
+*/
+LUALIB_API lua_Chunk *luaL_sharechunk (lua_State *L) {
+  return lua_sharechunk(L, l_alloc, NULL);
+}
+
+
 LUALIB_API void luaL_checkversion_ (lua_State *L, lua_Number ver, size_t sz) {
   lua_Number v = lua_version(L);
   if (sz != LUAL_NUMSIZES)  /* check numeric types */
@@ -94,11 +94,16 @@ LUALIB_API int (luaL_loadfilex) (lua_State *L, const char *filename,
 
 #define luaL_loadfile(L,f)	luaL_loadfilex(L,f,NULL)
 
+LUALIB_API void (luaL_setcachedir) (lua_State *L, const char *dir);
+
 LUALIB_API int (luaL_loadbufferx) (lua_State *L, const char *buff, size_t sz,
                                    const char *name, const char *mode);
 LUALIB_API int (luaL_loadstring) (lua_State *L, const char *s);
 
 LUALIB_API lua_State *(luaL_newstate) (void);
+LUALIB_API lua_State *(luaL_clonestate) (lua_State *L);
+
+LUALIB_API lua_Chunk *(luaL_sharechunk) (lua_State *L);
 
 LUALIB_API lua_Integer (luaL_len) (lua_State *L, int idx);
 
@@ -108,6 +113,7 @@ LUALIB_API const char *(luaL_gsub) (lua_State *L, const char *s,
                                     const char *p, const char *r);
 
 LUALIB_API void (luaL_setfuncs) (lua_State *L, const luaL_Reg *l, int nup);
+LUALIB_API void (luaL_setleaves) (lua_State *L, const char *const *names);
 
 LUALIB_API int (luaL_getsubtable) (lua_State *L, int idx, const char *fname);
 
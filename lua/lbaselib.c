@@ -199,10 +199,12 @@ static int pushmode (lua_State *L, int oldmode) {
 static int luaB_collectgarbage (lua_State *L) {
   static const char *const opts[] = {"stop", "restart", "collect",
     "count", "step", "setpause", "setstepmul",
-    "isrunning", "generational", "incremental", NULL};
+    "isrunning", "generational", "incremental", "limit", "trim",
+    "released", NULL};
   static const int optsnum[] = {LUA_GCSTOP, LUA_GCRESTART, LUA_GCCOLLECT,
     LUA_GCCOUNT, LUA_GCSTEP, LUA_GCSETPAUSE, LUA_GCSETSTEPMUL,
-    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC};
+    LUA_GCISRUNNING, LUA_GCGEN, LUA_GCINC, LUA_GCLIMIT, LUA_GCTRIM,
+    LUA_GCRELEASED};
   int o = optsnum[luaL_checkoption(L, 1, "collect", opts)];
   switch (o) {
     case LUA_GCCOUNT: {
@@ -212,6 +214,13 @@ static int luaB_collectgarbage (lua_State *L) {
       lua_pushnumber(L, (lua_Number)k + ((lua_Number)b/1024));
       return 1;
     }
+    case LUA_GCRELEASED: {
+      int k = lua_gc(L, o);
+      int b = lua_gc(L, LUA_GCRELEASEDB);
+      checkvalres(k);
+      lua_pushnumber(L, (lua_Number)k + ((lua_Number)b/1024));
+      return 1;
+    }
     case LUA_GCSTEP: {
       int step = (int)luaL_optinteger(L, 2, 0);
       int res = lua_gc(L, o, step);
@@ -227,6 +236,14 @@ static int luaB_collectgarbage (lua_State *L) {
       lua_pushinteger(L, previous);
       return 1;
     }
+    case LUA_GCLIMIT:
+    case LUA_GCTRIM: {
+      int k = (int)luaL_optinteger(L, 2, -1);
+      int previous = lua_gc(L, o, k);
+      checkvalres(previous);
+      lua_pushinteger(L, previous);
+      return 1;
+    }
     case LUA_GCISRUNNING: {
       int res = lua_gc(L, o);
       checkvalres(res);
@@ -322,7 +339,8 @@ static int luaB_ipairs (lua_State *L) {
 
 static int load_aux (lua_State *L, int status, int envidx) {
   if (l_likely(status == LUA_OK)) {
-    if (envidx != 0) {  /* 'env' parameter? */
+    /* 'env' parameter? (a data chunk keeps its value in upvalue 1) */
+    if (envidx != 0 && !lua_iscfunction(L, -1)) {
       lua_pushvalue(L, envidx);  /* environment for loaded function */
       if (!lua_setupvalue(L, -2, 1))  /* set it as 1st upvalue */
         lua_pop(L, 1);  /* remove 'env' if not used by previous call */
@@ -392,7 +410,8 @@ static int luaB_load (lua_State *L) {
   int env = (!lua_isnone(L, 4) ? 4 : 0);  /* 'env' index or 0 if no 'env' */
   if (s != NULL) {  /* loading a string? */
     const char *chunkname = luaL_optstring(L, 2, s);
-    status = luaL_loadbufferx(L, s, l, chunkname, mode);
+    lua_pushvalue(L, 1);
+    status = lua_loadimage(L, s, l, chunkname, mode);  /* code used in place */
   }
   else {  /* loading from a reader function */
     const char *chunkname = luaL_optstring(L, 2, "=(load)");
@@ -534,10 +553,18 @@ static const luaL_Reg base_funcs[] = {
 };
 
 
+/* functions in 'base_funcs' that are leaves (see 'lua_pushleaf') */
+static const char *const base_leaves[] = {
+  "rawequal", "rawget", "rawlen", "type", NULL
+};
+
+
 LUAMOD_API int luaopen_base (lua_State *L) {
   /* open lib into global table */
   lua_pushglobaltable(L);
   luaL_setfuncs(L, base_funcs, 0);
+  luaL_setleaves(L, base_leaves);
+  lua_setselectf(L, luaB_select);  /* let the VM answer 'select(n, ...)' */
   /* set global _G */
   lua_pushvalue(L, -1);
   lua_setfield(L, -2, LUA_GNAME);
@@ -0,0 +1,479 @@
+/*
+** $Id: lclone.c $
+** Copies of whole Lua states
+** See Copyright Notice in lua.h
+*/
+
+#define lclone_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "lapi.h"
+#include "ldebug.h"
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "ltm.h"
+#include "lundump.h"
+
+
+/*
+** A clone is built by copying every object reachable from the registry
+** and the basic-type metatables of the original state. Each object met
+** is given an empty counterpart at once, recorded in a map from old to
+** new objects, and filled in later, in the order the map records them;
+** so cycles need no special care and the copy does not recurse. The
+** collector of the new state does not run while it is being built, so
+** the objects not yet linked anywhere are safe.
+*/
+
+
+typedef struct CPair {
+  GCObject *from;
+  GCObject *to;
+} CPair;
+
+typedef struct Clone {
+  lua_State *L;  /* state being built */
+  lua_State *from;  /* state being copied */
+  CPair *pair;  /* objects met, in order */
+  int npair;
+  int sizepair;
+  int *index;  /* hash of 'pair' by 'from' (-1 for free slots) */
+  int lsizeindex;  /* log2 of size of 'index' */
+} Clone;
+
+
+#define MINLSIZEINDEX	8
+
+
+static unsigned int hashobj (Clone *c, const GCObject *o) {
+  unsigned int h = cast_uint(point2uint(o)) * 2654435769u;
+  return (h >> (32 - c->lsizeindex)) & ((1u << c->lsizeindex) - 1);
+}
+
+
+static void rehash (Clone *c) {
+  int i;
+  int size = 1 << c->lsizeindex;
+  luaM_freearray(c->L, c->index, size);
+  c->index = NULL;
+  c->index = luaM_newvector(c->L, size * 2, int);
+  c->lsizeindex++;
+  for (i = 0; i < size * 2; i++)
+    c->index[i] = -1;
+  for (i = 0; i < c->npair; i++) {
+    unsigned int h = hashobj(c, c->pair[i].from);
+    while (c->index[h] != -1)
+      h = (h + 1) & (size * 2 - 1);
+    c->index[h] = i;
+  }
+}
+
+
+static GCObject *lookup (Clone *c, const GCObject *o) {
+  unsigned int mask = (1u << c->lsizeindex) - 1;
+  unsigned int h = hashobj(c, o);
+  int i;
+  while ((i = c->index[h]) != -1) {
+    if (c->pair[i].from == o)
+      return c->pair[i].to;
+    h = (h + 1) & mask;
+  }
+  return NULL;
+}
+
+
+static void record (Clone *c, GCObject *from, GCObject *to) {
+  unsigned int mask, h;
+  if (c->npair >= (1 << c->lsizeindex) / 2)
+    rehash(c);
+  luaM_growvector(c->L, c->pair, c->npair, c->sizepair, CPair,
+                  MAX_INT, "objects");
+  c->pair[c->npair].from = from;
+  c->pair[c->npair].to = to;
+  mask = (1u << c->lsizeindex) - 1;
+  h = hashobj(c, from);
+  while (c->index[h] != -1)
+    h = (h + 1) & mask;
+  c->index[h] = c->npair++;
+}
+
+
+/*
+** Returns the counterpart of 'o' in the new state, making an empty one
+** if 'o' was not met before. Strings have no references to follow and
+** are made whole; short ones are not recorded, as interning makes
+** copies of the same short string the same object already.
+*/
+static GCObject *copyobj (Clone *c, GCObject *o) {
+  lua_State *L = c->L;
+  GCObject *n;
+  if (o->tt == LUA_VSHRSTR) {
+    TString *ts = gco2ts(o);
+    return obj2gco(luaS_newlstr(L, getshrstr(ts), ts->shrlen));
+  }
+  if ((n = lookup(c, o)) != NULL)
+    return n;
+  switch (o->tt) {
+    case LUA_VLNGSTR: {
+      TString *ts = gco2ts(o);
+      TString *nts = luaS_createlngstrobj(L, ts->u.lnglen);
+      memcpy(getlngstr(nts), getlngstr(ts), ts->u.lnglen * sizeof(char));
+      n = obj2gco(nts);
+      break;
+    }
+    case LUA_VTABLE: {
+      Table *t = gco2t(o);
+      Table *nt = luaH_new(L);
+      n = obj2gco(nt);
+      luaH_resize(L, nt, luaH_realasize(t), isdummy(t) ? 0 : sizenode(t));
+      break;
+    }
+    case LUA_VLCL: {
+      n = obj2gco(luaF_newLclosure(L, gco2lcl(o)->nupvalues));
+      break;
+    }
+    case LUA_VCCL: {
+      CClosure *cl = gco2ccl(o);
+      CClosure *ncl = luaF_newCclosure(L, cl->nupvalues);
+      int i;
+      ncl->f = cl->f;
+      for (i = 0; i < cl->nupvalues; i++)
+        setnilvalue(&ncl->upvalue[i]);
+      n = obj2gco(ncl);
+      break;
+    }
+    case LUA_VUSERDATA: {
+      Udata *u = gco2u(o);
+      Udata *nu = luaS_newudata(L, u->len, u->nuvalue);
+      memcpy(getudatamem(nu), getudatamem(u), u->len);
+      n = obj2gco(nu);
+      break;
+    }
+    case LUA_VUPVAL: {
+      GCObject *o1 = luaC_newobj(L, LUA_VUPVAL, sizeof(UpVal));
+      UpVal *uv = gco2upv(o1);
+      uv->v.p = &uv->u.value;
+      setnilvalue(uv->v.p);
+      n = obj2gco(uv);
+      break;
+    }
+    case LUA_VPROTO: {
+      n = obj2gco(luaF_newproto(L));
+      break;
+    }
+    case LUA_VTHREAD: {
+      if (gco2th(o) == G(c->from)->mainthread)
+        return obj2gco(L);
+      luaG_runerror(L, "cannot clone a state holding coroutines");
+    }
+    default: lua_assert(0); return NULL;
+  }
+  record(c, o, n);
+  return n;
+}
+
+
+static void copyvalue (Clone *c, TValue *to, const TValue *from) {
+  if (iscollectable(from)) {
+    GCObject *o = copyobj(c, gcvalue(from));
+    val_(to).gc = o;
+    settt_(to, ctb(rawtt(from)));
+  }
+  else
+    setobj(c->L, to, from);
+}
+
+
+/* counterpart of object 'o' of C type 't' */
+#define copyref(c,o,t)	cast(t *, copyobj(c, obj2gco(o)))
+
+#define copystring(c,ts)	((ts) ? copyref(c, ts, TString) : NULL)
+
+
+static void filltable (Clone *c, Table *from, Table *to) {
+  lua_State *L = c->L;
+  unsigned int i, asize = luaH_realasize(from);
+  TValue k, v;
+  lua_assert(luaH_realasize(to) >= asize);
+  for (i = 0; i < asize; i++) {
+    if (!isempty(&from->array[i]))
+      copyvalue(c, &to->array[i], &from->array[i]);
+  }
+  if (!isdummy(from)) {
+    for (i = 0; i < cast_uint(sizenode(from)); i++) {
+      Node *n = gnode(from, i);
+      if (!isempty(gval(n))) {
+        getnodekey(c->from, &k, n);
+        copyvalue(c, &k, &k);
+        copyvalue(c, &v, gval(n));
+        luaH_set(L, to, &k, &v);
+      }
+    }
+  }
+  if (from->metatable)
+    to->metatable = copyref(c, from->metatable, Table);
+  invalidateTMcache(to);
+}
+
+
+#define copyarray(to,from,n)  \
+	{ if ((n) > 0) memcpy(to, from, (n) * sizeof(*(from))); }
+
+
+static void fillproto (Clone *c, Proto *from, Proto *to) {
+  lua_State *L = c->L;
+  int i, n;
+  to->numparams = from->numparams;
+  to->is_vararg = from->is_vararg;
+  to->maxstacksize = from->maxstacksize;
+  to->linedefined = from->linedefined;
+  to->lastlinedefined = from->lastlinedefined;
+  to->source = copystring(c, from->source);
+  to->lazy = from->lazy;
+  to->body = copystring(c, from->body);
+  n = from->sizecode;
+  to->code = luaM_newvectorchecked(L, n, Instruction);
+  to->sizecode = n;
+  copyarray(to->code, from->code, n);
+  n = from->sizek;
+  to->k = luaM_newvectorchecked(L, n, TValue);
+  to->sizek = n;
+  for (i = 0; i < n; i++)
+    setnilvalue(&to->k[i]);
+  for (i = 0; i < n; i++)
+    copyvalue(c, &to->k[i], &from->k[i]);
+  n = from->sizeupvalues;
+  to->upvalues = luaM_newvectorchecked(L, n, Upvaldesc);
+  to->sizeupvalues = n;
+  for (i = 0; i < n; i++)
+    to->upvalues[i].name = NULL;
+  for (i = 0; i < n; i++) {
+    to->upvalues[i] = from->upvalues[i];
+    to->upvalues[i].name = copystring(c, from->upvalues[i].name);
+  }
+  n = from->sizep;
+  to->p = luaM_newvectorchecked(L, n, Proto *);
+  to->sizep = n;
+  for (i = 0; i < n; i++)
+    to->p[i] = NULL;
+  for (i = 0; i < n; i++)
+    to->p[i] = copyref(c, from->p[i], Proto);
+  if (from->sizelineinfo >= 0) {  /* else still in its image */
+    n = from->sizelineinfo;
+    to->lineinfo = luaM_newvectorchecked(L, n, ls_byte);
+    to->sizelineinfo = n;
+    copyarray(to->lineinfo, from->lineinfo, n);
+    n = from->sizeabslineinfo;
+    to->abslineinfo = luaM_newvectorchecked(L, n, AbsLineInfo);
+    to->sizeabslineinfo = n;
+    copyarray(to->abslineinfo, from->abslineinfo, n);
+  }
+  n = from->sizelocvars;
+  to->locvars = luaM_newvectorchecked(L, n, LocVar);
+  to->sizelocvars = n;
+  for (i = 0; i < n; i++)
+    to->locvars[i].varname = NULL;
+  for (i = 0; i < n; i++) {
+    to->locvars[i] = from->locvars[i];
+    to->locvars[i].varname = copystring(c, from->locvars[i].varname);
+  }
+  luaU_copydebug(L, to, from);  /* debug info still in its image, if any */
+}
+
+
+/*
+** Fills the counterpart of 'from'. Open upvalues are copied with the
+** values they have at the moment.
+*/
+static void fill (Clone *c, GCObject *from, GCObject *to) {
+  int i;
+  switch (from->tt) {
+    case LUA_VTABLE:
+      filltable(c, gco2t(from), gco2t(to));
+      break;
+    case LUA_VLCL: {
+      LClosure *cl = gco2lcl(from), *ncl = gco2lcl(to);
+      ncl->p = copyref(c, cl->p, Proto);
+      for (i = 0; i < cl->nupvalues; i++) {
+        if (cl->upvals[i])
+          ncl->upvals[i] = copyref(c, cl->upvals[i], UpVal);
+      }
+      break;
+    }
+    case LUA_VCCL: {
+      CClosure *cl = gco2ccl(from), *ncl = gco2ccl(to);
+      for (i = 0; i < cl->nupvalues; i++)
+        copyvalue(c, &ncl->upvalue[i], &cl->upvalue[i]);
+      break;
+    }
+    case LUA_VUSERDATA: {
+      Udata *u = gco2u(from), *nu = gco2u(to);
+      for (i = 0; i < u->nuvalue; i++)
+        copyvalue(c, &nu->uv[i].uv, &u->uv[i].uv);
+      if (u->metatable)
+        nu->metatable = copyref(c, u->metatable, Table);
+      break;
+    }
+    case LUA_VUPVAL:
+      copyvalue(c, gco2upv(to)->v.p, gco2upv(from)->v.p);
+      break;
+    case LUA_VPROTO:
+      fillproto(c, gco2p(from), gco2p(to));
+      break;
+    default:  /* long strings are made whole */
+      lua_assert(from->tt == LUA_VLNGSTR);
+  }
+}
+
+
+static void f_clone (lua_State *L, void *ud) {
+  Clone *c = cast(Clone *, ud);
+  global_State *g = G(L), *og = G(c->from);
+  int i;
+  c->index = luaM_newvector(L, 1 << MINLSIZEINDEX, int);
+  c->lsizeindex = MINLSIZEINDEX;
+  for (i = 0; i < (1 << MINLSIZEINDEX); i++)
+    c->index[i] = -1;
+  /* the registry of the copy takes the place of the original's */
+  record(c, gcvalue(&og->l_registry), gcvalue(&g->l_registry));
+  luaH_resize(L, hvalue(&g->l_registry),
+              luaH_realasize(hvalue(&og->l_registry)),
+              sizenode(hvalue(&og->l_registry)));
+  for (i = 0; i < LUA_NUMTAGS; i++) {
+    if (og->mt[i])
+      g->mt[i] = copyref(c, og->mt[i], Table);
+  }
+  for (i = 0; i < c->npair; i++)  /* 'npair' grows as objects are met */
+    fill(c, c->pair[i].from, c->pair[i].to);
+}
+
+
+/*
+** Give each copy of a full userdata whose metatable has a '__clone'
+** field to that function, called in the new state, so that the library
+** owning the userdata can make the copy stand on its own: drop or
+** replace pointers to memory of the original state, take references to
+** resources shared with it. Such copies own what they hold, so they
+** get their finalizers; other copies do not.
+*/
+static void f_hooks (lua_State *L, void *ud) {
+  Clone *c = cast(Clone *, ud);
+  TString *name = luaS_newliteral(L, "__clone");
+  int i;
+  for (i = 0; i < c->npair; i++) {
+    GCObject *o = c->pair[i].to;
+    Table *mt;
+    const TValue *hook;
+    if (o->tt != LUA_VUSERDATA || (mt = gco2u(o)->metatable) == NULL)
+      continue;
+    hook = luaH_getshortstr(mt, name);
+    if (notm(hook))
+      continue;
+    luaD_checkstack(L, 2);
+    setobj2s(L, L->top.p, hook);
+    setuvalue(L, s2v(L->top.p + 1), gco2u(o));
+    L->top.p += 2;
+    luaD_callnoyield(L, L->top.p - 2, 0);
+    luaC_checkfinalizer(L, o, mt);
+  }
+}
+
+
+static void f_genmode (lua_State *L, void *ud) {
+  UNUSED(ud);
+  luaC_changemode(L, KGC_GEN);
+}
+
+
+/*
+** Creates a new state, using allocator 'f' with 'ud', that is a copy of
+** the state of 'L': a copy of everything reachable from its registry,
+** including its global table and loaded modules, without the values
+** on its stacks. 'L' must not be running Lua code while it is copied.
+** Full userdata are copied byte for byte and light userdata as they
+** are, so memory or resources they refer to are shared by both states,
+** and finalizers are not set for copies; as the new state may have an
+** allocator of its own, memory of the original state must not be
+** referred to that way. A library whose userdata hold such pointers
+** or references to shared resources gives them a '__clone' metamethod
+** to fix their copies (see 'f_hooks'). States holding coroutines other
+** than the main thread cannot be copied. The new state has no warning
+** function. In case of errors, returns NULL and pushes an error message
+** onto 'L'.
+*/
+LUA_API lua_State *lua_clonestate (lua_State *L, lua_Alloc f, void *ud) {
+  global_State *og = G(L), *g;
+  lua_State *L1;
+  Clone c;
+  int status;
+  lua_lock(L);
+  L1 = lua_newstate(f, ud);
+  if (L1 == NULL) {
+    setsvalue2s(L, L->top.p, og->memerrmsg);
+    api_incr_top(L);
+    lua_unlock(L);
+    return NULL;
+  }
+  g = G(L1);
+  g->panic = og->panic;
+  g->selectf = og->selectf;
+  g->inlinecode = og->inlinecode;
+  g->optcode = og->optcode;
+  g->lazycode = og->lazycode;
+  g->memlimit = og->memlimit;
+  g->gctrim = og->gctrim;
+  g->gcpause = og->gcpause;
+  g->gcstepmul = og->gcstepmul;
+  g->gcstepsize = og->gcstepsize;
+  g->genmajormul = og->genmajormul;
+  g->genminormul = og->genminormul;
+  memcpy(lua_getextraspace(L1), lua_getextraspace(og->mainthread),
+         LUA_EXTRASPACE);
+  c.L = L1;
+  c.from = L;
+  c.pair = NULL;
+  c.npair = c.sizepair = 0;
+  c.index = NULL;
+  c.lsizeindex = MINLSIZEINDEX;
+  g->gcstp = GCSTPGC;  /* no collections while objects are unanchored */
+  g->gcstopem = 1;
+  status = luaD_rawrunprotected(L1, f_clone, &c);
+  if (status == LUA_OK)
+    status = luaD_rawrunprotected(L1, f_hooks, &c);
+  g->gcstp = og->gcstp & GCSTPUSR;
+  g->gcstopem = 0;
+  luaM_freearray(L1, c.pair, c.sizepair);
+  if (c.index)
+    luaM_freearray(L1, c.index, 1 << c.lsizeindex);
+  if (status == LUA_OK && og->gckind == KGC_GEN)
+    status = luaD_rawrunprotected(L1, f_genmode, NULL);
+  if (status != LUA_OK) {
+    if (status == LUA_ERRMEM) {
+      setsvalue2s(L, L->top.p, og->memerrmsg);
+    }
+    else if (ttisstring(s2v(L1->top.p - 1))) {
+      TString *msg = tsvalue(s2v(L1->top.p - 1));
+      setsvalue2s(L, L->top.p, luaS_newlstr(L, getstr(msg), tsslen(msg)));
+    }
+    else  /* error object cannot be moved to 'L' */
+      setsvalue2s(L, L->top.p, luaS_newliteral(L, "error in __clone"));
+    api_incr_top(L);
+    lua_close(L1);
+    L1 = NULL;
+  }
+  lua_unlock(L);
+  return L1;
+}
@@ -14,12 +14,14 @@
 #include <limits.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lua.h"
 
 #include "lcode.h"
 #include "ldebug.h"
 #include "ldo.h"
+#include "lfunc.h"
 #include "lgc.h"
 #include "llex.h"
 #include "lmem.h"
@@ -1840,6 +1842,917 @@ static int finaltarget (Instruction *code, int i) {
 }
 
 
+#if defined(LUAI_OPTCODE) || defined(LUAI_MAXINLINE)
+
+/*
+** Helpers for the passes below, which move instructions around
+*/
+
+/* new position of the instruction at (or the first kept after) 'pc' */
+#define newpos(map,n,nn,pc)	((pc) < (n) ? (map)[pc] : (nn))
+
+/* number of integers taking as much space as 'n' instructions */
+#define intsforcode(n)	\
+	((cast_sizet(n) * sizeof(Instruction) + sizeof(int) - 1) / sizeof(int))
+
+
+/*
+** Scratch space, from the lexer buffer (which is not in use between
+** tokens): 'n' integers
+*/
+static int *scratch (LexState *ls, size_t n) {
+  size_t size = n * sizeof(int);
+  if (luaZ_sizebuffer(ls->buff) < size)
+    luaZ_resizebuffer(ls->L, ls->buff, size);
+  return cast(int *, luaZ_buffer(ls->buff));
+}
+
+
+/*
+** Copy the instruction at 'i' to its new position 'j', correcting the
+** distance of its jump, if it has one.
+*/
+static Instruction relocate (Instruction ins, int i, int j,
+                             const int *map, int n, int nn) {
+  switch (GET_OPCODE(ins)) {
+    case OP_JMP: {
+      int t = newpos(map, n, nn, i + 1 + GETARG_sJ(ins));
+      SETARG_sJ(ins, t - (j + 1));
+      break;
+    }
+    case OP_FORPREP: {
+      int t = newpos(map, n, nn, i + GETARG_Bx(ins) + 1);
+      SETARG_Bx(ins, t - (j + 1));
+      break;
+    }
+    case OP_TFORPREP: {
+      int t = newpos(map, n, nn, i + 1 + GETARG_Bx(ins));
+      SETARG_Bx(ins, t - (j + 1));
+      break;
+    }
+    case OP_FORLOOP: case OP_TFORLOOP: {
+      int t = newpos(map, n, nn, i + 1 - GETARG_Bx(ins));
+      SETARG_Bx(ins, (j + 1) - t);
+      break;
+    }
+    default: break;
+  }
+  return ins;
+}
+
+
+/*
+** Decode the line of each of the first 'n' instructions of 'f' into
+** 'line'.
+*/
+static void decodelines (const Proto *f, int n, int *line) {
+  int i, j;
+  int prev = f->linedefined;
+  for (i = 0, j = 0; i < n; i++) {
+    if (f->lineinfo[i] == ABSLINEINFO)
+      prev = f->abslineinfo[j++].line;
+    else
+      prev += f->lineinfo[i];
+    line[i] = prev;
+  }
+}
+
+
+/* number of the first 'n' local variables of 'p' active at 'pc' */
+static int activevars (const Proto *p, int n, int pc) {
+  int i, nact = 0;
+  for (i = 0; i < n; i++) {
+    if (p->locvars[i].startpc <= pc && pc < p->locvars[i].endpc)
+      nact++;
+  }
+  return nact;
+}
+
+#endif
+
+
+#if defined(LUAI_OPTCODE)
+
+/*
+** {======================================================
+** Optimization pass, run over the whole code of a function before
+** 'luaK_finish': jump threading and removal of dead code and, at level
+** 2, copy propagation and removal of dead stores
+** =======================================================
+*/
+
+/* a jump right after a test is half of a conditional jump */
+#define isconditional(code,i)	((i) > 0 && testTMode(GET_OPCODE((code)[(i) - 1])))
+
+
+/*
+** returns that can be copied anywhere in the function: they do not
+** depend on a 'top' set by the previous instruction
+*/
+static int isplainreturn (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_RETURN0: case OP_RETURN1: return 1;
+    case OP_RETURN: return (GETARG_B(i) != 0);
+    default: return 0;
+  }
+}
+
+
+/*
+** Make every jump go straight to its final target, and replace
+** unconditional jumps to a return by the return itself.
+*/
+static void threadjumps (FuncState *fs) {
+  Instruction *code = fs->f->code;
+  int i;
+  for (i = 0; i < fs->pc; i++) {
+    if (GET_OPCODE(code[i]) == OP_JMP) {
+      int target = finaltarget(code, i);
+      if (!isconditional(code, i) && isplainreturn(code[target]))
+        code[i] = code[target];
+      else
+        fixjump(fs, i, target);
+    }
+  }
+}
+
+
+/*
+** Jump tables: a chain of tests of one register against different
+** constants, as in 'if x == "a" then ... elseif x == "b" then ...',
+** becomes an OP_SWITCH, which finds the block to run through a table
+** constant giving the case number of each constant (see 'lopcodes.h').
+*/
+
+/* fewest different constants worth a jump table */
+#define MINCASES	4
+
+
+/*
+** If the instruction at 'pc' tests whether a register is equal to a
+** number or a string constant, jumping away when it is not, return that
+** register and put the constant in 'key'; otherwise return -1.
+*/
+static int casetest (FuncState *fs, const Instruction *code, int n, int pc,
+                     TValue *key) {
+  Instruction i = code[pc];
+  if ((GET_OPCODE(i) != OP_EQI && GET_OPCODE(i) != OP_EQK) || GETARG_k(i) ||
+      pc + 1 >= n || GET_OPCODE(code[pc + 1]) != OP_JMP)
+    return -1;
+  if (GET_OPCODE(i) == OP_EQI) {
+    setivalue(key, GETARG_sB(i));
+  }
+  else {
+    const TValue *k = &fs->f->k[GETARG_B(i)];
+    if (!ttisnumber(k) && !ttisstring(k))
+      return -1;
+    setobj(fs->ls->L, key, k);
+  }
+  return GETARG_A(i);
+}
+
+
+/*
+** Collect in 'chain' the tests of register 'a' that run one after the
+** other, going forward, when they fail, starting at 'pc'; return how
+** many there are and put in 'ncases' how many different constants they
+** test, up to MAXARG_B. The chain goes where its last test jumps to.
+*/
+static int walkchain (FuncState *fs, const Instruction *code, int n,
+                      int pc, int a, int *chain, int *ncases) {
+  int nt = 0;
+  int nc = 0;
+  TValue key, prev;
+  while (pc < n && casetest(fs, code, n, pc, &key) == a) {
+    int j;
+    for (j = 0; j < nt; j++) {  /* constant tested before? */
+      casetest(fs, code, n, chain[j], &prev);
+      if (luaV_rawequalobj(&prev, &key))
+        break;
+    }
+    if (j == nt) {  /* new constant */
+      if (nc == MAXARG_B)
+        break;
+      nc++;
+    }
+    chain[nt++] = pc;
+    j = pc + 2 + GETARG_sJ(code[pc + 1]);
+    if (j <= pc)
+      break;
+    pc = j;
+  }
+  *ncases = nc;
+  return nt;
+}
+
+
+/*
+** Add to 'f' a table constant giving, for each constant tested in the
+** 'nt' tests in 'chain', the number of its case, counting in the order
+** they first appear; return its index. The table is anchored before
+** anything is put in it.
+*/
+static int newswitch (FuncState *fs, const int *chain, int nt, int nc) {
+  lua_State *L = fs->ls->L;
+  Proto *f = fs->f;
+  int oldsize = f->sizek;
+  int k = fs->nk;
+  int c = 0;
+  int j;
+  Table *t;
+  luaM_growvector(L, f->k, k, f->sizek, TValue, MAXARG_Ax, "constants");
+  while (oldsize < f->sizek)
+    setnilvalue(&f->k[oldsize++]);
+  t = luaH_new(L);
+  sethvalue(L, &f->k[k], t);
+  fs->nk++;
+  luaC_objbarrier(L, f, t);
+  luaH_resize(L, t, 0, nc);
+  for (j = 0; j < nt; j++) {
+    TValue key, val;
+    casetest(fs, f->code, fs->pc, chain[j], &key);
+    if (isempty(luaH_get(t, &key))) {
+      setivalue(&val, ++c);
+      luaH_set(L, t, &key, &val);
+    }
+  }
+  lua_assert(c == nc);
+  return k;
+}
+
+
+/* a jump at 'pc' to 'target' */
+#define jumpto(pc,target)  \
+	CREATE_sJ(OP_JMP, (target) - ((pc) + 1) + OFFSET_sJ, 0)
+
+
+/*
+** Replace the chains of tests with at least MINCASES constants by
+** jump tables. The OP_SWITCH takes the place of the first test of the
+** chain, its OP_EXTRAARG the place of the test's jump, and its jumps
+** go after them, moving the rest of the code down. The tests are left
+** in place, for 'compact' to remove when nothing else reaches them.
+** 'ks' tells, for each instruction, the switch it starts (the index
+** of the table constant), -1 for none, or -2 for a test that is part
+** of a chain already.
+*/
+static void makeswitches (FuncState *fs) {
+  lua_State *L = fs->ls->L;
+  Proto *f = fs->f;
+  int n = fs->pc;
+  int *ks, *chain, *map, *line;
+  Instruction *old, *code;
+  int i, j, nn;
+  int extra = 0;  /* instructions inserted so far */
+  int pending = 0;  /* instructions to insert after the next one */
+  /* layout: ks, chain, map, line, old code */
+  ks = scratch(fs->ls, 4 * cast_sizet(n) + 1 + intsforcode(n));
+  chain = ks + n;
+  map = chain + n;
+  line = map + n + 1;
+  old = cast(Instruction *, line + n);
+  for (i = 0; i < n; i++)
+    ks[i] = -1;
+  for (i = 0; i < n; i++) {
+    TValue key;
+    int a, nt, nc;
+    map[i] = i + extra;
+    extra += pending;
+    pending = 0;
+    if (ks[i] != -1 || (a = casetest(fs, f->code, n, i, &key)) < 0)
+      continue;
+    nt = walkchain(fs, f->code, n, i, a, chain, &nc);
+    if (nc < MINCASES)
+      continue;
+    ks[i] = newswitch(fs, chain, nt, nc);
+    for (j = 1; j < nt; j++)
+      ks[chain[j]] = -2;
+    pending = nc + 1;  /* its jumps */
+  }
+  nn = map[n] = n + extra;
+  if (nn == n)
+    return;  /* no chains */
+  decodelines(f, n, line);
+  memcpy(old, f->code, n * sizeof(Instruction));
+  if (nn > f->sizecode) {
+    f->code = luaM_reallocvector(L, f->code, f->sizecode, nn, Instruction);
+    f->sizecode = nn;
+  }
+  code = f->code;
+  fs->nabslineinfo = 0;
+  fs->iwthabs = 0;
+  fs->previousline = f->linedefined;
+  for (i = 0; i < n; i++) {
+    int pc = map[i];
+    if (ks[i] >= 0) {  /* first test of a chain */
+      Table *t = hvalue(&f->k[ks[i]]);
+      int nc, c;
+      int next = 1;  /* next case to find */
+      int nt = walkchain(fs, old, n, i, GETARG_A(old[i]), chain, &nc);
+      int last = chain[nt - 1];
+      code[pc] = CREATE_ABCk(OP_SWITCH, GETARG_A(old[i]), nc, 0, 0);
+      code[pc + 1] = CREATE_Ax(OP_EXTRAARG, ks[i]);
+      code[pc + 2] = jumpto(pc + 2,
+          newpos(map, n, nn, last + 2 + GETARG_sJ(old[last + 1])));
+      for (j = 0; j < nt; j++) {
+        TValue key;
+        casetest(fs, old, n, chain[j], &key);
+        c = cast_int(ivalue(luaH_get(t, &key)));
+        if (c == next) {  /* first test of this constant? */
+          code[pc + 2 + c] = jumpto(pc + 2 + c,
+                                    newpos(map, n, nn, chain[j] + 2));
+          next++;
+        }
+      }
+      for (c = 0; c < nc + 3; c++) {
+        fs->pc = pc + c + 1;
+        savelineinfo(fs, f, line[i]);
+      }
+      i++;  /* skip the test's jump */
+    }
+    else {
+      code[pc] = relocate(old[i], i, pc, map, n, nn);
+      fs->pc = pc + 1;
+      savelineinfo(fs, f, line[i]);
+    }
+  }
+  lua_assert(fs->pc == nn);
+  for (i = 0; i < fs->ndebugvars; i++) {
+    LocVar *var = &f->locvars[i];
+    var->startpc = newpos(map, n, nn, var->startpc);
+    var->endpc = newpos(map, n, nn, var->endpc);
+  }
+}
+
+
+/*
+** Mark in 'live' (with 1) every instruction that can run, walking the
+** control flow from the first one. Instructions that other ones skip
+** over or read as operands ('MMBIN' after arithmetic, 'EXTRAARG', the
+** jump after a test, the instruction after 'LFALSESKIP', the 'FORLOOP'
+** of a 'FORPREP', the jumps of a 'SWITCH') are always followed too, so
+** they stay in place.
+*/
+static void markalive (Proto *f, int n, int *live, int *stack) {
+  Instruction *code = f->code;
+  int top = 0;
+  memset(live, 0, n * sizeof(int));
+  live[0] = 1;
+  stack[top++] = 0;
+  while (top > 0) {
+    int i = stack[--top];
+    Instruction ins = code[i];
+    int next[3];
+    int nn = 0;
+    int k;
+    switch (GET_OPCODE(ins)) {
+      case OP_RETURN: case OP_RETURN0: case OP_RETURN1:
+        break;  /* no successors */
+      case OP_JMP:
+        next[nn++] = i + 1 + GETARG_sJ(ins);
+        break;
+      case OP_LFALSESKIP:
+        next[nn++] = i + 1;
+        next[nn++] = i + 2;
+        break;
+      case OP_FORPREP:
+        next[nn++] = i + 1;
+        next[nn++] = i + GETARG_Bx(ins) + 1;  /* its 'FORLOOP' */
+        next[nn++] = i + GETARG_Bx(ins) + 2;  /* loop skipped */
+        break;
+      case OP_FORLOOP: case OP_TFORLOOP:
+        next[nn++] = i + 1;
+        next[nn++] = i + 1 - GETARG_Bx(ins);
+        break;
+      case OP_TFORPREP:
+        next[nn++] = i + 1 + GETARG_Bx(ins);
+        break;
+      case OP_SWITCH:  /* its extra argument and all its jumps */
+        for (k = i + 2 + GETARG_B(ins); k > i; k--) {
+          if (!live[k]) {
+            live[k] = 1;
+            stack[top++] = k;
+          }
+        }
+        break;
+      default:
+        next[nn++] = i + 1;
+        if (testTMode(GET_OPCODE(ins)))
+          next[nn++] = i + 2;  /* skip the jump */
+        else if (i + 1 < n && testMMMode(GET_OPCODE(code[i + 1])))
+          next[nn++] = i + 2;  /* skip the 'MMBIN' (fast path) */
+        break;
+    }
+    for (k = 0; k < nn; k++) {
+      int t = next[k];
+      if (t < n && !live[t]) {
+        live[t] = 1;
+        stack[top++] = t;
+      }
+    }
+  }
+}
+
+
+/*
+** Remove instructions that cannot run and unconditional jumps to the
+** next instruction that runs, moving the rest down. Line information
+** is rebuilt for the new positions (from the lines decoded into
+** 'line'), and the ranges of local variables are moved with the code.
+*/
+static void compact (FuncState *fs, int *live, int *line) {
+  Proto *f = fs->f;
+  Instruction *code = f->code;
+  int n = fs->pc;
+  int *map = live;  /* 'live' becomes the map of new positions */
+  int i, j, nn;
+  decodelines(f, n, line);
+  /* jumps whose target is the next live instruction are dead too */
+  for (i = 0; i < n; i++) {
+    if (live[i] && GET_OPCODE(code[i]) == OP_SWITCH)
+      i += GETARG_B(code[i]) + 2;  /* its jumps stay, to keep their order */
+    else if (live[i] && GET_OPCODE(code[i]) == OP_JMP &&
+             !isconditional(code, i)) {
+      int t = i + 1 + GETARG_sJ(code[i]);
+      for (j = i + 1; j < t && !live[j]; j++) ;
+      if (j == t && t > i)
+        live[i] = 0;
+    }
+  }
+  for (i = 0, nn = 0; i < n; i++) {  /* build map */
+    int l = live[i];
+    map[i] = nn;
+    nn += l;
+  }
+  if (nn == n)
+    return;  /* nothing to remove */
+  fs->nabslineinfo = 0;
+  fs->iwthabs = 0;
+  fs->previousline = f->linedefined;
+  for (i = 0, j = 0; i < n; i++) {
+    if ((i + 1 < n ? map[i + 1] : nn) != map[i]) {  /* kept? */
+      code[j] = relocate(code[i], i, j, map, n, nn);
+      fs->pc = ++j;
+      savelineinfo(fs, f, line[i]);
+    }
+  }
+  lua_assert(fs->pc == nn);
+  for (i = 0; i < fs->ndebugvars; i++) {
+    LocVar *var = &f->locvars[i];
+    var->startpc = newpos(map, n, nn, var->startpc);
+    var->endpc = newpos(map, n, nn, var->endpc);
+  }
+}
+
+
+/*
+** Reuse of loaded upvalues, copy propagation and removal of dead
+** stores, for the chunks compiled at level 2 (see 'lua_setoptimize').
+** They stay within a block and leave alone what the collector or other
+** functions could tell apart: an upvalue is reused only while no other
+** function can run, a register captured by a closure or to be closed
+** is not propagated, and a store is removed only when another one to
+** the same register follows it with nothing in between that could run
+** the collector.
+** (So a variable that only keeps a value alive still does, and one
+** assigned to let a value go still lets it go.) Sets of registers are
+** arrays of 'nw' words, one bit per register.
+*/
+
+#define WBITS		(cast_int(sizeof(unsigned int)) * CHAR_BIT)
+#define hasreg(s,r)	(((s)[(r) / WBITS] >> ((r) % WBITS)) & 1u)
+#define addreg(s,r)	((s)[(r) / WBITS] |= 1u << ((r) % WBITS))
+
+
+static void addregs (unsigned int *s, int from, int to) {
+  for (; from <= to; from++)
+    addreg(s, from);
+}
+
+
+/*
+** Add to 'use' the registers that instruction 'i' reads and to 'kill'
+** the ones it always writes. Reads up to the top take all registers
+** from 'a' on; writes up to the top or that may not happen are not
+** kills. Unknown instructions read everything.
+*/
+static void useskill (const Proto *f, Instruction i, unsigned int *use,
+                      unsigned int *kill) {
+  int a = GETARG_A(i);
+  int top = f->maxstacksize - 1;
+  switch (GET_OPCODE(i)) {
+    case OP_GETTABLE: case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
+    case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR:
+    case OP_BXOR: case OP_SHL: case OP_SHR:
+      addreg(use, GETARG_C(i));
+      /* FALLTHROUGH */
+    case OP_MOVE: case OP_GETI: case OP_GETFIELD: case OP_ADDI: case OP_ADDK:
+    case OP_SUBK: case OP_MULK: case OP_MODK: case OP_POWK: case OP_DIVK:
+    case OP_IDIVK: case OP_BANDK: case OP_BORK: case OP_BXORK: case OP_SHRI:
+    case OP_SHLI: case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN:
+      addreg(use, GETARG_B(i));
+      /* FALLTHROUGH */
+    case OP_LOADI: case OP_LOADF: case OP_LOADK: case OP_LOADKX:
+    case OP_LOADFALSE: case OP_LFALSESKIP: case OP_LOADTRUE:
+    case OP_GETUPVAL: case OP_GETTABUP: case OP_NEWTABLE:
+      addreg(kill, a);
+      break;
+    case OP_LOADNIL:
+      addregs(kill, a, a + GETARG_B(i));
+      break;
+    case OP_CLOSURE: {
+      const Proto *p = f->p[GETARG_Bx(i)];
+      int k;
+      for (k = 0; k < p->sizeupvalues; k++) {
+        if (p->upvalues[k].instack)
+          addreg(use, p->upvalues[k].idx);
+      }
+      addreg(kill, a);
+      break;
+    }
+    case OP_SELF:
+      addreg(use, GETARG_B(i));
+      if (!GETARG_k(i))
+        addreg(use, GETARG_C(i));
+      addregs(kill, a, a + 1);
+      break;
+    case OP_SETTABLE:
+      addreg(use, GETARG_B(i));
+      /* FALLTHROUGH */
+    case OP_SETI: case OP_SETFIELD:
+      addreg(use, a);
+      /* FALLTHROUGH */
+    case OP_SETTABUP:
+      if (!GETARG_k(i))
+        addreg(use, GETARG_C(i));
+      break;
+    case OP_MMBIN: case OP_EQ: case OP_LT: case OP_LE:
+      addreg(use, GETARG_B(i));
+      /* FALLTHROUGH */
+    case OP_SETUPVAL: case OP_MMBINI: case OP_MMBINK: case OP_EQK:
+    case OP_EQI: case OP_LTI: case OP_LEI: case OP_GTI: case OP_GEI:
+    case OP_TEST: case OP_TBC: case OP_RETURN1: case OP_SWITCH:
+      addreg(use, a);
+      break;
+    case OP_TESTSET:
+      addreg(use, GETARG_B(i));
+      break;
+    case OP_CONCAT:
+      addregs(use, a, a + GETARG_B(i) - 1);
+      addreg(kill, a);
+      break;
+    case OP_CALL:
+      addregs(use, a, (GETARG_B(i) != 0) ? a + GETARG_B(i) - 1 : top);
+      addregs(kill, a, a + GETARG_C(i) - 2);
+      break;
+    case OP_TAILCALL:
+      addregs(use, a, (GETARG_B(i) != 0) ? a + GETARG_B(i) - 1 : top);
+      break;
+    case OP_RETURN:
+      addregs(use, a, (GETARG_B(i) != 0) ? a + GETARG_B(i) - 2 : top);
+      break;
+    case OP_SETLIST:
+      addregs(use, a, (GETARG_B(i) != 0) ? a + GETARG_B(i) : top);
+      break;
+    case OP_VARARG:
+      addregs(kill, a, a + GETARG_C(i) - 2);
+      break;
+    case OP_SELECT:
+      addregs(use, a, a + 1);
+      break;
+    case OP_TFORCALL:
+      addregs(use, a, a + 3);
+      addregs(kill, a + 4, a + 3 + GETARG_C(i));
+      break;
+    case OP_FORPREP: case OP_FORLOOP: case OP_TFORPREP:
+      addregs(use, a, a + 3);
+      break;
+    case OP_TFORLOOP:
+      addregs(use, a + 2, a + 4);
+      break;
+    case OP_JMP: case OP_CLOSE: case OP_RETURN0: case OP_EXTRAARG:
+      break;
+    default:
+      addregs(use, 0, top);
+      break;
+  }
+}
+
+
+/*
+** Whether instruction 'i' may change register 'r'
+*/
+static int maywrite (Instruction i, int r) {
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  switch (op) {
+    case OP_LOADNIL: return (a <= r && r <= a + GETARG_B(i));
+    case OP_SELF: return (a <= r && r <= a + 1);
+    case OP_CONCAT: return (a <= r && r < a + GETARG_B(i));
+    case OP_CALL: case OP_TAILCALL: case OP_TFORCALL: case OP_VARARG:
+    case OP_SELECT: case OP_FORPREP: case OP_FORLOOP: case OP_TFORPREP:
+    case OP_TFORLOOP: return (a <= r);  /* up to the top */
+    case OP_VARARGPREP: return 1;
+    default: return (testAMode(op) && a == r);
+  }
+}
+
+
+/*
+** Put in 'next' where control goes after instruction 'pc' and return
+** how many places that is (at most 2), or -1 for an OP_SWITCH, which
+** goes to any of its jumps. Going past the 'MMBIN' after an arithmetic
+** instruction is not listed, as the 'MMBIN' only reads registers that
+** instruction reads and writes the one it writes.
+*/
+static int nextpcs (const Instruction *code, int pc, int *next) {
+  Instruction i = code[pc];
+  switch (GET_OPCODE(i)) {
+    case OP_RETURN: case OP_RETURN0: case OP_RETURN1: case OP_TAILCALL:
+      return 0;
+    case OP_JMP:
+      next[0] = pc + 1 + GETARG_sJ(i);
+      return 1;
+    case OP_LFALSESKIP:
+      next[0] = pc + 2;
+      return 1;
+    case OP_FORPREP:
+      next[0] = pc + 1;
+      next[1] = pc + GETARG_Bx(i) + 2;
+      return 2;
+    case OP_FORLOOP: case OP_TFORLOOP:
+      next[0] = pc + 1;
+      next[1] = pc + 1 - GETARG_Bx(i);
+      return 2;
+    case OP_TFORPREP:
+      next[0] = pc + 1 + GETARG_Bx(i);
+      return 1;
+    case OP_SWITCH:
+      return -1;
+    default:
+      next[0] = pc + 1;
+      if (!testTMode(GET_OPCODE(i)))
+        return 1;
+      next[1] = pc + 2;  /* skip the jump */
+      return 2;
+  }
+}
+
+
+/*
+** Mark in 'target' (with 1) the live instructions that control can
+** reach other than from the instruction before them.
+*/
+static void marktargets (const Instruction *code, int n, const int *live,
+                         int *target) {
+  int i, k;
+  memset(target, 0, n * sizeof(int));
+  for (i = 0; i < n; i++) {
+    int next[2];
+    int nn;
+    if (!live[i])
+      continue;
+    nn = nextpcs(code, i, next);
+    if (nn < 0) {  /* OP_SWITCH */
+      for (k = i + 2; k <= i + 2 + GETARG_B(code[i]); k++)
+        target[k] = 1;
+    }
+    for (k = 0; k < nn; k++) {
+      if (next[k] != i + 1 && next[k] < n)
+        target[next[k]] = 1;
+    }
+  }
+}
+
+
+/*
+** Replace register 'd' by 's' where instruction 'pi' reads it as a
+** value that is just moved around: never where an error message could
+** name the variable holding it, so messages stay the same.
+*/
+static void replacereg (Instruction *pi, int d, int s) {
+  Instruction i = *pi;
+  switch (GET_OPCODE(i)) {
+    case OP_EQ:
+      if (GETARG_B(i) == d) SETARG_B(*pi, s);
+      /* FALLTHROUGH */
+    case OP_SETUPVAL: case OP_EQK: case OP_EQI: case OP_TEST:
+    case OP_RETURN1:
+      if (GETARG_A(i) == d) SETARG_A(*pi, s);
+      break;
+    case OP_NOT: case OP_TESTSET:
+      if (GETARG_B(i) == d) SETARG_B(*pi, s);
+      break;
+    case OP_SETTABUP: case OP_SETTABLE: case OP_SETI: case OP_SETFIELD:
+      if (!GETARG_k(i) && GETARG_C(i) == d) SETARG_C(*pi, s);
+      break;
+    default: break;
+  }
+}
+
+
+/*
+** After each 'MOVE d s', make the instructions that follow it in the
+** same block read 's' instead of 'd' where 'replacereg' can, for as
+** long as neither register changes.
+*/
+static void propagate (Proto *f, int n, const int *live, const int *target,
+                       const unsigned int *fixed) {
+  Instruction *code = f->code;
+  int i, j;
+  for (i = 0; i < n; i++) {
+    int d, s;
+    if (!live[i] || GET_OPCODE(code[i]) != OP_MOVE)
+      continue;
+    d = GETARG_A(code[i]);
+    s = GETARG_B(code[i]);
+    if (d == s || hasreg(fixed, d) || hasreg(fixed, s))
+      continue;
+    for (j = i + 1; j < n && !target[j]; j++) {
+      int next[2];
+      if (!live[j])
+        continue;
+      replacereg(&code[j], d, s);
+      if (maywrite(code[j], d) || maywrite(code[j], s) ||
+          nextpcs(code, j, next) != 1 || next[0] != j + 1)
+        break;  /* end of the block or of the copy */
+    }
+  }
+}
+
+
+/*
+** Whether instruction 'i' can neither raise errors, call functions nor
+** allocate memory, so that the collector cannot run while it does
+*/
+static int isquiet (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_LOADI: case OP_LOADF: case OP_LOADK:
+    case OP_LOADKX: case OP_LOADFALSE: case OP_LOADTRUE: case OP_LOADNIL:
+    case OP_GETUPVAL: case OP_SETUPVAL: case OP_NOT: case OP_TEST:
+    case OP_TESTSET: case OP_EQK: case OP_EQI: case OP_JMP:
+    case OP_EXTRAARG:
+      return 1;
+    default: return 0;
+  }
+}
+
+
+/* whether instruction 'i' does nothing but set its register A */
+static int isstore (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_LOADI: case OP_LOADF: case OP_LOADK:
+    case OP_LOADFALSE: case OP_LOADTRUE: case OP_GETUPVAL: case OP_NOT:
+      return 1;
+    case OP_LOADNIL:
+      return (GETARG_B(i) == 0);
+    default: return 0;
+  }
+}
+
+
+/*
+** After each 'GETUPVAL r u', make the loads of upvalue 'u' that follow
+** it in the same block copy 'r' instead, for as long as 'r' does not
+** change and only quiet instructions come in between, none of them an
+** OP_SETUPVAL (so no function that could change 'u' runs). A load into
+** 'r' itself goes away. An error message names the copy by following
+** the move to 'r', so only a copy above 'r', which is not a local
+** variable, is made; others stay loads.
+*/
+static void reuseupvals (Proto *f, int n, int *live, const int *target,
+                         int nvars) {
+  Instruction *code = f->code;
+  int i, j;
+  for (i = 0; i < n; i++) {
+    int r, u;
+    if (!live[i] || GET_OPCODE(code[i]) != OP_GETUPVAL)
+      continue;
+    r = GETARG_A(code[i]);
+    u = GETARG_B(code[i]);
+    for (j = i + 1; j < n && !target[j]; j++) {
+      int next[2];
+      if (!live[j])
+        continue;
+      if (GET_OPCODE(code[j]) == OP_GETUPVAL && GETARG_B(code[j]) == u) {
+        int d = GETARG_A(code[j]);
+        if (d == r) {  /* load it already has? */
+          live[j] = 0;
+          continue;
+        }
+        else if (r < d && r >= activevars(f, nvars, j))
+          code[j] = CREATE_ABCk(OP_MOVE, d, r, 0, 0);
+      }
+      if (!isquiet(code[j]) || GET_OPCODE(code[j]) == OP_SETUPVAL ||
+          maywrite(code[j], r) ||
+          nextpcs(code, j, next) != 1 || next[0] != j + 1)
+        break;  /* end of the block or of the value in 'r' */
+    }
+  }
+}
+
+
+/*
+** Take out of 'live' the stores that another store to the same register
+** makes useless: one later in the same block, with only quiet
+** instructions in between, none of which reads the register. (The
+** instruction after an OP_LFALSESKIP, which skips it, stays.) 'use' and
+** 'kill' are scratch sets.
+*/
+static void deadstores (const Proto *f, int n, int *live, const int *target,
+                        unsigned int *use, unsigned int *kill, int nw) {
+  const Instruction *code = f->code;
+  int i, j;
+  for (i = 0; i < n; i++) {
+    int r;
+    if (!live[i] || !isstore(code[i]) ||
+        (i > 0 && GET_OPCODE(code[i - 1]) == OP_LFALSESKIP))
+      continue;
+    r = GETARG_A(code[i]);
+    for (j = i + 1; j < n && !target[j]; j++) {
+      int next[2];
+      if (!live[j])
+        continue;
+      if (!isquiet(code[j]))
+        break;
+      memset(use, 0, nw * sizeof(unsigned int));
+      memset(kill, 0, nw * sizeof(unsigned int));
+      useskill(f, code[j], use, kill);
+      if (hasreg(use, r))
+        break;
+      if (hasreg(kill, r)) {
+        live[i] = 0;
+        break;
+      }
+      if (nextpcs(code, j, next) != 1 || next[0] != j + 1)
+        break;  /* end of the block */
+    }
+  }
+}
+
+
+/*
+** Run reuse of upvalues, copy propagation and removal of dead stores
+** over the live code of a function, taking the loads and stores removed
+** out of 'live'. 'target' has
+** room for an integer per instruction and 'mem' for 3 sets of registers
+** of 'nw' words.
+*/
+static void optregs (FuncState *fs, int *live, int *target,
+                     unsigned int *mem, int nw) {
+  Proto *f = fs->f;
+  int n = fs->pc;
+  unsigned int *fixed = mem;  /* registers captured or to be closed */
+  int i, k;
+  memset(fixed, 0, nw * sizeof(unsigned int));
+  for (i = 0; i < fs->np; i++) {
+    const Proto *p = f->p[i];
+    for (k = 0; k < p->sizeupvalues; k++) {
+      if (p->upvalues[k].instack)
+        addreg(fixed, p->upvalues[k].idx);
+    }
+  }
+  for (i = 0; i < n; i++) {
+    if (GET_OPCODE(f->code[i]) == OP_TBC)
+      addreg(fixed, GETARG_A(f->code[i]));
+    else if (GET_OPCODE(f->code[i]) == OP_TFORPREP)
+      addreg(fixed, GETARG_A(f->code[i]) + 3);
+  }
+  marktargets(f->code, n, live, target);
+  reuseupvals(f, n, live, target, fs->ndebugvars);
+  propagate(f, n, live, target, fixed);
+  deadstores(f, n, live, target, mem + nw, mem + 2 * nw, nw);
+}
+
+
+/*
+** Optimize the code of a function, as much as asked for by its lexer's
+** 'optcode' (see 'lua_setoptimize'). The tests replaced by jump tables
+** go away with the rest of the dead code.
+*/
+void luaK_optimize (FuncState *fs) {
+  int level = fs->ls->optcode;
+  int nw = fs->f->maxstacksize / WBITS + 1;  /* words in a register set */
+  size_t n;
+  int *live, *stack;
+  if (level == 0)
+    return;
+  threadjumps(fs);
+  makeswitches(fs);
+  n = cast_sizet(fs->pc);
+  live = scratch(fs->ls, 2 * n + ((level > 1) ? 3 * nw : 0));
+  stack = live + n;
+  markalive(fs->f, fs->pc, live, stack);
+  if (level > 1)  /* 'stack' is free until 'compact' */
+    optregs(fs, live, stack, cast(unsigned int *, stack + n), nw);
+  compact(fs, live, stack);
+}
+
+/* }====================================================== */
+
+#endif
+
+
 /*
 ** Do a final pass over the code of a function, doing small peephole
 ** optimizations and adjustments.
@@ -1852,7 +2765,7 @@ void luaK_finish (FuncState *fs) {
     lua_assert(i == 0 || isOT(*(pc - 1)) == isIT(*pc));
     switch (GET_OPCODE(*pc)) {
       case OP_RETURN0: case OP_RETURN1: {
-        if (!(fs->needclose || p->is_vararg))
+        if (!fs->needclose)
           break;  /* no extra work */
         /* else use OP_RETURN to do the extra work */
         SET_OPCODE(*pc, OP_RETURN);
@@ -1860,8 +2773,6 @@ void luaK_finish (FuncState *fs) {
       case OP_RETURN: case OP_TAILCALL: {
         if (fs->needclose)
           SETARG_k(*pc, 1);  /* signal that it needs to close */
-        if (p->is_vararg)
-          SETARG_C(*pc, p->numparams + 1);  /* signal that it is vararg */
         break;
       }
       case OP_JMP: {
@@ -1873,3 +2784,748 @@ void luaK_finish (FuncState *fs) {
     }
   }
 }
+
+
+
+#if defined(LUAI_MAXINLINE)
+
+/*
+** {======================================================
+** Inlining, run over the whole tree of prototypes of a chunk once it
+** is parsed: a call to a small local function whose variable is never
+** assigned again is replaced by a copy of the function's body, moved
+** to the registers above the call.  The copy keeps the lines of the
+** function, so errors in it still point to the right place.
+** =======================================================
+*/
+
+/* chain of functions, from one with calls up to the one declaring it */
+typedef struct Nest {
+  Proto *p;
+  struct Nest *prev;  /* enclosing function (NULL for the declaring one) */
+} Nest;
+
+
+/*
+** Whether instruction 'i' can change register 'r'
+*/
+static int setsreg (Instruction i, int r) {
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  switch (op) {
+    case OP_LOADNIL: return (a <= r && r <= a + GETARG_B(i));
+    case OP_SELF: return (a <= r && r <= a + 1);
+    case OP_FORPREP: case OP_FORLOOP:
+    case OP_TFORPREP: case OP_TFORLOOP: return (a <= r && r <= a + 4);
+    case OP_CALL: case OP_TAILCALL:
+    case OP_TFORCALL: case OP_VARARG: return (a <= r);  /* up to the top */
+    default: return (testAMode(op) && a == r);
+  }
+}
+
+
+/*
+** Where instruction 'pc' may go other than to the next one, or -1
+*/
+static int jumpdest (const Instruction *code, int n, int pc) {
+  Instruction i = code[pc];
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: return pc + 1 + GETARG_sJ(i);
+    case OP_LFALSESKIP: return pc + 2;
+    case OP_FORPREP: return pc + GETARG_Bx(i) + 2;
+    case OP_TFORPREP: return pc + 1 + GETARG_Bx(i);
+    case OP_FORLOOP: case OP_TFORLOOP: return pc + 1 - GETARG_Bx(i);
+    default:
+      if (testTMode(GET_OPCODE(i)) ||
+          (pc + 1 < n && testMMMode(GET_OPCODE(code[pc + 1]))))
+        return pc + 2;
+      return -1;
+  }
+}
+
+
+static int isreturn (Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return (op == OP_RETURN || op == OP_RETURN0 || op == OP_RETURN1);
+}
+
+
+/*
+** Whether 'p', or a function nested in it, assigns its upvalue 'u'
+*/
+static int setsupval (const Proto *p, int u) {
+  int i, j;
+  if (p->lazy)  /* body not compiled yet? */
+    return 1;  /* it may well */
+  for (i = 0; i < p->sizecode; i++) {
+    if (GET_OPCODE(p->code[i]) == OP_SETUPVAL && GETARG_B(p->code[i]) == u)
+      return 1;
+  }
+  for (i = 0; i < p->sizep; i++) {
+    const Proto *c = p->p[i];
+    for (j = 0; j < c->sizeupvalues; j++) {
+      if (!c->upvalues[j].instack && c->upvalues[j].idx == u &&
+          setsupval(c, j))
+        return 1;
+    }
+  }
+  return 0;
+}
+
+
+/*
+** Whether the body of 'f', a function held in register 'r' of its
+** enclosing function, can be copied into a caller: it has a fixed
+** number of parameters, creates no closures, does not assign upvalues,
+** has no variables to close nor jump tables, returns a known number of
+** values and calls no function. (A function it called could look at
+** the stack by level, as 'error(msg, 2)' and 'debug.getinfo(2)' do,
+** and find the caller one level up once the body is copied.)
+*/
+static int canmove (const Proto *f, int r, int limit) {
+  int i;
+  if (f->lazy || f->is_vararg || f->sizep > 0 || f->sizecode > limit)
+    return 0;
+  for (i = 0; i < f->sizeupvalues; i++) {
+    if (f->upvalues[i].instack && f->upvalues[i].idx == r)
+      return 0;  /* recursive */
+  }
+  for (i = 0; i < f->sizecode; i++) {
+    Instruction ins = f->code[i];
+    switch (GET_OPCODE(ins)) {
+      case OP_SETUPVAL: case OP_CALL: case OP_TAILCALL: case OP_TFORCALL:
+      case OP_CLOSURE:
+      case OP_VARARG: case OP_VARARGPREP: case OP_CLOSE: case OP_TBC:
+      case OP_SWITCH:
+        return 0;
+      case OP_RETURN:
+        if (GETARG_B(ins) == 0 || GETARG_k(ins))
+          return 0;
+        break;
+      default: break;
+    }
+  }
+  return 1;
+}
+
+
+/*
+** If local variable 'v' of 'd' is initialized with a closure that can
+** be inlined and is never assigned again, return its prototype and set
+** 'reg' to its register; otherwise return NULL.  The register of a variable is the
+** number of variables active before it where it starts.
+*/
+static Proto *inlinable (Proto *d, int v, int *reg, int limit) {
+  LocVar *var = &d->locvars[v];
+  int start = var->startpc;
+  int r = 0;
+  int i, j;
+  Proto *f;
+  if (start == 0 || start >= var->endpc)
+    return NULL;
+  for (i = 0; i < v; i++) {
+    if (d->locvars[i].startpc <= start && start < d->locvars[i].endpc)
+      r++;
+  }
+  if (GET_OPCODE(d->code[start - 1]) != OP_CLOSURE ||
+      GETARG_A(d->code[start - 1]) != r)
+    return NULL;
+  f = d->p[GETARG_Bx(d->code[start - 1])];
+  if (!canmove(f, r, limit))
+    return NULL;
+  for (i = 0; i < d->sizecode; i++) {  /* closure may be skipped? */
+    if (jumpdest(d->code, d->sizecode, i) == start)
+      return NULL;
+  }
+  for (i = start; i < var->endpc; i++) {  /* variable assigned? */
+    Instruction ins = d->code[i];
+    if (setsreg(ins, r))
+      return NULL;
+    if (GET_OPCODE(ins) == OP_CLOSURE) {
+      const Proto *c = d->p[GETARG_Bx(ins)];
+      for (j = 0; j < c->sizeupvalues; j++) {
+        if (c->upvalues[j].instack && c->upvalues[j].idx == r &&
+            setsupval(c, j))
+          return NULL;
+      }
+    }
+  }
+  *reg = r;
+  return f;
+}
+
+
+/*
+** Index of an upvalue of 'n->p' for the variable that the declaring
+** function (at the end of the chain) reaches as 'uv', added to 'n->p'
+** and to the functions between them if missing.
+*/
+static int upvalfor (LexState *ls, Nest *n, const Upvaldesc *uv) {
+  Proto *p = n->p;
+  int instack, idx, i;
+  if (n->prev->prev == NULL) {  /* 'p' nested in the declaring function? */
+    instack = uv->instack;
+    idx = uv->idx;
+  }
+  else {
+    instack = 0;
+    idx = upvalfor(ls, n->prev, uv);
+  }
+  for (i = 0; i < p->sizeupvalues; i++) {
+    if (p->upvalues[i].instack == instack && p->upvalues[i].idx == idx)
+      return i;
+  }
+  p->upvalues = luaM_reallocvector(ls->L, p->upvalues, i, i + 1, Upvaldesc);
+  p->sizeupvalues = i + 1;
+  p->upvalues[i].name = uv->name;
+  p->upvalues[i].instack = cast_byte(instack);
+  p->upvalues[i].idx = cast_byte(idx);
+  p->upvalues[i].kind = uv->kind;
+  if (uv->name)
+    luaC_objbarrier(ls->L, p, uv->name);
+  return i;
+}
+
+
+/*
+** Index of constant 'v' in 'p', added if missing.  Floats equal to
+** zero are never shared, so that 0.0 and -0.0 stay apart.
+*/
+static int copyk (LexState *ls, Proto *p, const TValue *v) {
+  int i;
+  for (i = 0; i < p->sizek; i++) {
+    const TValue *k = &p->k[i];
+    if (ttypetag(k) == ttypetag(v) && luaV_rawequalobj(k, v) &&
+        !(ttisfloat(v) && fltvalue(v) == 0))
+      return i;
+  }
+  p->k = luaM_reallocvector(ls->L, p->k, i, i + 1, TValue);
+  p->sizek = i + 1;
+  setobj(ls->L, &p->k[i], v);
+  luaC_barrier(ls->L, p, v);
+  return i;
+}
+
+
+/*
+** Move instruction 'i' of an inlined function to registers from 'base'
+** on, with its constants ('kt') and upvalues ('ut') as the caller sees
+** them: an upvalue 'u' is the caller's upvalue 'ut[u]', or its register
+** '-(ut[u] + 1)' when negative. 'prev' is the previous instruction.
+** Returns 0 if an operand does not fit in its field.
+*/
+static int moveins (Instruction *pi, Instruction prev, int base,
+                    const int *kt, const int *ut) {
+  Instruction i = *pi;
+  int a = GETARG_A(i) + base;
+  switch (GET_OPCODE(i)) {
+    case OP_JMP: case OP_RETURN0:
+      return 1;  /* no operands to move */
+    case OP_EXTRAARG:
+      if (GET_OPCODE(prev) == OP_LOADKX) {
+        if (kt[GETARG_Ax(i)] > MAXARG_Ax) return 0;
+        SETARG_Ax(i, kt[GETARG_Ax(i)]);
+      }
+      break;
+    case OP_LOADK:
+      if (kt[GETARG_Bx(i)] > MAXARG_Bx) return 0;
+      SETARG_A(i, a);
+      SETARG_Bx(i, kt[GETARG_Bx(i)]);
+      break;
+    case OP_MOVE: case OP_GETI: case OP_UNM: case OP_BNOT: case OP_NOT:
+    case OP_LEN: case OP_ADDI: case OP_SHRI: case OP_SHLI: case OP_MMBIN:
+    case OP_EQ: case OP_LT: case OP_LE: case OP_TESTSET:
+      SETARG_A(i, a);
+      SETARG_B(i, GETARG_B(i) + base);
+      break;
+    case OP_GETTABLE: case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD:
+    case OP_POW: case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR:
+    case OP_BXOR: case OP_SHL: case OP_SHR:
+      SETARG_A(i, a);
+      SETARG_B(i, GETARG_B(i) + base);
+      SETARG_C(i, GETARG_C(i) + base);
+      break;
+    case OP_GETFIELD: case OP_ADDK: case OP_SUBK: case OP_MULK:
+    case OP_MODK: case OP_POWK: case OP_DIVK: case OP_IDIVK:
+    case OP_BANDK: case OP_BORK: case OP_BXORK:
+      if (kt[GETARG_C(i)] > MAXARG_C) return 0;
+      SETARG_A(i, a);
+      SETARG_B(i, GETARG_B(i) + base);
+      SETARG_C(i, kt[GETARG_C(i)]);
+      break;
+    case OP_EQK: case OP_MMBINK:
+      if (kt[GETARG_B(i)] > MAXARG_B) return 0;
+      SETARG_A(i, a);
+      SETARG_B(i, kt[GETARG_B(i)]);
+      break;
+    case OP_GETUPVAL: {
+      int u = ut[GETARG_B(i)];
+      if (u < 0)  /* caller has it in a register? */
+        i = CREATE_ABCk(OP_MOVE, a, -(u + 1), 0, 0);
+      else {
+        SETARG_A(i, a);
+        SETARG_B(i, u);
+      }
+      break;
+    }
+    case OP_GETTABUP: {
+      int u = ut[GETARG_B(i)];
+      if (kt[GETARG_C(i)] > MAXARG_C) return 0;
+      if (u < 0)
+        i = CREATE_ABCk(OP_GETFIELD, a, -(u + 1), kt[GETARG_C(i)], 0);
+      else
+        i = CREATE_ABCk(OP_GETTABUP, a, u, kt[GETARG_C(i)], 0);
+      break;
+    }
+    case OP_SETTABUP: case OP_SETTABLE: case OP_SETI: case OP_SETFIELD:
+    case OP_SELF: {
+      OpCode op = GET_OPCODE(i);
+      int b = GETARG_B(i);
+      int c = GETARG_C(i);
+      if (GETARG_k(i)) {  /* value is a constant? */
+        if (kt[c] > MAXARG_C) return 0;
+        c = kt[c];
+      }
+      else
+        c += base;
+      if (op == OP_SETTABUP || op == OP_SETFIELD) {  /* key is a constant? */
+        if (kt[b] > MAXARG_B) return 0;
+        b = kt[b];
+      }
+      else if (op != OP_SETI)  /* key is a register? */
+        b += base;
+      if (op == OP_SETTABUP) {
+        int u = ut[GETARG_A(i)];
+        if (u < 0) {
+          op = OP_SETFIELD;
+          a = -(u + 1);
+        }
+        else
+          a = u;
+      }
+      i = CREATE_ABCk(op, a, b, c, GETARG_k(i));
+      break;
+    }
+    default:  /* only register A */
+      SETARG_A(i, a);
+      break;
+  }
+  *pi = i;
+  return 1;
+}
+
+
+/*
+** Lay out a copy of 'f' replacing 'call' from 'pc' on: missing arguments
+** are set to nil first, and a return becomes a move of its value to the
+** register of the call (if it wants one) and, but for the last one, a
+** jump to the end. Fills 'bmap' (if not NULL) with the position of each
+** instruction of 'f' and returns the position after the copy.
+*/
+static int bodymap (const Proto *f, Instruction call, int pc, int *bmap) {
+  int nres = GETARG_C(call) - 1;
+  int n = f->sizecode;
+  int i;
+  pc += (GETARG_B(call) - 1 < f->numparams);
+  for (i = 0; i < n; i++) {
+    if (bmap) bmap[i] = pc;
+    pc += isreturn(f->code[i]) ? nres + (i < n - 1) : 1;
+  }
+  return pc;
+}
+
+
+/*
+** Copy the body of 'f' in place of instruction 'call', starting at
+** 'pc' of 'code', with the lines of 'f' (in 'bline'). Returns the
+** position after the copy.
+*/
+static int copybody (const Proto *f, Instruction call, int callline,
+                     Instruction *code, int *line, int pc,
+                     const int *kt, const int *ut, int *bmap,
+                     const int *bline) {
+  int a = GETARG_A(call);
+  int base = a + 1;
+  int nargs = GETARG_B(call) - 1;
+  int nres = GETARG_C(call) - 1;
+  int n = f->sizecode;
+  int end = bodymap(f, call, pc, bmap);
+  int i;
+  if (nargs < f->numparams) {  /* complete missing arguments */
+    code[pc] = CREATE_ABCk(OP_LOADNIL, base + nargs,
+                           f->numparams - nargs - 1, 0, 0);
+    line[pc++] = callline;
+  }
+  for (i = 0; i < n; i++) {
+    Instruction ins = f->code[i];
+    if (isreturn(ins)) {
+      if (nres > 0) {
+        if (GET_OPCODE(ins) == OP_RETURN0 ||
+            (GET_OPCODE(ins) == OP_RETURN && GETARG_B(ins) == 1))
+          code[pc] = CREATE_ABCk(OP_LOADNIL, a, 0, 0, 0);
+        else
+          code[pc] = CREATE_ABCk(OP_MOVE, a, GETARG_A(ins) + base, 0, 0);
+        line[pc++] = bline[i];
+      }
+      if (i < n - 1) {
+        code[pc] = CREATE_sJ(OP_JMP, end - (pc + 1) + OFFSET_sJ, 0);
+        line[pc++] = bline[i];
+      }
+    }
+    else {
+      moveins(&ins, (i > 0) ? f->code[i - 1] : 0, base, kt, ut);
+      code[pc] = relocate(ins, i, pc, bmap, n, end);
+      line[pc++] = bline[i];
+    }
+  }
+  lua_assert(pc == end);
+  return end;
+}
+
+
+/*
+** A call at 'pc' to 'f' passing all its results to the next instruction
+** can pass just one, when 'f' always returns one value: change both
+** instructions to say so. Returns whether that was possible.
+*/
+static int onevalue (Instruction *code, int n, int pc, const Proto *f) {
+  int a = GETARG_A(code[pc]);
+  Instruction *next = &code[pc + 1];
+  int i, b;
+  if (pc + 1 >= n)
+    return 0;
+  for (i = 0; i < f->sizecode; i++) {
+    Instruction ins = f->code[i];
+    if (GET_OPCODE(ins) == OP_RETURN0 ||
+        (GET_OPCODE(ins) == OP_RETURN && GETARG_B(ins) != 2))
+      return 0;
+  }
+  switch (GET_OPCODE(*next)) {
+    case OP_CALL: case OP_TAILCALL: b = a - GETARG_A(*next) + 1; break;
+    case OP_RETURN: b = a - GETARG_A(*next) + 2; break;
+    case OP_SETLIST: b = a - GETARG_A(*next); break;
+    default: return 0;
+  }
+  if (GETARG_B(*next) != 0)
+    return 0;
+  SETARG_B(*next, b);
+  SETARG_C(code[pc], 2);
+  return 1;
+}
+
+
+/*
+** Find in 'p', between 'from' and 'to', the calls to a function that
+** 'p' loads from its register or upvalue 'idx' (as told by 'isreg'),
+** marking in 'mark' the load (with -1), which goes away, and the call
+** (with 1), which is replaced by the body.  A call qualifies when it
+** passes a fixed number of arguments, wants at most one result (see
+** 'onevalue'), has room for the body's registers and nothing else can
+** reach its arguments or the call.  'src' keeps the first and last instruction
+** jumping to each one. Returns the number of calls found.
+*/
+static int findcalls (Proto *p, const Proto *f, int isreg, int idx,
+                      int from, int to, int *mark, int *src) {
+  Instruction *code = p->code;
+  int n = p->sizecode;
+  int found = 0;
+  int i, j, t;
+  for (i = 0; i < n; i++) {
+    mark[i] = 0;
+    src[2 * i] = MAX_INT;
+    src[2 * i + 1] = -1;
+  }
+  for (i = 0; i < n; i++) {
+    int d = jumpdest(code, n, i);
+    if (0 <= d && d < n) {
+      if (src[2 * d] > i) src[2 * d] = i;
+      src[2 * d + 1] = i;
+    }
+  }
+  for (i = from; i < to; i++) {
+    Instruction ld = code[i];
+    int a = GETARG_A(ld);
+    if (GET_OPCODE(ld) != (isreg ? OP_MOVE : OP_GETUPVAL) ||
+        GETARG_B(ld) != idx)
+      continue;
+    for (j = i + 1; j < n; j++) {  /* find the call */
+      if (GET_OPCODE(code[j]) == OP_CALL && GETARG_A(code[j]) == a)
+        break;
+      if (setsreg(code[j], a) || isreturn(code[j])) {
+        j = n;  /* not a call after all */
+        break;
+      }
+    }
+    if (j == n || GETARG_B(code[j]) == 0 || GETARG_C(code[j]) > 2 ||
+        a + 1 + f->maxstacksize >= MAXREGS)
+      continue;
+    for (t = i + 1; t <= j; t++) {  /* all jumps stay inside? */
+      int d = (t < j) ? jumpdest(code, n, t) : -1;
+      if ((src[2 * t + 1] >= 0 && (src[2 * t] <= i || src[2 * t + 1] >= j))
+          || (d >= 0 && (d <= i || d > j)))
+        break;
+    }
+    if (t <= j || (GETARG_C(code[j]) == 0 && !onevalue(code, n, j, f)))
+      continue;
+    mark[i] = -1;
+    mark[j] = 1;
+    found++;
+  }
+  return found;
+}
+
+
+/*
+** Rebuild the line information of 'f' from the line of each
+** instruction, as 'savelineinfo' does.
+*/
+static void setlines (lua_State *L, Proto *f, const int *line) {
+  int n = f->sizecode;
+  int nabs = 0;
+  int iwthabs = 0;
+  int prev = f->linedefined;
+  int i;
+  for (i = 0; i < n; i++) {  /* count absolute lines */
+    if (abs(line[i] - prev) >= LIMLINEDIFF || iwthabs++ >= MAXIWTHABS) {
+      nabs++;
+      iwthabs = 1;
+    }
+    prev = line[i];
+  }
+  f->lineinfo = luaM_reallocvector(L, f->lineinfo, f->sizelineinfo, n,
+                                   ls_byte);
+  f->sizelineinfo = n;
+  f->abslineinfo = luaM_reallocvector(L, f->abslineinfo,
+                                      f->sizeabslineinfo, nabs, AbsLineInfo);
+  f->sizeabslineinfo = nabs;
+  nabs = iwthabs = 0;
+  prev = f->linedefined;
+  for (i = 0; i < n; i++) {
+    int linedif = line[i] - prev;
+    if (abs(linedif) >= LIMLINEDIFF || iwthabs++ >= MAXIWTHABS) {
+      f->abslineinfo[nabs].pc = i;
+      f->abslineinfo[nabs++].line = line[i];
+      linedif = ABSLINEINFO;
+      iwthabs = 1;
+    }
+    f->lineinfo[i] = cast(ls_byte, linedif);
+    prev = line[i];
+  }
+}
+
+
+/*
+** Give names to the registers of the copies of 'f' in 'p', for debug
+** information: the variables of 'f' go with its code, after
+** placeholders for the registers between the active variables of 'p'
+** and the copy. Variables are kept sorted by their start, and their
+** order gives their registers.
+*/
+static void movelocvars (LexState *ls, Proto *p, const Proto *f,
+                         const int *mark, const Instruction *old,
+                         const int *map, int np, int *bmap) {
+  lua_State *L = ls->L;
+  int nl = p->sizelocvars;
+  int total = nl;
+  int i, j, k, s;
+  TString *tmp;
+  for (s = 0; s < np; s++) {  /* count new variables */
+    if (mark[s] > 0) {
+      bodymap(f, old[s], map[s], bmap);
+      total += GETARG_A(old[s]) + 1 - activevars(p, nl, bmap[0]) +
+               f->sizelocvars;
+    }
+  }
+  p->locvars = luaM_reallocvector(L, p->locvars, nl, total, LocVar);
+  for (k = nl; k < total; k++)
+    p->locvars[k].varname = NULL;
+  p->sizelocvars = total;
+  tmp = luaS_newliteral(L, "(temporary)");
+  for (s = np - 1, i = nl - 1, k = total - 1; s >= 0; s--) {
+    if (mark[s] > 0) {  /* insert variables of this copy */
+      int end = bodymap(f, old[s], map[s], bmap);
+      int r, nact;
+      while (i >= 0 && p->locvars[i].startpc > bmap[0])
+        p->locvars[k--] = p->locvars[i--];
+      nact = activevars(p, i + 1, bmap[0]);
+      for (j = f->sizelocvars - 1; j >= 0; j--) {
+        LocVar *var = &p->locvars[k--];
+        var->varname = f->locvars[j].varname;
+        var->startpc = newpos(bmap, f->sizecode, end, f->locvars[j].startpc);
+        var->endpc = newpos(bmap, f->sizecode, end, f->locvars[j].endpc);
+        luaC_objbarrier(L, p, var->varname);
+      }
+      for (r = GETARG_A(old[s]); r >= nact; r--) {
+        LocVar *var = &p->locvars[k--];
+        var->varname = tmp;
+        var->startpc = bmap[0];
+        var->endpc = end;
+      }
+    }
+  }
+  lua_assert(k == i);
+  luaC_objbarrier(L, p, tmp);
+}
+
+
+/*
+** Replace the calls marked in 'p' by copies of the body of 'f',
+** whose constants and upvalues are first made available in 'p' (the
+** last function in chain 'n'). Gives up (returning 0) if they do not
+** fit.
+*/
+static int inlinecalls (LexState *ls, Nest *n, const Proto *f) {
+  lua_State *L = ls->L;
+  Proto *p = n->p;
+  int np = p->sizecode;
+  int nf = f->sizecode;
+  int *mark, *kt, *ut, *bmap, *bline, *map, *line, *nline;
+  Instruction *old;
+  Nest *c;
+  int i, pc, nn;
+  for (c = n; c->prev != NULL; c = c->prev) {  /* room for upvalues? */
+    if (c->p->sizeupvalues + f->sizeupvalues > MAXUPVAL)
+      return 0;
+  }
+  /* layout: mark, kt, ut, bmap, bline, map, line, nline, old code */
+  mark = scratch(ls, cast_sizet(np) + f->sizek + f->sizeupvalues);
+  kt = mark + np;
+  ut = kt + f->sizek;
+  for (i = 0; i < f->sizek; i++)
+    kt[i] = copyk(ls, p, &f->k[i]);
+  for (i = 0; i < f->sizeupvalues; i++) {
+    const Upvaldesc *uv = &f->upvalues[i];
+    if (n->prev != NULL)
+      ut[i] = upvalfor(ls, n, uv);
+    else  /* 'p' declares the function */
+      ut[i] = uv->instack ? -(uv->idx + 1) : uv->idx;
+  }
+  for (i = 0; i < nf; i++) {  /* check that all operands fit */
+    Instruction ins = f->code[i];
+    if (!moveins(&ins, (i > 0) ? f->code[i - 1] : 0, 0, kt, ut))
+      return 0;
+  }
+  for (i = 0, nn = 0; i < np; i++) {
+    if (mark[i] > 0)
+      nn += bodymap(f, p->code[i], 0, NULL);
+    else
+      nn += (mark[i] == 0);
+  }
+  mark = scratch(ls, cast_sizet(np) + f->sizek + f->sizeupvalues +
+                     2 * cast_sizet(nf) + 1 + 2 * cast_sizet(np) + 1 + nn +
+                     intsforcode(np));
+  kt = mark + np;
+  ut = kt + f->sizek;
+  bmap = ut + f->sizeupvalues;
+  bline = bmap + nf;
+  map = bline + nf;
+  line = map + np + 1;
+  nline = line + np;
+  old = cast(Instruction *, nline + nn);
+  decodelines(f, nf, bline);
+  decodelines(p, np, line);
+  memcpy(old, p->code, np * sizeof(Instruction));
+  for (i = 0, pc = 0; i < np; i++) {
+    map[i] = pc;
+    if (mark[i] > 0)
+      pc = bodymap(f, old[i], pc, NULL);
+    else
+      pc += (mark[i] == 0);
+  }
+  map[np] = nn;
+  p->code = luaM_reallocvector(L, p->code, np, nn, Instruction);
+  p->sizecode = nn;
+  for (i = 0, pc = 0; i < np; i++) {
+    if (mark[i] > 0) {
+      int top = GETARG_A(old[i]) + 1 + f->maxstacksize;
+      pc = copybody(f, old[i], line[i], p->code, nline, pc, kt, ut,
+                    bmap, bline);
+      if (top > p->maxstacksize)
+        p->maxstacksize = cast_byte(top);
+    }
+    else if (mark[i] == 0) {
+      p->code[pc] = relocate(old[i], i, pc, map, np, nn);
+      nline[pc++] = line[i];
+    }
+  }
+  lua_assert(pc == nn);
+  setlines(L, p, nline);
+  for (i = 0; i < p->sizelocvars; i++) {
+    LocVar *var = &p->locvars[i];
+    var->startpc = newpos(map, np, nn, var->startpc);
+    var->endpc = newpos(map, np, nn, var->endpc);
+  }
+  movelocvars(ls, p, f, mark, old, map, np, bmap);
+  return 1;
+}
+
+
+/*
+** Inline the calls to 'f' in the last function of chain 'n', which
+** reaches it through its register or upvalue 'idx', between 'from' and
+** 'to', and in the functions nested there. Returns whether any was.
+*/
+static int inlinein (LexState *ls, Nest *n, const Proto *f, int isreg,
+                      int idx, int from, int to) {
+  Proto *p = n->p;
+  int done = 0;
+  int i, j;
+  for (i = from; i < to; i++) {  /* nested functions first */
+    if (GET_OPCODE(p->code[i]) == OP_CLOSURE) {
+      Nest cn;
+      cn.p = p->p[GETARG_Bx(p->code[i])];
+      cn.prev = n;
+      for (j = 0; j < cn.p->sizeupvalues; j++) {
+        const Upvaldesc *uv = &cn.p->upvalues[j];
+        if (uv->instack == isreg && uv->idx == idx) {
+          done |= inlinein(ls, &cn, f, 0, j, 0, cn.p->sizecode);
+          break;
+        }
+      }
+    }
+  }
+  if (p->sizecode > 0) {
+    size_t np = cast_sizet(p->sizecode);
+    int *mark = scratch(ls, 3 * np);
+    if (findcalls(p, f, isreg, idx, from, to, mark, mark + np) > 0)
+      done |= inlinecalls(ls, n, f);
+  }
+  return done;
+}
+
+
+/*
+** Inline the local functions of 'd' and of the functions nested in it,
+** innermost first, so that functions get their own calls inlined
+** before being copied. A second pass catches calls taking the result
+** of another call that was only inlined in the first one.
+*/
+static void inlinefuncs (LexState *ls, Proto *d) {
+  int i, pass;
+  int done = 1;
+  for (i = 0; i < d->sizep; i++)
+    inlinefuncs(ls, d->p[i]);
+  for (pass = 0; pass < 2 && done; pass++) {
+    done = 0;
+    for (i = 0; i < d->sizelocvars; i++) {
+      int reg;
+      Proto *f = inlinable(d, i, &reg, LUAI_MAXINLINE);
+      if (f != NULL) {
+        Nest n;
+        n.p = d;
+        n.prev = NULL;
+        done |= inlinein(ls, &n, f, 1, reg, d->locvars[i].startpc,
+                         d->locvars[i].endpc);
+      }
+    }
+  }
+}
+
+
+void luaK_inline (LexState *ls, Proto *f) {
+  inlinefuncs(ls, f);
+}
+
+/* }====================================================== */
+
+#endif
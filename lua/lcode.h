@@ -95,6 +95,16 @@ LUAI_FUNC void luaK_settablesize (FuncState *fs, int pc,
                                   int ra, int asize, int hsize);
 LUAI_FUNC void luaK_setlist (FuncState *fs, int base, int nelems, int tostore);
 LUAI_FUNC void luaK_finish (FuncState *fs);
+#if defined(LUAI_OPTCODE)
+LUAI_FUNC void luaK_optimize (FuncState *fs);
+#else
+#define luaK_optimize(fs)	((void)0)
+#endif
+#if defined(LUAI_MAXINLINE)
+LUAI_FUNC void luaK_inline (LexState *ls, Proto *f);
+#else
+#define luaK_inline(ls,f)	((void)0)
+#endif
 LUAI_FUNC l_noret luaK_semerror (LexState *ls, const char *msg);
 
 
@@ -10,6 +10,7 @@
 #include "lprefix.h"
 
 
+#include <limits.h>
 #include <stdlib.h>
 
 #include "lua.h"
@@ -94,8 +95,11 @@ static int luaB_auxwrap (lua_State *L) {
 
 static int luaB_cocreate (lua_State *L) {
   lua_State *NL;
+  lua_Integer size = luaL_optinteger(L, 2, 0);  /* stack size hint */
   luaL_checktype(L, 1, LUA_TFUNCTION);
-  NL = lua_newthread(L);
+  luaL_argcheck(L, 0 <= size && size <= LUAI_MAXSTACK, 2,
+                   "stack size out of range");
+  NL = lua_newthreadsize(L, (int)size);
   lua_pushvalue(L, 1);  /* move function to top */
   lua_xmove(L, NL, 1);  /* move function from L to NL */
   return 1;
@@ -160,6 +164,29 @@ static int luaB_yieldable (lua_State *L) {
 }
 
 
+/*
+** coroutine.quota(co [, n [, what]]): returns the quota of 'co' and
+** what is left of it, then sets it to 'n' if given. 'what' is
+** "yield" (the default) or "error". A coroutine yielding when out of
+** its quota gives 'coroutine.quotamark'.
+*/
+static int luaB_quota (lua_State *L) {
+  static const char *const opts[] = {"yield", "error", NULL};
+  lua_State *co = getco(L);
+  int left;
+  int quota = lua_getquota(co, &left);
+  if (!lua_isnoneornil(L, 2)) {
+    lua_Integer n = luaL_checkinteger(L, 2);
+    int what = luaL_checkoption(L, 3, "yield", opts);
+    luaL_argcheck(L, 0 <= n && n <= INT_MAX, 2, "quota out of range");
+    lua_setquota(co, (int)n, (what == 0) ? LUA_QUOTAYIELD : LUA_QUOTAERROR);
+  }
+  lua_pushinteger(L, quota);
+  lua_pushinteger(L, left);
+  return 2;
+}
+
+
 static int luaB_corunning (lua_State *L) {
   int ismain = lua_pushthread(L);
   lua_pushboolean(L, ismain);
@@ -198,6 +225,7 @@ static const luaL_Reg co_funcs[] = {
   {"yield", luaB_yield},
   {"isyieldable", luaB_yieldable},
   {"close", luaB_close},
+  {"quota", luaB_quota},
   {NULL, NULL}
 };
 
@@ -205,6 +233,8 @@ static const luaL_Reg co_funcs[] = {
 
 LUAMOD_API int luaopen_coroutine (lua_State *L) {
   luaL_newlib(L, co_funcs);
+  lua_pushlightuserdata(L, (void *)lua_quotamark);
+  lua_setfield(L, -2, "quotamark");
   return 1;
 }
 
@@ -454,6 +454,30 @@ static int db_setcstacklimit (lua_State *L) {
 }
 
 
+static int snapwriter (lua_State *L, const void *b, size_t size, void *f) {
+  (void)L;
+  return (fwrite(b, 1, size, (FILE *)f) != size);
+}
+
+
+/*
+** Collects all garbage and writes a snapshot of the heap to the
+** given file (see 'lsnap.c' for its format).
+*/
+static int db_snapshot (lua_State *L) {
+  const char *fname = luaL_checkstring(L, 1);
+  int status;
+  FILE *f = fopen(fname, "wb");
+  if (f == NULL)
+    return luaL_fileresult(L, 0, fname);
+  lua_gc(L, LUA_GCCOLLECT);
+  status = lua_snapshot(L, snapwriter, f);
+  if (fclose(f) != 0)
+    status = 1;
+  return luaL_fileresult(L, status == 0, fname);
+}
+
+
 static const luaL_Reg dblib[] = {
   {"debug", db_debug},
   {"getuservalue", db_getuservalue},
@@ -472,6 +496,7 @@ static const luaL_Reg dblib[] = {
   {"setupvalue", db_setupvalue},
   {"traceback", db_traceback},
   {"setcstacklimit", db_setcstacklimit},
+  {"snapshot", db_snapshot},
   {NULL, NULL}
 };
 
@@ -27,6 +27,7 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lundump.h"
 #include "lvm.h"
 
 
@@ -160,6 +161,27 @@ LUA_API int lua_gethookcount (lua_State *L) {
 }
 
 
+/*
+** Quotas limit how much Lua code a thread runs without the cost of a
+** count hook: each call to a Lua function and each backward jump
+** charges one unit, and when a slice of 'quota' units is used up the
+** thread yields or raises an error (see 'luaG_quota'). A 'quota' of
+** zero removes the limit.
+*/
+LUA_API void lua_setquota (lua_State *L, int quota, int what) {
+  L->quota = (quota > 0) ? quota : 0;
+  L->quotawhat = cast_byte(what);
+  resetbudget(L);
+}
+
+
+LUA_API int lua_getquota (lua_State *L, int *left) {
+  if (left)
+    *left = (L->quota > 0 && L->budget > 0) ? L->budget : 0;
+  return L->quota;
+}
+
+
 LUA_API int lua_getstack (lua_State *L, int level, lua_Debug *ar) {
   int status;
   CallInfo *ci;
@@ -188,7 +210,7 @@ static const char *findvararg (CallInfo *ci, int n, StkId *pos) {
   if (clLvalue(s2v(ci->func.p))->p->is_vararg) {
     int nextra = ci->u.l.nextraargs;
     if (n >= -nextra) {  /* 'n' is negative */
-      *pos = ci->func.p - nextra - (n + 1);
+      *pos = ci_base(ci) - nextra - (n + 1);
       return "(vararg)";  /* generic name for any vararg */
     }
   }
@@ -197,13 +219,15 @@ static const char *findvararg (CallInfo *ci, int n, StkId *pos) {
 
 
 const char *luaG_findlocal (lua_State *L, CallInfo *ci, int n, StkId *pos) {
-  StkId base = ci->func.p + 1;
+  StkId base = isLua(ci) ? ci_base(ci) : ci->func.p + 1;
   const char *name = NULL;
   if (isLua(ci)) {
     if (n < 0)  /* access to vararg values? */
       return findvararg(ci, n, pos);
-    else
+    else {
+      luaU_checkdebug(L, ci_func(ci)->p);
       name = luaF_getlocalname(ci_func(ci)->p, n, currentpc(ci));
+    }
   }
   if (name == NULL) {  /* no 'standard' name? */
     StkId limit = (ci == L->ci) ? L->top.p : ci->next->func.p;
@@ -226,8 +250,11 @@ LUA_API const char *lua_getlocal (lua_State *L, const lua_Debug *ar, int n) {
   if (ar == NULL) {  /* information about non-active function? */
     if (!isLfunction(s2v(L->top.p - 1)))  /* not a Lua function? */
       name = NULL;
-    else  /* consider live variables at function start (parameters) */
-      name = luaF_getlocalname(clLvalue(s2v(L->top.p - 1))->p, n, 0);
+    else {  /* consider live variables at function start (parameters) */
+      Proto *p = clLvalue(s2v(L->top.p - 1))->p;
+      luaU_checkdebug(L, p);
+      name = luaF_getlocalname(p, n, 0);
+    }
   }
   else {  /* active function; get information through 'ar' */
     StkId pos = NULL;  /* to avoid warnings */
@@ -296,9 +323,11 @@ static void collectvalidlines (lua_State *L, Closure *f) {
     api_incr_top(L);
   }
   else {
-    const Proto *p = f->l.p;
+    Proto *p = f->l.p;
     int currentline = p->linedefined;
-    Table *t = luaH_new(L);  /* new table to store active lines */
+    Table *t;
+    luaU_checklines(L, p);
+    t = luaH_new(L);  /* new table to store active lines */
     sethvalue2s(L, L->top.p, t);  /* push it on stack */
     api_incr_top(L);
     if (p->lineinfo != NULL) {  /* proto with debug information? */
@@ -339,7 +368,12 @@ static int auxgetinfo (lua_State *L, const char *what, lua_Debug *ar,
         break;
       }
       case 'l': {
-        ar->currentline = (ci && isLua(ci)) ? getcurrentline(ci) : -1;
+        if (ci && isLua(ci)) {
+          luaU_checklines(L, ci_func(ci)->p);
+          ar->currentline = getcurrentline(ci);
+        }
+        else
+          ar->currentline = -1;
         break;
       }
       case 'u': {
@@ -455,7 +489,8 @@ static int findsetreg (const Proto *p, int lastpc, int reg) {
         break;
       }
       case OP_CALL:
-      case OP_TAILCALL: {  /* affect all registers above base */
+      case OP_TAILCALL:
+      case OP_SELECT: {  /* affect all registers above base */
         change = (reg >= a);
         break;
       }
@@ -624,6 +659,7 @@ static const char *funcnamefromcode (lua_State *L, const Proto *p,
   switch (GET_OPCODE(i)) {
     case OP_CALL:
     case OP_TAILCALL:
+    case OP_SELECT:
       return getobjname(p, pc, GETARG_A(i), name);  /* get function name */
     case OP_TFORCALL: {  /* for iterator */
       *name = "for iterator";
@@ -671,8 +707,10 @@ static const char *funcnamefromcall (lua_State *L, CallInfo *ci,
     *name = "__gc";
     return "metamethod";  /* report it as such */
   }
-  else if (isLua(ci))
+  else if (isLua(ci)) {
+    luaU_checkdebug(L, ci_func(ci)->p);
     return funcnamefromcode(L, ci_func(ci)->p, currentpc(ci), name);
+  }
   else
     return NULL;
 }
@@ -689,7 +727,7 @@ static const char *funcnamefromcall (lua_State *L, CallInfo *ci,
 */
 static int instack (CallInfo *ci, const TValue *o) {
   int pos;
-  StkId base = ci->func.p + 1;
+  StkId base = ci_base(ci);
   for (pos = 0; base + pos < ci->top.p; pos++) {
     if (o == s2v(base + pos))
       return pos;
@@ -734,6 +772,7 @@ static const char *varinfo (lua_State *L, const TValue *o) {
   const char *name = NULL;  /* to avoid warnings */
   const char *kind = NULL;
   if (isLua(ci)) {
+    luaU_checkdebug(L, ci_func(ci)->p);
     kind = getupvalname(ci, o, &name);  /* check whether 'o' is an upvalue */
     if (!kind) {  /* not an upvalue? */
       int reg = instack(ci, o);  /* try a register */
@@ -854,6 +893,7 @@ l_noret luaG_runerror (lua_State *L, const char *fmt, ...) {
   msg = luaO_pushvfstring(L, fmt, argp);  /* format message */
   va_end(argp);
   if (isLua(ci)) {  /* if Lua function, add source:line information */
+    luaU_checklines(L, ci_func(ci)->p);
     luaG_addinfo(L, msg, ci_func(ci)->p->source, getcurrentline(ci));
     setobjs2s(L, L->top.p - 2, L->top.p - 1);  /* remove 'msg' */
     L->top.p--;
@@ -928,7 +968,7 @@ int luaG_tracecall (lua_State *L) {
 int luaG_traceexec (lua_State *L, const Instruction *pc) {
   CallInfo *ci = L->ci;
   lu_byte mask = L->hookmask;
-  const Proto *p = ci_func(ci)->p;
+  Proto *p = ci_func(ci)->p;
   int counthook;
   if (!(mask & (LUA_MASKLINE | LUA_MASKCOUNT))) {  /* no hooks? */
     ci->u.l.trap = 0;  /* don't need to stop again */
@@ -953,6 +993,7 @@ int luaG_traceexec (lua_State *L, const Instruction *pc) {
     /* 'L->oldpc' may be invalid; use zero in this case */
     int oldpc = (L->oldpc < p->sizecode) ? L->oldpc : 0;
     int npci = pcRel(pc, p);
+    luaU_checklines(L, p);
     if (npci <= oldpc ||  /* call hook when jump back (loop), */
         changedline(p, oldpc, npci)) {  /* or when enter new line */
       int newline = luaG_getfuncline(p, npci);
@@ -969,3 +1010,40 @@ int luaG_traceexec (lua_State *L, const Instruction *pc) {
   return 1;  /* keep 'trap' on */
 }
 
+
+const char lua_quotamark[] = "quota";
+
+
+/*
+** Called from 'luaV_execute' when the budget of a thread runs out, with
+** 'pc' pointing to the next instruction to run. Yields the way a count
+** hook does, so that 'resume' continues at 'pc', but with one value,
+** a light userdata pointing to 'lua_quotamark', to tell the resumer
+** that the thread did not yield by itself. A thread that cannot
+** yield now is left with an empty budget, so that it yields at the
+** first chance it gets. Errors leave the budget empty too, so that
+** nothing can run long after catching them.
+*/
+void luaG_quota (lua_State *L, const Instruction *pc) {
+  CallInfo *ci = L->ci;
+  if (L->quota == 0) {  /* no quota? */
+    resetbudget(L);
+    return;
+  }
+  L->budget = 0;
+  if (L->quotawhat == LUA_QUOTAYIELD && !yieldable(L))
+    return;  /* try again at the next charge */
+  ci->u.l.savedpc = pc + 1;  /* as 'luaG_traceexec' leaves it */
+  if (L->quotawhat == LUA_QUOTAERROR)
+    luaG_runerror(L, "instruction quota exceeded");
+  else {
+    resetbudget(L);  /* next slice */
+    luaD_checkstack(L, 1);
+    setpvalue(s2v(L->top.p), cast_voidp(lua_quotamark));
+    L->top.p++;
+    ci->u2.nyield = 1;  /* the mark */
+    L->status = LUA_YIELD;
+    luaD_throw(L, LUA_YIELD);
+  }
+}
+
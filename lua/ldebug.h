@@ -17,9 +17,18 @@
 /* Active Lua function (given call info) */
 #define ci_func(ci)		(clLvalue(s2v((ci)->func.p)))
 
+/* First register of active Lua function (see 'luaT_adjustvarargs') */
+#define ci_base(ci)		((ci)->func.p + 1 + (ci)->u.l.shift)
+
 
 #define resethookcount(L)	(L->hookcount = L->basehookcount)
 
+/*
+** Start a new slice of the quota. Without a quota the budget still
+** runs down, but only reaches 'luaG_quota' once every MAX_INT charges.
+*/
+#define resetbudget(L)	(L->budget = (L->quota > 0) ? L->quota : MAX_INT)
+
 /*
 ** mark for entries in 'lineinfo' array that has absolute information in
 ** 'abslineinfo' array
@@ -59,6 +68,7 @@ LUAI_FUNC const char *luaG_addinfo (lua_State *L, const char *msg,
 LUAI_FUNC l_noret luaG_errormsg (lua_State *L);
 LUAI_FUNC int luaG_traceexec (lua_State *L, const Instruction *pc);
 LUAI_FUNC int luaG_tracecall (lua_State *L);
+LUAI_FUNC void luaG_quota (lua_State *L, const Instruction *pc);
 
 
 #endif
@@ -394,17 +394,10 @@ void luaD_hookcall (lua_State *L, CallInfo *ci) {
 static void rethook (lua_State *L, CallInfo *ci, int nres) {
   if (L->hookmask & LUA_MASKRET) {  /* is return hook on? */
     StkId firstres = L->top.p - nres;  /* index of first result */
-    int delta = 0;  /* correction for vararg functions */
-    int ftransfer;
-    if (isLua(ci)) {
-      Proto *p = ci_func(ci)->p;
-      if (p->is_vararg)
-        delta = ci->u.l.nextraargs + p->numparams + 1;
-    }
-    ci->func.p += delta;  /* if vararg, back to virtual 'func' */
-    ftransfer = cast(unsigned short, firstres - ci->func.p);
+    /* transferred values are counted from the function's base */
+    StkId base = isLua(ci) ? ci_base(ci) : ci->func.p + 1;
+    int ftransfer = cast(unsigned short, firstres - base + 1);
     luaD_hook(L, LUA_HOOKRET, -1, ftransfer, nres);  /* call it */
-    ci->func.p -= delta;
   }
   if (isLua(ci = ci->previous))
     L->oldpc = pcRel(ci->u.l.savedpc, ci_func(ci)->p);  /* set 'oldpc' */
@@ -541,6 +534,17 @@ l_sinline int precallC (lua_State *L, StkId func, int nresults,
 }
 
 
+/*
+** Compile the body of Lua function 'func' for its first call. Returns
+** its new position, as the stack may move meanwhile.
+*/
+static StkId compilecall (lua_State *L, StkId func, Proto *p) {
+  ptrdiff_t t = savestack(L, func);
+  luaD_compile(L, p);
+  return restorestack(L, t);
+}
+
+
 /*
 ** Prepare a function for a tail call, building its call info on top
 ** of the current call info. 'narg1' is the number of arguments plus 1
@@ -548,20 +552,23 @@ l_sinline int precallC (lua_State *L, StkId func, int nresults,
 ** results, if it was a C function, or -1 for a Lua function.
 */
 int luaD_pretailcall (lua_State *L, CallInfo *ci, StkId func,
-                                    int narg1, int delta) {
+                                    int narg1) {
  retry:
   switch (ttypetag(s2v(func))) {
     case LUA_VCCL:  /* C closure */
       return precallC(L, func, LUA_MULTRET, clCvalue(s2v(func))->f);
     case LUA_VLCF:  /* light C function */
+    case LUA_VLEAF:  /* leaf C function */
       return precallC(L, func, LUA_MULTRET, fvalue(s2v(func)));
     case LUA_VLCL: {  /* Lua function */
       Proto *p = clLvalue(s2v(func))->p;
-      int fsize = p->maxstacksize;  /* frame size */
-      int nfixparams = p->numparams;
+      int fsize, nfixparams;
       int i;
-      checkstackGCp(L, fsize - delta, func);
-      ci->func.p -= delta;  /* restore 'func' (if vararg) */
+      if (l_unlikely(p->lazy))  /* body not compiled yet? */
+        func = compilecall(L, func, p);
+      fsize = p->maxstacksize;  /* frame size */
+      nfixparams = p->numparams;
+      checkstackGCp(L, fsize, func);
       for (i = 0; i < narg1; i++)  /* move down function and arguments */
         setobjs2s(L, ci->func.p + i, func + i);
       func = ci->func.p;  /* moved-down function */
@@ -570,13 +577,15 @@ int luaD_pretailcall (lua_State *L, CallInfo *ci, StkId func,
       ci->top.p = func + 1 + fsize;  /* top for new function */
       lua_assert(ci->top.p <= L->stack_last.p);
       ci->u.l.savedpc = p->code;  /* starting point */
+      ci->u.l.shift = 0;
       ci->callstatus |= CIST_TAIL;
+      L->budget--;  /* charge the call; 'luaV_execute' checks it */
       L->top.p = func + narg1;  /* set top */
       return -1;
     }
     default: {  /* not a function */
       func = tryfuncTM(L, func);  /* try to get '__call' metamethod */
-      /* return luaD_pretailcall(L, ci, func, narg1 + 1, delta); */
+      /* return luaD_pretailcall(L, ci, func, narg1 + 1); */
       narg1++;
       goto retry;  /* try again */
     }
@@ -599,17 +608,23 @@ CallInfo *luaD_precall (lua_State *L, StkId func, int nresults) {
       precallC(L, func, nresults, clCvalue(s2v(func))->f);
       return NULL;
     case LUA_VLCF:  /* light C function */
+    case LUA_VLEAF:  /* leaf C function */
       precallC(L, func, nresults, fvalue(s2v(func)));
       return NULL;
     case LUA_VLCL: {  /* Lua function */
       CallInfo *ci;
       Proto *p = clLvalue(s2v(func))->p;
-      int narg = cast_int(L->top.p - func) - 1;  /* number of real arguments */
-      int nfixparams = p->numparams;
-      int fsize = p->maxstacksize;  /* frame size */
+      int narg, nfixparams, fsize;
+      if (l_unlikely(p->lazy))  /* body not compiled yet? */
+        func = compilecall(L, func, p);
+      narg = cast_int(L->top.p - func) - 1;  /* number of real arguments */
+      nfixparams = p->numparams;
+      fsize = p->maxstacksize;  /* frame size */
       checkstackGCp(L, fsize, func);
       L->ci = ci = prepCallInfo(L, func, nresults, 0, func + 1 + fsize);
       ci->u.l.savedpc = p->code;  /* starting point */
+      ci->u.l.shift = 0;
+      L->budget--;  /* charge the call; 'luaV_execute' checks it */
       for (; narg < nfixparams; narg++)
         setnilvalue(s2v(L->top.p++));  /* complete missing arguments */
       lua_assert(ci->top.p <= L->stack_last.p);
@@ -714,6 +729,7 @@ static int finishpcallk (lua_State *L,  CallInfo *ci) {
 */
 static void finishCcall (lua_State *L, CallInfo *ci) {
   int n;  /* actual number of results from C function */
+  ci->callstatus &= ~CIST_DIRECT;  /* continuing from here, not 'callC' */
   if (ci->callstatus & CIST_CLSRET) {  /* was returning? */
     lua_assert(hastocloseCfunc(ci->nresults));
     n = ci->u2.nres;  /* just redo 'luaD_poscall' */
@@ -743,7 +759,8 @@ static void finishCcall (lua_State *L, CallInfo *ci) {
 static void unroll (lua_State *L, void *ud) {
   CallInfo *ci;
   UNUSED(ud);
-  while ((ci = L->ci) != &L->base_ci) {  /* something in the stack */
+  while ((ci = L->ci) != &L->base_ci &&  /* something in the stack */
+         L->status == LUA_OK) {  /* and not yielded in place? */
     if (!isLua(ci))  /* C function? */
       finishCcall(L, ci);  /* complete its execution */
     else {  /* Lua function */
@@ -798,15 +815,15 @@ static void resume (lua_State *L, void *ud) {
   else {  /* resuming from previous yield */
     lua_assert(L->status == LUA_YIELD);
     L->status = LUA_OK;  /* mark that it is running (again) */
-    if (isLua(ci)) {  /* yielded inside a hook? */
-      /* undo increment made by 'luaG_traceexec': instruction was not
-         executed yet */
-      lua_assert(ci->callstatus & CIST_HOOKYIELD);
+    if (isLua(ci)) {  /* yielded inside a hook or by its quota? */
+      /* undo increment made by 'luaG_traceexec' or 'luaG_quota':
+         instruction was not executed yet */
       ci->u.l.savedpc--;
       L->top.p = firstArg;  /* discard arguments */
       luaV_execute(L, ci);  /* just continue running Lua code */
     }
     else {  /* 'common' yield */
+      ci->callstatus &= ~CIST_DIRECT;  /* continuing from here */
       if (ci->u.c.k != NULL) {  /* does it have a continuation function? */
         lua_unlock(L);
         n = (*ci->u.c.k)(L, LUA_YIELD, ci->u.c.ctx); /* call continuation */
@@ -861,7 +878,7 @@ LUA_API int lua_resume (lua_State *L, lua_State *from, int nargs,
    /* continue running after recoverable errors */
   status = precover(L, status);
   if (l_likely(!errorstatus(status)))
-    lua_assert(status == L->status);  /* normal end or yield */
+    status = L->status;  /* normal end or yield (maybe without a throw) */
   else {  /* unrecoverable error */
     L->status = cast_byte(status);  /* mark thread as 'dead' */
     luaD_seterrorobj(L, status, L->top.p);  /* push error message */
@@ -879,6 +896,24 @@ LUA_API int lua_isyieldable (lua_State *L) {
 }
 
 
+/*
+** A yield from a C function called by 'luaV_execute' itself, with only
+** Lua functions run by that same 'luaV_execute' below it, can return
+** through the C stack instead of throwing: that 'luaV_execute' was
+** called by 'resume' or 'unroll', which stop when they see the yield.
+** (Any other Lua function called from C starts a "fresh" frame.)
+*/
+static int inplaceyield (lua_State *L, CallInfo *ci) {
+  if (!(ci->callstatus & CIST_DIRECT))
+    return 0;
+  for (ci = ci->previous; ci->previous != &L->base_ci; ci = ci->previous) {
+    if (!isLua(ci) || (ci->callstatus & CIST_FRESH))
+      return 0;
+  }
+  return isLua(ci);
+}
+
+
 LUA_API int lua_yieldk (lua_State *L, int nresults, lua_KContext ctx,
                         lua_KFunction k) {
   CallInfo *ci;
@@ -902,6 +937,11 @@ LUA_API int lua_yieldk (lua_State *L, int nresults, lua_KContext ctx,
   else {
     if ((ci->u.c.k = k) != NULL)  /* is there a continuation? */
       ci->u.c.ctx = ctx;  /* save context */
+    if (inplaceyield(L, ci)) {
+      ci->previous->u.l.trap = 1;  /* 'luaV_execute' will see the yield */
+      lua_unlock(L);
+      return 0;  /* back to 'callC' */
+    }
     luaD_throw(L, LUA_YIELD);
   }
   lua_assert(ci->callstatus & CIST_HOOKED);  /* must be inside a hook */
@@ -978,15 +1018,35 @@ int luaD_pcall (lua_State *L, Pfunc func, void *u,
 /*
 ** Execute a protected parser.
 */
-struct SParser {  /* data to 'f_parser' */
+struct SParser {  /* data to 'f_parser' and 'f_compile' */
   ZIO *z;
   Mbuffer buff;  /* dynamic structure used by the scanner */
   Dyndata dyd;  /* dynamic structures used by the parser */
   const char *mode;
   const char *name;
+  Proto *f;  /* function to compile */
 };
 
 
+static void initparser (lua_State *L, struct SParser *p) {
+  UNUSED(L);
+  p->dyd.actvar.arr = NULL; p->dyd.actvar.size = 0;
+  p->dyd.gt.arr = NULL; p->dyd.gt.size = 0;
+  p->dyd.label.arr = NULL; p->dyd.label.size = 0;
+  luaZ_initbuffer(L, &p->dyd.body);
+  luaZ_initbuffer(L, &p->buff);
+}
+
+
+static void freeparser (lua_State *L, struct SParser *p) {
+  luaZ_freebuffer(L, &p->buff);
+  luaZ_freebuffer(L, &p->dyd.body);
+  luaM_freearray(L, p->dyd.actvar.arr, p->dyd.actvar.size);
+  luaM_freearray(L, p->dyd.gt.arr, p->dyd.gt.size);
+  luaM_freearray(L, p->dyd.label.arr, p->dyd.label.size);
+}
+
+
 static void checkmode (lua_State *L, const char *mode, const char *x) {
   if (mode && strchr(mode, x[0]) == NULL) {
     luaO_pushfstring(L,
@@ -1004,6 +1064,10 @@ static void f_parser (lua_State *L, void *ud) {
     checkmode(L, p->mode, "binary");
     cl = luaU_undump(L, p->z, p->name);
   }
+  else if (p->mode && strchr(p->mode, 'd')) {  /* data chunk? */
+    luaY_data(L, p->z, &p->buff, &p->dyd, p->name, c);
+    return;  /* leave its value */
+  }
   else {
     checkmode(L, p->mode, "text");
     cl = luaY_parser(L, p->z, &p->buff, &p->dyd, p->name, c);
@@ -1019,17 +1083,38 @@ int luaD_protectedparser (lua_State *L, ZIO *z, const char *name,
   int status;
   incnny(L);  /* cannot yield during parsing */
   p.z = z; p.name = name; p.mode = mode;
-  p.dyd.actvar.arr = NULL; p.dyd.actvar.size = 0;
-  p.dyd.gt.arr = NULL; p.dyd.gt.size = 0;
-  p.dyd.label.arr = NULL; p.dyd.label.size = 0;
-  luaZ_initbuffer(L, &p.buff);
+  initparser(L, &p);
   status = luaD_pcall(L, f_parser, &p, savestack(L, L->top.p), L->errfunc);
-  luaZ_freebuffer(L, &p.buff);
-  luaM_freearray(L, p.dyd.actvar.arr, p.dyd.actvar.size);
-  luaM_freearray(L, p.dyd.gt.arr, p.dyd.gt.size);
-  luaM_freearray(L, p.dyd.label.arr, p.dyd.label.size);
+  freeparser(L, &p);
   decnny(L);
   return status;
 }
 
 
+static void f_compile (lua_State *L, void *ud) {
+  struct SParser *p = cast(struct SParser *, ud);
+  luaY_compile(L, &p->buff, &p->dyd, p->f);
+}
+
+
+/*
+** Compile the body of 'f', put off when its chunk was loaded. An error
+** in it is raised as any other error in a call to the function.
+*/
+void luaD_compile (lua_State *L, Proto *f) {
+  struct SParser p;
+  int status;
+  incnny(L);  /* cannot yield during parsing */
+  p.f = f;
+  initparser(L, &p);
+  status = luaD_pcall(L, f_compile, &p, savestack(L, L->top.p), L->errfunc);
+  freeparser(L, &p);
+  decnny(L);
+  if (l_unlikely(status != LUA_OK)) {
+    if (status == LUA_ERRSYNTAX)
+      luaG_errormsg(L);
+    luaD_throw(L, status);
+  }
+}
+
+
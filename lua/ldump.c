@@ -15,8 +15,11 @@
 
 #include "lua.h"
 
+#include "ldo.h"
+#include "lgc.h"
 #include "lobject.h"
 #include "lstate.h"
+#include "ltable.h"
 #include "lundump.h"
 
 
@@ -26,6 +29,7 @@ typedef struct {
   void *data;
   int strip;
   int status;
+  size_t offset;  /* bytes dumped so far */
 } DumpState;
 
 
@@ -38,12 +42,26 @@ typedef struct {
 #define dumpLiteral(D, s)	dumpBlock(D,s,sizeof(s) - sizeof(char))
 
 
+/* (with no writer, only counts what would be dumped; see 'debugsize') */
 static void dumpBlock (DumpState *D, const void *b, size_t size) {
-  if (D->status == 0 && size > 0) {
+  if (D->status == 0 && size > 0 && D->writer != NULL) {
     lua_unlock(D->L);
     D->status = (*D->writer)(D->L, b, size, D->data);
     lua_lock(D->L);
   }
+  D->offset += size;
+}
+
+
+/*
+** Pad the dump with zeros up to a multiple of 'align' from its start,
+** so that the arrays that follow can be used in place by a loader
+** reading the chunk from a block as aligned (see 'loadInPlace').
+*/
+static void dumpAlign (DumpState *D, size_t align) {
+  static const char zeros[sizeof(Instruction)] = {0};
+  lua_assert(align <= sizeof(zeros));
+  dumpBlock(D, zeros, (align - D->offset % align) % align);
 }
 
 
@@ -103,35 +121,76 @@ static void dumpString (DumpState *D, const TString *s) {
 
 static void dumpCode (DumpState *D, const Proto *f) {
   dumpInt(D, f->sizecode);
+  dumpAlign(D, sizeof(Instruction));
   dumpVector(D, f->code, f->sizecode);
 }
 
 
 static void dumpFunction(DumpState *D, const Proto *f, TString *psource);
 
+static void dumpConstant (DumpState *D, const TValue *o);
+
+
+/*
+** A table constant (the cases of an OP_SWITCH) goes as its number of
+** entries followed by the key and the value of each one.
+*/
+static void dumpTable (DumpState *D, Table *t) {
+  unsigned int i, asize = luaH_realasize(t);
+  int n = 0;
+  TValue k;
+  for (i = 0; i < asize; i++)
+    n += !isempty(&t->array[i]);
+  for (i = 0; i < cast_uint(sizenode(t)); i++)
+    n += !isempty(gval(gnode(t, i)));
+  dumpInt(D, n);
+  for (i = 0; i < asize; i++) {
+    if (!isempty(&t->array[i])) {
+      setivalue(&k, cast(lua_Integer, i) + 1);
+      dumpConstant(D, &k);
+      dumpConstant(D, &t->array[i]);
+    }
+  }
+  for (i = 0; i < cast_uint(sizenode(t)); i++) {
+    Node *node = gnode(t, i);
+    if (!isempty(gval(node))) {
+      getnodekey(D->L, &k, node);
+      dumpConstant(D, &k);
+      dumpConstant(D, gval(node));
+    }
+  }
+}
+
+
+static void dumpConstant (DumpState *D, const TValue *o) {
+  int tt = ttypetag(o);
+  dumpByte(D, tt);
+  switch (tt) {
+    case LUA_VNUMFLT:
+      dumpNumber(D, fltvalue(o));
+      break;
+    case LUA_VNUMINT:
+      dumpInteger(D, ivalue(o));
+      break;
+    case LUA_VSHRSTR:
+    case LUA_VLNGSTR:
+      dumpString(D, tsvalue(o));
+      break;
+    case LUA_VTABLE:
+      dumpTable(D, hvalue(o));
+      break;
+    default:
+      lua_assert(tt == LUA_VNIL || tt == LUA_VFALSE || tt == LUA_VTRUE);
+  }
+}
+
+
 static void dumpConstants (DumpState *D, const Proto *f) {
   int i;
   int n = f->sizek;
   dumpInt(D, n);
-  for (i = 0; i < n; i++) {
-    const TValue *o = &f->k[i];
-    int tt = ttypetag(o);
-    dumpByte(D, tt);
-    switch (tt) {
-      case LUA_VNUMFLT:
-        dumpNumber(D, fltvalue(o));
-        break;
-      case LUA_VNUMINT:
-        dumpInteger(D, ivalue(o));
-        break;
-      case LUA_VSHRSTR:
-      case LUA_VLNGSTR:
-        dumpString(D, tsvalue(o));
-        break;
-      default:
-        lua_assert(tt == LUA_VNIL || tt == LUA_VFALSE || tt == LUA_VTRUE);
-    }
-  }
+  for (i = 0; i < n; i++)
+    dumpConstant(D, &f->k[i]);
 }
 
 
@@ -162,10 +221,8 @@ static void dumpDebug (DumpState *D, const Proto *f) {
   dumpVector(D, f->lineinfo, n);
   n = (D->strip) ? 0 : f->sizeabslineinfo;
   dumpInt(D, n);
-  for (i = 0; i < n; i++) {
-    dumpInt(D, f->abslineinfo[i].pc);
-    dumpInt(D, f->abslineinfo[i].line);
-  }
+  dumpAlign(D, sizeof(int));
+  dumpVector(D, f->abslineinfo, n);
   n = (D->strip) ? 0 : f->sizelocvars;
   dumpInt(D, n);
   for (i = 0; i < n; i++) {
@@ -180,7 +237,45 @@ static void dumpDebug (DumpState *D, const Proto *f) {
 }
 
 
+/*
+** Size of the debug information of 'f' as 'dumpDebug' dumps it from an
+** offset aligned to an int, found by dumping it without a writer.
+*/
+static size_t debugsize (DumpState *D, const Proto *f) {
+  lua_Writer w = D->writer;
+  size_t offset = D->offset;
+  size_t size;
+  D->writer = NULL;
+  D->offset = 0;
+  dumpDebug(D, f);
+  size = D->offset;
+  D->writer = w;
+  D->offset = offset;
+  return size;
+}
+
+
+/*
+** Dump the debug information of 'f' and of the functions nested in it,
+** in the order of their prototypes, each from an offset aligned to an
+** int. It goes after all the prototypes, so that a loader reading the
+** chunk in place can leave it alone until it is needed (see
+** 'loadDebugs'); each prototype gives the size of its part.
+*/
+static void dumpDebugs (DumpState *D, const Proto *f) {
+  int i;
+  dumpAlign(D, sizeof(int));
+  dumpDebug(D, f);
+  for (i = 0; i < f->sizep; i++)
+    dumpDebugs(D, f->p[i]);
+}
+
+
 static void dumpFunction (DumpState *D, const Proto *f, TString *psource) {
+  if (f->lazy)  /* body not compiled yet? */
+    luaD_compile(D->L, cast(Proto *, f));
+  if (!D->strip)  /* debug information still in its image? */
+    luaU_checkdebug(D->L, cast(Proto *, f));
   if (D->strip || f->source == psource)
     dumpString(D, NULL);  /* no debug info or same source as its parent */
   else
@@ -194,7 +289,7 @@ static void dumpFunction (DumpState *D, const Proto *f, TString *psource) {
   dumpConstants(D, f);
   dumpUpvalues(D, f);
   dumpProtos(D, f);
-  dumpDebug(D, f);
+  dumpSize(D, debugsize(D, f));
 }
 
 
@@ -222,9 +317,11 @@ int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
   D.data = data;
   D.strip = strip;
   D.status = 0;
+  D.offset = 0;
   dumpHeader(&D);
   dumpByte(&D, f->sizeupvalues);
   dumpFunction(&D, f, NULL);
+  dumpDebugs(&D, f);
   return D.status;
 }
 
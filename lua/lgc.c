@@ -105,6 +105,8 @@
 #define markobjectN(g,t)	{ if (t) markobject(g,t); }
 
 static void reallymarkobject (global_State *g, GCObject *o);
+static void ephkeymarked (global_State *g, GCObject *o);
+static int ephwatch (global_State *g, GCObject *k, TValue *v);
 static lu_mem atomic (lua_State *L);
 static void entersweep (lua_State *L);
 
@@ -295,6 +297,8 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
 ** (only closures can), and a userdata's metatable must be a table.
 */
 static void reallymarkobject (global_State *g, GCObject *o) {
+  if (l_unlikely(testbit(o->marked, EPHKEYBIT)))
+    ephkeymarked(g, o);
   switch (o->tt) {
     case LUA_VSHRSTR:
     case LUA_VLNGSTR: {
@@ -472,7 +476,8 @@ static void traverseweakvalue (global_State *g, Table *h) {
 ** in 'grayagain' list, to be visited again in the atomic phase. In
 ** the atomic phase, if table has any white->white entry, it has to
 ** be revisited during ephemeron convergence (as that key may turn
-** black). Otherwise, if it has any white key, table has to be cleared
+** black), unless 'convergebyworklist' is running and takes those
+** entries. Otherwise, if it has any white key, table has to be cleared
 ** (in the atomic phase). In generational mode, some tables
 ** must be kept in some gray list for post-processing; this is done
 ** by 'genlink'.
@@ -499,7 +504,8 @@ static int traverseephemeron (global_State *g, Table *h, int inv) {
       clearkey(n);  /* clear its key */
     else if (iscleared(g, gckeyN(n))) {  /* key is not marked (yet)? */
       hasclears = 1;  /* table must be cleared */
-      if (valiswhite(gval(n)))  /* value not marked yet? */
+      if (valiswhite(gval(n)) &&  /* value not marked yet? */
+          !(g->ephwork != NULL && ephwatch(g, gckeyN(n), gval(n))))
         hasww = 1;  /* white-white entry */
     }
     else if (valiswhite(gval(n))) {  /* value not marked yet? */
@@ -580,6 +586,8 @@ static int traverseudata (global_State *g, Udata *u) {
 static int traverseproto (global_State *g, Proto *f) {
   int i;
   markobjectN(g, f->source);
+  markobjectN(g, f->body);
+  markobjectN(g, f->image);
   for (i = 0; i < f->sizek; i++)  /* mark literals */
     markvalue(g, &f->k[i]);
   for (i = 0; i < f->sizeupvalues; i++)  /* mark upvalue names */
@@ -680,33 +688,246 @@ static lu_mem propagateall (global_State *g) {
   return tot;
 }
 
+/* }====================================================== */
+
 
 /*
-** Traverse all ephemeron tables propagating marks from keys to values.
-** Repeat until it converges, that is, nothing new is marked. 'dir'
-** inverts the direction of the traversals, trying to speed up
-** convergence on chains in the same table.
-**
+** {======================================================
+** Ephemeron convergence
+** =======================================================
 */
-static void convergeephemerons (global_State *g) {
-  int changed;
-  int dir = 0;
-  do {
-    GCObject *w;
-    GCObject *next = g->ephemeron;  /* get ephemeron list */
-    g->ephemeron = NULL;  /* tables may return to this list when traversed */
-    changed = 0;
-    while ((w = next) != NULL) {  /* for each ephemeron table */
-      Table *h = gco2t(w);
-      next = h->gclist;  /* list is rebuilt during loop */
-      nw2black(h);  /* out of the list (for now) */
-      if (traverseephemeron(g, h, dir)) {  /* marked some value? */
-        propagateall(g);  /* propagate changes */
-        changed = 1;  /* will have to revisit all ephemeron tables */
+
+/*
+** An entry of an ephemeron table whose key and value are still white.
+** Entries are chained by key in a hash, so that when a key is marked
+** all its entries can be found without traversing their tables again.
+*/
+typedef struct EphEntry {
+  GCObject *key;
+  TValue *val;
+  int next;  /* next entry with the same key (-1 if none) */
+} EphEntry;
+
+
+typedef struct EphWork {
+  EphEntry *entries;
+  GCObject **marked;  /* stack of watched keys marked meanwhile */
+  int *slots;  /* hash of keys, giving their first entries (-1 if free) */
+  unsigned int nslots;  /* size of 'slots' (a power of 2) */
+  int size;  /* size of 'entries' and 'marked' */
+  int nentries;
+  int nmarked;
+} EphWork;
+
+
+#define ephslot(w,k)  \
+	(((point2uint(k) >> 3) * 2654435761u) & ((w)->nslots - 1))
+
+
+/*
+** Called by 'reallymarkobject' when it marks a key being watched:
+** stop watching it and remember to revisit its entries.
+*/
+static void ephkeymarked (global_State *g, GCObject *o) {
+  EphWork *w = g->ephwork;
+  resetbit(o->marked, EPHKEYBIT);
+  lua_assert(w != NULL && w->nmarked < w->nentries);
+  w->marked[w->nmarked++] = o;
+}
+
+
+/* find the slot of key 'k' in the hash, or the free slot for it */
+static unsigned int ephfind (EphWork *w, GCObject *k) {
+  unsigned int s = ephslot(w, k);
+  while (w->slots[s] != -1 && w->entries[w->slots[s]].key != k)
+    s = (s + 1) & (w->nslots - 1);
+  return s;
+}
+
+
+/* chain entry 'i' to the others with its key */
+static void ephchain (EphWork *w, int i) {
+  unsigned int s = ephfind(w, w->entries[i].key);
+  w->entries[i].next = w->slots[s];
+  w->slots[s] = i;
+}
+
+
+static void ephfree (global_State *g, EphWork *w) {
+  if (w->size > 0) {
+    (*g->frealloc)(g->ud, w->entries,
+                   w->size * (sizeof(EphEntry) + sizeof(GCObject *)), 0);
+    (*g->frealloc)(g->ud, w->slots, w->nslots * sizeof(int), 0);
+  }
+}
+
+
+/*
+** Resize the work area to hold 'size' entries, with a hash at most
+** half full. The collector can neither raise errors nor collect here,
+** so it uses the allocator directly. Returns false if out of memory,
+** leaving the work area as it was.
+*/
+static int ephresize (global_State *g, EphWork *w, int size) {
+  size_t esize = sizeof(EphEntry) + sizeof(GCObject *);
+  unsigned int nslots = 4;
+  char *b;
+  int *s;
+  int i;
+  if (size >= MAX_INT / 4)
+    return 0;
+  while (nslots < 2 * cast_uint(size))
+    nslots <<= 1;
+  b = cast_charp((*g->frealloc)(g->ud, NULL, 0, size * esize));
+  if (b == NULL)
+    return 0;
+  s = cast(int *, (*g->frealloc)(g->ud, NULL, 0, nslots * sizeof(int)));
+  if (s == NULL) {
+    (*g->frealloc)(g->ud, b, size * esize, 0);
+    return 0;
+  }
+  if (w->size > 0) {
+    memcpy(b, w->entries, w->nentries * sizeof(EphEntry));
+    memcpy(b + size * sizeof(EphEntry), w->marked,
+           w->nmarked * sizeof(GCObject *));
+    ephfree(g, w);
+  }
+  w->entries = cast(EphEntry *, b);
+  w->marked = cast(GCObject **, b + size * sizeof(EphEntry));
+  w->size = size;
+  w->slots = s;
+  w->nslots = nslots;
+  for (i = 0; i < cast_int(nslots); i++)
+    s[i] = -1;
+  for (i = 0; i < w->nentries; i++)
+    ephchain(w, i);
+  return 1;
+}
+
+
+/*
+** Add to the work the entry with white key 'k' and white value 'v',
+** watching its key. Called also by 'traverseephemeron' for the tables
+** first reached while the work goes on. Returns false if the work area
+** cannot grow.
+*/
+static int ephwatch (global_State *g, GCObject *k, TValue *v) {
+  EphWork *w = g->ephwork;
+  int i = w->nentries;
+  if (i == w->size && !ephresize(g, w, 2 * w->size))
+    return 0;
+  w->entries[i].key = k;
+  w->entries[i].val = v;
+  w->nentries++;
+  l_setbit(k->marked, EPHKEYBIT);
+  ephchain(w, i);
+  return 1;
+}
+
+
+/*
+** Traverse once all tables in the ephemeron list, which is rebuilt
+** with the tables that still have white->white entries. Returns true
+** if something was marked.
+*/
+static int ephemeronpass (global_State *g, int dir) {
+  int changed = 0;
+  GCObject *w;
+  GCObject *next = g->ephemeron;  /* get ephemeron list */
+  g->ephemeron = NULL;  /* tables may return to this list when traversed */
+  while ((w = next) != NULL) {  /* for each ephemeron table */
+    Table *h = gco2t(w);
+    next = h->gclist;  /* list is rebuilt during loop */
+    nw2black(h);  /* out of the list (for now) */
+    if (traverseephemeron(g, h, dir)) {  /* marked some value? */
+      propagateall(g);  /* propagate changes */
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+/*
+** Watch the white keys of the entries with white values in the tables
+** in the ephemeron list, and mark the values of the others. Then
+** propagate; every watched key marked in that process brings in the
+** values of its entries, and every ephemeron table reached adds its
+** own entries with white keys, until no more keys are marked. Each
+** entry is visited a bounded number of times, however long the chains
+** of keys and values and however many tables they go through. Returns
+** false if it could not allocate the work area.
+*/
+static int convergebyworklist (global_State *g) {
+  EphWork w;
+  GCObject *l;
+  size_t n = 0;
+  int i;
+  for (l = g->ephemeron; l != NULL; l = gco2t(l)->gclist) {
+    Table *h = gco2t(l);
+    Node *node, *limit = gnodelast(h);
+    for (node = gnode(h, 0); node < limit; node++)
+      if (!isempty(gval(node)) && valiswhite(gval(node)))
+        n++;
+  }
+  w.entries = NULL;
+  w.marked = NULL;
+  w.slots = NULL;
+  w.nslots = 0;
+  w.size = w.nentries = w.nmarked = 0;
+  if (n >= cast_sizet(MAX_INT / 4) ||
+      !ephresize(g, &w, (n < 4) ? 4 : cast_int(n)))
+    return 0;  /* use the simple method */
+  g->ephwork = &w;
+  for (l = g->ephemeron; l != NULL; l = gco2t(l)->gclist) {
+    Table *h = gco2t(l);
+    Node *node, *limit = gnodelast(h);
+    for (node = gnode(h, 0); node < limit; node++) {
+      if (!isempty(gval(node)) && valiswhite(gval(node))) {
+        if (iscleared(g, gckeyN(node)))  /* key not marked (yet)? */
+          ephwatch(g, gckeyN(node), gval(node));  /* has room for it */
+        else
+          markvalue(g, gval(node));
       }
     }
-    dir = !dir;  /* invert direction next time */
-  } while (changed);  /* repeat until no more changes */
+  }
+  for (;;) {
+    propagateall(g);
+    if (w.nmarked == 0)
+      break;
+    i = w.slots[ephfind(&w, w.marked[--w.nmarked])];
+    for (; i != -1; i = w.entries[i].next)
+      markvalue(g, w.entries[i].val);
+  }
+  g->ephwork = NULL;
+  for (i = 0; i < w.nentries; i++)  /* stop watching unmarked keys */
+    resetbit(w.entries[i].key->marked, EPHKEYBIT);
+  ephfree(g, &w);
+  return 1;
+}
+
+
+/*
+** Traverse all ephemeron tables propagating marks from keys to values,
+** until it converges, that is, nothing new is marked. After a first
+** pass over all tables, white->white entries that remain are handled
+** by 'convergebyworklist'; a pass then moves each table to its proper
+** list. Only tables that did not fit in the worklist, for lack of
+** memory, can still mark something in that pass. Without memory for
+** the worklist, repeat passes until nothing changes; 'dir' inverts the
+** direction of the traversals, trying to speed up convergence on chains
+** in the same table.
+*/
+static void convergeephemerons (global_State *g) {
+  int dir = 0;
+  int changed = ephemeronpass(g, dir);
+  while (changed && g->ephemeron != NULL) {
+    if (convergebyworklist(g))
+      dir = 0;
+    else
+      dir = !dir;
+    changed = ephemeronpass(g, dir);
+  }
 }
 
 /* }====================================================== */
@@ -879,6 +1100,17 @@ static void checkSizes (lua_State *L, global_State *g) {
 }
 
 
+/*
+** After a major collection, when garbage is gone, let the allocator
+** release its free memory beyond 'g->gctrim' bytes.
+** (Not in emergencies: the memory is probably needed right away.)
+*/
+static void trimheap (global_State *g) {
+  if (g->trimf != NULL && !g->gcemergency)
+    g->released += (*g->trimf)(g->ud, cast_sizet(g->gctrim));
+}
+
+
 /*
 ** Get the next udata to be finalized from the 'tobefnz' list, and
 ** link it back into the 'allgc' list.
@@ -1307,6 +1539,7 @@ static void atomic2gen (lua_State *L, global_State *g) {
   g->gckind = KGC_GEN;
   g->lastatomic = 0;
   g->GCestimate = gettotalbytes(g);  /* base for memory control */
+  trimheap(g);
   finishgencycle(L, g);
 }
 
@@ -1623,6 +1856,7 @@ static lu_mem singlestep (lua_State *L) {
     }
     case GCSswpend: {  /* finish sweeps */
       checkSizes(L, g);
+      trimheap(g);
       g->gcstate = GCScallfin;
       work = 0;
       break;
@@ -70,7 +70,8 @@
 /*
 ** Layout for bit use in 'marked' field. First three bits are
 ** used for object "age" in generational mode. Last bit is used
-** by tests.
+** by tests and, during ephemeron convergence, to flag keys whose
+** marking must be noticed (see 'convergeephemerons').
 */
 #define WHITE0BIT	3  /* object is white (type 0) */
 #define WHITE1BIT	4  /* object is white (type 1) */
@@ -78,6 +79,7 @@
 #define FINALIZEDBIT	6  /* object has been marked for finalization */
 
 #define TESTBIT		7
+#define EPHKEYBIT	TESTBIT
 
 
 
@@ -140,6 +142,9 @@
 /* how much to allocate before next GC step (log2) */
 #define LUAI_GCSTEPSIZE 13      /* 8 KB */
 
+/* free memory the allocator may keep after a major collection */
+#define LUAI_GCTRIM	(1024 * 1024)	/* 1 MB */
+
 
 /*
 ** Check whether the declared GC mode is generational. While in
@@ -197,6 +202,7 @@ LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt);
 LUAI_FUNC void luaC_changemode (lua_State *L, int newmode);
+LUAI_FUNC int luaC_snapshot (lua_State *L, lua_Writer w, void *data);
 
 
 #endif
@@ -107,6 +107,8 @@ static const void *const disptab[NUM_OPCODES] = {
 &&L_OP_CLOSURE,
 &&L_OP_VARARG,
 &&L_OP_VARARGPREP,
+&&L_OP_SELECT,
+&&L_OP_SWITCH,
 &&L_OP_EXTRAARG
 
 };
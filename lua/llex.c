@@ -96,10 +96,34 @@ const char *luaX_token2str (LexState *ls, int token) {
 }
 
 
+/*
+** Skip a line break at 'p' (any of \n, \r, \n\r, or \r\n), if there
+** is one; 'p[1]' must be readable.
+*/
+static const char *skipbreak (const char *p) {
+  if (*p == '\n' || *p == '\r')
+    p += (p[1] != *p && (p[1] == '\n' || p[1] == '\r')) ? 2 : 1;
+  return p;
+}
+
+
 static const char *txtToken (LexState *ls, int token) {
   switch (token) {
     case TK_NAME: case TK_STRING:
     case TK_FLT: case TK_INT:
+      if (ls->tok != NULL) {  /* token read in place? */
+        const char *t = ls->tok;
+        const char *e = t + ls->tokl;
+        ls->tok = NULL;
+        luaZ_resetbuffer(ls->buff);
+        if (*t == '[') {  /* long string? */
+          do save(ls, *t++); while (*t == '=');
+          save(ls, *t++);
+          t = skipbreak(t);  /* not kept, as in 'read_long_string' */
+        }
+        while (t < e)
+          save(ls, *t++);
+      }
       save(ls, '\0');
       return luaO_pushfstring(ls->L, "'%s'", luaZ_buffer(ls->buff));
     default:
@@ -175,7 +199,11 @@ void luaX_setinput (lua_State *L, LexState *ls, ZIO *z, TString *source,
   ls->linenumber = 1;
   ls->lastline = 1;
   ls->source = source;
+  ls->tok = NULL;
   ls->envn = luaS_newliteral(L, LUA_ENV);  /* get env name */
+  ls->inlinecode = G(L)->inlinecode;
+  ls->optcode = G(L)->optcode;
+  ls->lazycode = G(L)->lazycode;
   luaZ_resizebuffer(ls->L, ls->buff, LUA_MINBUFFER);  /* initialize buffer */
 }
 
@@ -442,8 +470,252 @@ static void read_string (LexState *ls, int del, SemInfo *seminfo) {
 }
 
 
+/*
+** {======================================================
+** In-place scanning: tokens that end inside the block the reader
+** gave are read directly from it, without copying them to 'buff'.
+** Each function below returns 0, having consumed nothing, when its
+** token runs past the block or needs the careful path (escapes, '\r'
+** line breaks, errors), which then reads it as usual. 'current' is
+** always the character before 'z->p', in the block.
+** =======================================================
+*/
+
+#define zcurrent(ls)	((ls)->z->p - 1)
+#define zend(ls)	((ls)->z->p + (ls)->z->n)
+
+
+/*
+** Move on to the character at 'q', which may be the end of the block.
+*/
+static void skipto (LexState *ls, const char *q) {
+  ZIO *z = ls->z;
+  lua_assert(z->p <= q && q <= zend(ls));
+  z->n -= cast_sizet(q - z->p);
+  z->p = q;
+  next(ls);
+}
+
+
+/*
+** Keep the text of a token read in place for error messages.
+*/
+static void settok (LexState *ls, const char *s, const char *e) {
+  ls->tok = s;
+  ls->tokl = cast_sizet(e - s);
+}
+
+
+static void skipspaces (LexState *ls) {
+  const char *q = zcurrent(ls) + 1;
+  const char *e = zend(ls);
+  while (q < e && (*q == ' ' || *q == '\t'))
+    q++;
+  skipto(ls, q);
+}
+
+
+/*
+** Skip the rest of a line, block by block.
+*/
+static void skipline (LexState *ls) {
+  while (!currIsNewline(ls) && ls->current != EOZ) {
+    const char *s = zcurrent(ls);
+    const char *e = zend(ls);
+    const char *q = cast(const char *, memchr(s, '\n', e - s));
+    const char *r = cast(const char *, memchr(s, '\r', (q ? q : e) - s));
+    skipto(ls, r ? r : q ? q : e);
+  }
+}
+
+
+/*
+** Reserved word with text 's' of length 'l', or 0; it must agree
+** with 'luaX_tokens'. Knowing them here saves creating their strings.
+*/
+static int reserved (const char *s, size_t l) {
+#define word(w,t)  if (l == sizeof(w) - 1 && memcmp(s, w, l) == 0) return t
+  switch (*s) {
+    case 'a': word("and", TK_AND); break;
+    case 'b': word("break", TK_BREAK); break;
+    case 'd': word("do", TK_DO); break;
+    case 'e':
+      word("end", TK_END); word("else", TK_ELSE); word("elseif", TK_ELSEIF);
+      break;
+    case 'f':
+      word("function", TK_FUNCTION); word("false", TK_FALSE);
+      word("for", TK_FOR);
+      break;
+    case 'g': word("goto", TK_GOTO); break;
+    case 'i': word("if", TK_IF); word("in", TK_IN); break;
+    case 'l': word("local", TK_LOCAL); break;
+    case 'n': word("nil", TK_NIL); word("not", TK_NOT); break;
+    case 'o': word("or", TK_OR); break;
+    case 'r': word("return", TK_RETURN); word("repeat", TK_REPEAT); break;
+    case 't': word("then", TK_THEN); word("true", TK_TRUE); break;
+    case 'u': word("until", TK_UNTIL); break;
+    case 'w': word("while", TK_WHILE); break;
+  }
+  return 0;
+#undef word
+}
+
+
+static int inplacename (LexState *ls, SemInfo *seminfo) {
+  const char *s = zcurrent(ls);
+  const char *e = zend(ls);
+  const char *q = s + 1;
+  int t;
+  while (q < e && lislalnum(cast_uchar(*q)))
+    q++;
+  if (q == e)  /* may go on in the next block? */
+    return 0;
+  t = reserved(s, q - s);
+  if (t == 0) {
+    seminfo->ts = luaX_newstring(ls, s, q - s);
+    t = TK_NAME;
+  }
+  settok(ls, s, q);
+  skipto(ls, q);
+  return t;
+}
+
+
+/*
+** Same pattern as 'read_numeral', for numerals starting with a digit.
+*/
+static int inplacenumeral (LexState *ls, SemInfo *seminfo) {
+  const char *s = zcurrent(ls);
+  const char *e = zend(ls);
+  const char *q = s + 1;
+  const char *expo = "Ee";
+  char buff[LUAI_MAXSHORTLEN + 1];
+  TValue obj;
+  if (*s == '0' && q < e && (*q == 'x' || *q == 'X')) {  /* hexadecimal? */
+    q++;
+    expo = "Pp";
+  }
+  for (; q < e; q++) {
+    if (*q == expo[0] || *q == expo[1]) {  /* exponent mark? */
+      if (q + 1 < e && (q[1] == '-' || q[1] == '+'))
+        q++;  /* optional exponent sign */
+    }
+    else if (!lisxdigit(cast_uchar(*q)) && *q != '.')
+      break;
+  }
+  if (q == e || lislalpha(cast_uchar(*q)) || q - s > LUAI_MAXSHORTLEN)
+    return 0;
+  memcpy(buff, s, q - s);
+  buff[q - s] = '\0';
+  if (luaO_str2num(buff, &obj) == 0)  /* format error? */
+    return 0;
+  settok(ls, s, q);
+  skipto(ls, q);
+  if (ttisinteger(&obj)) {
+    seminfo->i = ivalue(&obj);
+    return TK_INT;
+  }
+  else {
+    seminfo->r = fltvalue(&obj);
+    return TK_FLT;
+  }
+}
+
+
+/*
+** Short strings without escapes.
+*/
+static int inplacestring (LexState *ls, SemInfo *seminfo) {
+  const char *s = zcurrent(ls);  /* opening delimiter */
+  const char *e = zend(ls);
+  const char *q;
+  for (q = s + 1; q < e && *q != *s; q++) {
+    if (*q == '\\' || *q == '\n' || *q == '\r')
+      return 0;
+  }
+  if (q + 1 >= e)
+    return 0;
+  seminfo->ts = luaX_newstring(ls, s + 1, q - s - 1);
+  settok(ls, s, q + 1);
+  skipto(ls, q + 1);
+  return 1;
+}
+
+
+/*
+** Long strings, and long comments when 'seminfo' is NULL, with
+** '\n' line breaks only. 'current' is the first bracket.
+*/
+static int inplacelong (LexState *ls, SemInfo *seminfo) {
+  const char *s = zcurrent(ls);
+  const char *e = zend(ls);
+  const char *p = s + 1;
+  const char *q, *start;
+  size_t sep, i;
+  int lines = 0;
+  while (p < e && *p == '=')
+    p++;
+  if (e - p < 3 || *p != '[')  /* split, or not a long bracket? */
+    return 0;
+  sep = cast_sizet(p - s) + 1;  /* number of '='s + 2 */
+  start = skipbreak(p + 1);  /* skip 2nd '[' and a first line break */
+  if (start != p + 1)
+    lines++;
+  for (;;) {  /* look for the closing bracket */
+    q = cast(const char *, memchr(p, ']', e - p));
+    if (q == NULL || cast_sizet(e - q) <= sep)
+      return 0;
+    for (i = 1; i < sep - 1 && q[i] == '='; i++) ;
+    if (i == sep - 1 && q[i] == ']')
+      break;
+    p = q + 1;
+  }
+  if (memchr(start, '\r', q - start) != NULL)
+    return 0;
+  for (p = start; (p = cast(const char *, memchr(p, '\n', q - p))) != NULL;
+       p++)
+    lines++;
+  if (lines >= MAX_INT - ls->linenumber)
+    return 0;
+  ls->linenumber += lines;
+  if (seminfo) {
+    seminfo->ts = luaX_newstring(ls, start, q - start);
+    settok(ls, s, q + sep);
+  }
+  skipto(ls, q + sep);
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** Read the word of a "--!word" comment: "--!inline" turns on the
+** inlining of small local functions for the chunk, "--!lazy" the
+** compilation of function bodies on their first call, "--!optimize"
+** optimization level 2. Other words are ignored, as is the rest of
+** the line.
+*/
+static void pragma (LexState *ls) {
+  next(ls);  /* skip '!' */
+  while (lislalnum(ls->current))
+    save_and_next(ls);
+  if (luaZ_bufflen(ls->buff) == 6 &&
+      memcmp(luaZ_buffer(ls->buff), "inline", 6) == 0)
+    ls->inlinecode = 1;
+  else if (luaZ_bufflen(ls->buff) == 4 &&
+           memcmp(luaZ_buffer(ls->buff), "lazy", 4) == 0)
+    ls->lazycode = 1;
+  else if (luaZ_bufflen(ls->buff) == 8 &&
+           memcmp(luaZ_buffer(ls->buff), "optimize", 8) == 0)
+    ls->optcode = 2;
+  luaZ_resetbuffer(ls->buff);
+}
+
+
 static int llex (LexState *ls, SemInfo *seminfo) {
   luaZ_resetbuffer(ls->buff);
+  ls->tok = NULL;
   for (;;) {
     switch (ls->current) {
       case '\n': case '\r': {  /* line breaks */
@@ -451,7 +723,7 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         break;
       }
       case ' ': case '\f': case '\t': case '\v': {  /* spaces */
-        next(ls);
+        skipspaces(ls);
         break;
       }
       case '-': {  /* '-' or '--' (comment) */
@@ -460,7 +732,10 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         /* else is a comment */
         next(ls);
         if (ls->current == '[') {  /* long comment? */
-          size_t sep = skip_sep(ls);
+          size_t sep;
+          if (inplacelong(ls, NULL))
+            break;
+          sep = skip_sep(ls);
           luaZ_resetbuffer(ls->buff);  /* 'skip_sep' may dirty the buffer */
           if (sep >= 2) {
             read_long_string(ls, NULL, sep);  /* skip long comment */
@@ -469,12 +744,16 @@ static int llex (LexState *ls, SemInfo *seminfo) {
           }
         }
         /* else short comment */
-        while (!currIsNewline(ls) && ls->current != EOZ)
-          next(ls);  /* skip until end of line (or end of file) */
+        if (ls->current == '!')
+          pragma(ls);
+        skipline(ls);
         break;
       }
       case '[': {  /* long string or simply '[' */
-        size_t sep = skip_sep(ls);
+        size_t sep;
+        if (inplacelong(ls, seminfo))
+          return TK_STRING;
+        sep = skip_sep(ls);
         if (sep >= 2) {
           read_long_string(ls, seminfo, sep);
           return TK_STRING;
@@ -516,7 +795,8 @@ static int llex (LexState *ls, SemInfo *seminfo) {
         else return ':';
       }
       case '"': case '\'': {  /* short literal strings */
-        read_string(ls, ls->current, seminfo);
+        if (!inplacestring(ls, seminfo))
+          read_string(ls, ls->current, seminfo);
         return TK_STRING;
       }
       case '.': {  /* '.', '..', '...', or number */
@@ -531,7 +811,8 @@ static int llex (LexState *ls, SemInfo *seminfo) {
       }
       case '0': case '1': case '2': case '3': case '4':
       case '5': case '6': case '7': case '8': case '9': {
-        return read_numeral(ls, seminfo);
+        int t = inplacenumeral(ls, seminfo);
+        return (t != 0) ? t : read_numeral(ls, seminfo);
       }
       case EOZ: {
         return TK_EOS;
@@ -539,6 +820,9 @@ static int llex (LexState *ls, SemInfo *seminfo) {
       default: {
         if (lislalpha(ls->current)) {  /* identifier or reserved word? */
           TString *ts;
+          int t = inplacename(ls, seminfo);
+          if (t != 0)
+            return t;
           do {
             save_and_next(ls);
           } while (lislalnum(ls->current));
@@ -71,10 +71,15 @@ typedef struct LexState {
   struct lua_State *L;
   ZIO *z;  /* input stream */
   Mbuffer *buff;  /* buffer for tokens */
+  const char *tok;  /* text of last token, if read in place (not in 'buff') */
+  size_t tokl;  /* length of 'tok' */
   Table *h;  /* to avoid collection/reuse strings */
   struct Dyndata *dyd;  /* dynamic structures used by the parser */
   TString *source;  /* current source name */
   TString *envn;  /* environment variable name */
+  lu_byte inlinecode;  /* inline small local functions? */
+  lu_byte optcode;  /* optimization level (see 'lua_setoptimize') */
+  lu_byte lazycode;  /* compile function bodies on their first call? */
 } LexState;
 #pragma incomplete LexState;
 
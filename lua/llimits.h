@@ -274,6 +274,25 @@ typedef l_uint32 Instruction;
 #endif
 
 
+/*
+** macros to increment and decrement (giving the new value) the
+** reference count of a shared chunk, which states running in
+** different threads may hold at the same time
+*/
+#if !defined(luai_chunkinc)
+#if defined(LUA_USE_PLAN9)
+#define luai_chunkinc(r)	ainc(r)
+#define luai_chunkdec(r)	adec(r)
+#elif defined(__GNUC__)
+#define luai_chunkinc(r)	__atomic_add_fetch(r, 1, __ATOMIC_RELAXED)
+#define luai_chunkdec(r)	__atomic_sub_fetch(r, 1, __ATOMIC_ACQ_REL)
+#else
+#define luai_chunkinc(r)	(++(*(r)))
+#define luai_chunkdec(r)	(--(*(r)))
+#endif
+#endif
+
+
 /*
 ** these macros allow user-specific actions when a thread is
 ** created/deleted/resumed/yielded.
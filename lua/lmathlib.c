@@ -765,8 +765,17 @@ static const luaL_Reg mathlib[] = {
 /*
 ** Open math library
 */
+/* functions in 'mathlib' that are leaves (see 'lua_pushleaf') */
+static const char *const mathleaves[] = {
+  "abs", "ceil", "floor", "fmod", "sqrt", "exp", "log", "sin", "cos",
+  "tan", "asin", "acos", "atan", "max", "min", "tointeger", "type", "ult",
+  NULL
+};
+
+
 LUAMOD_API int luaopen_math (lua_State *L) {
   luaL_newlib(L, mathlib);
+  luaL_setleaves(L, mathleaves);
   lua_pushnumber(L, PI);
   lua_setfield(L, -2, "pi");
   lua_pushnumber(L, (lua_Number)HUGE_VAL);
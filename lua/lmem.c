@@ -58,6 +58,34 @@
 #define cantryagain(g)	(completestate(g) && !g->gcstopem)
 
 
+/*
+** Blocks got from 'malloc' are tagged with the address of their
+** allocator's caller, to help finding leaks with acid(1).  Blocks the
+** allocator serves from slabs of its own ('slabmax') do not have a
+** 'malloc' header to be tagged.
+*/
+#define tagblock(g,b,s,L)  \
+  do { if ((s) > (g)->slabmax) setmalloctag(b, getcallerpc(&L)); } while (0)
+
+
+
+
+/*
+** Call the allocation function, unless the allocation would take the
+** number of bytes in use beyond 'memlimit'. Such allocations fail as
+** if the allocation function itself had failed, so that they go through
+** the emergency collection in 'tryagain' before raising a memory
+** error. (For new blocks 'os' is a type tag, not a size.)
+*/
+static void *limitedrealloc (global_State *g, void *block,
+                             size_t os, size_t ns) {
+  if (l_unlikely(g->memlimit > 0)) {
+    size_t realos = (block == NULL) ? 0 : os;
+    if (ns > realos && gettotalbytes(g) + (ns - realos) > g->memlimit)
+      return NULL;  /* over the limit */
+  }
+  return callfrealloc(g, block, os, ns);
+}
 
 
 #if defined(EMERGENCYGCTESTS)
@@ -70,10 +98,10 @@ static void *firsttry (global_State *g, void *block, size_t os, size_t ns) {
   if (ns > 0 && cantryagain(g))
     return NULL;  /* fail */
   else  /* normal allocation */
-    return callfrealloc(g, block, os, ns);
+    return limitedrealloc(g, block, os, ns);
 }
 #else
-#define firsttry(g,block,os,ns)    callfrealloc(g, block, os, ns)
+#define firsttry(g,block,os,ns)    limitedrealloc(g, block, os, ns)
 #endif
 
 
@@ -164,7 +192,7 @@ static void *tryagain (lua_State *L, void *block,
   global_State *g = G(L);
   if (cantryagain(g)) {
     luaC_fullgc(L, 1);  /* try to free some memory... */
-    return callfrealloc(g, block, osize, nsize);  /* try again */
+    return limitedrealloc(g, block, osize, nsize);  /* try again */
   }
   else return NULL;  /* cannot run an emergency collection */
 }
@@ -185,7 +213,7 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   }
   lua_assert((nsize == 0) == (newblock == NULL));
   g->GCdebt = (g->GCdebt + nsize) - osize;
-  setmalloctag(newblock, getcallerpc(&L));
+  tagblock(g, newblock, nsize, L);
   return newblock;
 }
 
@@ -195,7 +223,7 @@ void *luaM_saferealloc_ (lua_State *L, void *block, size_t osize,
   void *newblock = luaM_realloc_(L, block, osize, nsize);
   if (l_unlikely(newblock == NULL && nsize > 0))  /* allocation failed? */
     luaM_error(L);
-  setmalloctag(newblock, getcallerpc(&L));
+  tagblock(G(L), newblock, nsize, L);
   return newblock;
 }
 
@@ -212,7 +240,7 @@ void *luaM_malloc_ (lua_State *L, size_t size, int tag) {
         luaM_error(L);
     }
     g->GCdebt += size;
-    setmalloctag(newblock, getcallerpc(&L));
+    tagblock(g, newblock, size, L);
     return newblock;
   }
 }
@@ -552,10 +552,12 @@ typedef struct Proto {
   lu_byte numparams;  /* number of fixed (named) parameters */
   lu_byte is_vararg;
   lu_byte maxstacksize;  /* number of registers needed by this function */
+  lu_byte shared;  /* 'code' and line info belong to a chunk or 'image' */
+  lu_byte lazy;  /* body not compiled yet (see 'skipbody' in lparser.c) */
   int sizeupvalues;  /* size of 'upvalues' */
   int sizek;  /* size of 'k' */
   int sizecode;
-  int sizelineinfo;
+  int sizelineinfo;  /* -1 while line info is still in 'debug' */
   int sizep;  /* size of 'p' */
   int sizelocvars;
   int sizeabslineinfo;  /* size of 'abslineinfo' */
@@ -569,6 +571,10 @@ typedef struct Proto {
   AbsLineInfo *abslineinfo;  /* idem */
   LocVar *locvars;  /* information about local variables (debug information) */
   TString  *source;  /* used for debug information */
+  TString  *body;  /* source of the body, while 'lazy' */
+  GCObject *image;  /* object holding 'code' and debug info, if in place */
+  const char *debug;  /* debug info not loaded yet, in 'image', or NULL */
+  size_t sizedebug;  /* size of 'debug' */
   GCObject *gclist;
 } Proto;
 
@@ -588,11 +594,13 @@ typedef struct Proto {
 #define LUA_VLCL	makevariant(LUA_TFUNCTION, 0)  /* Lua closure */
 #define LUA_VLCF	makevariant(LUA_TFUNCTION, 1)  /* light C function */
 #define LUA_VCCL	makevariant(LUA_TFUNCTION, 2)  /* C closure */
+#define LUA_VLEAF	makevariant(LUA_TFUNCTION, 3)  /* leaf C function */
 
 #define ttisfunction(o)		checktype(o, LUA_TFUNCTION)
 #define ttisLclosure(o)		checktag((o), ctb(LUA_VLCL))
 #define ttislcf(o)		checktag((o), LUA_VLCF)
 #define ttisCclosure(o)		checktag((o), ctb(LUA_VCCL))
+#define ttisleaf(o)		checktag((o), LUA_VLEAF)
 #define ttisclosure(o)         (ttisLclosure(o) || ttisCclosure(o))
 
 
@@ -600,7 +608,7 @@ typedef struct Proto {
 
 #define clvalue(o)	check_exp(ttisclosure(o), gco2cl(val_(o).gc))
 #define clLvalue(o)	check_exp(ttisLclosure(o), gco2lcl(val_(o).gc))
-#define fvalue(o)	check_exp(ttislcf(o), val_(o).f)
+#define fvalue(o)	check_exp(ttislcf(o) || ttisleaf(o), val_(o).f)
 #define clCvalue(o)	check_exp(ttisCclosure(o), gco2ccl(val_(o).gc))
 
 #define fvalueraw(v)	((v).f)
@@ -615,6 +623,9 @@ typedef struct Proto {
 #define setfvalue(obj,x) \
   { TValue *io=(obj); val_(io).f=(x); settt_(io, LUA_VLCF); }
 
+#define setleafvalue(obj,x) \
+  { TValue *io=(obj); val_(io).f=(x); settt_(io, LUA_VLEAF); }
+
 #define setclCvalue(L,obj,x) \
   { TValue *io = (obj); CClosure *x_ = (x); \
     val_(io).gc = obj2gco(x_); settt_(io, ctb(LUA_VCCL)); \
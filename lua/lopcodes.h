@@ -306,6 +306,10 @@ OP_VARARG,/*	A C	R[A], R[A+1], ..., R[A+C-2] = vararg		*/
 
 OP_VARARGPREP,/*A	(adjust vararg parameters)			*/
 
+OP_SELECT,/*	A C	R[A], ... ,R[A+C-2] := R[A](R[A+1], vararg)	*/
+
+OP_SWITCH,/*	A B	do jump (K[EXTRAARG][R[A]] or 0) after EXTRAARG (*)	*/
+
 OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
 } OpCode;
 
@@ -335,6 +339,16 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   (*) In OP_VARARG, if (C == 0) then use actual number of varargs and
   set top (like in OP_CALL with C == 0).
 
+  (*) OP_SELECT is a call 'select(R[A+1], ...)' whose varargs were not
+  pushed. When R[A] is the original 'select', the results are taken
+  straight from the vararg area; otherwise the varargs are pushed and
+  it behaves like OP_CALL. C is as in OP_CALL.
+
+  (*) OP_SWITCH is followed by OP_EXTRAARG, the index of a table
+  constant mapping values to case numbers 1 to B, and by B + 1 jumps:
+  jump 0, right after the OP_EXTRAARG, is done for values not in the
+  table, and jump c for case c.
+
   (*) In OP_RETURN, if (B == 0) then return up to 'top'.
 
   (*) In OP_LOADKX and OP_NEWTABLE, the next instruction is always
@@ -357,9 +371,9 @@ OP_EXTRAARG/*	Ax	extra (larger) argument for previous opcode	*/
   (*) All 'skips' (pc++) assume that next instruction is a jump.
 
   (*) In instructions OP_RETURN/OP_TAILCALL, 'k' specifies that the
-  function builds upvalues, which may need to be closed. C > 0 means
-  the function is vararg, so that its 'func' must be corrected before
-  returning; in this case, (C - 1) is its number of fixed parameters.
+  function builds upvalues, which may need to be closed. (Vararg
+  functions need no correction before returning: their arguments stay
+  below their frames.)
 
   (*) In comparisons with an immediate operand, C signals whether the
   original operand was a float. (It must be corrected in case of
@@ -19,6 +19,7 @@
 #include "ldebug.h"
 #include "ldo.h"
 #include "lfunc.h"
+#include "lgc.h"
 #include "llex.h"
 #include "lmem.h"
 #include "lobject.h"
@@ -27,6 +28,7 @@
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
+#include "lundump.h"
 
 
 
@@ -760,6 +762,7 @@ static void close_func (LexState *ls) {
   luaK_ret(fs, luaY_nvarstack(fs), 0);  /* final return */
   leaveblock(fs);
   lua_assert(fs->bl == NULL);
+  luaK_optimize(fs);
   luaK_finish(fs);
   luaM_shrinkvector(L, f->code, f->sizecode, fs->pc, Instruction);
   luaM_shrinkvector(L, f->lineinfo, f->sizelineinfo, fs->pc, ls_byte);
@@ -986,6 +989,238 @@ static void parlist (LexState *ls) {
 }
 
 
+/*
+** {======================================================================
+** Lazy compilation: with 'lazycode' on, the body of a function is only
+** skimmed when its chunk is loaded, to find where it ends and which
+** variables of the enclosing functions it uses, and its source is kept
+** to be compiled on the first call of the function.
+** =======================================================================
+*/
+
+/* bits of 'Proto.lazy' */
+#define LAZYBODY	1  /* body still to be compiled */
+#define LAZYSELF	2  /* method, with an implicit 'self' parameter */
+#define LAZYINLINE	4  /* inline small local functions in it */
+#define LAZYOPT		3  /* shift of its optimization level */
+
+
+/*
+** Make sure that the function open in 'ls' gets 'name' as an upvalue
+** if it is a variable of an enclosing function, or '_ENV' if it is a
+** global name. Returns false if the body has to be compiled right away
+** instead, when 'name' is a compile-time constant, whose value is only
+** known here, or when upvalues may run out.
+*/
+static int freename (LexState *ls, TString *name) {
+  FuncState *fs = ls->fs;
+  expdesc v;
+  if (fs->nups >= MAXUPVAL - 1)  /* no room for 'name' and '_ENV'? */
+    return 0;
+  singlevaraux(fs, name, &v, 1);
+  if (v.k == VVOID)  /* global name? */
+    singlevaraux(fs, ls->envn, &v, 1);
+  return (v.k != VCONST);
+}
+
+
+/*
+** Skip the tokens of a body up to its matching 'end', counting the
+** blocks closed by an 'end' opened in it. The parameters are counted
+** into the prototype, for 'debug.getinfo' to report before the body
+** is compiled. Every other name in it that does not follow '.', ':',
+** 'goto', 'local' or 'for' is taken for the use of a variable, which
+** may give the function a few upvalues it does not need, but never
+** leaves out one that it does. Returns what the last 'freename' did.
+*/
+static int skim (LexState *ls, int line) {
+  Proto *f = ls->fs->f;
+  int depth = 1;  /* blocks open: the body itself */
+  int prev = '(';
+  int lazy = 1;
+  luaX_next(ls);  /* skip '(' */
+  while (ls->t.token == TK_NAME || ls->t.token == TK_DOTS) {
+    if (ls->t.token == TK_DOTS)
+      f->is_vararg = 1;
+    else if (f->numparams < MAXVARS)  /* (more is an error when compiled) */
+      f->numparams++;
+    luaX_next(ls);
+    if (ls->t.token != ',')
+      break;
+    luaX_next(ls);
+  }
+  for (;;) {
+    switch (ls->t.token) {
+      case TK_FUNCTION: case TK_DO: case TK_IF: {
+        depth++;
+        break;
+      }
+      case TK_END: {
+        if (--depth == 0)
+          return lazy;
+        break;
+      }
+      case TK_EOS: {
+        check_match(ls, TK_END, TK_FUNCTION, line);  /* error */
+        break;
+      }
+      case TK_NAME: {
+        if (lazy && prev != '.' && prev != ':' && prev != TK_GOTO &&
+                    prev != TK_LOCAL && prev != TK_FOR)
+          lazy = freename(ls, ls->t.seminfo.ts);
+        break;
+      }
+      default: break;
+    }
+    prev = ls->t.token;
+    luaX_next(ls);
+  }
+}
+
+
+static const char *getbody (lua_State *L, void *ud, size_t *size) {
+  TString **body = cast(TString **, ud);
+  const char *s;
+  UNUSED(L);
+  if (*body == NULL)
+    return NULL;
+  s = getstr(*body);
+  *size = tsslen(*body);
+  *body = NULL;  /* all read in one piece */
+  return s;
+}
+
+
+/*
+** Compile the body of 'f' from 'body', its source from after the '(',
+** with lexer 'ls', which shares its scanner table and dynamic structures
+** with the lexer of the enclosing function, if any ('prev').
+*/
+static void compilebody (lua_State *L, LexState *ls, FuncState *prev,
+                         Proto *f, TString *body, int lazy) {
+  ZIO z;
+  FuncState fs;
+  BlockCnt bl;
+  luaZ_init(L, &z, getbody, &body);
+  luaX_setinput(L, ls, &z, f->source, zgetc(&z));
+  ls->linenumber = f->linedefined;
+  ls->lazycode = 1;  /* skip its own nested functions too */
+  ls->inlinecode = (lazy & LAZYINLINE) != 0;
+  ls->optcode = cast_byte(lazy >> LAZYOPT);
+  ls->fs = prev;
+  fs.f = f;
+  open_func(ls, &fs, &bl);
+  fs.nups = cast_byte(f->sizeupvalues);  /* as found when skimming */
+  luaX_next(ls);  /* read first token */
+  if (lazy & LAZYSELF) {
+    new_localvarliteral(ls, "self");  /* create 'self' parameter */
+    adjustlocalvars(ls, 1);
+  }
+  parlist(ls);
+  checknext(ls, ')');
+  statlist(ls);
+  f->lastlinedefined = ls->linenumber;
+  check_match(ls, TK_END, TK_FUNCTION, f->linedefined);
+  check(ls, TK_EOS);
+  close_func(ls);
+}
+
+
+/*
+** Skip the body of the function just opened, from its '(' on, keeping
+** a copy of it in the prototype, and code its closure into 'e'. The
+** copy starts with a line break for each one between 'function' and
+** '(', so that its lines count from 'linedefined'.
+*/
+static void skipbody (LexState *ls, expdesc *e, int ismethod, int line) {
+  lua_State *L = ls->L;
+  FuncState *fs = ls->fs;
+  Proto *f = fs->f;
+  Mbuffer *b = &ls->dyd->body;
+  size_t nl = cast_sizet(ls->linenumber - line);
+  TString *body;
+  int lazy;
+  luaZ_resetbuffer(b);
+  if (nl > 0) {  /* '(' not in the line of 'function'? */
+    if (luaZ_sizebuffer(b) < nl)
+      luaZ_resizebuffer(L, b, nl);
+    memset(luaZ_buffer(b), '\n', nl);
+    luaZ_bufflen(b) = nl;
+  }
+  luaZ_startcopy(ls->z, b);
+  f->numparams = cast_byte(ismethod);  /* 'self' */
+  lazy = skim(ls, line);
+  luaZ_endcopy(ls->z, ls->current);  /* up to the 'end' */
+  f->lastlinedefined = ls->linenumber;
+  body = luaS_newlstr(L, luaZ_buffer(b), luaZ_bufflen(b));
+  setsvalue2s(L, L->top.p, body);  /* anchor it */
+  luaD_inctop(L);
+  if (lazy) {
+    f->lazy = cast_byte(LAZYBODY | (ismethod ? LAZYSELF : 0) |
+                        (ls->inlinecode ? LAZYINLINE : 0) |
+                        (ls->optcode << LAZYOPT));
+    f->body = body;
+    luaC_objbarrier(L, f, body);
+  }
+  codeclosure(ls, e);
+  leaveblock(fs);
+  luaM_shrinkvector(L, f->upvalues, f->sizeupvalues, fs->nups, Upvaldesc);
+  ls->fs = fs->prev;
+  if (!lazy) {  /* compile it now from the copy, finding its upvalues */
+    LexState bls;
+    luaM_freearray(L, f->upvalues, f->sizeupvalues);
+    f->upvalues = NULL;
+    f->sizeupvalues = 0;
+    bls.h = ls->h;
+    bls.buff = ls->buff;
+    bls.dyd = ls->dyd;
+    compilebody(L, &bls, ls->fs, f, body, (ismethod ? LAZYSELF : 0) |
+                                          (ls->inlinecode ? LAZYINLINE : 0) |
+                                          (ls->optcode << LAZYOPT));
+  }
+  L->top.p--;  /* remove 'body' */
+  luaX_next(ls);  /* skip 'end' */
+}
+
+
+/*
+** Give 'f' all that was compiled for it in 'nf', leaving 'nf' empty.
+*/
+static void movebody (lua_State *L, Proto *f, Proto *nf) {
+  int i;
+  lua_assert(f->sizecode == 0 && f->sizek == 0 && f->sizep == 0);
+  luaU_checkdebug(L, f);  /* upvalue names may still be in its image */
+  f->numparams = nf->numparams;
+  f->is_vararg = nf->is_vararg;
+  f->maxstacksize = nf->maxstacksize;
+  f->shared = 0;  /* its code is not in a shared chunk any more */
+  f->image = NULL;
+  f->lastlinedefined = nf->lastlinedefined;
+#define movearray(a,n)	(f->a = nf->a, f->n = nf->n, nf->a = NULL, nf->n = 0)
+  movearray(code, sizecode);
+  movearray(k, sizek);
+  movearray(p, sizep);
+  movearray(lineinfo, sizelineinfo);
+  movearray(abslineinfo, sizeabslineinfo);
+  movearray(locvars, sizelocvars);
+#undef movearray
+  f->body = NULL;
+  f->lazy = 0;
+  for (i = 0; i < f->sizek; i++) {  /* 'f' may be black, even old */
+    if (iscollectable(&f->k[i]))
+      luaC_objbarrier(L, f, gcvalue(&f->k[i]));
+  }
+  for (i = 0; i < f->sizep; i++)
+    luaC_objbarrier(L, f, f->p[i]);
+  for (i = 0; i < f->sizelocvars; i++) {
+    if (f->locvars[i].varname)
+      luaC_objbarrier(L, f, f->locvars[i].varname);
+  }
+}
+
+/* }====================================================================== */
+
+
 static void body (LexState *ls, expdesc *e, int ismethod, int line) {
   /* body ->  '(' parlist ')' block END */
   FuncState new_fs;
@@ -993,6 +1228,10 @@ static void body (LexState *ls, expdesc *e, int ismethod, int line) {
   new_fs.f = addprototype(ls);
   new_fs.f->linedefined = line;
   open_func(ls, &new_fs, &bl);
+  if (ls->lazycode && ls->t.token == '(' && ls->current != EOZ) {
+    skipbody(ls, e, ismethod, line);
+    return;
+  }
   checknext(ls, '(');
   if (ismethod) {
     new_localvarliteral(ls, "self");  /* create 'self' parameter */
@@ -1021,7 +1260,7 @@ static int explist (LexState *ls, expdesc *v) {
 }
 
 
-static void funcargs (LexState *ls, expdesc *f) {
+static void funcargs (LexState *ls, expdesc *f, int isselect) {
   FuncState *fs = ls->fs;
   expdesc args;
   int base, nparams;
@@ -1054,6 +1293,16 @@ static void funcargs (LexState *ls, expdesc *f) {
   }
   lua_assert(f->k == VNONRELOC);
   base = f->u.info;  /* base register for call */
+  if (isselect && args.k == VVARARG &&
+      GETARG_A(getinstruction(fs, &args)) == base + 2) {
+    /* 'select(x, ...)': let OP_SELECT read the varargs in place */
+    lua_assert(args.u.info == fs->pc - 1);
+    getinstruction(fs, &args) = CREATE_ABCk(OP_SELECT, base, 0, 2, 0);
+    init_exp(f, VCALL, args.u.info);
+    luaK_fixline(fs, line);
+    fs->freereg = base+1;
+    return;
+  }
   if (hasmultret(args.k))
     nparams = LUA_MULTRET;  /* open call */
   else {
@@ -1099,6 +1348,23 @@ static void primaryexp (LexState *ls, expdesc *v) {
 }
 
 
+/*
+** Check whether 'v' is the global 'select', whose calls with varargs
+** compile to OP_SELECT. (The VM checks that the function really is the
+** original 'select' before skipping the call.)
+*/
+static int isselect (LexState *ls, expdesc *v) {
+  FuncState *fs = ls->fs;
+  if (v->k == VINDEXUP &&
+      eqstr(fs->f->upvalues[v->u.ind.t].name, ls->envn)) {
+    TValue *key = &fs->f->k[v->u.ind.idx];
+    return (ttisshrstring(key) &&
+            strcmp(getstr(tsvalue(key)), "select") == 0);
+  }
+  return 0;
+}
+
+
 static void suffixedexp (LexState *ls, expdesc *v) {
   /* suffixedexp ->
        primaryexp { '.' NAME | '[' exp ']' | ':' NAME funcargs | funcargs } */
@@ -1122,12 +1388,13 @@ static void suffixedexp (LexState *ls, expdesc *v) {
         luaX_next(ls);
         codename(ls, &key);
         luaK_self(fs, v, &key);
-        funcargs(ls, v);
+        funcargs(ls, v, 0);
         break;
       }
       case '(': case TK_STRING: case '{': {  /* funcargs */
+        int sel = isselect(ls, v);
         luaK_exp2nextreg(fs, v);
-        funcargs(ls, v);
+        funcargs(ls, v, sel);
         break;
       }
       default: return;
@@ -1821,7 +2088,8 @@ static void retstat (LexState *ls) {
     nret = explist(ls, &e);  /* optional return values */
     if (hasmultret(e.k)) {
       luaK_setmultret(fs, &e);
-      if (e.k == VCALL && nret == 1 && !fs->bl->insidetbc) {  /* tail call? */
+      if (e.k == VCALL && nret == 1 && !fs->bl->insidetbc &&
+          GET_OPCODE(getinstruction(fs,&e)) == OP_CALL) {  /* tail call? */
         SET_OPCODE(getinstruction(fs,&e), OP_TAILCALL);
         lua_assert(GETARG_A(getinstruction(fs,&e)) == luaY_nvarstack(fs));
       }
@@ -1957,6 +2225,8 @@ LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
   dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
   luaX_setinput(L, &lexstate, z, funcstate.f->source, firstchar);
   mainfunc(&lexstate, &funcstate);
+  if (lexstate.inlinecode)
+    luaK_inline(&lexstate, cl->p);
   lua_assert(!funcstate.prev && funcstate.nups == 1 && !lexstate.fs);
   /* all scopes should be correctly finished */
   lua_assert(dyd->actvar.n == 0 && dyd->gt.n == 0 && dyd->label.n == 0);
@@ -1964,3 +2234,261 @@ LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
   return cl;  /* closure is on the stack, too */
 }
 
+
+/*
+** Compile the body of 'f', skipped when its chunk was loaded. It is
+** compiled into a new prototype that hands it over to 'f' when done,
+** so that an error leaves 'f' as it was, and so that 'f' is left alone
+** if it got compiled meanwhile (by a finalizer run in a collection).
+*/
+void luaY_compile (lua_State *L, Mbuffer *buff, Dyndata *dyd, Proto *f) {
+  LexState lexstate;
+  LClosure *cl = luaF_newLclosure(L, 0);  /* to anchor the new prototype */
+  Proto *nf;
+  int i;
+  setclLvalue2s(L, L->top.p, cl);
+  luaD_inctop(L);
+  setsvalue2s(L, L->top.p, f->body);  /* anchor the source */
+  luaD_inctop(L);
+  lexstate.h = luaH_new(L);  /* create table for scanner */
+  sethvalue2s(L, L->top.p, lexstate.h);  /* anchor it */
+  luaD_inctop(L);
+  nf = cl->p = luaF_newproto(L);
+  luaC_objbarrier(L, cl, nf);
+  nf->linedefined = f->linedefined;
+  nf->source = f->source;
+  nf->upvalues = luaM_newvectorchecked(L, f->sizeupvalues, Upvaldesc);
+  nf->sizeupvalues = f->sizeupvalues;
+  for (i = 0; i < f->sizeupvalues; i++)
+    nf->upvalues[i] = f->upvalues[i];  /* names are kept alive by 'f' */
+  lexstate.buff = buff;
+  lexstate.dyd = dyd;
+  dyd->actvar.n = dyd->gt.n = dyd->label.n = 0;
+  compilebody(L, &lexstate, NULL, nf, f->body, f->lazy);
+  if (f->lazy & LAZYINLINE)
+    luaK_inline(&lexstate, nf);
+  if (f->lazy)  /* not compiled meanwhile? */
+    movebody(L, f, nf);
+  L->top.p -= 3;  /* remove closure, source and scanner's table */
+}
+
+
+
+/*
+** {======================================================================
+** Data chunks: a single literal, usually a table constructor, built
+** directly into its value without generating code. Only constants,
+** with an optional '-' for numbers, and constructors of them are
+** accepted. Fields are stored in the same order as compiled code would
+** store them, with list items in batches of LFIELDS_PER_FLUSH.
+** =======================================================================
+*/
+
+static void datavalue (LexState *ls);
+
+
+/*
+** Fields of a constructor wait on the stack as key-value pairs, with a
+** nil key for list items, until DATABATCH of them are there or the
+** constructor ends. They are then stored into the table, sized for
+** all fields seen so far: exactly when the constructor has ended,
+** with room to grow otherwise.
+*/
+#define DATABATCH	(4 * LFIELDS_PER_FLUSH)
+
+typedef struct DataCons {
+  Table *t;  /* table being built */
+  ptrdiff_t base;  /* first pair waiting on the stack */
+  unsigned int na;  /* list items stored */
+  int tostore;  /* list items pending, as the first pairs from 'base' */
+  unsigned int nl;  /* list items seen */
+  unsigned int nh;  /* other fields seen */
+} DataCons;
+
+
+/*
+** Store the pending list items among pairs 'first' to 'last' - 1, as
+** OP_SETLIST would.
+*/
+static void datalist (lua_State *L, DataCons *dc, int first, int last) {
+  StkId base = restorestack(L, dc->base);
+  Table *t = dc->t;
+  int i;
+  if (dc->na + dc->tostore > luaH_realasize(t))  /* shrunk by a rehash? */
+    luaH_resizearray(L, t, dc->nl);
+  for (i = first; i < last; i++) {
+    if (ttisnil(s2v(base + 2 * i))) {
+      TValue *val = s2v(base + 2 * i + 1);
+      setobj2t(L, &t->array[dc->na++], val);
+      luaC_barrierback(L, obj2gco(t), val);
+    }
+  }
+  dc->tostore = 0;
+}
+
+
+/*
+** Store the pairs waiting on the stack. As in compiled code, list
+** items are stored in batches of LFIELDS_PER_FLUSH, each one when the
+** field after it comes, so that other fields in between go first.
+** Those of the last batch stay on the stack unless 'final'.
+*/
+static void datastore (lua_State *L, DataCons *dc, int final) {
+  Table *t = dc->t;
+  StkId base;
+  int n, i, j;
+  int first = 0;  /* first pair with pending list items */
+  unsigned int asize = luaH_realasize(t);
+  unsigned int hsize = allocsizenode(t);
+  if (dc->nl > asize || dc->nh > hsize) {  /* make room */
+    unsigned int grow = final ? 1 : 2;
+    luaH_resize(L, t, (dc->nl > asize) ? grow * dc->nl : asize,
+                      (dc->nh > hsize) ? grow * dc->nh : hsize);
+  }
+  base = restorestack(L, dc->base);
+  n = cast_int(L->top.p - base) / 2;
+  for (i = dc->tostore; i < n; i++) {
+    TValue *key = s2v(base + 2 * i);
+    if (dc->tostore == LFIELDS_PER_FLUSH) {
+      datalist(L, dc, first, i);
+      first = i;
+    }
+    if (ttisnil(key))
+      dc->tostore++;
+    else {
+      TValue *val = s2v(base + 2 * i + 1);
+      luaH_set(L, t, key, val);
+      luaC_barrierback(L, obj2gco(t), val);
+    }
+  }
+  if (final && dc->tostore > 0)
+    datalist(L, dc, first, n);
+  for (i = first, j = 0; j < dc->tostore; i++) {  /* keep pending items */
+    if (ttisnil(s2v(base + 2 * i))) {
+      setobjs2s(L, base + 2 * j + 1, base + 2 * i + 1);
+      setnilvalue(s2v(base + 2 * j));
+      j++;
+    }
+  }
+  L->top.p = base + 2 * j;
+}
+
+
+static void datatable (LexState *ls) {
+  lua_State *L = ls->L;
+  int line = ls->linenumber;
+  DataCons dc;
+  dc.t = luaH_new(L);
+  sethvalue2s(L, L->top.p, dc.t);  /* anchor it */
+  luaD_inctop(L);
+  dc.base = savestack(L, L->top.p);
+  dc.na = dc.nl = dc.nh = 0;
+  dc.tostore = 0;
+  checknext(ls, '{');
+  do {
+    if (ls->t.token == '}') break;
+    if (L->top.p - restorestack(L, dc.base) == 2 * DATABATCH)
+      datastore(L, &dc, 0);
+    luaD_checkstack(L, 1);
+    if (ls->t.token == TK_NAME) {  /* name = value */
+      setsvalue2s(L, L->top.p, ls->t.seminfo.ts);
+      L->top.p++;
+      luaX_next(ls);
+      checknext(ls, '=');
+      dc.nh++;
+    }
+    else if (testnext(ls, '[')) {  /* [value] = value */
+      datavalue(ls);
+      if (ttisnil(s2v(L->top.p - 1)))  /* literals cannot make a NaN */
+        luaK_semerror(ls, "table index is nil");
+      checknext(ls, ']');
+      checknext(ls, '=');
+      dc.nh++;
+    }
+    else {  /* list item */
+      setnilvalue(s2v(L->top.p));
+      L->top.p++;
+      dc.nl++;
+    }
+    datavalue(ls);
+  } while (testnext(ls, ',') || testnext(ls, ';'));
+  check_match(ls, '}', '{', line);
+  datastore(L, &dc, 1);
+  if (luaH_realasize(dc.t) > dc.na)  /* grown too much? */
+    luaH_resizearray(L, dc.t, dc.na);
+  luaC_checkGC(L);
+}
+
+
+/*
+** Push the value of the literal starting at the current token.
+*/
+static void datavalue (LexState *ls) {
+  lua_State *L = ls->L;
+  TValue *o;
+  int neg = 0;
+  if (ls->t.token == '{') {
+    enterlevel(ls);
+    datatable(ls);
+    leavelevel(ls);
+    return;
+  }
+  while (testnext(ls, '-'))
+    neg = !neg;
+  luaD_checkstack(L, 1);
+  o = s2v(L->top.p);
+  switch (ls->t.token) {
+    case TK_INT: {
+      lua_Integer i = ls->t.seminfo.i;
+      setivalue(o, neg ? l_castU2S(0u - l_castS2U(i)) : i);
+      break;
+    }
+    case TK_FLT: {
+      lua_Number r = ls->t.seminfo.r;
+      setfltvalue(o, neg ? luai_numunm(L, r) : r);
+      break;
+    }
+    case TK_NIL: case TK_TRUE: case TK_FALSE: case TK_STRING: {
+      if (neg)
+        luaX_syntaxerror(ls, "number expected");
+      if (ls->t.token == TK_NIL) setnilvalue(o);
+      else if (ls->t.token == TK_TRUE) setbtvalue(o);
+      else if (ls->t.token == TK_FALSE) setbfvalue(o);
+      else setsvalue(L, o, ls->t.seminfo.ts);
+      break;
+    }
+    default: {
+      luaX_syntaxerror(ls, neg ? "number expected" : "unexpected symbol");
+    }
+  }
+  L->top.p++;
+  luaX_next(ls);
+}
+
+
+/*
+** Read a data chunk: an optional 'return' and a literal. Its value is
+** left on the stack.
+*/
+void luaY_data (lua_State *L, ZIO *z, Mbuffer *buff, Dyndata *dyd,
+                const char *name, int firstchar) {
+  LexState lexstate;
+  TString *source = luaS_new(L, name);
+  setsvalue2s(L, L->top.p, source);  /* anchor it */
+  luaD_inctop(L);
+  lexstate.h = luaH_new(L);  /* create table for scanner */
+  sethvalue2s(L, L->top.p, lexstate.h);  /* anchor it */
+  luaD_inctop(L);
+  lexstate.buff = buff;
+  lexstate.dyd = dyd;
+  luaX_setinput(L, &lexstate, z, source, firstchar);
+  luaX_next(&lexstate);  /* read first token */
+  testnext(&lexstate, TK_RETURN);
+  datavalue(&lexstate);
+  testnext(&lexstate, ';');
+  check(&lexstate, TK_EOS);
+  setobjs2s(L, L->top.p - 3, L->top.p - 1);  /* value replaces source */
+  L->top.p -= 2;  /* remove scanner's table and value */
+}
+
+/* }====================================================================== */
@@ -133,6 +133,7 @@ typedef struct Dyndata {
   } actvar;
   Labellist gt;  /* list of pending gotos */
   Labellist label;   /* list of active labels */
+  Mbuffer body;  /* copy of the source of a function body being skipped */
 } Dyndata;
 
 
@@ -167,6 +168,10 @@ typedef struct FuncState {
 LUAI_FUNC int luaY_nvarstack (FuncState *fs);
 LUAI_FUNC LClosure *luaY_parser (lua_State *L, ZIO *z, Mbuffer *buff,
                                  Dyndata *dyd, const char *name, int firstchar);
+LUAI_FUNC void luaY_compile (lua_State *L, Mbuffer *buff, Dyndata *dyd,
+                             Proto *f);
+LUAI_FUNC void luaY_data (lua_State *L, ZIO *z, Mbuffer *buff, Dyndata *dyd,
+                          const char *name, int firstchar);
 
 
 #endif
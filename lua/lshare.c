@@ -0,0 +1,485 @@
+/*
+** $Id: lshare.c $
+** Compiled chunks shared by several states
+** See Copyright Notice in lua.h
+*/
+
+#define lshare_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "lundump.h"
+
+
+/*
+** A shared chunk is a tree of function prototypes kept in a single
+** block outside of any Lua state, so that any number of states (in
+** any number of threads) can make closures from it without compiling
+** or loading it again. The block is never written after it is built.
+** The prototypes made from it in each state use its code and line
+** information in place; constants and names are kept as plain bytes,
+** from which each state makes its own strings, as short strings must
+** be interned in the state using them. A state holds one reference to
+** each chunk it has loaded, released when the state is closed.
+*/
+
+
+typedef union { LUAI_MAXALIGN; } Align;
+
+typedef struct SString {
+  const char *s;  /* NULL for no string */
+  size_t len;
+} SString;
+
+typedef struct STable {
+  struct SValue *kv;  /* key and value of each entry, in turn */
+  int n;  /* number of entries */
+} STable;
+
+typedef struct SValue {
+  lu_byte tt;  /* variant tag */
+  union {
+    lua_Integer i;
+    lua_Number n;
+    SString s;
+    STable t;  /* the cases of an OP_SWITCH */
+  } u;
+} SValue;
+
+typedef struct SUpval {
+  SString name;
+  lu_byte instack;
+  lu_byte idx;
+  lu_byte kind;
+} SUpval;
+
+typedef struct SLocVar {
+  SString varname;
+  int startpc;
+  int endpc;
+} SLocVar;
+
+typedef struct SProto {
+  lu_byte numparams;
+  lu_byte is_vararg;
+  lu_byte maxstacksize;
+  int linedefined;
+  int lastlinedefined;
+  int sizecode;
+  int sizelineinfo;
+  int sizeabslineinfo;
+  int sizek;
+  int sizep;
+  int sizeupvalues;
+  int sizelocvars;
+  Instruction *code;
+  ls_byte *lineinfo;
+  AbsLineInfo *abslineinfo;
+  SValue *k;
+  struct SProto **p;
+  SUpval *upvalues;
+  SLocVar *locvars;
+  SString source;  /* NULL when equal to the parent's */
+  SString body;  /* source of a body not compiled yet */
+  lu_byte lazy;
+} SProto;
+
+struct lua_Chunk {
+  lua_Alloc frealloc;  /* allocator that owns this block */
+  void *ud;
+  size_t size;  /* size of the whole block */
+  long ref;  /* number of holders */
+  SProto *main;
+};
+
+
+/*
+** {======================================================
+** Building
+** =======================================================
+*/
+
+/*
+** A chunk is built in two passes over the prototypes with the same
+** code: the first one, with a NULL 'block', only adds up the sizes of
+** the pieces; the second one places them in a block of that size.
+*/
+typedef struct Builder {
+  char *block;
+  size_t n;  /* bytes used so far */
+} Builder;
+
+
+static void *place (Builder *B, size_t size) {
+  void *p = (B->block != NULL) ? B->block + B->n : NULL;
+  B->n += (size + sizeof(Align) - 1) / sizeof(Align) * sizeof(Align);
+  return p;
+}
+
+
+static void *placecopy (Builder *B, const void *src, size_t size) {
+  void *p = place(B, size);
+  if (p != NULL && size > 0)
+    memcpy(p, src, size);
+  return p;
+}
+
+
+static SString placestring (Builder *B, const TString *ts) {
+  SString s;
+  s.s = NULL;
+  s.len = 0;
+  if (ts != NULL) {
+    s.len = tsslen(ts);
+    s.s = (const char *)placecopy(B, getstr(ts), s.len + 1);
+  }
+  return s;
+}
+
+
+static STable placetable (Builder *B, Table *t);
+
+
+/*
+** Place what constant 'o' refers to and describe it in 'so' (unless
+** 'so' is NULL, in the first pass).
+*/
+static void placevalue (Builder *B, SValue *so, const TValue *o) {
+  SString s = placestring(B, ttisstring(o) ? tsvalue(o) : NULL);
+  STable t = {NULL, 0};
+  if (ttistable(o))
+    t = placetable(B, hvalue(o));
+  if (so != NULL) {
+    so->tt = ttypetag(o);
+    if (ttisinteger(o)) so->u.i = ivalue(o);
+    else if (ttisfloat(o)) so->u.n = fltvalue(o);
+    else if (ttistable(o)) so->u.t = t;
+    else so->u.s = s;
+  }
+}
+
+
+static STable placetable (Builder *B, Table *t) {
+  unsigned int i, asize = luaH_realasize(t);
+  STable st;
+  TValue k;
+  int n = 0;
+  for (i = 0; i < asize; i++)
+    n += !isempty(&t->array[i]);
+  for (i = 0; i < cast_uint(sizenode(t)); i++)
+    n += !isempty(gval(gnode(t, i)));
+  st.n = n;
+  st.kv = (SValue *)place(B, 2 * n * sizeof(SValue));
+  n = 0;
+  for (i = 0; i < asize; i++) {
+    if (!isempty(&t->array[i])) {
+      setivalue(&k, cast(lua_Integer, i) + 1);
+      placevalue(B, st.kv ? &st.kv[n] : NULL, &k);
+      placevalue(B, st.kv ? &st.kv[n + 1] : NULL, &t->array[i]);
+      n += 2;
+    }
+  }
+  for (i = 0; i < cast_uint(sizenode(t)); i++) {
+    Node *node = gnode(t, i);
+    if (!isempty(gval(node))) {
+      getnodekey(cast(lua_State *, NULL), &k, node);  /* no state here */
+      placevalue(B, st.kv ? &st.kv[n] : NULL, &k);
+      placevalue(B, st.kv ? &st.kv[n + 1] : NULL, gval(node));
+      n += 2;
+    }
+  }
+  return st;
+}
+
+
+static SProto *placeproto (Builder *B, const Proto *f, TString *psource) {
+  int i;
+  SProto *sp = (SProto *)place(B, sizeof(SProto));
+  Instruction *code = (Instruction *)placecopy(B, f->code,
+                                     f->sizecode * sizeof(Instruction));
+  ls_byte *lineinfo = (ls_byte *)placecopy(B, f->lineinfo,
+                                     f->sizelineinfo * sizeof(ls_byte));
+  AbsLineInfo *abslineinfo = (AbsLineInfo *)placecopy(B, f->abslineinfo,
+                                     f->sizeabslineinfo * sizeof(AbsLineInfo));
+  SValue *k = (SValue *)place(B, f->sizek * sizeof(SValue));
+  SProto **p = (SProto **)place(B, f->sizep * sizeof(SProto *));
+  SUpval *upvalues = (SUpval *)place(B, f->sizeupvalues * sizeof(SUpval));
+  SLocVar *locvars = (SLocVar *)place(B, f->sizelocvars * sizeof(SLocVar));
+  SString source = placestring(B, (f->source != psource) ? f->source : NULL);
+  SString body = placestring(B, f->body);
+  for (i = 0; i < f->sizek; i++)
+    placevalue(B, k ? &k[i] : NULL, &f->k[i]);
+  for (i = 0; i < f->sizeupvalues; i++) {
+    SString s = placestring(B, f->upvalues[i].name);
+    if (upvalues != NULL) {
+      upvalues[i].name = s;
+      upvalues[i].instack = f->upvalues[i].instack;
+      upvalues[i].idx = f->upvalues[i].idx;
+      upvalues[i].kind = f->upvalues[i].kind;
+    }
+  }
+  for (i = 0; i < f->sizelocvars; i++) {
+    SString s = placestring(B, f->locvars[i].varname);
+    if (locvars != NULL) {
+      locvars[i].varname = s;
+      locvars[i].startpc = f->locvars[i].startpc;
+      locvars[i].endpc = f->locvars[i].endpc;
+    }
+  }
+  for (i = 0; i < f->sizep; i++) {
+    SProto *c = placeproto(B, f->p[i], f->source);
+    if (p != NULL)
+      p[i] = c;
+  }
+  if (sp != NULL) {
+    sp->numparams = f->numparams;
+    sp->is_vararg = f->is_vararg;
+    sp->maxstacksize = f->maxstacksize;
+    sp->linedefined = f->linedefined;
+    sp->lastlinedefined = f->lastlinedefined;
+    sp->sizecode = f->sizecode;
+    sp->sizelineinfo = f->sizelineinfo;
+    sp->sizeabslineinfo = f->sizeabslineinfo;
+    sp->sizek = f->sizek;
+    sp->sizep = f->sizep;
+    sp->sizeupvalues = f->sizeupvalues;
+    sp->sizelocvars = f->sizelocvars;
+    sp->code = code;
+    sp->lineinfo = lineinfo;
+    sp->abslineinfo = abslineinfo;
+    sp->k = k;
+    sp->p = p;
+    sp->upvalues = upvalues;
+    sp->locvars = locvars;
+    sp->source = source;
+    sp->body = body;
+    sp->lazy = f->lazy;
+  }
+  return sp;
+}
+
+
+/*
+** Build a chunk from prototype 'f' in a block from allocator 'fa'.
+** Returns NULL if the block cannot be allocated.
+*/
+lua_Chunk *luaU_share (const Proto *f, lua_Alloc fa, void *ud) {
+  Builder B;
+  lua_Chunk *c;
+  size_t size;
+  B.block = NULL;
+  B.n = 0;
+  place(&B, sizeof(lua_Chunk));
+  placeproto(&B, f, NULL);
+  size = B.n;
+  B.block = (char *)(*fa)(ud, NULL, 0, size);
+  if (B.block == NULL)
+    return NULL;
+  B.n = 0;
+  c = (lua_Chunk *)place(&B, sizeof(lua_Chunk));
+  c->main = placeproto(&B, f, NULL);
+  lua_assert(B.n == size);
+  c->frealloc = fa;
+  c->ud = ud;
+  c->size = size;
+  c->ref = 1;
+  return c;
+}
+
+
+void luaU_releasechunk (lua_Chunk *c) {
+  if (luai_chunkdec(&c->ref) == 0)
+    (*c->frealloc)(c->ud, c, c->size, 0);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Loading
+** =======================================================
+*/
+
+typedef struct ChunkRef {
+  lua_Chunk *c;
+  struct ChunkRef *next;
+} ChunkRef;
+
+
+/*
+** Make the state hold a reference to chunk 'c', if it does not
+** hold one yet.
+*/
+static void holdchunk (lua_State *L, lua_Chunk *c) {
+  global_State *g = G(L);
+  ChunkRef *r;
+  for (r = g->chunkrefs; r != NULL; r = r->next) {
+    if (r->c == c)
+      return;  /* already held */
+  }
+  r = luaM_new(L, ChunkRef);
+  r->c = c;
+  r->next = g->chunkrefs;
+  g->chunkrefs = r;
+  luai_chunkinc(&c->ref);
+}
+
+
+void luaU_releasechunks (lua_State *L) {
+  global_State *g = G(L);
+  while (g->chunkrefs != NULL) {
+    ChunkRef *r = g->chunkrefs;
+    g->chunkrefs = r->next;
+    luaU_releasechunk(r->c);
+    luaM_free(L, r);
+  }
+}
+
+
+static TString *loadstring (lua_State *L, Proto *f, SString s) {
+  TString *ts;
+  if (s.s == NULL)
+    return NULL;
+  ts = luaS_newlstr(L, s.s, s.len);
+  luaC_objbarrier(L, f, ts);
+  return ts;
+}
+
+
+static void loadtable (lua_State *L, Proto *f, TValue *o, const STable *st);
+
+
+static void loadvalue (lua_State *L, Proto *f, TValue *o, const SValue *so) {
+  switch (so->tt) {
+    case LUA_VNIL: setnilvalue(o); break;
+    case LUA_VFALSE: setbfvalue(o); break;
+    case LUA_VTRUE: setbtvalue(o); break;
+    case LUA_VNUMFLT: setfltvalue(o, so->u.n); break;
+    case LUA_VNUMINT: setivalue(o, so->u.i); break;
+    case LUA_VSHRSTR: case LUA_VLNGSTR:
+      setsvalue2n(L, o, loadstring(L, f, so->u.s));
+      break;
+    case LUA_VTABLE: loadtable(L, f, o, &so->u.t); break;
+    default: lua_assert(0);
+  }
+}
+
+
+/*
+** Make table constant 'o' from 'st'. As in 'lundump.c', the table is
+** made big enough for all entries first, so that setting them does
+** not allocate while a key is not anchored anywhere.
+*/
+static void loadtable (lua_State *L, Proto *f, TValue *o, const STable *st) {
+  int i;
+  Table *t = luaH_new(L);
+  sethvalue(L, o, t);
+  luaC_objbarrier(L, f, t);
+  luaH_resize(L, t, 0, st->n);
+  for (i = 0; i < st->n; i++) {
+    TValue key, val;
+    loadvalue(L, f, &key, &st->kv[2 * i]);
+    loadvalue(L, f, &val, &st->kv[2 * i + 1]);
+    luaH_set(L, t, &key, &val);
+  }
+}
+
+
+/*
+** Fill prototype 'f' from 'sp'. As in 'lundump.c', every array is made
+** valid for the collector before anything that can collect is done.
+*/
+static void loadproto (lua_State *L, Proto *f, const SProto *sp,
+                       TString *psource) {
+  int i, n;
+  f->shared = 1;
+  f->code = sp->code;
+  f->sizecode = sp->sizecode;
+  f->lineinfo = sp->lineinfo;
+  f->sizelineinfo = sp->sizelineinfo;
+  f->abslineinfo = sp->abslineinfo;
+  f->sizeabslineinfo = sp->sizeabslineinfo;
+  f->numparams = sp->numparams;
+  f->is_vararg = sp->is_vararg;
+  f->maxstacksize = sp->maxstacksize;
+  f->linedefined = sp->linedefined;
+  f->lastlinedefined = sp->lastlinedefined;
+  f->source = loadstring(L, f, sp->source);
+  if (f->source == NULL)
+    f->source = psource;
+  f->lazy = sp->lazy;
+  f->body = loadstring(L, f, sp->body);
+  n = sp->sizek;
+  f->k = luaM_newvectorchecked(L, n, TValue);
+  f->sizek = n;
+  for (i = 0; i < n; i++)
+    setnilvalue(&f->k[i]);
+  for (i = 0; i < n; i++)
+    loadvalue(L, f, &f->k[i], &sp->k[i]);
+  n = sp->sizeupvalues;
+  f->upvalues = luaM_newvectorchecked(L, n, Upvaldesc);
+  f->sizeupvalues = n;
+  for (i = 0; i < n; i++)
+    f->upvalues[i].name = NULL;
+  for (i = 0; i < n; i++) {
+    f->upvalues[i].instack = sp->upvalues[i].instack;
+    f->upvalues[i].idx = sp->upvalues[i].idx;
+    f->upvalues[i].kind = sp->upvalues[i].kind;
+    f->upvalues[i].name = loadstring(L, f, sp->upvalues[i].name);
+  }
+  n = sp->sizelocvars;
+  f->locvars = luaM_newvectorchecked(L, n, LocVar);
+  f->sizelocvars = n;
+  for (i = 0; i < n; i++)
+    f->locvars[i].varname = NULL;
+  for (i = 0; i < n; i++) {
+    f->locvars[i].startpc = sp->locvars[i].startpc;
+    f->locvars[i].endpc = sp->locvars[i].endpc;
+    f->locvars[i].varname = loadstring(L, f, sp->locvars[i].varname);
+  }
+  n = sp->sizep;
+  f->p = luaM_newvectorchecked(L, n, Proto *);
+  f->sizep = n;
+  for (i = 0; i < n; i++)
+    f->p[i] = NULL;
+  for (i = 0; i < n; i++) {
+    f->p[i] = luaF_newproto(L);
+    luaC_objbarrier(L, f, f->p[i]);
+    loadproto(L, f->p[i], sp->p[i], f->source);
+  }
+}
+
+
+/*
+** Push a new closure for the main function of chunk 'c', with fresh
+** upvalues (as 'luaU_undump' does).
+*/
+LClosure *luaU_loadshared (lua_State *L, lua_Chunk *c) {
+  LClosure *cl;
+  holdchunk(L, c);
+  cl = luaF_newLclosure(L, c->main->sizeupvalues);
+  setclLvalue2s(L, L->top.p, cl);
+  luaD_inctop(L);
+  cl->p = luaF_newproto(L);
+  luaC_objbarrier(L, cl, cl->p);
+  loadproto(L, cl->p, c->main, NULL);
+  luaF_initupvals(L, cl);
+  return cl;
+}
+
+/* }====================================================== */
@@ -0,0 +1,434 @@
+/*
+** $Id: lsnap.c $
+** Heap snapshots
+** See Copyright Notice in lua.h
+*/
+
+#define lsnap_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "ldo.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "ltm.h"
+
+
+/*
+** A snapshot is a stream of records describing every collectable
+** object in the heap (a "node") and every reference between them (an
+** "edge"), following the same paths the collector uses when marking.
+** All integers are written as in 'ldump.c' (big-endian groups of 7
+** bits, last byte marked with 0x80); strings are a size (length + 1,
+** 0 for NULL) followed by their bytes.
+**
+** header: LUA_SNAPSIGNATURE, version byte, sizeof(size_t) byte
+** node:   'n', type tag byte, id, size, name
+** edge:   'e', from id, to id, kind byte, name
+** end:    'z'
+**
+** Ids are object addresses; id 0 is the synthetic root, whose edges
+** go to the main thread, the registry, the basic-type metatables and
+** the objects waiting to be finalized.  Edges flagged with
+** LUA_SNAPWEAK do not keep their targets alive.
+*/
+
+
+/* format of snapshot files */
+#define LUA_SNAPSIGNATURE	"\x1bLuaS"
+#define LUA_SNAPVERSION		1
+
+/* kinds of edges */
+#define LUA_SNAPINTERNAL	0  /* internal reference (proto, source, ...) */
+#define LUA_SNAPFIELD		1  /* table entry (array or hash part) */
+#define LUA_SNAPKEY		2  /* table key */
+#define LUA_SNAPMETA		3  /* metatable */
+#define LUA_SNAPUPVAL		4  /* closure upvalue */
+#define LUA_SNAPUSERVAL		5  /* userdata user value */
+#define LUA_SNAPCONST		6  /* prototype constant */
+#define LUA_SNAPSTACK		7  /* thread stack slot */
+#define LUA_SNAPROOT		8  /* edge from the root set */
+#define LUA_SNAPWEAK		0x80  /* flag: reference does not retain */
+
+
+/* maximum length of node and edge names */
+#define MAXNAME		LUA_IDSIZE
+
+
+typedef struct {
+  lua_State *L;
+  lua_Writer writer;
+  void *data;
+  TString *name;  /* "__name" */
+  int status;
+} SnapState;
+
+
+static void snapBlock (SnapState *S, const void *b, size_t size) {
+  if (S->status == 0 && size > 0) {
+    lua_unlock(S->L);
+    S->status = (*S->writer)(S->L, b, size, S->data);
+    lua_lock(S->L);
+  }
+}
+
+
+static void snapByte (SnapState *S, int y) {
+  lu_byte x = (lu_byte)y;
+  snapBlock(S, &x, 1);
+}
+
+
+#define DIBS    ((sizeof(size_t) * CHAR_BIT + 6) / 7)
+
+static void snapSize (SnapState *S, size_t x) {
+  lu_byte buff[DIBS];
+  int n = 0;
+  do {
+    buff[DIBS - (++n)] = x & 0x7f;  /* fill buffer in reverse order */
+    x >>= 7;
+  } while (x != 0);
+  buff[DIBS - 1] |= 0x80;  /* mark last byte */
+  snapBlock(S, buff + DIBS - n, n);
+}
+
+
+static void snapName (SnapState *S, const char *s, size_t len) {
+  if (s == NULL)
+    snapSize(S, 0);
+  else {
+    if (len > MAXNAME)
+      len = MAXNAME;
+    snapSize(S, len + 1);
+    snapBlock(S, s, len);
+  }
+}
+
+
+static void snapNode (SnapState *S, int tt, const void *o, size_t size,
+                      const char *name, size_t len) {
+  snapByte(S, 'n');
+  snapByte(S, tt);
+  snapSize(S, cast_sizet(o));
+  snapSize(S, size);
+  snapName(S, name, len);
+}
+
+
+static void snapEdge (SnapState *S, const void *from, const GCObject *to,
+                      int kind, const char *name) {
+  snapByte(S, 'e');
+  snapSize(S, cast_sizet(from));
+  snapSize(S, cast_sizet(to));
+  snapByte(S, kind);
+  snapName(S, name, (name == NULL) ? 0 : strlen(name));
+}
+
+
+/* edge to a value, if it is collectable */
+static void snapValueEdge (SnapState *S, const void *from, const TValue *v,
+                           int kind, const char *name) {
+  if (iscollectable(v))
+    snapEdge(S, from, gcvalue(v), kind, name);
+}
+
+
+static void snapEdgeN (SnapState *S, const void *from, const void *to,
+                       int kind, const char *name) {
+  if (to != NULL)
+    snapEdge(S, from, obj2gco(cast(const GCObject *, to)), kind, name);
+}
+
+
+/*
+** Name of an edge going out of a table entry with key 'k'
+*/
+static const char *keyname (const TValue *k, char *buff) {
+  if (ttisstring(k)) {
+    size_t len = tsslen(tsvalue(k));
+    if (len > MAXNAME)
+      len = MAXNAME;
+    memcpy(buff, getstr(tsvalue(k)), len);
+    buff[len] = '\0';
+  }
+  else if (ttisinteger(k))
+    l_sprintf(buff, MAXNAME + 1, "[" LUA_INTEGER_FMT "]",
+              (LUAI_UACINT)ivalue(k));
+  else if (ttisfloat(k))
+    l_sprintf(buff, MAXNAME + 1, "[" LUA_NUMBER_FMT "]",
+              (LUAI_UACNUMBER)fltvalue(k));
+  else
+    l_sprintf(buff, MAXNAME + 1, "[%s]", ttypename(ttype(k)));
+  return buff;
+}
+
+
+/*
+** Name of a function prototype: its source and line
+*/
+static size_t protoname (Proto *f, char *buff) {
+  char line[LUAI_MAXSHORTLEN];
+  size_t len;
+  if (f->source)
+    luaO_chunkid(buff, getstr(f->source), tsslen(f->source));
+  else
+    strcpy(buff, "?");
+  l_sprintf(line, sizeof(line), ":%d", f->linedefined);
+  len = strlen(buff);
+  if (len + strlen(line) <= MAXNAME) {
+    strcpy(buff + len, line);
+    len += strlen(line);
+  }
+  return len;
+}
+
+
+/*
+** Weakness of a table, as in 'traversetable': bit 0 for weak keys,
+** bit 1 for weak values.
+*/
+static int weakmode (global_State *g, Table *h) {
+  const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
+  int w = 0;
+  if (mode && ttisshrstring(mode)) {
+    const char *smode = getshrstr(tsvalue(mode));
+    if (strchr(smode, 'k')) w |= 1;
+    if (strchr(smode, 'v')) w |= 2;
+  }
+  return w;
+}
+
+
+static void snapTable (SnapState *S, Table *h) {
+  char buff[MAXNAME + 1];
+  unsigned int i;
+  unsigned int asize = luaH_realasize(h);
+  Node *n, *limit = gnode(h, cast_sizet(sizenode(h)));
+  int w = weakmode(G(S->L), h);
+  int kweak = (w & 1) ? LUA_SNAPWEAK : 0;
+  int vweak = (w & 2) ? LUA_SNAPWEAK : 0;
+  size_t size = sizeof(Table) + asize * sizeof(TValue);
+  if (!isdummy(h))
+    size += sizenode(h) * sizeof(Node);
+  snapNode(S, LUA_VTABLE, h, size, NULL, 0);
+  snapEdgeN(S, h, h->metatable, LUA_SNAPMETA, NULL);
+  for (i = 0; i < asize; i++) {
+    if (iscollectable(&h->array[i])) {
+      l_sprintf(buff, sizeof(buff), "[%u]", i + 1);
+      snapValueEdge(S, h, &h->array[i], LUA_SNAPFIELD | vweak, buff);
+    }
+  }
+  for (n = gnode(h, 0); n < limit; n++) {
+    TValue k;
+    if (isempty(gval(n)))
+      continue;
+    getnodekey(S->L, &k, n);
+    keyname(&k, buff);
+    if (keyiscollectable(n) && !ttisstring(&k))  /* strings are values */
+      snapEdge(S, h, gckey(n), LUA_SNAPKEY | kweak, buff);
+    else if (keyiscollectable(n))
+      snapEdge(S, h, gckey(n), LUA_SNAPKEY, buff);
+    snapValueEdge(S, h, gval(n), LUA_SNAPFIELD | vweak, buff);
+  }
+}
+
+
+static void snapProto (SnapState *S, Proto *f) {
+  char buff[MAXNAME + 1];
+  int i;
+  size_t len = protoname(f, buff);
+  size_t size = sizeof(Proto) +
+                f->sizep * sizeof(Proto *) +
+                f->sizek * sizeof(TValue) +
+                f->sizelocvars * sizeof(LocVar) +
+                f->sizeupvalues * sizeof(Upvaldesc);
+  if (!f->shared)  /* else code and line info are not in the heap */
+    size += f->sizecode * sizeof(Instruction) +
+            f->sizelineinfo * sizeof(ls_byte) +
+            f->sizeabslineinfo * sizeof(AbsLineInfo);
+  snapNode(S, LUA_VPROTO, f, size, buff, len);
+  snapEdgeN(S, f, f->source, LUA_SNAPINTERNAL, "source");
+  snapEdgeN(S, f, f->body, LUA_SNAPINTERNAL, "body");
+  snapEdgeN(S, f, f->image, LUA_SNAPINTERNAL, "image");
+  for (i = 0; i < f->sizek; i++)
+    snapValueEdge(S, f, &f->k[i], LUA_SNAPCONST, NULL);
+  for (i = 0; i < f->sizep; i++)
+    snapEdgeN(S, f, f->p[i], LUA_SNAPINTERNAL, "proto");
+  for (i = 0; i < f->sizeupvalues; i++)
+    snapEdgeN(S, f, f->upvalues[i].name, LUA_SNAPINTERNAL, "debug");
+  for (i = 0; i < f->sizelocvars; i++)
+    snapEdgeN(S, f, f->locvars[i].varname, LUA_SNAPINTERNAL, "debug");
+}
+
+
+static void snapLclosure (SnapState *S, LClosure *cl) {
+  char buff[MAXNAME + 1];
+  int i;
+  size_t len = (cl->p != NULL) ? protoname(cl->p, buff) : 0;
+  snapNode(S, LUA_VLCL, cl, sizeLclosure(cl->nupvalues),
+              (len > 0) ? buff : NULL, len);
+  snapEdgeN(S, cl, cl->p, LUA_SNAPINTERNAL, "proto");
+  for (i = 0; i < cl->nupvalues; i++) {
+    TString *name = NULL;
+    if (cl->p != NULL && i < cl->p->sizeupvalues)
+      name = cl->p->upvalues[i].name;
+    snapEdgeN(S, cl, cl->upvals[i], LUA_SNAPUPVAL,
+                 (name != NULL) ? getstr(name) : NULL);
+  }
+}
+
+
+static void snapCclosure (SnapState *S, CClosure *cl) {
+  char buff[MAXNAME + 1];
+  int i;
+  lua_pointer2str(buff, sizeof(buff), cast_voidp(cast_sizet(cl->f)));
+  snapNode(S, LUA_VCCL, cl, sizeCclosure(cl->nupvalues), buff, strlen(buff));
+  for (i = 0; i < cl->nupvalues; i++)
+    snapValueEdge(S, cl, &cl->upvalue[i], LUA_SNAPUPVAL, NULL);
+}
+
+
+static void snapUdata (SnapState *S, Udata *u) {
+  int i;
+  const TValue *name = NULL;
+  if (u->metatable != NULL)
+    name = luaH_getshortstr(u->metatable, S->name);
+  if (name != NULL && ttisstring(name))
+    snapNode(S, LUA_VUSERDATA, u, sizeudata(u->nuvalue, u->len),
+                getstr(tsvalue(name)), tsslen(tsvalue(name)));
+  else
+    snapNode(S, LUA_VUSERDATA, u, sizeudata(u->nuvalue, u->len), NULL, 0);
+  snapEdgeN(S, u, u->metatable, LUA_SNAPMETA, NULL);
+  for (i = 0; i < u->nuvalue; i++)
+    snapValueEdge(S, u, &u->uv[i].uv, LUA_SNAPUSERVAL, NULL);
+}
+
+
+static void snapThread (SnapState *S, lua_State *th) {
+  UpVal *uv;
+  StkId o;
+  size_t size = sizeof(lua_State) + LUA_EXTRASPACE +
+                th->nci * sizeof(CallInfo);
+  if (th->stack.p != NULL)
+    size += (stacksize(th) + EXTRA_STACK) * sizeof(StackValue);
+  if (th == G(S->L)->mainthread)
+    snapNode(S, LUA_VTHREAD, th, size, "main", 4);
+  else
+    snapNode(S, LUA_VTHREAD, th, size, NULL, 0);
+  if (th->stack.p == NULL)
+    return;  /* stack not completely built yet */
+  for (o = th->stack.p; o < th->top.p; o++)
+    snapValueEdge(S, th, s2v(o), LUA_SNAPSTACK, NULL);
+  for (uv = th->openupval; uv != NULL; uv = uv->u.open.next)
+    snapEdge(S, th, obj2gco(uv), LUA_SNAPINTERNAL, "openupval");
+}
+
+
+static void snapObject (SnapState *S, GCObject *o) {
+  switch (o->tt) {
+    case LUA_VSHRSTR: {
+      TString *ts = gco2ts(o);
+      snapNode(S, o->tt, o, sizelstring(ts->shrlen), getstr(ts), ts->shrlen);
+      break;
+    }
+    case LUA_VLNGSTR: {
+      TString *ts = gco2ts(o);
+      snapNode(S, o->tt, o, sizelstring(ts->u.lnglen),
+                  getstr(ts), ts->u.lnglen);
+      break;
+    }
+    case LUA_VUPVAL: {
+      UpVal *uv = gco2upv(o);
+      snapNode(S, o->tt, o, sizeof(UpVal), NULL, 0);
+      snapValueEdge(S, uv, uv->v.p, LUA_SNAPINTERNAL, NULL);
+      break;
+    }
+    case LUA_VTABLE: snapTable(S, gco2t(o)); break;
+    case LUA_VUSERDATA: snapUdata(S, gco2u(o)); break;
+    case LUA_VLCL: snapLclosure(S, gco2lcl(o)); break;
+    case LUA_VCCL: snapCclosure(S, gco2ccl(o)); break;
+    case LUA_VPROTO: snapProto(S, gco2p(o)); break;
+    case LUA_VTHREAD: snapThread(S, gco2th(o)); break;
+    default: lua_assert(0);
+  }
+}
+
+
+static void snapList (SnapState *S, GCObject *o) {
+  for (; o != NULL && S->status == 0; o = o->next)
+    snapObject(S, o);
+}
+
+
+/*
+** The root set, as in 'restartcollection'
+*/
+static void snapRoots (SnapState *S) {
+  global_State *g = G(S->L);
+  GCObject *o;
+  int i;
+  snapNode(S, LUA_TNIL, NULL,
+           sizeof(global_State) + g->strt.size * sizeof(TString *),
+           "(root)", 6);
+  snapEdgeN(S, NULL, g->mainthread, LUA_SNAPROOT, "mainthread");
+  snapValueEdge(S, NULL, &g->l_registry, LUA_SNAPROOT, "registry");
+  for (i = 0; i < LUA_NUMTAGS; i++)
+    snapEdgeN(S, NULL, g->mt[i], LUA_SNAPROOT, ttypename(i));
+  for (o = g->tobefnz; o != NULL; o = o->next)
+    snapEdge(S, NULL, o, LUA_SNAPROOT, "tobefnz");
+}
+
+
+static void snapHeap (lua_State *L, void *ud) {
+  SnapState *S = cast(SnapState *, ud);
+  global_State *g = G(L);
+  S->name = luaS_newliteral(L, "__name");
+  snapBlock(S, LUA_SNAPSIGNATURE, sizeof(LUA_SNAPSIGNATURE) - sizeof(char));
+  snapByte(S, LUA_SNAPVERSION);
+  snapByte(S, sizeof(size_t));
+  snapRoots(S);
+  snapList(S, g->allgc);
+  snapList(S, g->finobj);
+  snapList(S, g->tobefnz);
+  snapList(S, g->fixedgc);
+  snapByte(S, 'z');
+}
+
+
+/*
+** Write a snapshot of the whole heap. The collector cannot run while
+** the lists are being walked (the writer may allocate), so it is
+** stopped for the duration of the walk and restarted even if the
+** writer raises an error.
+*/
+int luaC_snapshot (lua_State *L, lua_Writer w, void *data) {
+  global_State *g = G(L);
+  SnapState S;
+  int status;
+  lu_byte oldstp = g->gcstp;
+  lu_byte oldstopem = g->gcstopem;
+  S.L = L;
+  S.writer = w;
+  S.data = data;
+  S.status = 0;
+  g->gcstp |= GCSTPGC;  /* avoid GC steps */
+  g->gcstopem = 1;  /* and emergency collections */
+  status = luaD_rawrunprotected(L, snapHeap, &S);
+  g->gcstp = oldstp;
+  g->gcstopem = oldstopem;
+  if (l_unlikely(status != LUA_OK))
+    luaD_throw(L, status);
+  return S.status;
+}
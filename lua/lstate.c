@@ -26,6 +26,7 @@
 #include "lstring.h"
 #include "ltable.h"
 #include "ltm.h"
+#include "lundump.h"
 
 
 
@@ -102,56 +103,90 @@ LUA_API int lua_setcstacklimit (lua_State *L, unsigned int limit) {
 }
 
 
+/*
+** CallInfo structures are allocated in chunks of consecutive elements
+** (still linked in a list), so that calls at neighbouring depths use
+** neighbouring memory and one allocation serves several depths. The
+** size of a chunk depends only on the number 'n' of elements before
+** it in the list: sizes double from CIMINCHUNK up to CIMAXCHUNK.
+*/
+#define CIMINCHUNK	4
+#define CIMAXCHUNK	64
+
+#define cichunk(n)  \
+	((n) < CIMINCHUNK ? CIMINCHUNK : (n) > CIMAXCHUNK ? CIMAXCHUNK : (n))
+
+
 CallInfo *luaE_extendCI (lua_State *L) {
   CallInfo *ci;
+  int i;
+  int size = cichunk(L->nci);
   lua_assert(L->ci->next == NULL);
-  ci = luaM_new(L, CallInfo);
+  ci = luaM_newvector(L, size, CallInfo);
   lua_assert(L->ci->next == NULL);
+  for (i = 0; i < size; i++) {
+    ci[i].previous = (i == 0) ? L->ci : &ci[i - 1];
+    ci[i].next = (i == size - 1) ? NULL : &ci[i + 1];
+    ci[i].u.l.trap = 0;
+  }
   L->ci->next = ci;
-  ci->previous = L->ci;
-  ci->next = NULL;
-  ci->u.l.trap = 0;
-  L->nci++;
+  L->nci += size;
   return ci;
 }
 
 
+/*
+** Free the chunks of a CallInfo list from 'ci', the first element of
+** a chunk with 'n' elements before it; returns the number of elements
+** freed.
+*/
+static int freechunks (lua_State *L, CallInfo *ci, int n) {
+  int n0 = n;
+  while (ci != NULL) {
+    int size = cichunk(n);
+    CallInfo *next = ci[size - 1].next;
+    luaM_freearray(L, ci, size);
+    n += size;
+    ci = next;
+  }
+  return n - n0;
+}
+
+
 /*
 ** free all CallInfo structures not in use by a thread
 */
 static void freeCI (lua_State *L) {
-  CallInfo *ci = L->ci;
-  CallInfo *next = ci->next;
-  ci->next = NULL;
-  while ((ci = next) != NULL) {
-    next = ci->next;
-    luaM_free(L, ci);
-    L->nci--;
-  }
+  lua_assert(L->ci == &L->base_ci);
+  L->nci -= freechunks(L, L->base_ci.next, 0);
+  L->base_ci.next = NULL;
 }
 
 
 /*
-** free half of the CallInfo structures not in use by a thread,
-** keeping the first one.
+** free half of the chunks of CallInfo structures not in use by a
+** thread, keeping at least one.
 */
 void luaE_shrinkCI (lua_State *L) {
-  CallInfo *ci = L->ci->next;  /* first free CallInfo */
-  CallInfo *next;
-  if (ci == NULL)
-    return;  /* no extra elements */
-  while ((next = ci->next) != NULL) {  /* two extra elements? */
-    CallInfo *next2 = next->next;  /* next's next */
-    ci->next = next2;  /* remove next from the list */
-    L->nci--;
-    luaM_free(L, next);  /* free next */
-    if (next2 == NULL)
-      break;  /* no more elements */
-    else {
-      next2->previous = ci;
-      ci = next2;  /* continue */
-    }
+  CallInfo *ci;
+  CallInfo *last = &L->base_ci;  /* last element kept */
+  int pos = 0;  /* position of 'L->ci' in the list */
+  int n = 0;  /* number of elements up to 'last' */
+  int m, nfree;
+  for (ci = &L->base_ci; ci != L->ci; ci = ci->next)
+    pos++;
+  while (n < pos) {  /* skip chunks in use */
+    last = last->next + cichunk(n) - 1;
+    n += cichunk(n);
+  }
+  for (m = n, nfree = 0; m < L->nci; nfree++)  /* count free chunks */
+    m += cichunk(m);
+  for (nfree = (nfree + 1) / 2; nfree > 0; nfree--) {  /* keep half */
+    last = last->next + cichunk(n) - 1;
+    n += cichunk(n);
   }
+  L->nci -= freechunks(L, last->next, n);
+  last->next = NULL;
 }
 
 
@@ -177,18 +212,47 @@ LUAI_FUNC void luaE_incCstack (lua_State *L) {
 }
 
 
-static void stack_init (lua_State *L1, lua_State *L) {
+/*
+** Take from the pool a stack with at least 'size' slots (the most
+** recently pooled one, if 'size' is 0) together with its CallInfo
+** list. Returns the size of the stack, or 0 if there is none.
+*/
+static int reusestack (lua_State *L1, global_State *g, int size) {
+  int i = g->nstackpool - 1;
+  PooledStack *p;
+  while (i >= 0 && g->stackpool[i].size < size)
+    i--;
+  if (i < 0)
+    return 0;
+  p = &g->stackpool[i];
+  size = p->size;
+  L1->stack.p = p->stack;
+  L1->base_ci.next = p->ci;
+  if (p->ci != NULL)
+    p->ci->previous = &L1->base_ci;
+  L1->nci = p->nci;
+  *p = g->stackpool[--g->nstackpool];  /* remove it from the pool */
+  return size;
+}
+
+
+static void stack_init (lua_State *L1, lua_State *L, int size) {
   int i; CallInfo *ci;
-  /* initialize stack array */
-  L1->stack.p = luaM_newvector(L, BASIC_STACK_SIZE + EXTRA_STACK, StackValue);
+  size = (size < BASIC_STACK_SIZE) ? BASIC_STACK_SIZE
+       : (size > LUAI_MAXSTACK) ? LUAI_MAXSTACK : size;
+  ci = &L1->base_ci;
+  ci->next = NULL;
+  if ((i = reusestack(L1, G(L), size)) > 0)
+    size = i;
+  else  /* initialize stack array */
+    L1->stack.p = luaM_newvector(L, size + EXTRA_STACK, StackValue);
   L1->tbclist.p = L1->stack.p;
-  for (i = 0; i < BASIC_STACK_SIZE + EXTRA_STACK; i++)
+  for (i = 0; i < size + EXTRA_STACK; i++)
     setnilvalue(s2v(L1->stack.p + i));  /* erase new stack */
   L1->top.p = L1->stack.p;
-  L1->stack_last.p = L1->stack.p + BASIC_STACK_SIZE;
+  L1->stack_last.p = L1->stack.p + size;
   /* initialize first ci */
-  ci = &L1->base_ci;
-  ci->next = ci->previous = NULL;
+  ci->previous = NULL;
   ci->callstatus = CIST_C;
   ci->func.p = L1->top.p;
   ci->u.c.k = NULL;
@@ -210,6 +274,35 @@ static void freestack (lua_State *L) {
 }
 
 
+/*
+** Keep the stack of a dead thread, with its CallInfo list, in the
+** pool for new threads, if it is not too big and there is room.
+** (Values left in the stack are erased when it is reused.)
+*/
+static int poolstack (lua_State *L1, global_State *g) {
+  PooledStack *p;
+  if (L1->stack.p == NULL || g->nstackpool >= LUAI_STACKPOOL ||
+      stacksize(L1) > LUAI_MAXPOOLSTACK)
+    return 0;
+  p = &g->stackpool[g->nstackpool++];
+  p->stack = L1->stack.p;
+  p->size = stacksize(L1);
+  p->ci = L1->base_ci.next;
+  p->nci = L1->nci;
+  return 1;
+}
+
+
+static void freestackpool (lua_State *L) {
+  global_State *g = G(L);
+  while (g->nstackpool > 0) {
+    PooledStack *p = &g->stackpool[--g->nstackpool];
+    freechunks(L, p->ci, 0);
+    luaM_freearray(L, p->stack, p->size + EXTRA_STACK);
+  }
+}
+
+
 /*
 ** Create registry table and its predefined values
 */
@@ -231,7 +324,7 @@ static void init_registry (lua_State *L, global_State *g) {
 static void f_luaopen (lua_State *L, void *ud) {
   global_State *g = G(L);
   UNUSED(ud);
-  stack_init(L, L);  /* init stack */
+  stack_init(L, L, 0);  /* init stack */
   init_registry(L, g);
   luaS_init(L);
   luaT_init(L);
@@ -259,6 +352,9 @@ static void preinit_thread (lua_State *L, global_State *g) {
   L->basehookcount = 0;
   L->allowhook = 1;
   resethookcount(L);
+  L->quota = 0;
+  L->quotawhat = LUA_QUOTAYIELD;
+  resetbudget(L);
   L->openupval = NULL;
   L->status = LUA_OK;
   L->errfunc = 0;
@@ -279,13 +375,15 @@ static void close_state (lua_State *L) {
     luai_userstateclose(L);
   }
   luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
+  luaU_releasechunks(L);  /* after the prototypes using them are gone */
+  freestackpool(L);
   freestack(L);
   lua_assert(gettotalbytes(g) == sizeof(LG));
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
 }
 
 
-LUA_API lua_State *lua_newthread (lua_State *L) {
+LUA_API lua_State *lua_newthreadsize (lua_State *L, int size) {
   global_State *g = G(L);
   GCObject *o;
   lua_State *L1;
@@ -306,18 +404,24 @@ LUA_API lua_State *lua_newthread (lua_State *L) {
   memcpy(lua_getextraspace(L1), lua_getextraspace(g->mainthread),
          LUA_EXTRASPACE);
   luai_userstatethread(L, L1);
-  stack_init(L1, L);  /* init stack */
+  stack_init(L1, L, size);  /* init stack */
   lua_unlock(L);
   return L1;
 }
 
 
+LUA_API lua_State *lua_newthread (lua_State *L) {
+  return lua_newthreadsize(L, 0);
+}
+
+
 void luaE_freethread (lua_State *L, lua_State *L1) {
   LX *l = fromstate(L1);
   luaF_closeupval(L1, L1->stack.p);  /* close all upvalues */
   lua_assert(L1->openupval == NULL);
   luai_userstatefree(L, L1);
-  freestack(L1);
+  if (!poolstack(L1, G(L)))
+    freestack(L1);
   luaM_free(L, l);
 }
 
@@ -386,11 +490,18 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->strt.hash = NULL;
   setnilvalue(&g->l_registry);
   g->panic = NULL;
+  g->selectf = NULL;
+  g->inlinecode = 0;
+  g->optcode = 0;
+  g->lazycode = 0;
+  g->chunkrefs = NULL;
   g->gcstate = GCSpause;
   g->gckind = KGC_INC;
   g->gcstopem = 0;
   g->gcemergency = 0;
   g->finobj = g->tobefnz = g->fixedgc = NULL;
+  g->ephwork = NULL;
+  g->nstackpool = 0;
   g->firstold1 = g->survival = g->old1 = g->reallyold = NULL;
   g->finobjsur = g->finobjold1 = g->finobjrold = NULL;
   g->sweepgc = NULL;
@@ -400,6 +511,11 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
   g->lastatomic = 0;
+  g->memlimit = 0;
+  g->trimf = NULL;
+  g->slabmax = 0;
+  g->gctrim = LUAI_GCTRIM;
+  g->released = 0;
   setivalue(&g->nilvalue, 0);  /* to signal that state is not yet built */
   setgcparam(g->gcpause, LUAI_GCPAUSE);
   setgcparam(g->gcstepmul, LUAI_GCMUL);
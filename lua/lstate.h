@@ -147,6 +147,27 @@ struct lua_longjmp;  /* defined in ldo.c */
 #define stacksize(th)	cast_int((th)->stack_last.p - (th)->stack.p)
 
 
+/*
+** Stacks of collected threads, with their lists of CallInfo, are kept
+** in a pool to be reused by new threads. LUAI_STACKPOOL is the number
+** of stacks kept and LUAI_MAXPOOLSTACK the size of the largest one.
+*/
+#if !defined(LUAI_STACKPOOL)
+#define LUAI_STACKPOOL		32
+#endif
+
+#if !defined(LUAI_MAXPOOLSTACK)
+#define LUAI_MAXPOOLSTACK	(8*BASIC_STACK_SIZE)
+#endif
+
+typedef struct PooledStack {
+  StkId stack;
+  int size;  /* size of 'stack', not counting EXTRA_STACK */
+  int nci;  /* number of elements in 'ci' */
+  struct CallInfo *ci;  /* list of free CallInfo */
+} PooledStack;
+
+
 /* kinds of Garbage Collection */
 #define KGC_INC		0	/* incremental gc */
 #define KGC_GEN		1	/* generational gc */
@@ -183,6 +204,7 @@ struct CallInfo {
       const Instruction *savedpc;
       volatile l_signalT trap;  /* function is tracing lines/counts */
       int nextraargs;  /* # of extra arguments in vararg functions */
+      int shift;  /* slots between 'func' + 1 and the function's base */
     } l;
     struct {  /* only for C functions */
       lua_KFunction k;  /* continuation in case of yields */
@@ -222,6 +244,7 @@ struct CallInfo {
 #if defined(LUA_COMPAT_LT_LE)
 #define CIST_LEQ	(1<<13)  /* using __lt for __le */
 #endif
+#define CIST_DIRECT	(1<<14)	/* C function called by 'luaV_execute' itself */
 
 
 /*
@@ -258,6 +281,11 @@ typedef struct global_State {
   l_mem GCdebt;  /* bytes allocated not yet compensated by the collector */
   lu_mem GCestimate;  /* an estimate of the non-garbage memory in use */
   lu_mem lastatomic;  /* see function 'genstep' in file 'lgc.c' */
+  lu_mem memlimit;  /* maximum number of bytes in use (0 for no limit) */
+  lua_Trim trimf;  /* function to release free memory of 'frealloc' */
+  size_t slabmax;  /* blocks up to this size do not come from 'malloc' */
+  lu_mem gctrim;  /* free memory the allocator may keep after a cycle */
+  lu_mem released;  /* total memory released by 'trimf' */
   stringtable strt;  /* hash table for strings */
   TValue l_registry;
   TValue nilvalue;  /* a nil value */
@@ -283,6 +311,9 @@ typedef struct global_State {
   GCObject *allweak;  /* list of all-weak tables */
   GCObject *tobefnz;  /* list of userdata to be GC */
   GCObject *fixedgc;  /* list of objects not to be collected */
+  struct EphWork *ephwork;  /* pending ephemeron entries (see 'lgc.c') */
+  PooledStack stackpool[LUAI_STACKPOOL];  /* stacks for new threads */
+  int nstackpool;  /* number of stacks in 'stackpool' */
   /* fields for generational collector */
   GCObject *survival;  /* start of objects that survived one GC cycle */
   GCObject *old1;  /* start of old1 objects */
@@ -293,6 +324,11 @@ typedef struct global_State {
   GCObject *finobjrold;  /* list of really old objects with finalizers */
   struct lua_State *twups;  /* list of threads with open upvalues */
   lua_CFunction panic;  /* to be called in unprotected errors */
+  lua_CFunction selectf;  /* 'select' answered inline by OP_SELECT */
+  lu_byte inlinecode;  /* inline small local functions in new chunks? */
+  lu_byte optcode;  /* optimization level of new chunks */
+  lu_byte lazycode;  /* compile function bodies on their first call? */
+  struct ChunkRef *chunkrefs;  /* shared chunks loaded in this state */
   struct lua_State *mainthread;
   TString *memerrmsg;  /* message for memory-allocation errors */
   TString *tmname[TM_N];  /* array with tag-method names */
@@ -310,7 +346,7 @@ struct lua_State {
   CommonHeader;
   lu_byte status;
   lu_byte allowhook;
-  unsigned short nci;  /* number of items in 'ci' list */
+  int nci;  /* number of items in 'ci' list */
   StkIdRel top;  /* first free slot in the stack */
   global_State *l_G;
   CallInfo *ci;  /* call info for current function */
@@ -328,6 +364,9 @@ struct lua_State {
   int oldpc;  /* last pc traced */
   int basehookcount;
   int hookcount;
+  int quota;  /* calls and backward jumps allowed per slice (0 = no limit) */
+  int budget;  /* what is left of the current slice */
+  lu_byte quotawhat;  /* LUA_QUOTAYIELD or LUA_QUOTAERROR */
   volatile l_signalT hookmask;
 };
 
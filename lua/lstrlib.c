@@ -1866,8 +1866,15 @@ static void createmetatable (lua_State *L) {
 /*
 ** Open string library
 */
+/* functions in 'strlib' that are leaves (see 'lua_pushleaf') */
+static const char *const strleaves[] = {
+  "len", "lower", "upper", "rep", "reverse", NULL
+};
+
+
 LUAMOD_API int luaopen_string (lua_State *L) {
   luaL_newlib(L, strlib);
+  luaL_setleaves(L, strleaves);
   createmetatable(L);
   return 1;
 }
@@ -174,7 +174,7 @@ static Node *mainpositionTV (const Table *t, const TValue *key) {
       void *p = pvalue(key);
       return hashpointer(t, p);
     }
-    case LUA_VLCF: {
+    case LUA_VLCF: case LUA_VLEAF: {
       lua_CFunction f = fvalue(key);
       return hashpointer(t, f);
     }
@@ -226,7 +226,7 @@ static int equalkey (const TValue *k1, const Node *n2, int deadok) {
       return luai_numeq(fltvalue(k1), fltvalueraw(keyval(n2)));
     case LUA_VLIGHTUSERDATA:
       return pvalue(k1) == pvalueraw(keyval(n2));
-    case LUA_VLCF:
+    case LUA_VLCF: case LUA_VLEAF:
       return fvalue(k1) == fvalueraw(keyval(n2));
     case ctb(LUA_VLNGSTR):
       return luaS_eqlngstr(tsvalue(k1), keystrval(n2));
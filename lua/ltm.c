@@ -235,36 +235,49 @@ int luaT_callorderiTM (lua_State *L, const TValue *p1, int v2,
 }
 
 
+/*
+** The extra arguments of a vararg function stay where the caller left
+** them. If there are any, the function's frame starts right above
+** them, at 'ci_base', with the fixed parameters moved there; 'func'
+** stays with the function, so returns need no correction.
+*/
 void luaT_adjustvarargs (lua_State *L, int nfixparams, CallInfo *ci,
                          const Proto *p) {
   int i;
   int actual = cast_int(L->top.p - ci->func.p) - 1;  /* number of arguments */
   int nextra = actual - nfixparams;  /* number of extra arguments */
   ci->u.l.nextraargs = nextra;
-  luaD_checkstack(L, p->maxstacksize + 1);
-  /* copy function to the top of the stack */
-  setobjs2s(L, L->top.p++, ci->func.p);
-  /* move fixed parameters to the top of the stack */
+  if (nextra == 0)
+    return;  /* frame can stay where it is */
+  luaD_checkstack(L, p->maxstacksize);
+  /* move fixed parameters to the top of the stack, the new base */
   for (i = 1; i <= nfixparams; i++) {
     setobjs2s(L, L->top.p++, ci->func.p + i);
     setnilvalue(s2v(ci->func.p + i));  /* erase original parameter (for GC) */
   }
-  ci->func.p += actual + 1;
-  ci->top.p += actual + 1;
+  ci->u.l.shift = actual;
+  ci->top.p += actual;
+  lua_assert(ci_base(ci) == L->top.p - nfixparams);
   lua_assert(L->top.p <= ci->top.p && ci->top.p <= L->stack_last.p);
 }
 
 
-void luaT_getvarargs (lua_State *L, CallInfo *ci, StkId where, int wanted) {
+/*
+** Copy 'wanted' varargs (all if negative) to 'where', skipping the
+** 'first' ones.
+*/
+void luaT_getvarargs (lua_State *L, CallInfo *ci, StkId where, int first,
+                                    int wanted) {
   int i;
-  int nextra = ci->u.l.nextraargs;
+  int nextra = ci->u.l.nextraargs - first;
+  lua_assert(0 <= nextra);
   if (wanted < 0) {
     wanted = nextra;  /* get all extra arguments available */
     checkstackGCp(L, nextra, where);  /* ensure stack space */
     L->top.p = where + nextra;  /* next instruction will need top */
   }
   for (i = 0; i < wanted && i < nextra; i++)
-    setobjs2s(L, where + i, ci->func.p - nextra + i);
+    setobjs2s(L, where + i, ci_base(ci) - nextra + i);
   for (; i < wanted; i++)   /* complete required results with nil */
     setnilvalue(s2v(where + i));
 }
@@ -126,6 +126,20 @@ typedef int (*lua_Writer) (lua_State *L, const void *p, size_t sz, void *ud);
 typedef void * (*lua_Alloc) (void *ud, void *ptr, size_t osize, size_t nsize);
 
 
+/*
+** Type for functions that release the free memory held by an allocator
+** beyond 'keep' bytes (to 'malloc' or the system, as the allocator
+** can); they return the number of bytes released
+*/
+typedef size_t (*lua_Trim) (void *ud, size_t keep);
+
+
+/*
+** Type for compiled chunks shared by several states
+*/
+typedef struct lua_Chunk lua_Chunk;
+
+
 /*
 ** Type for warning functions
 */
@@ -163,7 +177,9 @@ extern const char lua_ident[];
 */
 LUA_API lua_State *(lua_newstate) (lua_Alloc f, void *ud);
 LUA_API void       (lua_close) (lua_State *L);
+LUA_API lua_State *(lua_clonestate) (lua_State *L, lua_Alloc f, void *ud);
 LUA_API lua_State *(lua_newthread) (lua_State *L);
+LUA_API lua_State *(lua_newthreadsize) (lua_State *L, int size);
 LUA_API int        (lua_closethread) (lua_State *L, lua_State *from);
 LUA_API int        (lua_resetthread) (lua_State *L);  /* Deprecated! */
 
@@ -251,6 +267,7 @@ LUA_API const char *(lua_pushvfstring) (lua_State *L, const char *fmt,
                                                       va_list argp);
 LUA_API const char *(lua_pushfstring) (lua_State *L, const char *fmt, ...);
 LUA_API void  (lua_pushcclosure) (lua_State *L, lua_CFunction fn, int n);
+LUA_API void  (lua_pushleaf) (lua_State *L, lua_CFunction fn);
 LUA_API void  (lua_pushboolean) (lua_State *L, int b);
 LUA_API void  (lua_pushlightuserdata) (lua_State *L, void *p);
 LUA_API int   (lua_pushthread) (lua_State *L);
@@ -300,9 +317,16 @@ LUA_API int   (lua_pcallk) (lua_State *L, int nargs, int nresults, int errfunc,
 
 LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
                           const char *chunkname, const char *mode);
+LUA_API int   (lua_loadimage) (lua_State *L, const char *buff, size_t sz,
+                               const char *chunkname, const char *mode);
 
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data, int strip);
 
+LUA_API lua_Chunk *(lua_sharechunk) (lua_State *L, lua_Alloc f, void *ud);
+LUA_API void (lua_loadchunk) (lua_State *L, lua_Chunk *c);
+LUA_API void (lua_releasechunk) (lua_Chunk *c);
+LUA_API int (lua_snapshot) (lua_State *L, lua_Writer writer, void *data);
+
 
 /*
 ** coroutine functions
@@ -313,9 +337,18 @@ LUA_API int  (lua_resume)     (lua_State *L, lua_State *from, int narg,
                                int *nres);
 LUA_API int  (lua_status)     (lua_State *L);
 LUA_API int (lua_isyieldable) (lua_State *L);
+LUA_API void (lua_setquota)   (lua_State *L, int quota, int what);
+LUA_API int  (lua_getquota)   (lua_State *L, int *left);
 
 #define lua_yield(L,n)		lua_yieldk(L, (n), 0, NULL)
 
+/* what to do when a thread runs out of its quota */
+#define LUA_QUOTAYIELD	0
+#define LUA_QUOTAERROR	1
+
+/* a thread out of its quota yields a light userdata pointing here */
+extern const char lua_quotamark[];
+
 
 /*
 ** Warning-related functions
@@ -339,6 +372,10 @@ LUA_API void (lua_warning)  (lua_State *L, const char *msg, int tocont);
 #define LUA_GCISRUNNING		9
 #define LUA_GCGEN		10
 #define LUA_GCINC		11
+#define LUA_GCLIMIT		12
+#define LUA_GCTRIM		13
+#define LUA_GCRELEASED		14
+#define LUA_GCRELEASEDB		15
 
 LUA_API int (lua_gc) (lua_State *L, int what, ...);
 
@@ -358,6 +395,14 @@ LUA_API size_t   (lua_stringtonumber) (lua_State *L, const char *s);
 
 LUA_API lua_Alloc (lua_getallocf) (lua_State *L, void **ud);
 LUA_API void      (lua_setallocf) (lua_State *L, lua_Alloc f, void *ud);
+LUA_API void      (lua_settrimf) (lua_State *L, lua_Trim f);
+LUA_API void      (lua_setslabmax) (lua_State *L, size_t max);
+LUA_API size_t    (lua_getslabmax) (lua_State *L);
+LUA_API void      (lua_adjustexternal) (lua_State *L, ptrdiff_t delta);
+LUA_API void      (lua_setselectf) (lua_State *L, lua_CFunction f);
+LUA_API int       (lua_setinline) (lua_State *L, int on);
+LUA_API int       (lua_setlazy) (lua_State *L, int on);
+LUA_API int       (lua_setoptimize) (lua_State *L, int level);
 
 LUA_API void (lua_toclose) (lua_State *L, int idx);
 LUA_API void (lua_closeslot) (lua_State *L, int idx);
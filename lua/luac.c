@@ -34,6 +34,7 @@ static void PrintFunction(const Proto* f, int full);
 static int listing=0;			/* list bytecodes? */
 static int dumping=1;			/* dump bytecodes? */
 static int stripping=0;			/* strip debug information? */
+static int inlining=0;			/* inline small local functions? */
 static char Output[]={ OUTPUT };	/* default output file name */
 static const char* output=Output;	/* actual output file name */
 static const char* progname=PROGNAME;	/* actual program name */
@@ -62,6 +63,7 @@ static void usage(const char* message)
   "Available options are:\n"
   "  -l       list (use -l -l for full listing)\n"
   "  -o name  output to file 'name' (default is \"%s\")\n"
+  "  -O       inline small local functions and optimize harder\n"
   "  -p       parse only\n"
   "  -s       strip debug information\n"
   "  -v       show version information\n"
@@ -99,6 +101,8 @@ static int doargs(int argc, char* argv[])
     usage("'-o' needs argument");
    if (IS("-")) output=NULL;
   }
+  else if (IS("-O"))			/* inline and optimize */
+   inlining=1;
   else if (IS("-p"))			/* parse only */
    dumping=0;
   else if (IS("-s"))			/* strip debug information */
@@ -173,13 +177,19 @@ static int pmain(lua_State* L)
  int i;
  tmname=G(L)->tmname;
  if (!lua_checkstack(L,argc)) fatal("too many input files");
+ lua_setinline(L,inlining);
+ if (inlining) lua_setoptimize(L,2);
  for (i=0; i<argc; i++)
  {
   const char* filename=IS("-") ? NULL : argv[i];
   if (luaL_loadfile(L,filename)!=LUA_OK) fatal(lua_tostring(L,-1));
  }
  f=combine(L,argc);
- if (listing) luaU_print(f,listing>1);
+ if (listing)
+ {
+  luaU_loaddebug(L,(Proto*)f,1);
+  luaU_print(f,listing>1);
+ }
  if (dumping)
  {
   FILE* D= (output==NULL) ? stdout : fopen(output,"wb");
@@ -320,6 +330,9 @@ static void PrintConstant(const Proto* f, int i)
   case LUA_VLNGSTR:
 	PrintString(tsvalue(o));
 	break;
+  case LUA_VTABLE:			/* cases of an OP_SWITCH */
+	printf("switch: %p",VOID(hvalue(o)));
+	break;
   default:				/* cannot happen */
 	printf("?%d",ttypetag(o));
 	break;
@@ -647,6 +660,15 @@ static void PrintCode(const Proto* f)
    case OP_VARARGPREP:
 	printf("%d",a);
 	break;
+   case OP_SELECT:
+	printf("%d %d",a,c);
+	printf(COMMENT);
+	if (c==0) printf("all out"); else printf("%d out",c-1);
+	break;
+   case OP_SWITCH:
+	printf("%d %d",a,b);
+	printf(COMMENT "%d cases",b);
+	break;
    case OP_EXTRAARG:
 	printf("%d",ax);
 	break;
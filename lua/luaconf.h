@@ -774,6 +774,37 @@
 #define LUAL_BUFFERSIZE   ((int)(16 * sizeof(void*) * sizeof(lua_Number)))
 
 
+/*
+@@ LUAL_SLABALLOC makes 'luaL_newstate' serve small blocks from
+** per-size-class slabs, going to 'malloc' only for large blocks.
+** (Blocks from slabs are not tagged with 'setmalloctag'.)
+** CHANGE it (undefine it) to use plain 'realloc' and 'free'.
+*/
+#define LUAL_SLABALLOC
+
+
+/*
+@@ LUAI_OPTCODE makes the compiler able to run an extra pass over the
+** code of each function, when asked to (see 'lua_setoptimize' and the
+** "--!optimize" pragma): threading jumps, turning chains of comparisons
+** of a variable with constants into jump tables, removing code that
+** cannot run and, at the higher level, reusing upvalues loaded,
+** propagating copies of registers and removing stores overwritten
+** before they are read.
+** CHANGE it (undefine it) to leave the pass out.
+*/
+#define LUAI_OPTCODE
+
+
+/*
+@@ LUAI_MAXINLINE is the size, in instructions, of the largest local
+** function whose calls the compiler replaces by a copy of its body,
+** when asked to (see 'lua_setinline' and the "--!inline" pragma).
+** CHANGE it (undefine it) to leave the inliner out.
+*/
+#define LUAI_MAXINLINE		40
+
+
 /*
 @@ LUAI_MAXALIGN defines fields that, when used in a union, ensure
 ** maximum alignment for the other items in that union.
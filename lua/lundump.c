@@ -21,6 +21,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lstring.h"
+#include "ltable.h"
 #include "lundump.h"
 #include "lzio.h"
 
@@ -34,6 +35,8 @@ typedef struct {
   lua_State *L;
   ZIO *Z;
   const char *name;
+  GCObject *image;  /* object holding the chunk, if read in place */
+  size_t offset;  /* bytes read so far */
 } LoadState;
 
 
@@ -52,6 +55,7 @@ static l_noret error (LoadState *S, const char *why) {
 static void loadBlock (LoadState *S, void *b, size_t size) {
   if (luaZ_read(S->Z, b, size) != 0)
     error(S, "truncated chunk");
+  S->offset += size;
 }
 
 
@@ -62,10 +66,36 @@ static lu_byte loadByte (LoadState *S) {
   int b = zgetc(S->Z);
   if (b == EOZ)
     error(S, "truncated chunk");
+  S->offset++;
   return cast_byte(b);
 }
 
 
+/*
+** Skip the padding before an array of 'n' elements of 'size' bytes,
+** aligned to 'size' in the chunk (see 'dumpAlign'). When the chunk is
+** read in place, return the array where it is in the chunk, past
+** which the stream is moved; otherwise return NULL, leaving the array
+** to be read into a block of its own. (Empty arrays stay NULL, as
+** some users of line information tell it is missing that way.)
+*/
+static void *loadInPlace (LoadState *S, int n, size_t size) {
+  void *p;
+  size_t pad = (size - S->offset % size) % size;
+  while (pad-- > 0)
+    loadByte(S);
+  if (S->image == NULL || n == 0)
+    return NULL;
+  if (cast_sizet(n) > S->Z->n / size)
+    error(S, "truncated chunk");
+  p = cast(void *, S->Z->p);
+  S->Z->p += n * size;
+  S->Z->n -= n * size;
+  S->offset += n * size;
+  return p;
+}
+
+
 static size_t loadUnsigned (LoadState *S, size_t limit) {
   size_t x = 0;
   int b;
@@ -143,15 +173,77 @@ static TString *loadString (LoadState *S, Proto *p) {
 
 static void loadCode (LoadState *S, Proto *f) {
   int n = loadInt(S);
-  f->code = luaM_newvectorchecked(S->L, n, Instruction);
-  f->sizecode = n;
-  loadVector(S, f->code, n);
+  f->code = cast(Instruction *, loadInPlace(S, n, sizeof(Instruction)));
+  if (f->code != NULL)
+    f->sizecode = n;
+  else {
+    f->code = luaM_newvectorchecked(S->L, n, Instruction);
+    f->sizecode = n;
+    loadVector(S, f->code, n);
+  }
 }
 
 
 static void loadFunction(LoadState *S, Proto *f, TString *psource);
 
 
+static void loadConstant (LoadState *S, Proto *f, TValue *o);
+
+
+/*
+** Load a table constant (see 'dumpTable') into 'o'. The table is made
+** big enough for all its entries first, so that setting them does not
+** allocate: a key is not anchored anywhere until it is in the table.
+*/
+static void loadTable (LoadState *S, Proto *f, TValue *o) {
+  lua_State *L = S->L;
+  int n = loadInt(S);
+  int i;
+  Table *t = luaH_new(L);
+  sethvalue(L, o, t);
+  luaC_objbarrier(L, f, t);
+  luaH_resize(L, t, 0, n);
+  for (i = 0; i < n; i++) {
+    TValue key, val;
+    loadConstant(S, f, &key);
+    loadConstant(S, f, &val);
+    if (!(ttisnumber(&key) || ttisstring(&key)) || !ttisinteger(&val))
+      error(S, "bad format for constant table");
+    luaH_set(L, t, &key, &val);
+  }
+}
+
+
+static void loadConstant (LoadState *S, Proto *f, TValue *o) {
+  int t = loadByte(S);
+  switch (t) {
+    case LUA_VNIL:
+      setnilvalue(o);
+      break;
+    case LUA_VFALSE:
+      setbfvalue(o);
+      break;
+    case LUA_VTRUE:
+      setbtvalue(o);
+      break;
+    case LUA_VNUMFLT:
+      setfltvalue(o, loadNumber(S));
+      break;
+    case LUA_VNUMINT:
+      setivalue(o, loadInteger(S));
+      break;
+    case LUA_VSHRSTR:
+    case LUA_VLNGSTR:
+      setsvalue2n(S->L, o, loadString(S, f));
+      break;
+    case LUA_VTABLE:
+      loadTable(S, f, o);
+      break;
+    default: lua_assert(0);
+  }
+}
+
+
 static void loadConstants (LoadState *S, Proto *f) {
   int i;
   int n = loadInt(S);
@@ -159,32 +251,8 @@ static void loadConstants (LoadState *S, Proto *f) {
   f->sizek = n;
   for (i = 0; i < n; i++)
     setnilvalue(&f->k[i]);
-  for (i = 0; i < n; i++) {
-    TValue *o = &f->k[i];
-    int t = loadByte(S);
-    switch (t) {
-      case LUA_VNIL:
-        setnilvalue(o);
-        break;
-      case LUA_VFALSE:
-        setbfvalue(o);
-        break;
-      case LUA_VTRUE:
-        setbtvalue(o);
-        break;
-      case LUA_VNUMFLT:
-        setfltvalue(o, loadNumber(S));
-        break;
-      case LUA_VNUMINT:
-        setivalue(o, loadInteger(S));
-        break;
-      case LUA_VSHRSTR:
-      case LUA_VLNGSTR:
-        setsvalue2n(S->L, o, loadString(S, f));
-        break;
-      default: lua_assert(0);
-    }
-  }
+  for (i = 0; i < n; i++)
+    loadConstant(S, f, &f->k[i]);
 }
 
 
@@ -224,20 +292,12 @@ static void loadUpvalues (LoadState *S, Proto *f) {
 }
 
 
-static void loadDebug (LoadState *S, Proto *f) {
+/*
+** Load the names of the local variables and upvalues of 'f'.
+*/
+static void loadNames (LoadState *S, Proto *f) {
   int i, n;
   n = loadInt(S);
-  f->lineinfo = luaM_newvectorchecked(S->L, n, ls_byte);
-  f->sizelineinfo = n;
-  loadVector(S, f->lineinfo, n);
-  n = loadInt(S);
-  f->abslineinfo = luaM_newvectorchecked(S->L, n, AbsLineInfo);
-  f->sizeabslineinfo = n;
-  for (i = 0; i < n; i++) {
-    f->abslineinfo[i].pc = loadInt(S);
-    f->abslineinfo[i].line = loadInt(S);
-  }
-  n = loadInt(S);
   f->locvars = luaM_newvectorchecked(S->L, n, LocVar);
   f->sizelocvars = n;
   for (i = 0; i < n; i++)
@@ -255,7 +315,76 @@ static void loadDebug (LoadState *S, Proto *f) {
 }
 
 
+/*
+** Load the line information of 'f', in place if the chunk is read so.
+*/
+static void loadLines (LoadState *S, Proto *f) {
+  int n;
+  n = loadInt(S);
+  f->lineinfo = cast(ls_byte *, loadInPlace(S, n, sizeof(ls_byte)));
+  if (f->lineinfo != NULL)
+    f->sizelineinfo = n;
+  else {
+    f->lineinfo = luaM_newvectorchecked(S->L, n, ls_byte);
+    f->sizelineinfo = n;
+    loadVector(S, f->lineinfo, n);
+  }
+  n = loadInt(S);
+  lua_assert(sizeof(AbsLineInfo) == 2 * sizeof(int));
+  f->abslineinfo = cast(AbsLineInfo *, loadInPlace(S, 2 * n, sizeof(int)));
+  if (f->abslineinfo != NULL)
+    f->sizeabslineinfo = n;
+  else {
+    f->abslineinfo = luaM_newvectorchecked(S->L, n, AbsLineInfo);
+    f->sizeabslineinfo = n;
+    loadVector(S, f->abslineinfo, n);
+  }
+}
+
+
+/*
+** Load the debug information of 'f' and of the functions nested in it,
+** which comes after all the prototypes (see 'dumpDebugs'). In a chunk
+** read in place, only where the part of each function starts is noted,
+** for 'luaU_loadlines' and 'luaU_loaddebug': none of it is read (nor,
+** in a mapped file, brought into memory) until something asks for the
+** lines or names of that function.
+*/
+static void loadDebugs (LoadState *S, Proto *f) {
+  size_t pad = (sizeof(int) - S->offset % sizeof(int)) % sizeof(int);
+  size_t size = f->sizedebug;
+  int i;
+  if (S->image != NULL) {
+    if (pad > S->Z->n || size > S->Z->n - pad)
+      error(S, "truncated chunk");
+    f->debug = S->Z->p + pad;
+    f->sizelineinfo = -1;  /* not read yet */
+    S->Z->p += pad + size;
+    S->Z->n -= pad + size;
+    S->offset += pad + size;
+  }
+  else {
+    size_t start;
+    while (pad-- > 0)
+      loadByte(S);
+    start = S->offset;
+    loadLines(S, f);
+    loadNames(S, f);
+    if (S->offset - start != size)
+      error(S, "corrupted chunk");
+    f->sizedebug = 0;
+  }
+  for (i = 0; i < f->sizep; i++)
+    loadDebugs(S, f->p[i]);
+}
+
+
 static void loadFunction (LoadState *S, Proto *f, TString *psource) {
+  if (S->image != NULL) {  /* arrays will be in the image? */
+    f->shared = 1;
+    f->image = S->image;
+    luaC_objbarrier(S->L, f, S->image);
+  }
   f->source = loadStringN(S, f);
   if (f->source == NULL)  /* no source in dump? */
     f->source = psource;  /* reuse parent's source */
@@ -268,7 +397,7 @@ static void loadFunction (LoadState *S, Proto *f, TString *psource) {
   loadConstants(S, f);
   loadUpvalues(S, f);
   loadProtos(S, f);
-  loadDebug(S, f);
+  f->sizedebug = loadSize(S);  /* (its debug information comes later) */
 }
 
 
@@ -321,6 +450,10 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
     S.name = name;
   S.L = L;
   S.Z = Z;
+  S.offset = 1;  /* first char already read */
+  S.image = NULL;
+  if (Z->image != NULL && point2uint(Z->p - 1) % sizeof(Instruction) == 0)
+    S.image = Z->image;  /* arrays in it will be aligned */
   checkHeader(&S);
   cl = luaF_newLclosure(L, loadByte(&S));
   setclLvalue2s(L, L->top.p, cl);
@@ -328,8 +461,87 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
   cl->p = luaF_newproto(L);
   luaC_objbarrier(L, cl, cl->p);
   loadFunction(&S, cl->p, NULL);
+  loadDebugs(&S, cl->p);
   lua_assert(cl->nupvalues == cl->p->sizeupvalues);
   luai_verifycode(L, cl->p);
   return cl;
 }
 
+
+/*
+** Start reading the debug information of 'from' not loaded yet.
+*/
+static void initdebug (lua_State *L, LoadState *S, ZIO *z,
+                       const Proto *from, GCObject *image) {
+  luaZ_initimage(L, z, NULL, from->debug, from->sizedebug);
+  S->L = L;
+  S->Z = z;
+  S->name = "binary string";
+  S->image = image;
+  S->offset = 0;  /* 'debug' is aligned (see 'loadDebugs') */
+}
+
+
+/*
+** Load the line information of 'f' left in its image by 'loadDebugs',
+** in place. What is left in 'debug' are its names.
+*/
+void luaU_loadlines (lua_State *L, Proto *f) {
+  LoadState S;
+  ZIO z;
+  lua_assert(f->sizelineinfo < 0 && f->image != NULL);
+  initdebug(L, &S, &z, f, f->image);
+  f->sizelineinfo = 0;
+  loadLines(&S, f);
+  f->debug = z.p;
+  f->sizedebug = z.n;
+}
+
+
+/*
+** Load into 'f' the debug information left by 'loadDebugs' in the
+** image of 'from', which is 'f' itself, with its lines already loaded,
+** or the function 'f' is a copy of. An error can leave 'f' with part
+** of it, which a later call replaces.
+*/
+static void loadskipped (lua_State *L, Proto *f, const Proto *from) {
+  LoadState S;
+  ZIO z;
+  initdebug(L, &S, &z, from, NULL);
+  if (from->sizelineinfo < 0)  /* lines not loaded either? */
+    loadLines(&S, f);
+  luaM_freearray(L, f->locvars, f->sizelocvars);
+  f->locvars = NULL;
+  f->sizelocvars = 0;
+  loadNames(&S, f);
+}
+
+
+/*
+** Load the debug information left in its image by 'loadDebugs' into
+** 'f', and, if 'all', into all functions nested in it.
+*/
+void luaU_loaddebug (lua_State *L, Proto *f, int all) {
+  int i;
+  if (f->debug != NULL) {
+    luaU_checklines(L, f);
+    loadskipped(L, f, f);
+    f->debug = NULL;
+    f->sizedebug = 0;
+  }
+  if (all) {
+    for (i = 0; i < f->sizep; i++)
+      luaU_loaddebug(L, f->p[i], 1);
+  }
+}
+
+
+/*
+** Load into 'to', a copy of 'from' made by another state, the debug
+** information 'from' still has in its image, which the copy does not
+** keep.
+*/
+void luaU_copydebug (lua_State *L, Proto *to, const Proto *from) {
+  if (from->debug != NULL)
+    loadskipped(L, to, from);
+}
@@ -23,13 +23,31 @@
 */
 #define LUAC_VERSION  (((LUA_VERSION_NUM / 100) * 16) + LUA_VERSION_NUM % 100)
 
-#define LUAC_FORMAT	0	/* this is the official format */
+#define LUAC_FORMAT	5	/* OP_SELECT, OP_SWITCH, arrays aligned in place,
+				   debug information at the end, in-place varargs */
 
 /* load one chunk; from lundump.c */
 LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name);
+LUAI_FUNC void luaU_loadlines (lua_State *L, Proto *f);
+LUAI_FUNC void luaU_loaddebug (lua_State *L, Proto *f, int all);
+LUAI_FUNC void luaU_copydebug (lua_State *L, Proto *to, const Proto *from);
+
+/* make sure the line information of 'f' is loaded */
+#define luaU_checklines(L,f)  \
+	{ if (l_unlikely((f)->sizelineinfo < 0)) luaU_loadlines(L, f); }
+
+/* make sure all debug information of 'f' is loaded */
+#define luaU_checkdebug(L,f)  \
+	{ if (l_unlikely((f)->debug != NULL)) luaU_loaddebug(L, f, 0); }
 
 /* dump one chunk; from ldump.c */
 LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w,
                          void* data, int strip);
 
+/* shared chunks; from lshare.c */
+LUAI_FUNC lua_Chunk *luaU_share (const Proto *f, lua_Alloc fa, void *ud);
+LUAI_FUNC void luaU_releasechunk (lua_Chunk *c);
+LUAI_FUNC LClosure *luaU_loadshared (lua_State *L, lua_Chunk *c);
+LUAI_FUNC void luaU_releasechunks (lua_State *L);
+
 #endif
@@ -590,7 +590,7 @@ int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2) {
     case LUA_VNUMINT: return (ivalue(t1) == ivalue(t2));
     case LUA_VNUMFLT: return luai_numeq(fltvalue(t1), fltvalue(t2));
     case LUA_VLIGHTUSERDATA: return pvalue(t1) == pvalue(t2);
-    case LUA_VLCF: return fvalue(t1) == fvalue(t2);
+    case LUA_VLCF: case LUA_VLEAF: return fvalue(t1) == fvalue(t2);
     case LUA_VSHRSTR: return eqshrstr(tsvalue(t1), tsvalue(t2));
     case LUA_VLNGSTR: return luaS_eqlngstr(tsvalue(t1), tsvalue(t2));
     case LUA_VUSERDATA: {
@@ -816,7 +816,7 @@ static void pushclosure (lua_State *L, Proto *p, UpVal **encup, StkId base,
 */
 void luaV_finishOp (lua_State *L) {
   CallInfo *ci = L->ci;
-  StkId base = ci->func.p + 1;
+  StkId base = ci_base(ci);
   Instruction inst = *(ci->u.l.savedpc - 1);  /* interrupted instruction */
   OpCode op = GET_OPCODE(inst);
   switch (op) {  /* finish its execution */
@@ -871,7 +871,7 @@ void luaV_finishOp (lua_State *L) {
     }
     default: {
       /* only these other opcodes can yield */
-      lua_assert(op == OP_TFORCALL || op == OP_CALL ||
+      lua_assert(op == OP_TFORCALL || op == OP_CALL || op == OP_SELECT ||
            op == OP_TAILCALL || op == OP_SETTABUP || op == OP_SETTABLE ||
            op == OP_SETI || op == OP_SETFIELD);
       break;
@@ -1077,18 +1077,29 @@ void luaV_finishOp (lua_State *L) {
 
 #define updatetrap(ci)  (trap = ci->u.l.trap)
 
-#define updatebase(ci)	(base = ci->func.p + 1)
+#define updatebase(ci)	(base = ci_base(ci))
 
 
 #define updatestack(ci)  \
 	{ if (l_unlikely(trap)) { updatebase(ci); ra = RA(i); } }
 
 
+/*
+** Charge a backward jump to the quota of the thread. 'luaG_quota' can
+** yield or raise an error, so 'top' must be correct; no instruction
+** after a jump uses the top set by an earlier one.
+*/
+#define checkquota(L)  \
+	{ if (l_unlikely(--L->budget < 0)) \
+	    { L->top.p = ci->top.p; luaG_quota(L, pc); } }
+
+
 /*
 ** Execute a jump instruction. The 'updatetrap' allows signals to stop
 ** tight loops. (Without it, the local copy of 'trap' could never change.)
 */
-#define dojump(ci,i,e)	{ pc += GETARG_sJ(i) + e; updatetrap(ci); }
+#define dojump(ci,i,e)	{ int sj = GETARG_sJ(i); pc += sj + e; \
+                          if (sj < 0) checkquota(L); updatetrap(ci); }
 
 
 /* for test instructions, execute the jump instruction that follows it */
@@ -1139,7 +1150,9 @@ void luaV_finishOp (lua_State *L) {
 
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
-  if (l_unlikely(trap)) {  /* stack reallocation or hooks? */ \
+  if (l_unlikely(trap)) {  /* stack reallocation, hooks or yield? */ \
+    if (l_unlikely(L->status == LUA_YIELD)) \
+      return;  /* back to 'resume' (see 'lua_yieldk') */ \
     trap = luaG_traceexec(L, pc);  /* handle hooks */ \
     updatebase(ci);  /* correct stack */ \
   } \
@@ -1151,6 +1164,96 @@ void luaV_finishOp (lua_State *L) {
 #define vmbreak		break
 
 
+/*
+** Calls from Lua to leaf C functions (see 'lua_pushleaf'). These
+** return one value and do not call back, yield or change hooks, so
+** nothing is checked after the call: the result goes straight to its
+** place. Only hooks or a short stack send them to the general path.
+*/
+l_sinline int callleaf (lua_State *L, StkId func, int nresults) {
+  CallInfo *ci = L->ci->next;
+  lua_CFunction f = fvalue(s2v(func));
+  StkId res;
+  int n;
+  if (l_unlikely(L->hookmask || L->stack_last.p - L->top.p <= LUA_MINSTACK))
+    return 0;
+  if (l_unlikely(ci == NULL))
+    ci = luaE_extendCI(L);
+  ci->func.p = func;
+  ci->nresults = nresults;
+  ci->callstatus = CIST_C;
+  ci->top.p = L->top.p + LUA_MINSTACK;
+  L->ci = ci;
+  lua_unlock(L);
+  n = (*f)(L);  /* do the actual call */
+  lua_lock(L);
+  api_check(L, n == 1 && n < (L->top.p - ci->func.p),
+               "leaf function must return one value");
+  res = ci->func.p;  /* stack may have moved */
+  setobjs2s(L, res, L->top.p - 1);  /* (harmless if it is not wanted) */
+  if (nresults == LUA_MULTRET)
+    nresults = 1;
+  for (n = 1; l_unlikely(n < nresults); n++)
+    setnilvalue(s2v(res + n));  /* complete missing results */
+  L->top.p = res + nresults;
+  L->ci = ci->previous;  /* back to caller */
+  return 1;
+}
+
+
+/*
+** Fast path for calls from Lua to C functions, taken when there are
+** no hooks, the next CallInfo is already allocated, and the stack has
+** room for the C function. It does what 'precallC' and 'luaD_poscall'
+** do, without their general cases; anything unusual at the return
+** (hooks set by the function, to-be-closed variables) goes through
+** 'luaD_poscall'. Returns false if the call must take the general
+** path. A function that yields may come back here without unwinding
+** the C stack (see 'lua_yieldk'); then the call is left as it is.
+*/
+l_sinline int callC (lua_State *L, StkId func, int nresults) {
+  CallInfo *ci = L->ci->next;
+  lua_CFunction f;
+  StkId res, first;
+  int n, i;
+  switch (ttypetag(s2v(func))) {
+    case LUA_VLEAF: return callleaf(L, func, nresults);
+    case LUA_VLCF: f = fvalue(s2v(func)); break;
+    case LUA_VCCL: f = clCvalue(s2v(func))->f; break;
+    default: return 0;
+  }
+  if (l_unlikely(ci == NULL || L->hookmask ||
+                 L->stack_last.p - L->top.p <= LUA_MINSTACK))
+    return 0;
+  ci->func.p = func;
+  ci->nresults = nresults;
+  ci->callstatus = CIST_C | CIST_DIRECT;
+  ci->top.p = L->top.p + LUA_MINSTACK;
+  L->ci = ci;
+  lua_unlock(L);
+  n = (*f)(L);  /* do the actual call */
+  lua_lock(L);
+  if (l_unlikely(L->status == LUA_YIELD))  /* yielded in place? */
+    return 1;  /* 'resume' will finish the call */
+  api_check(L, n < (L->top.p - ci->func.p), "not enough elements in the stack");
+  if (l_unlikely(L->hookmask || ci->nresults != nresults)) {
+    luaD_poscall(L, ci, n);
+    return 1;
+  }
+  res = ci->func.p;  /* stack may have moved */
+  first = L->top.p - n;
+  if (nresults == LUA_MULTRET)
+    nresults = n;
+  for (i = 0; i < n && i < nresults; i++)
+    setobjs2s(L, res + i, first + i);
+  for (; i < nresults; i++)
+    setnilvalue(s2v(res + i));
+  L->top.p = res + nresults;
+  L->ci = ci->previous;  /* back to caller */
+  return 1;
+}
+
+
 void luaV_execute (lua_State *L, CallInfo *ci) {
   LClosure *cl;
   TValue *k;
@@ -1161,6 +1264,8 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
 #include "ljumptab.h"
 #endif
  startfunc:
+  if (l_unlikely(L->budget < 0))  /* call used up the quota? */
+    luaG_quota(L, ci->u.l.savedpc);  /* (top still marks the arguments) */
   trap = L->hookmask;
  returning:  /* trap already set */
   cl = ci_func(ci);
@@ -1168,7 +1273,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
   pc = ci->u.l.savedpc;
   if (l_unlikely(trap))
     trap = luaG_tracecall(L);
-  base = ci->func.p + 1;
+  base = ci_base(ci);
   /* main loop of interpreter */
   for (;;) {
     Instruction i;  /* instruction being executed */
@@ -1177,7 +1282,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       /* low-level line tracing for debugging Lua */
       printf("line: %d\n", luaG_getfuncline(cl->p, pcRel(pc, cl->p)));
     #endif
-    lua_assert(base == ci->func.p + 1);
+    lua_assert(base == ci_base(ci));
     lua_assert(base <= L->top.p && L->top.p <= L->stack_last.p);
     /* invalidate top for instructions not expecting it */
     lua_assert(isIT(i) || (cast_void(L->top.p = base), 1));
@@ -1682,7 +1787,9 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           L->top.p = ra + b;  /* top signals number of arguments */
         /* else previous instruction set top */
         savepc(L);  /* in case of errors */
-        if ((newci = luaD_precall(L, ra, nresults)) == NULL)
+        if (callC(L, ra, nresults))
+          updatetrap(ci);  /* C call; nothing else to be done */
+        else if ((newci = luaD_precall(L, ra, nresults)) == NULL)
           updatetrap(ci);  /* C call; nothing else to be done */
         else {  /* Lua call: run function in this same C frame */
           ci = newci;
@@ -1694,9 +1801,6 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         StkId ra = RA(i);
         int b = GETARG_B(i);  /* number of arguments + 1 (function) */
         int n;  /* number of results when calling a C function */
-        int nparams1 = GETARG_C(i);
-        /* delta is virtual 'func' - real 'func' (vararg functions) */
-        int delta = (nparams1) ? ci->u.l.nextraargs + nparams1 : 0;
         if (b != 0)
           L->top.p = ra + b;
         else  /* previous instruction set top */
@@ -1705,12 +1809,10 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         if (TESTARG_k(i)) {
           luaF_closeupval(L, base);  /* close upvalues from current call */
           lua_assert(L->tbclist.p < base);  /* no pending tbc variables */
-          lua_assert(base == ci->func.p + 1);
         }
-        if ((n = luaD_pretailcall(L, ci, ra, b, delta)) < 0)  /* Lua function? */
+        if ((n = luaD_pretailcall(L, ci, ra, b)) < 0)  /* Lua function? */
           goto startfunc;  /* execute the callee */
         else {  /* C function? */
-          ci->func.p -= delta;  /* restore 'func' (if vararg) */
           luaD_poscall(L, ci, n);  /* finish caller */
           updatetrap(ci);  /* 'luaD_poscall' can change hooks */
           goto ret;  /* caller returns after the tail call */
@@ -1719,7 +1821,6 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       vmcase(OP_RETURN) {
         StkId ra = RA(i);
         int n = GETARG_B(i) - 1;  /* number of results */
-        int nparams1 = GETARG_C(i);
         if (n < 0)  /* not fixed? */
           n = cast_int(L->top.p - ra);  /* get what is available */
         savepc(ci);
@@ -1731,8 +1832,6 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           updatetrap(ci);
           updatestack(ci);
         }
-        if (nparams1)  /* vararg function? */
-          ci->func.p -= ci->u.l.nextraargs + nparams1;
         L->top.p = ra + n;  /* set call for 'luaD_poscall' */
         luaD_poscall(L, ci, n);
         updatetrap(ci);  /* 'luaD_poscall' can change hooks */
@@ -1749,7 +1848,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         else {  /* do the 'poscall' here */
           int nres;
           L->ci = ci->previous;  /* back to caller */
-          L->top.p = base - 1;
+          L->top.p = ci->func.p;
           for (nres = ci->nresults; l_unlikely(nres > 0); nres--)
             setnilvalue(s2v(L->top.p++));  /* all results are nil */
         }
@@ -1767,11 +1866,11 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
           int nres = ci->nresults;
           L->ci = ci->previous;  /* back to caller */
           if (nres == 0)
-            L->top.p = base - 1;  /* asked for no results */
+            L->top.p = ci->func.p;  /* asked for no results */
           else {
             StkId ra = RA(i);
-            setobjs2s(L, base - 1, ra);  /* at least this result */
-            L->top.p = base;
+            setobjs2s(L, ci->func.p, ra);  /* at least this result */
+            L->top.p = ci->func.p + 1;
             for (; l_unlikely(nres > 1); nres--)
               setnilvalue(s2v(L->top.p++));  /* complete missing results */
           }
@@ -1796,10 +1895,13 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
             chgivalue(s2v(ra), idx);  /* update internal index */
             setivalue(s2v(ra + 3), idx);  /* and control variable */
             pc -= GETARG_Bx(i);  /* jump back */
+            checkquota(L);
           }
         }
-        else if (floatforloop(ra))  /* float loop */
+        else if (floatforloop(ra)) {  /* float loop */
           pc -= GETARG_Bx(i);  /* jump back */
+          checkquota(L);
+        }
         updatetrap(ci);  /* allows a signal to break the loop */
         vmbreak;
       }
@@ -1842,6 +1944,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         if (!ttisnil(s2v(ra + 4))) {  /* continue loop? */
           setobjs2s(L, ra + 2, ra + 4);  /* save control variable */
           pc -= GETARG_Bx(i);  /* jump back */
+          checkquota(L);
         }
         vmbreak;
       }}
@@ -1879,7 +1982,7 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
       vmcase(OP_VARARG) {
         StkId ra = RA(i);
         int n = GETARG_C(i) - 1;  /* required results */
-        Protect(luaT_getvarargs(L, ci, ra, n));
+        Protect(luaT_getvarargs(L, ci, ra, 0, n));
         vmbreak;
       }
       vmcase(OP_VARARGPREP) {
@@ -1891,6 +1994,61 @@ void luaV_execute (lua_State *L, CallInfo *ci) {
         updatebase(ci);  /* function has new base after adjustment */
         vmbreak;
       }
+      vmcase(OP_SELECT) {
+        StkId ra = RA(i);
+        CallInfo *newci;
+        int nresults = GETARG_C(i) - 1;
+        TValue *rb = s2v(ra + 1);
+        if (ttislcf(s2v(ra)) && fvalue(s2v(ra)) == G(L)->selectf &&
+            !L->hookmask) {
+          int nextra = ci->u.l.nextraargs;
+          lua_Integer n;
+          if (ttisstring(rb) && *getstr(tsvalue(rb)) == '#') {  /* count? */
+            setivalue(s2v(ra), nextra);
+            if (nresults < 0)
+              L->top.p = ra + 1;
+            else {
+              int r;
+              for (r = 1; r < nresults; r++)
+                setnilvalue(s2v(ra + r));
+            }
+            vmbreak;
+          }
+          if (ttisinteger(rb)) {  /* select(n, ...) */
+            n = ivalue(rb);
+            if (n < 0)
+              n += nextra + 1;
+            else if (n > nextra)
+              n = nextra + 1;
+            if (n >= 1) {
+              Protect(luaT_getvarargs(L, ci, ra, cast_int(n) - 1, nresults));
+              vmbreak;
+            }
+          }
+          /* other selectors (and errors) go through the real call */
+        }
+        /* push the varargs after the selector and call the function */
+        Protect(luaT_getvarargs(L, ci, ra + 2, 0, -1));
+        updatestack(ci);  /* stack may have moved */
+        if (callC(L, ra, nresults))
+          updatetrap(ci);
+        else if ((newci = luaD_precall(L, ra, nresults)) == NULL)
+          updatetrap(ci);
+        else {  /* Lua call: run function in this same C frame */
+          ci = newci;
+          goto startfunc;
+        }
+        vmbreak;
+      }
+      vmcase(OP_SWITCH) {
+        StkId ra = RA(i);
+        const TValue *c = luaH_get(hvalue(&k[GETARG_Ax(*pc)]), s2v(ra));
+        pc += 1 + (ttisinteger(c) ? ivalue(c) : 0);  /* go to its jump */
+        i = *pc;
+        lua_assert(GET_OPCODE(i) == OP_JMP);
+        dojump(ci, i, 1);
+        vmbreak;
+      }
       vmcase(OP_EXTRAARG) {
         lua_assert(0);
         vmbreak;
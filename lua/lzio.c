@@ -20,17 +20,37 @@
 #include "lzio.h"
 
 
+/*
+** Add to the copy what was read from the current buffer up to 'e'.
+*/
+static void savecopy (ZIO *z, const char *e) {
+  Mbuffer *b = z->copy;
+  size_t n = cast_sizet(e - z->mark);
+  if (luaZ_bufflen(b) + n > luaZ_sizebuffer(b)) {
+    size_t size = luaZ_sizebuffer(b) * 2;
+    if (size < luaZ_bufflen(b) + n)
+      size = luaZ_bufflen(b) + n;
+    luaZ_resizebuffer(z->L, b, size);
+  }
+  memcpy(luaZ_buffer(b) + luaZ_bufflen(b), z->mark, n);
+  luaZ_bufflen(b) += n;
+  z->mark = e;
+}
+
+
 int luaZ_fill (ZIO *z) {
   size_t size;
   lua_State *L = z->L;
   const char *buff;
+  if (z->copy != NULL)  /* keep what was read before the buffer goes */
+    savecopy(z, z->p);
   lua_unlock(L);
   buff = z->reader(L, z->data, &size);
   lua_lock(L);
   if (buff == NULL || size == 0)
     return EOZ;
   z->n = size - 1;  /* discount char being returned */
-  z->p = buff;
+  z->p = z->mark = buff;
   return cast_uchar(*(z->p++));
 }
 
@@ -41,6 +61,49 @@ void luaZ_init (lua_State *L, ZIO *z, lua_Reader reader, void *data) {
   z->data = data;
   z->n = 0;
   z->p = NULL;
+  z->copy = NULL;
+  z->mark = NULL;
+  z->image = NULL;
+}
+
+
+static const char *noreader (lua_State *L, void *data, size_t *size) {
+  UNUSED(L); UNUSED(data);
+  *size = 0;
+  return NULL;
+}
+
+
+/*
+** Read the 'n' bytes at 'p' in place: they are the whole stream, and
+** 'o', if not NULL, is the object keeping them alive, which must itself
+** be kept alive while 'z' is read.
+*/
+void luaZ_initimage (lua_State *L, ZIO *z, struct GCObject *o,
+                                   const char *p, size_t n) {
+  luaZ_init(L, z, noreader, NULL);
+  z->n = n;
+  z->p = p;
+  z->image = o;
+}
+
+
+/*
+** Copy all that is read from 'z' from now on to the end of 'b', starting
+** with the last character read, which must not have been EOZ.
+*/
+void luaZ_startcopy (ZIO *z, Mbuffer *b) {
+  z->copy = b;
+  z->mark = z->p - 1;
+}
+
+
+/*
+** Stop copying, leaving out 'c', the last character read.
+*/
+void luaZ_endcopy (ZIO *z, int c) {
+  savecopy(z, z->p - (c != EOZ));
+  z->copy = NULL;
 }
 
 
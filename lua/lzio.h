@@ -46,7 +46,11 @@ typedef struct Mbuffer {
 
 LUAI_FUNC void luaZ_init (lua_State *L, ZIO *z, lua_Reader reader,
                                         void *data);
+LUAI_FUNC void luaZ_initimage (lua_State *L, ZIO *z, struct GCObject *o,
+                                             const char *p, size_t n);
 LUAI_FUNC size_t luaZ_read (ZIO* z, void *b, size_t n);	/* read next n bytes */
+LUAI_FUNC void luaZ_startcopy (ZIO *z, Mbuffer *b);
+LUAI_FUNC void luaZ_endcopy (ZIO *z, int c);
 
 
 
@@ -58,6 +62,9 @@ struct Zio {
   lua_Reader reader;		/* reader function */
   void *data;			/* additional data */
   lua_State *L;			/* Lua state (for reader) */
+  Mbuffer *copy;		/* where what is read is copied, if anywhere */
+  const char *mark;		/* start of what is still to be copied */
+  struct GCObject *image;	/* object holding the whole stream, if any */
 };
 
 
@@ -7,12 +7,16 @@
 #include <lualib.h>
 
 extern int luaopen_p9(lua_State*);
+extern int luaopen_p9_marshal(lua_State*);
 extern int luaopen_p9_note(lua_State*);
+extern int luaopen_p9_thread(lua_State*);
 extern int luaopen_lpeg(lua_State*);
 
 luaL_Reg preloadlibs[] = {
 	{"p9", luaopen_p9},
+	{"p9.marshal", luaopen_p9_marshal},
 	{"p9.note", luaopen_p9_note},
+	{"p9.thread", luaopen_p9_thread},
 	{"lpeg", luaopen_lpeg},
 	{nil, nil}
 };
@@ -20,17 +24,46 @@ luaL_Reg preloadlibs[] = {
 char flag[] = {
 	['c'] = 0, /* bytecode dump */
 	['i'] = 0, /* interactive */
+	['L'] = 0, /* compile function bodies on first call */
+	['O'] = 0, /* inline small local functions, optimize harder */
 	['v'] = 0, /* print version */
 	['w'] = 0, /* enable warnings */
 };
 
+vlong memlimit = 0; /* -m: memory limit in bytes */
+char *cachedir = nil; /* -C: directory of compiled chunks */
+
 void
 usage(void)
 {
-	fprint(2, "usage: %s [-ivw] [script] [arg ...]\n", argv0);
+	fprint(2, "usage: %s [-LOivw] [-C dir] [-m size] [script] [arg ...]\n", argv0);
 	exits("usage");
 }
 
+/*
+ * The limit goes to lua_gc in kilobytes, as an int.
+ */
+vlong
+memsize(char *s)
+{
+	vlong n;
+	int shift;
+	char *e;
+	
+	n = strtoll(s, &e, 10);
+	shift = 0;
+	switch(*e){
+	case 'k': case 'K': shift = 10; e++; break;
+	case 'm': case 'M': shift = 20; e++; break;
+	case 'g': case 'G': shift = 30; e++; break;
+	}
+	if(n <= 0 || *e != 0)
+		usage();
+	if(n > ((vlong)INT_MAX << 10) >> shift)
+		sysfatal("memory limit %s too large", s);
+	return n << shift;
+}
+
 int
 iscons(int fd)
 {
@@ -189,6 +222,9 @@ luamain(lua_State *L)
 	lua_pushboolean(L, 1);
 	lua_setfield(L, LUA_REGISTRYINDEX, "LUA_NOENV");
 	
+	if(cachedir != nil && cachedir[0] != 0)
+		luaL_setcachedir(L, cachedir);
+	
 	luaL_openlibs(L);
 	/*
 	 * Preload additional libraries.
@@ -238,11 +274,17 @@ main(int argc, char *argv[])
 	
 	ARGBEGIN{
 	case 'c': flag['c'] = 1; break;
+	case 'C': cachedir = EARGF(usage()); break;
 	case 'i': flag['i'] = 1; break;
+	case 'L': flag['L'] = 1; break;
+	case 'm': memlimit = memsize(EARGF(usage())); break;
+	case 'O': flag['O'] = 1; break;
 	case 'v': flag['v'] += 1; break;
 	case 'w': flag['w'] = 1; break;
 	default: usage();
 	}ARGEND;
+	if(cachedir == nil)
+		cachedir = getenv("luixcache");
 	if(flag['v']){
 		if(flag['v'] == 1)
 			print("%s\n", LUA_VERSION_MAJOR "." LUA_VERSION_MINOR);
@@ -254,6 +296,14 @@ main(int argc, char *argv[])
 	setfcr(getfcr() & ~(FPZDIV | FPOVFL | FPINVAL));
 	if((L = luaL_newstate()) == nil)
 		sysfatal("out of memory");
+	if(memlimit > 0)
+		lua_gc(L, LUA_GCLIMIT, (int)((memlimit + 1023) >> 10));
+	if(flag['O']){
+		lua_setinline(L, 1);
+		lua_setoptimize(L, 2);
+	}
+	if(flag['L'])
+		lua_setlazy(L, 1);
 	lua_pushcfunction(L, luamain);
 	lua_pushinteger(L, argc);
 	lua_pushlightuserdata(L, argv);
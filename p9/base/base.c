@@ -67,14 +67,15 @@ int
 luaopen_p9(lua_State *L)
 {
 	int lib;
-	Buf *buf;
 	
 	luaL_newlib(L, p9_module);
 	lib = lua_gettop(L);
 	
-	buf = resizebuffer(L, nil, Iosize);
-	lua_pushlightuserdata(L, buf);
-	lua_setfield(L, LUA_REGISTRYINDEX, "p9-buffer");
+	/* one result, no calls back into Lua: see lua_pushleaf */
+	static const char *leaves[] = {"nanosec", "nsec", "pid", "ppid", nil};
+	luaL_setleaves(L, leaves);
+	
+	resizebuffer(L, nil, Iosize);
 	
 	luaL_newmetatable(L, "p9-File");
 	luaL_setfuncs(L, p9_file_proto, 0);
@@ -91,6 +92,8 @@ luaopen_p9(lua_State *L)
 	
 	static luaL_Reg walkmt[] = {
 		{"__close", p9_walkclose},
+		{"__clone", p9_walkclone},
+		{"__gc", p9_walkgc},
 		{nil, nil},
 	};
 	luaL_newmetatable(L, "p9-Walk");
@@ -22,23 +22,30 @@ error(lua_State *L, char *fmt, ...)
 	return 2;
 }
 
-/* Memory allocator associated with Lua state */
+/*
+ * Memory allocator associated with Lua state.
+ * Like Lua itself, callers must give the current size
+ * of the block being reallocated or freed.
+ */
 static void*
-Lallocf(lua_State *L, void *ptr, usize sz)
+Lallocf(lua_State *L, void *ptr, usize osz, usize sz)
 {
 	void *ud;
 	
-	ptr = (lua_getallocf(L, &ud))(ud, ptr, LUA_TUSERDATA, sz);
+	if(ptr == nil)
+		osz = LUA_TUSERDATA;
+	ptr = (lua_getallocf(L, &ud))(ud, ptr, osz, sz);
 	if(ptr == nil && sz != 0){
 		lua_pushliteral(L, "out of memory");
 		lua_error(L);
 	}
-	setmalloctag(ptr, getcallerpc(&L));
+	if(sz > lua_getslabmax(L))
+		setmalloctag(ptr, getcallerpc(&L));
 	return ptr;
 }
-#define Lrealloc(L, ptr, sz) Lallocf(L, ptr, sz)
-#define Lmalloc(L, sz) Lallocf(L, nil, sz)
-#define Lfree(L, ptr) Lallocf(L, ptr, 0)
+#define Lrealloc(L, ptr, osz, sz) Lallocf(L, ptr, osz, sz)
+#define Lmalloc(L, sz) Lallocf(L, nil, 0, sz)
+#define Lfree(L, ptr, osz) Lallocf(L, ptr, osz, 0)
 
 /* 
  * Various functions in this library require a
@@ -63,16 +70,20 @@ struct Buf {
 	char b[1];
 };
 
+/*
+ * The buffer is a full userdata kept in the registry and
+ * replaced by a larger one as needed, so the collector
+ * frees old ones and a copy of the state made with
+ * lua_clonestate gets a buffer of its own.
+ */
 static Buf*
 resizebuffer(lua_State *L, Buf *buf, usize sz)
 {
-	if(buf == nil){
-		buf = Lmalloc(L, sizeof(Buf) + sz);
-		buf->sz = sz;
-	}else if(buf->sz < sz){
-		Lfree(L, buf);
-		return resizebuffer(L, nil, sz);
-	}
+	if(buf != nil && buf->sz >= sz)
+		return buf;
+	buf = lua_newuserdatauv(L, sizeof(Buf) + sz, 0);
+	buf->sz = sz;
+	lua_setfield(L, LUA_REGISTRYINDEX, "p9-buffer");
 	return buf;
 }
 
@@ -162,7 +162,7 @@ p9_exec(lua_State *L)
 		argv[0] = buf;
 	}
 	exec(argv[0], argv);
-	Lfree(L, argv);
+	Lfree(L, argv, (argc+1) * sizeof(char*));
 	return error(L, "exec: %r");
 }
 
@@ -84,10 +84,35 @@ p9_stat(lua_State *L)
 
 typedef struct Walk {
 	int fd;
+	int ownfd;	/* fd was opened by p9_walk */
 	int nleft;
 	Dir *dirs, *p;
+	usize dirsz;	/* bytes of dirs reported to the collector */
 } Walk;
 
+static void
+freedirs(lua_State *L, Walk *w)
+{
+	if(w->dirs != nil){
+		free(w->dirs);
+		w->dirs = nil;
+		lua_adjustexternal(L, -(ptrdiff_t)w->dirsz);
+		w->dirsz = 0;
+	}
+}
+
+static usize
+dirsize(Dir *d, int n)
+{
+	usize sz;
+	
+	sz = n * sizeof(Dir);
+	for(; n > 0; n--, d++)
+		sz += strlen(d->name) + strlen(d->uid) + strlen(d->gid)
+			+ strlen(d->muid) + 4;
+	return sz;
+}
+
 static int
 p9_walk(lua_State *L)
 {
@@ -101,8 +126,10 @@ p9_walk(lua_State *L)
 	w = lua_newuserdatauv(L, sizeof(Walk), 1);
 	wstate = nargs + 1;
 	w->fd = -1;
+	w->ownfd = 0;
 	w->nleft = 0;
 	w->dirs = w->p = nil;
+	w->dirsz = 0;
 	luaL_setmetatable(L, "p9-Walk");
 	if(nargs == 2){
 		lua_pushvalue(L, 2);
@@ -115,6 +142,7 @@ p9_walk(lua_State *L)
 			error(L, "open: %r");
 			goto Error;
 		}
+		w->ownfd = 1;
 	}
 	if((d = dirfstat(w->fd)) == nil){
 		error(L, "stat: %r");
@@ -155,15 +183,18 @@ p9_walknext(lua_State *L)
 	
 	w = luaL_checkudata(L, 1, "p9-Walk");
 	if(w->nleft == 0){
-		if(w->dirs != nil){
-			free(w->dirs);
-			w->dirs = nil;
-		}
+		freedirs(L, w);
+		if(w->fd == -1)
+			return 0;
 		if((w->nleft = dirread(w->fd, &w->dirs)) == -1){
 			error(L, "dirread: %r");
 			goto Error;
 		}
 		w->p = w->dirs;
+		if(w->dirs != nil){
+			w->dirsz = dirsize(w->dirs, w->nleft);
+			lua_adjustexternal(L, w->dirsz);
+		}
 		if(w->nleft == 0)
 			return 0; /* Last Walk state will be closed */
 	}
@@ -188,10 +219,7 @@ p9_walkclose(lua_State *L)
 	Walk *w;
 	
 	w = luaL_checkudata(L, 1, "p9-Walk");
-	if(w->dirs != nil){
-		free(w->dirs);
-		w->dirs = nil;
-	}
+	freedirs(L, w);
 	if(w->fd != -1){
 		close(w->fd);
 		w->fd = -1;
@@ -199,6 +227,39 @@ p9_walkclose(lua_State *L)
 	return 0;
 }
 
+/* Abandoned walks keep an fd given by the caller */
+static int
+p9_walkgc(lua_State *L)
+{
+	Walk *w;
+	
+	w = luaL_checkudata(L, 1, "p9-Walk");
+	freedirs(L, w);
+	if(w->ownfd && w->fd != -1){
+		close(w->fd);
+		w->fd = -1;
+	}
+	return 0;
+}
+
+/*
+ * The copy of a walk in a clone of the state (see lua_clonestate)
+ * shares neither the directory entries nor the fd: it is over.
+ */
+static int
+p9_walkclone(lua_State *L)
+{
+	Walk *w;
+	
+	w = luaL_checkudata(L, 1, "p9-Walk");
+	w->fd = -1;
+	w->ownfd = 0;
+	w->nleft = 0;
+	w->dirs = w->p = nil;
+	w->dirsz = 0;
+	return 0;
+}
+
 static int
 p9_wstat(lua_State *L)
 {
@@ -0,0 +1,618 @@
+#include <u.h>
+#include <libc.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include "../base/common.c"
+
+/*
+ * Marshalling turns nil, booleans, numbers, strings and
+ * tables of them without metatables into a compact byte
+ * string that any state, in this process or another, can
+ * turn back into an equal value. A table or string met
+ * again is written as a reference to its first occurrence,
+ * so shared and cyclic tables keep their shape.
+ *
+ * The data is a version byte followed by the value, each
+ * value a tag byte and its contents:
+ *
+ *	n f t			nil, false, true
+ *	i zigzag		integer
+ *	d 8 bytes		float, little-endian IEEE 754 double
+ *	s len bytes		string
+ *	T narr nhash ...	table: values 1 to narr, nil for
+ *				holes, then nhash keys and values
+ *	r ref			the ref'th string or table, counting
+ *				from 0 in order of first appearance
+ *
+ * Counts, lengths, references and integers (mapped to
+ * unsigned by zigzag) are varints: 7 bits per byte, low
+ * bits first, the high bit set on all but the last byte.
+ *
+ * Encoding and decoding stream through a lua_Writer and
+ * lua_Reader, so data need not be held in memory whole.
+ */
+
+enum {
+	Version = 1,
+	Maxdepth = 200,	/* table nesting */
+	Maxpresize = 1<<16,	/* table slots trusted to a streamed count */
+};
+
+typedef struct Enc Enc;
+typedef struct Dec Dec;
+
+struct Enc {
+	lua_Writer w;	/* nil to collect everything in p */
+	void *ud;
+	uchar *p;
+	usize n, sz;
+	int seen;	/* stack index of value -> reference */
+	int nref;
+};
+
+struct Dec {
+	lua_Reader r;	/* nil when all data is in p */
+	void *ud;
+	const uchar *p, *e;
+	int refs;	/* stack index of strings and tables decoded */
+	int nref;
+	int fn;	/* stack index of reader function */
+	int piece;	/* stack index keeping its last piece alive */
+};
+
+/*
+ * Encoding
+ */
+
+static void
+flush(lua_State *L, Enc *e)
+{
+	if(e->n > 0 && e->w(L, e->p, e->n, e->ud) != 0)
+		luaL_error(L, "marshal: write error");
+	e->n = 0;
+}
+
+/* Makes room for n more bytes */
+static void
+need(lua_State *L, Enc *e, usize n)
+{
+	usize sz;
+
+	if(e->n + n <= e->sz)
+		return;
+	if(e->w != nil){
+		flush(L, e);
+		if(n <= e->sz)
+			return;
+	}
+	sz = e->sz ? e->sz : e->w != nil ? Iosize : Smallbuf;
+	while(sz < e->n + n)
+		sz *= 2;
+	e->p = Lrealloc(L, e->p, e->sz, sz);
+	lua_adjustexternal(L, sz - e->sz);
+	e->sz = sz;
+}
+
+static void
+putbyte(lua_State *L, Enc *e, int c)
+{
+	if(e->n == e->sz)
+		need(L, e, 1);
+	e->p[e->n++] = c;
+}
+
+static void
+putvarint(lua_State *L, Enc *e, uvlong v)
+{
+	uchar *p;
+
+	need(L, e, 10);
+	p = e->p + e->n;
+	while(v >= 0x80){
+		*p++ = v | 0x80;
+		v >>= 7;
+	}
+	*p++ = v;
+	e->n = p - e->p;
+}
+
+static void
+putbytes(lua_State *L, Enc *e, const void *p, usize n)
+{
+	if(e->w != nil && n >= Iosize){
+		/* large strings go to the writer directly */
+		flush(L, e);
+		if(e->w(L, p, n, e->ud) != 0)
+			luaL_error(L, "marshal: write error");
+		return;
+	}
+	need(L, e, n);
+	memmove(e->p + e->n, p, n);
+	e->n += n;
+}
+
+static void
+putdouble(lua_State *L, Enc *e, double d)
+{
+	uvlong u;
+	uchar *p;
+	int i;
+
+	memmove(&u, &d, sizeof u);
+	need(L, e, 8);
+	p = e->p + e->n;
+	for(i = 0; i < 8; i++)
+		p[i] = u >> 8*i;
+	e->n += 8;
+}
+
+/*
+ * Writes a reference if the string or table at idx was
+ * marshalled before, and gives it the next number if not.
+ */
+static int
+putref(lua_State *L, Enc *e, int idx)
+{
+	lua_pushvalue(L, idx);
+	if(lua_rawget(L, e->seen) == LUA_TNUMBER){
+		putbyte(L, e, 'r');
+		putvarint(L, e, lua_tointeger(L, -1));
+		lua_pop(L, 1);
+		return 1;
+	}
+	lua_pop(L, 1);
+	lua_pushvalue(L, idx);
+	lua_pushinteger(L, e->nref++);
+	lua_rawset(L, e->seen);
+	return 0;
+}
+
+/* Whether the key at idx is one of 1 to narr */
+static int
+inarray(lua_State *L, int idx, lua_Unsigned narr)
+{
+	return lua_isinteger(L, idx)
+		&& (lua_Unsigned)lua_tointeger(L, idx) - 1 < narr;
+}
+
+static void encode(lua_State*, Enc*, int, int);
+
+static void
+enctable(lua_State *L, Enc *e, int idx, int depth)
+{
+	lua_Unsigned narr, nhash, i;
+
+	if(depth > Maxdepth)
+		luaL_error(L, "table nesting too deep to marshal");
+	luaL_checkstack(L, 4, "table nesting too deep to marshal");
+	if(putref(L, e, idx))
+		return;
+	if(lua_getmetatable(L, idx))
+		luaL_error(L, "cannot marshal a table with a metatable");
+
+	/* counts first, so the decoder can presize the table */
+	narr = lua_rawlen(L, idx);
+	nhash = 0;
+	lua_pushnil(L);
+	while(lua_next(L, idx) != 0){
+		lua_pop(L, 1);
+		if(!inarray(L, -1, narr))
+			nhash++;
+	}
+	putbyte(L, e, 'T');
+	putvarint(L, e, narr);
+	putvarint(L, e, nhash);
+	for(i = 1; i <= narr; i++){
+		lua_rawgeti(L, idx, i);
+		encode(L, e, lua_gettop(L), depth + 1);
+		lua_pop(L, 1);
+	}
+	lua_pushnil(L);
+	while(lua_next(L, idx) != 0){
+		if(!inarray(L, -2, narr)){
+			if(nhash-- == 0)
+				luaL_error(L, "table changed while being marshalled");
+			encode(L, e, lua_gettop(L) - 1, depth + 1);
+			encode(L, e, lua_gettop(L), depth + 1);
+		}
+		lua_pop(L, 1);
+	}
+	if(nhash != 0)
+		luaL_error(L, "table changed while being marshalled");
+}
+
+static void
+encode(lua_State *L, Enc *e, int idx, int depth)
+{
+	lua_Integer i;
+	const char *s;
+	usize len;
+
+	switch(lua_type(L, idx)){
+	case LUA_TNIL:
+		putbyte(L, e, 'n');
+		break;
+	case LUA_TBOOLEAN:
+		putbyte(L, e, lua_toboolean(L, idx) ? 't' : 'f');
+		break;
+	case LUA_TNUMBER:
+		if(lua_isinteger(L, idx)){
+			i = lua_tointeger(L, idx);
+			putbyte(L, e, 'i');
+			putvarint(L, e, ((uvlong)i << 1) ^ (uvlong)(i >> 63));
+		}else{
+			putbyte(L, e, 'd');
+			putdouble(L, e, lua_tonumber(L, idx));
+		}
+		break;
+	case LUA_TSTRING:
+		if(putref(L, e, idx))
+			break;
+		s = lua_tolstring(L, idx, &len);
+		putbyte(L, e, 's');
+		putvarint(L, e, len);
+		putbytes(L, e, s, len);
+		break;
+	case LUA_TTABLE:
+		enctable(L, e, idx, depth);
+		break;
+	default:
+		luaL_error(L, "cannot marshal a %s value", luaL_typename(L, idx));
+	}
+}
+
+static void
+encfree(lua_State *L, Enc *e)
+{
+	if(e->p != nil){
+		Lfree(L, e->p, e->sz);
+		lua_adjustexternal(L, -(ptrdiff_t)e->sz);
+	}
+	e->p = nil;
+	e->n = e->sz = 0;
+}
+
+static int
+encgc(lua_State *L)
+{
+	encfree(L, lua_touserdata(L, 1));
+	return 0;
+}
+
+/*
+ * Marshals the value at idx through w, or into the
+ * returned encoder's buffer if w is nil, leaving the
+ * encoder on top of the stack.
+ */
+static Enc*
+marshal(lua_State *L, int idx, lua_Writer w, void *ud)
+{
+	Enc *e;
+
+	idx = lua_absindex(L, idx);
+	e = lua_newuserdatauv(L, sizeof(Enc), 0);
+	memset(e, 0, sizeof(Enc));
+	luaL_setmetatable(L, "p9-Marshal");
+	e->w = w;
+	e->ud = ud;
+	lua_newtable(L);
+	e->seen = lua_gettop(L);
+	putbyte(L, e, Version);
+	encode(L, e, idx, 0);
+	if(w != nil)
+		flush(L, e);
+	lua_pop(L, 1);
+	return e;
+}
+
+/* ud points to the stack index of a Lua function */
+static int
+callwriter(lua_State *L, const void *p, size_t n, void *ud)
+{
+	lua_pushvalue(L, *(int*)ud);
+	lua_pushlstring(L, p, n);
+	lua_call(L, 1, 0);
+	return 0;
+}
+
+static int
+p9_marshal_encode(lua_State *L)
+{
+	Enc *e;
+
+	luaL_checkany(L, 1);
+	lua_settop(L, 1);
+	e = marshal(L, 1, nil, nil);
+	lua_pushlstring(L, (char*)e->p, e->n);
+	encfree(L, e);
+	return 1;
+}
+
+static int
+p9_marshal_write(lua_State *L)
+{
+	int fn;
+
+	luaL_checkany(L, 1);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	lua_settop(L, 2);
+	fn = 2;
+	encfree(L, marshal(L, 1, callwriter, &fn));
+	return 0;
+}
+
+/*
+ * Decoding
+ */
+
+static void
+fill(lua_State *L, Dec *d)
+{
+	const char *s;
+	size_t n;
+
+	s = nil;
+	if(d->r != nil)
+		s = d->r(L, d->ud, &n);
+	if(s == nil || n == 0)
+		luaL_error(L, "marshal: truncated data");
+	d->p = (uchar*)s;
+	d->e = d->p + n;
+}
+
+static int
+getbyte(lua_State *L, Dec *d)
+{
+	if(d->p == d->e)
+		fill(L, d);
+	return *d->p++;
+}
+
+static uvlong
+getvarint(lua_State *L, Dec *d)
+{
+	uvlong v;
+	int c, shift;
+
+	v = 0;
+	shift = 0;
+	do{
+		if(shift > 63)
+			luaL_error(L, "marshal: corrupt data");
+		c = getbyte(L, d);
+		v |= (uvlong)(c & 0x7f) << shift;
+		shift += 7;
+	}while(c & 0x80);
+	return v;
+}
+
+static void
+getbytes(lua_State *L, Dec *d, void *p, usize n)
+{
+	uchar *b;
+	usize m;
+
+	b = p;
+	while(n > 0){
+		if(d->p == d->e)
+			fill(L, d);
+		m = min(n, (usize)(d->e - d->p));
+		memmove(b, d->p, m);
+		b += m;
+		d->p += m;
+		n -= m;
+	}
+}
+
+static double
+getdouble(lua_State *L, Dec *d)
+{
+	uchar b[8];
+	uvlong u;
+	double x;
+	int i;
+
+	getbytes(L, d, b, 8);
+	u = 0;
+	for(i = 0; i < 8; i++)
+		u |= (uvlong)b[i] << 8*i;
+	memmove(&x, &u, sizeof x);
+	return x;
+}
+
+static void
+getstring(lua_State *L, Dec *d)
+{
+	luaL_Buffer b;
+	uvlong len;
+
+	len = getvarint(L, d);
+	if(len <= (uvlong)(d->e - d->p)){
+		lua_pushlstring(L, (char*)d->p, len);
+		d->p += len;
+	}else{
+		if(d->r == nil)	/* all data is in p: it cannot be this long */
+			luaL_error(L, "marshal: truncated data");
+		if(len != (usize)len)
+			luaL_error(L, "marshal: string too large");
+		getbytes(L, d, luaL_buffinitsize(L, &b, len), len);
+		luaL_pushresultsize(&b, len);
+	}
+}
+
+static int
+isnankey(lua_State *L, int idx)
+{
+	lua_Number n;
+
+	if(lua_type(L, idx) != LUA_TNUMBER || lua_isinteger(L, idx))
+		return 0;
+	n = lua_tonumber(L, idx);
+	return n != n;
+}
+
+static void
+decode(lua_State *L, Dec *d, int depth)
+{
+	uvlong u, narr, nhash, i;
+
+	if(depth > Maxdepth)
+		luaL_error(L, "table nesting too deep to unmarshal");
+	luaL_checkstack(L, 3, "table nesting too deep to unmarshal");
+	switch(getbyte(L, d)){
+	case 'n':
+		lua_pushnil(L);
+		break;
+	case 'f':
+		lua_pushboolean(L, 0);
+		break;
+	case 't':
+		lua_pushboolean(L, 1);
+		break;
+	case 'i':
+		u = getvarint(L, d);
+		lua_pushinteger(L, (lua_Integer)(u >> 1) ^ -(lua_Integer)(u & 1));
+		break;
+	case 'd':
+		lua_pushnumber(L, getdouble(L, d));
+		break;
+	case 's':
+		getstring(L, d);
+		lua_pushvalue(L, -1);
+		lua_rawseti(L, d->refs, ++d->nref);
+		break;
+	case 'T':
+		narr = getvarint(L, d);
+		nhash = getvarint(L, d);
+		if(narr != (int)narr || nhash != (int)nhash)
+			luaL_error(L, "marshal: table too large");
+		/* every value takes a byte at least */
+		if(d->r == nil && narr + 2*nhash > (uvlong)(d->e - d->p))
+			luaL_error(L, "marshal: corrupt data");
+		if(d->r != nil)
+			lua_createtable(L, min(narr, Maxpresize), min(nhash, Maxpresize));
+		else
+			lua_createtable(L, narr, nhash);
+		lua_pushvalue(L, -1);
+		lua_rawseti(L, d->refs, ++d->nref);
+		for(i = 1; i <= narr; i++){
+			decode(L, d, depth + 1);
+			if(lua_isnil(L, -1))
+				lua_pop(L, 1);
+			else
+				lua_rawseti(L, -2, i);
+		}
+		while(nhash-- > 0){
+			decode(L, d, depth + 1);
+			if(lua_isnil(L, -1) || isnankey(L, -1))
+				luaL_error(L, "marshal: corrupt data");
+			decode(L, d, depth + 1);
+			lua_rawset(L, -3);
+		}
+		break;
+	case 'r':
+		u = getvarint(L, d);
+		if(u >= (uvlong)d->nref)
+			luaL_error(L, "marshal: corrupt data");
+		lua_rawgeti(L, d->refs, u + 1);
+		break;
+	default:
+		luaL_error(L, "marshal: corrupt data");
+	}
+}
+
+/*
+ * Pushes the value read from d, which is
+ * set up with its input but nothing else.
+ */
+static void
+unmarshal(lua_State *L, Dec *d)
+{
+	int v;
+
+	lua_newtable(L);
+	d->refs = lua_gettop(L);
+	d->nref = 0;
+	if((v = getbyte(L, d)) != Version)
+		luaL_error(L, "marshal: unknown version %d", v);
+	decode(L, d, 0);
+	lua_remove(L, d->refs);
+}
+
+static const char*
+callreader(lua_State *L, void *ud, size_t *n)
+{
+	Dec *d;
+
+	d = ud;
+	lua_pushvalue(L, d->fn);
+	lua_call(L, 0, 1);
+	if(lua_isnil(L, -1)){
+		lua_pop(L, 1);
+		return nil;
+	}
+	if(lua_type(L, -1) != LUA_TSTRING)
+		luaL_error(L, "reader function must return a string");
+	lua_replace(L, d->piece);
+	return lua_tolstring(L, d->piece, n);
+}
+
+static int
+p9_marshal_decode(lua_State *L)
+{
+	Dec d;
+	const char *s;
+	usize len;
+	lua_Integer init;
+
+	s = luaL_checklstring(L, 1, &len);
+	init = luaL_optinteger(L, 2, 1);
+	luaL_argcheck(L, init >= 1 && (lua_Unsigned)init <= len + 1, 2,
+		"initial position out of string");
+	d.r = nil;
+	d.p = (uchar*)s + init - 1;
+	d.e = (uchar*)s + len;
+	unmarshal(L, &d);
+	lua_pushinteger(L, (char*)d.p - s + 1);
+	return 2;
+}
+
+static int
+p9_marshal_read(lua_State *L)
+{
+	Dec d;
+
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	lua_settop(L, 1);
+	lua_pushnil(L);
+	d.r = callreader;
+	d.ud = &d;
+	d.fn = 1;
+	d.piece = 2;
+	d.p = d.e = nil;
+	unmarshal(L, &d);
+	lua_pushlstring(L, (char*)d.p, d.e - d.p);
+	return 2;
+}
+
+static luaL_Reg p9_marshal_module[] = {
+	{"encode", p9_marshal_encode},
+	{"decode", p9_marshal_decode},
+	{"write", p9_marshal_write},
+	{"read", p9_marshal_read},
+	{nil, nil},
+};
+
+int
+luaopen_p9_marshal(lua_State *L)
+{
+	luaL_newmetatable(L, "p9-Marshal");
+	lua_pushcfunction(L, encgc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 1);
+	luaL_newlib(L, p9_marshal_module);
+	return 1;
+}
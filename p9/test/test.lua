@@ -50,6 +50,16 @@ do
 	assert(fd:seek(16*1024 - 4, "set") == 16*1024 - 4)
 	assert(fd:slurp() == "ABCD")
 	fd:close()
+	
+	-- Reads growing the shared buffer more than once
+	-- (a read may return less than asked for)
+	fd = p9.open(f, "r")
+	for _, n in ipairs{12*1024, 4*1024, 16*1024, 20*1024} do
+		local r = fd:read(n, 0)
+		assert(#r > 0 and #r <= n and r == s:sub(1, #r))
+	end
+	assert(fd:path() == f)
+	fd:close()
 end
 
 -- File objects
@@ -191,6 +201,21 @@ do
 		return true
 	end
 	assert(compare("/tmp/fs", fs) == true)
+	
+	-- Abandoned walks of a path close the fd they opened
+	local function nfd()
+		local n = 0
+		for _ in p9.walk("/fd") do n = n + 1 end
+		return n
+	end
+	local n = nfd()
+	for i = 1, 10 do
+		local f, s = p9.walk("/tmp/fs")
+		f(s)
+	end
+	collectgarbage()
+	collectgarbage()
+	assert(nfd() == n)
 end
 
 
@@ -328,6 +353,349 @@ end
 
 
 
+-- Threads
+do
+	local thread = require "p9.thread"
+	
+	local t = thread.start("local a, b = ... return a + b, {a, b}", 2, 3)
+	local ok, sum, pair = t:join()
+	assert(ok and sum == 5 and pair[1] == 2 and pair[2] == 3)
+	assert(pcall(t.join, t) == false)
+	
+	local err
+	ok, err = thread.start(function() error("boom") end):join()
+	assert(not ok and err:find("boom"))
+	
+	-- shared and cyclic tables
+	local c = {}
+	c.self, c.list = c, {c, c}
+	ok, c = thread.start(function(c) return c end, c):join()
+	assert(ok and c.self == c and c.list[1] == c and c.list[2] == c)
+	assert(pcall(thread.start, "", setmetatable({}, {})) == false)
+	
+	-- workers
+	local jobs, results = thread.channel(4), thread.channel(4)
+	local workers = {}
+	for i = 1, 4 do
+		workers[i] = thread.start(function(jobs, results)
+			for v in function() return (jobs:recv()) end do
+				results:send(v * v)
+			end
+		end, jobs, results)
+	end
+	thread.start(function(jobs)
+		for i = 1, 100 do jobs:send(i) end
+		jobs:close()
+	end, jobs)
+	local sum = 0
+	for i = 1, 100 do sum = sum + results:recv() end
+	assert(sum == 338350)
+	for i = 1, 4 do assert(workers[i]:join()) end
+	assert(select(2, jobs:recv()) == false)
+end
+
+
+
+-- Marshalling
+do
+	local marshal = require "p9.marshal"
+
+	local t = {1, nil, 3.5, "x", {true, false}, [-1] = math.mininteger, k = string.rep("v", 10000)}
+	local s = marshal.encode(t)
+	local r, n = marshal.decode(s)
+	assert(n == #s + 1)
+	assert(r[1] == 1 and r[2] == nil and r[3] == 3.5 and r[4] == "x")
+	assert(r[5][1] == true and r[5][2] == false)
+	assert(math.type(r[-1]) == "integer" and r[-1] == math.mininteger)
+	assert(r.k == t.k)
+
+	-- shared and cyclic tables
+	local c = {}
+	c.self, c.list = c, {c, c}
+	c = marshal.decode(marshal.encode(c))
+	assert(c.self == c and c.list[1] == c and c.list[2] == c)
+	assert(pcall(marshal.encode, setmetatable({}, {})) == false)
+	assert(pcall(marshal.encode, print) == false)
+	assert(pcall(marshal.decode, s:sub(1, -2)) == false)
+	local ok, err = pcall(marshal.decode, "\1s\128\128\128\128\128\32x")
+	assert(not ok and err:find("truncated"))	-- a 2^40-byte string
+
+	-- streaming, a byte at a time on the way back
+	local pieces = {}
+	marshal.write(t, function(p) pieces[#pieces + 1] = p end)
+	s = table.concat(pieces) .. "rest"
+	local i = 0
+	local rest
+	r, rest = marshal.read(function()
+		i = i + 1
+		return s:sub(i, i) ~= "" and s:sub(i, i) or nil
+	end)
+	assert(r.k == t.k and rest == "")
+end
+
+
+
+-- Ephemerons reached only through other ephemerons
+do
+	local mk = {__mode = "k"}
+	local e = setmetatable({}, mk)
+	local root = {}
+	local keys = {root}
+	for i = 2, 100 do keys[i] = {} end
+	math.randomseed(7)
+	for i = 100, 3, -1 do
+		local j = math.random(2, i)
+		keys[i], keys[j] = keys[j], keys[i]
+	end
+	for i = 1, 99 do e[keys[i]] = keys[i + 1] end
+	-- groups of weak-key tables first reached through 'e', whose
+	-- keys are themselves reached only through the previous table
+	local attach = function(v) e[keys[100]] = v end
+	for g = 1, 3 do
+		local t, b = {}, {}
+		for i = 1, 4 do t[i] = setmetatable({}, mk); b[i] = {} end
+		attach(t[1])
+		for i = 1, 3 do e[t[i]] = t[i + 1]; t[i][b[i]] = b[i + 1] end
+		e[t[4]] = b[1]
+		local t4, b4 = t[4], b[4]
+		attach = function(v) t4[b4] = v end
+	end
+	attach({tag = "live"})
+	keys, attach = nil, nil
+	collectgarbage()
+	collectgarbage()
+	local k = root
+	for i = 1, 99 do k = e[k] end
+	local v = e[k]
+	for g = 1, 3 do
+		local t = {v}
+		for i = 1, 3 do t[i + 1] = e[t[i]] end
+		local b = e[t[4]]
+		for i = 1, 3 do b = t[i][b] end
+		v = t[4][b]
+	end
+	assert(v.tag == "live")
+end
+
+
+
+-- The same chunks with and without --!optimize
+do
+	local progs = {
+		[[
+		local a, b = ...
+		local x = a
+		local y = x
+		x = 10
+		x = b
+		local n = nil
+		n = 5
+		local c = a
+		if c == y then n = not c end
+		local t = {}
+		for i = 1, 10 do local d = i; t[d] = d end
+		return x, y, n, t[10], c == b
+		]],
+		-- a local that only keeps a value alive still does
+		[[
+		local w = setmetatable({}, {__mode = "v"})
+		local k = {}
+		w[1] = k
+		local keep = k
+		k = nil
+		collectgarbage()
+		return w[1] == keep, keep ~= nil
+		]],
+		-- error messages still name the variables
+		[[
+		local a = ...
+		local b = a
+		local c = b
+		return select(2, pcall(function() return b.x end)), select(2, pcall(function() return c.y end))
+		]],
+		-- upvalues are read again after a call that may change them
+		[[
+		local u = ...
+		local function bump() u = u + 1 end
+		local function f()
+			local a, b = u, u
+			bump()
+			return a, b, u, u
+		end
+		return f()
+		]],
+		-- and name themselves in errors when read once
+		[[
+		local up = ...
+		local function f() return up, up[1] end
+		local function g() local a = up; return a, not up, up[2] end
+		return select(2, pcall(f)), select(2, pcall(g))
+		]],
+	}
+	for _, s in ipairs(progs) do
+		local f = assert(load("--\n" .. s, "=opt"))
+		local g = assert(load("--!optimize\n" .. s, "=opt"))
+		local r1 = table.pack(f(3, 4))
+		local r2 = table.pack(g(3, 4))
+		assert(r1.n == r2.n)
+		for i = 1, r1.n do assert(r1[i] == r2[i], s) end
+		assert(#string.dump(g, true) <= #string.dump(f, true))
+	end
+end
+
+
+
+-- Data chunks
+do
+	local s = "return {1, 2, x = 'y', {z = -3}}"
+	local t = assert(load(s, "=d", "d", {}))()	-- env is not the value
+	assert(t[1] == 1 and t[2] == 2 and t.x == "y" and t[3].z == -3)
+	assert(assert(load(s, "=d", "d"))()[3].z == -3)
+	assert(load("return 1 + 1", "=d", "d") == nil)
+	local name = os.tmpname()
+	local f = assert(io.open(name, "w"))
+	f:write(s)
+	f:close()
+	t = assert(loadfile(name, "d", {}))()
+	os.remove(name)
+	assert(t.x == "y" and t[3].z == -3)
+end
+
+
+
+-- Inlining leaves alone helpers that look at the stack by level
+do
+	local s = [[
+local function check(v)
+	if not v then error("bad value", 2) end
+	return v
+end
+local function line() return debug.getinfo(2, "l").currentline end
+local ok, e = pcall(function() local v = check(false); return v end)
+local n = line()
+return e, n
+]]
+	local e1, n1 = assert(load("--\n" .. s, "=in"))()
+	local e2, n2 = assert(load("--!inline\n" .. s, "=in"))()
+	assert(e1 == "in:7: bad value" and n1 == 8, e1)
+	assert(e2 == e1 and n2 == n1, e2)
+end
+
+
+
+-- Lazy functions report their parameters before the first call
+do
+	local s = [[
+local obj = {}
+function obj:m(a, b) return self, a, b end
+local function v(x, ...) return select("#", ...) end
+return obj.m, v
+]]
+	local m, v = assert(load("--!lazy\n" .. s))()
+	for i = 1, 2 do
+		local a, b = debug.getinfo(m, "u"), debug.getinfo(v, "u")
+		assert(a.nparams == 3 and not a.isvararg)
+		assert(b.nparams == 1 and b.isvararg)
+		assert(select(3, m(1, 2, 3)) == 3 and v(1, 2, 3) == 2)
+	end
+end
+
+
+
+-- A coroutine out of its quota yields coroutine.quotamark
+do
+	local co = coroutine.create(function(n)
+		local s = 0
+		for i = 1, n do s = s + i end
+		coroutine.yield("quota")
+		return s
+	end)
+	coroutine.quota(co, 1000)
+	local marks = 0
+	local ok, v = coroutine.resume(co, 100000)
+	while v == coroutine.quotamark do
+		assert(ok and type(v) == "userdata")
+		marks = marks + 1
+		ok, v = coroutine.resume(co)
+	end
+	assert(ok and v == "quota" and marks > 50)
+	repeat ok, v = coroutine.resume(co) until v ~= coroutine.quotamark
+	assert(ok and v == 5000050000)
+end
+
+
+
+-- Binary chunks give their lines and names when asked for them
+do
+	local s = [[
+local up = 1
+local function f(a)
+	local b = a + up
+	if b > 2 then error("big") end
+	return b
+end
+return f
+]]
+	for _, strip in ipairs{false, true} do
+		local bc = string.dump(assert(load(s, "=lines")), strip)
+		local f = assert(load(bc, "=lines", "b"))()
+		local _, e = pcall(f, 5)
+		assert(e == (strip and "big" or "lines:4: big"))
+		local l = debug.getinfo(f, "L").activelines
+		assert(strip and next(l) == nil or l[3] and l[4] and l[5])
+		assert(debug.getlocal(f, 1) == (not strip and "a" or nil))
+		local bf = string.dump(f, strip)
+		assert(string.dump(load(bf), strip) == bf)
+	end
+end
+
+
+
+-- Vararg functions see their arguments where the caller left them
+do
+	local function f(a, ...)
+		assert(select(2, debug.getlocal(1, 1)) == a)
+		assert(select(2, debug.getlocal(1, -2)) == select(2, ...))
+		return a, ...
+	end
+	local seen
+	debug.sethook(function()
+		local ar = debug.getinfo(2, "r")
+		seen = select(2, debug.getlocal(2, ar.ftransfer + 2))
+	end, "r")
+	local a, b, c = f(1, 2, 3)
+	debug.sethook()
+	assert(a == 1 and b == 2 and c == 3 and seen == 3)
+	local function g(...) return f(...) end
+	assert(select("#", g(1, 2, 3, nil)) == 4)
+	local co = coroutine.wrap(function(...)
+		local x = coroutine.yield(select("#", ...))
+		return x, ...
+	end)
+	assert(co(4, 5) == 2)
+	assert(select(3, co(6)) == 5)
+end
+
+
+
+-- Leaf C functions give one value and fail like other C functions
+do
+	local abs = math.abs
+	assert(select("#", abs(-1)) == 1 and abs(-1, 2) == 1)
+	local a, b = abs(-1)
+	assert(a == 1 and b == nil)
+	local ok, err = pcall(function() return abs("x") end)
+	assert(not ok and err:find("bad argument #1 to 'abs'"))
+	local calls = 0
+	debug.sethook(function() calls = calls + 1 end, "cr")
+	a = abs(-2)
+	debug.sethook()
+	assert(a == 2 and calls >= 2)
+	assert(({[abs] = true})[math.abs] and p9.nsec() > 0)
+end
+
+
+
 -- Check for leaks (might not come from us)
 if leak then
 	if p9.rfork("proc") == 0 then
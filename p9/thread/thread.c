@@ -0,0 +1,895 @@
+#include <u.h>
+#include <libc.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+#include "../base/common.c"
+
+/*
+ * Threads run Lua states of their own, each in a proc
+ * sharing memory with its creator (rfork(RFPROC|RFMEM)),
+ * so a program can keep more than one processor busy.
+ *
+ * Lua values never cross states. They are copied through
+ * messages: flat buffers allocated outside of any Lua heap
+ * holding an encoding of nil, booleans, numbers, strings,
+ * C functions without upvalues, channels and tables
+ * without metatables. Shared and cyclic references to
+ * tables survive the copy.
+ *
+ * Channels are bounded queues of messages. Every state
+ * holding a channel keeps a reference to it, and the
+ * channel is freed when the last of them lets it go.
+ * A message still queued on a channel keeps references
+ * to the channels it carries, so a channel sent into
+ * itself is never freed.
+ */
+
+enum {
+	Maxdepth = 200,	/* table nesting in a message */
+};
+
+typedef struct Msg Msg;
+typedef struct Chan Chan;
+typedef struct Thread Thread;
+typedef struct Enc Enc;
+typedef struct Dec Dec;
+
+struct Msg {
+	Msg *next;
+	int nval;	/* number of values */
+	int nchan;
+	Chan **chan;	/* channels referred to by data */
+	uchar *data;
+	usize n;	/* size of data */
+};
+
+struct Chan {
+	QLock lk;
+	Rendez full;	/* senders wait for room */
+	Rendez empty;	/* receivers wait for messages */
+	int ref;
+	int cap;
+	int n;
+	int closed;
+	Msg *head;
+	Msg *tail;
+};
+
+struct Thread {
+	QLock lk;
+	Rendez done;
+	int ref;	/* handle and proc */
+	int finished;
+	Msg *args;	/* preloads, chunk and arguments */
+	lua_Chunk *chunk;	/* the chunk, when a function */
+	Msg *result;	/* values returned by the chunk */
+	char *err;	/* or the error it raised */
+};
+
+struct Enc {
+	uchar *p;
+	usize n, sz;
+	int seen;	/* stack index of value -> reference number */
+	int chans;	/* stack index of channels referred to */
+	int ntab, nchan;
+};
+
+struct Dec {
+	Msg *m;
+	uchar *p;
+	int tabs;	/* stack index of tables decoded so far */
+	int ntab;
+};
+
+static void msgfree(Msg*);
+
+static void
+chanunref(Chan *c)
+{
+	Msg *m;
+	int r;
+
+	qlock(&c->lk);
+	r = --c->ref;
+	qunlock(&c->lk);
+	if(r > 0)
+		return;
+	while((m = c->head) != nil){
+		c->head = m->next;
+		msgfree(m);
+	}
+	free(c);
+}
+
+static void
+msgfree(Msg *m)
+{
+	int i;
+
+	if(m == nil)
+		return;
+	for(i = 0; i < m->nchan; i++)
+		chanunref(m->chan[i]);
+	free(m);
+}
+
+static void
+threadunref(Thread *t)
+{
+	int r;
+
+	qlock(&t->lk);
+	r = --t->ref;
+	qunlock(&t->lk);
+	if(r > 0)
+		return;
+	msgfree(t->args);
+	msgfree(t->result);
+	if(t->chunk != nil)
+		lua_releasechunk(t->chunk);
+	free(t->err);
+	free(t);
+}
+
+/*
+ * Message encoding
+ */
+
+static void
+put(lua_State *L, Enc *e, void *p, usize n)
+{
+	uchar *np;
+	usize sz;
+
+	if(e->n + n > e->sz){
+		sz = e->sz ? e->sz : Smallbuf;
+		while(sz < e->n + n)
+			sz *= 2;
+		if((np = realloc(e->p, sz)) == nil)
+			luaL_error(L, "out of memory");
+		e->p = np;
+		e->sz = sz;
+	}
+	memmove(e->p + e->n, p, n);
+	e->n += n;
+}
+
+static void
+puttag(lua_State *L, Enc *e, int tag)
+{
+	uchar c;
+
+	c = tag;
+	put(L, e, &c, 1);
+}
+
+static void encode(lua_State*, Enc*, int, int);
+
+/* C functions without upvalues are the same in every state */
+static int
+islightcf(lua_State *L, int idx)
+{
+	if(lua_tocfunction(L, idx) == nil)
+		return 0;
+	if(lua_getupvalue(L, idx, 1) != nil){
+		lua_pop(L, 1);
+		return 0;
+	}
+	return 1;
+}
+
+static void
+enctable(lua_State *L, Enc *e, int idx, int depth)
+{
+	usize at;
+	int narr, npair, ref;
+
+	if(depth > Maxdepth)
+		luaL_error(L, "table nesting too deep to copy");
+	luaL_checkstack(L, 3, "table nesting too deep to copy");
+	lua_pushvalue(L, idx);
+	if(lua_rawget(L, e->seen) == LUA_TNUMBER){
+		ref = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		puttag(L, e, 'r');
+		put(L, e, &ref, sizeof ref);
+		return;
+	}
+	lua_pop(L, 1);
+	if(lua_getmetatable(L, idx))
+		luaL_error(L, "cannot copy a table with a metatable");
+	lua_pushvalue(L, idx);
+	lua_pushinteger(L, ++e->ntab);
+	lua_rawset(L, e->seen);
+
+	/* counts are filled in once known, for presizing on decode */
+	puttag(L, e, 'T');
+	at = e->n;
+	narr = npair = 0;
+	put(L, e, &narr, sizeof narr);
+	put(L, e, &npair, sizeof npair);
+	lua_pushnil(L);
+	while(lua_next(L, idx) != 0){
+		encode(L, e, lua_gettop(L) - 1, depth + 1);
+		encode(L, e, lua_gettop(L), depth + 1);
+		lua_pop(L, 1);
+		npair++;
+	}
+	narr = min(lua_rawlen(L, idx), (lua_Unsigned)npair);
+	memmove(e->p + at, &narr, sizeof narr);
+	memmove(e->p + at + sizeof narr, &npair, sizeof npair);
+}
+
+static void
+encode(lua_State *L, Enc *e, int idx, int depth)
+{
+	lua_Integer i;
+	lua_Number n;
+	lua_CFunction f;
+	const char *s;
+	usize len;
+	int ref;
+
+	switch(lua_type(L, idx)){
+	case LUA_TNIL:
+		puttag(L, e, 'n');
+		break;
+	case LUA_TBOOLEAN:
+		puttag(L, e, lua_toboolean(L, idx) ? 't' : 'f');
+		break;
+	case LUA_TNUMBER:
+		if(lua_isinteger(L, idx)){
+			i = lua_tointeger(L, idx);
+			puttag(L, e, 'i');
+			put(L, e, &i, sizeof i);
+		}else{
+			n = lua_tonumber(L, idx);
+			puttag(L, e, 'd');
+			put(L, e, &n, sizeof n);
+		}
+		break;
+	case LUA_TSTRING:
+		s = lua_tolstring(L, idx, &len);
+		puttag(L, e, 's');
+		put(L, e, &len, sizeof len);
+		put(L, e, (void*)s, len);
+		break;
+	case LUA_TTABLE:
+		enctable(L, e, idx, depth);
+		break;
+	case LUA_TFUNCTION:
+		if(!islightcf(L, idx))
+			goto bad;
+		f = lua_tocfunction(L, idx);
+		puttag(L, e, 'C');
+		put(L, e, &f, sizeof f);
+		break;
+	case LUA_TUSERDATA:
+		if(luaL_testudata(L, idx, "p9-Chan") == nil)
+			goto bad;
+		lua_pushvalue(L, idx);
+		if(lua_rawget(L, e->seen) == LUA_TNUMBER)
+			ref = lua_tointeger(L, -1);
+		else{
+			ref = e->nchan++;
+			lua_pushvalue(L, idx);
+			lua_rawseti(L, e->chans, e->nchan);
+			lua_pushvalue(L, idx);
+			lua_pushinteger(L, ref);
+			lua_rawset(L, e->seen);
+		}
+		lua_pop(L, 1);
+		puttag(L, e, 'c');
+		put(L, e, &ref, sizeof ref);
+		break;
+	default:
+	bad:
+		luaL_error(L, "cannot copy a %s value", luaL_typename(L, idx));
+	}
+}
+
+static int
+encgc(lua_State *L)
+{
+	Enc *e;
+
+	e = lua_touserdata(L, 1);
+	free(e->p);
+	e->p = nil;
+	return 0;
+}
+
+/*
+ * Copies the values from stack index first to the top
+ * into a new message, leaving the stack as it was.
+ */
+static Msg*
+pack(lua_State *L, int first)
+{
+	Enc *e;
+	Msg *m;
+	Chan **c;
+	int i, last;
+
+	last = lua_gettop(L);
+	e = lua_newuserdatauv(L, sizeof(Enc), 0);
+	memset(e, 0, sizeof(Enc));
+	luaL_setmetatable(L, "p9-Enc");
+	lua_newtable(L);
+	e->seen = lua_gettop(L);
+	lua_newtable(L);
+	e->chans = lua_gettop(L);
+	for(i = first; i <= last; i++)
+		encode(L, e, i, 0);
+	m = malloc(sizeof(Msg) + e->nchan * sizeof(Chan*) + e->n);
+	if(m == nil)
+		luaL_error(L, "out of memory");
+	m->next = nil;
+	m->nval = last - first + 1;
+	m->nchan = e->nchan;
+	m->chan = (Chan**)(m + 1);
+	m->data = (uchar*)(m->chan + m->nchan);
+	m->n = e->n;
+	if(e->n > 0)
+		memmove(m->data, e->p, e->n);
+	for(i = 0; i < m->nchan; i++){
+		lua_rawgeti(L, e->chans, i + 1);
+		c = lua_touserdata(L, -1);
+		m->chan[i] = *c;
+		qlock(&(*c)->lk);
+		(*c)->ref++;
+		qunlock(&(*c)->lk);
+		lua_pop(L, 1);
+	}
+	free(e->p);
+	e->p = nil;
+	lua_settop(L, last);
+	return m;
+}
+
+/*
+ * Message decoding
+ */
+
+static void
+get(Dec *d, void *p, usize n)
+{
+	memmove(p, d->p, n);
+	d->p += n;
+}
+
+static void
+chanpush(lua_State *L, Chan *c)
+{
+	Chan **p;
+
+	p = lua_newuserdatauv(L, sizeof(Chan*), 0);
+	*p = c;
+	qlock(&c->lk);
+	c->ref++;
+	qunlock(&c->lk);
+	luaL_setmetatable(L, "p9-Chan");
+}
+
+static void
+decode(lua_State *L, Dec *d)
+{
+	lua_Integer i;
+	lua_Number n;
+	lua_CFunction f;
+	usize len;
+	int narr, npair, ref;
+
+	luaL_checkstack(L, 3, "table nesting too deep to copy");
+	switch(*d->p++){
+	case 'n':
+		lua_pushnil(L);
+		break;
+	case 'f':
+		lua_pushboolean(L, 0);
+		break;
+	case 't':
+		lua_pushboolean(L, 1);
+		break;
+	case 'i':
+		get(d, &i, sizeof i);
+		lua_pushinteger(L, i);
+		break;
+	case 'd':
+		get(d, &n, sizeof n);
+		lua_pushnumber(L, n);
+		break;
+	case 's':
+		get(d, &len, sizeof len);
+		lua_pushlstring(L, (char*)d->p, len);
+		d->p += len;
+		break;
+	case 'T':
+		get(d, &narr, sizeof narr);
+		get(d, &npair, sizeof npair);
+		lua_createtable(L, narr, npair - narr);
+		lua_pushvalue(L, -1);
+		lua_rawseti(L, d->tabs, ++d->ntab);
+		while(npair-- > 0){
+			decode(L, d);
+			decode(L, d);
+			lua_rawset(L, -3);
+		}
+		break;
+	case 'r':
+		get(d, &ref, sizeof ref);
+		lua_rawgeti(L, d->tabs, ref);
+		break;
+	case 'C':
+		get(d, &f, sizeof f);
+		lua_pushcfunction(L, f);
+		break;
+	case 'c':
+		get(d, &ref, sizeof ref);
+		chanpush(L, d->m->chan[ref]);
+		break;
+	default:
+		luaL_error(L, "corrupt message");
+	}
+}
+
+static int
+boxgc(lua_State *L)
+{
+	Msg **b;
+
+	b = lua_touserdata(L, 1);
+	msgfree(*b);
+	*b = nil;
+	return 0;
+}
+
+/*
+ * Pushes a box that frees the message it holds
+ * in case of errors while the message is unpacked.
+ */
+static Msg**
+newbox(lua_State *L)
+{
+	Msg **b;
+
+	b = lua_newuserdatauv(L, sizeof(Msg*), 0);
+	*b = nil;
+	luaL_setmetatable(L, "p9-Msgbox");
+	return b;
+}
+
+/*
+ * Pushes the values of the message held in the box at
+ * the top of the stack in its place, and frees the message.
+ */
+static int
+unpack(lua_State *L)
+{
+	Msg **b;
+	Dec d;
+	int box, i, n;
+
+	box = lua_gettop(L);
+	b = lua_touserdata(L, box);
+	d.m = *b;
+	d.p = d.m->data;
+	d.ntab = 0;
+	luaL_checkstack(L, d.m->nval + 1, "too many values to copy");
+	lua_newtable(L);
+	d.tabs = lua_gettop(L);
+	for(i = 0; i < d.m->nval; i++)
+		decode(L, &d);
+	lua_remove(L, d.tabs);
+	n = d.m->nval;
+	msgfree(*b);
+	*b = nil;
+	lua_remove(L, box);
+	return n;
+}
+
+/*
+ * Threads
+ */
+
+static void newmetatables(lua_State*);
+
+static int
+traceback(lua_State *L)
+{
+	const char *m;
+
+	m = lua_tostring(L, 1);
+	if(m == nil){
+		if(luaL_callmeta(L, 1, "__tostring") && lua_type(L, -1) == LUA_TSTRING)
+			return 1;
+		m = lua_pushfstring(L,
+			"(error object is a %s value)", luaL_typename(L, 1));
+	}
+	luaL_traceback(L, L, m, 1);
+	return 1;
+}
+
+static int
+threadmain(lua_State *L)
+{
+	Thread *t;
+	const char *s;
+	usize len;
+	int n;
+
+	t = lua_touserdata(L, 1);
+	lua_settop(L, 0);
+	lua_pushboolean(L, 1);
+	lua_setfield(L, LUA_REGISTRYINDEX, "LUA_NOENV");
+	luaL_openlibs(L);
+	newmetatables(L);
+
+	/* traceback, preloads, chunk, arguments */
+	lua_pushcfunction(L, traceback);
+	*newbox(L) = t->args;
+	t->args = nil;
+	n = unpack(L) - 2;
+	luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+	lua_pushnil(L);
+	while(lua_next(L, 2) != 0){
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_settable(L, -4);
+	}
+	lua_pop(L, 1);
+	lua_remove(L, 2);
+	if(t->chunk != nil){
+		lua_loadchunk(L, t->chunk);
+		lua_releasechunk(t->chunk);	/* L holds it now */
+		t->chunk = nil;
+	}else{
+		s = lua_tolstring(L, 2, &len);
+		if(luaL_loadbuffer(L, s, len, "=thread") != LUA_OK)
+			return lua_error(L);
+	}
+	lua_replace(L, 2);
+	if(lua_pcall(L, n, LUA_MULTRET, 1) != LUA_OK)
+		return lua_error(L);
+	t->result = pack(L, 2);
+	return 0;
+}
+
+static void
+threadrun(Thread *t)
+{
+	lua_State *L;
+	const char *err;
+
+	if((L = luaL_newstate()) == nil)
+		t->err = strdup("out of memory");
+	else{
+		lua_pushcfunction(L, threadmain);
+		lua_pushlightuserdata(L, t);
+		if(lua_pcall(L, 1, 0, 0) != LUA_OK){
+			if((err = lua_tostring(L, -1)) == nil)
+				err = "(error object is not a string)";
+			t->err = strdup(err);
+		}
+		lua_close(L);
+	}
+	qlock(&t->lk);
+	t->finished = 1;
+	rwakeupall(&t->done);
+	qunlock(&t->lk);
+	threadunref(t);
+}
+
+/*
+ * A function goes to the new state as a chunk shared with
+ * it (see lua_sharechunk), not compiled or undumped again;
+ * its place in the message is taken by false. The thread
+ * is tied to its handle from the start, so that errors on
+ * the way leave the handle to free it.
+ */
+static int
+p9_thread_start(lua_State *L)
+{
+	Thread **h, *t;
+
+	luaL_argexpected(L, lua_type(L, 1) == LUA_TSTRING
+		|| lua_type(L, 1) == LUA_TFUNCTION, 1, "string or function");
+	h = lua_newuserdatauv(L, sizeof(Thread*), 0);
+	*h = nil;
+	luaL_setmetatable(L, "p9-Thread");
+	lua_insert(L, 1);
+	if((t = mallocz(sizeof(Thread), 1)) == nil)
+		return luaL_error(L, "out of memory");
+	t->done.l = &t->lk;
+	t->ref = 1;
+	*h = t;
+	if(lua_type(L, 2) == LUA_TFUNCTION){
+		lua_pushvalue(L, 2);
+		if((t->chunk = luaL_sharechunk(L)) == nil)
+			return luaL_error(L, "unable to share given function");
+		lua_pop(L, 1);
+		lua_pushboolean(L, 0);
+		lua_replace(L, 2);
+	}
+
+	/* Loaders the new state can use too */
+	lua_newtable(L);
+	luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
+	lua_pushnil(L);
+	while(lua_next(L, -2) != 0){
+		if(lua_type(L, -2) == LUA_TSTRING && islightcf(L, -1)){
+			lua_pushvalue(L, -2);
+			lua_insert(L, -2);
+			lua_rawset(L, -5);
+		}else
+			lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	lua_insert(L, 2);
+
+	t->args = pack(L, 2);
+	t->ref = 2;
+	switch(rfork(RFPROC|RFMEM|RFNOWAIT)){
+	case -1:
+		t->ref = 1;
+		return error(L, "rfork: %r");
+	case 0:
+		threadrun(t);
+		_exits(nil);
+	}
+	lua_settop(L, 1);
+	return 1;
+}
+
+static int
+p9_thread_join(lua_State *L)
+{
+	Thread **h, *t;
+	Msg **b;
+
+	h = luaL_checkudata(L, 1, "p9-Thread");
+	if((t = *h) == nil)
+		return luaL_error(L, "thread already joined");
+	lua_settop(L, 1);
+	lua_pushboolean(L, 1);
+	b = newbox(L);
+	qlock(&t->lk);
+	while(!t->finished)
+		rsleep(&t->done);
+	qunlock(&t->lk);
+	if(t->err != nil){
+		lua_pushboolean(L, 0);
+		lua_pushstring(L, t->err);
+		*h = nil;
+		threadunref(t);
+		return 2;
+	}
+	*b = t->result;
+	t->result = nil;
+	*h = nil;
+	threadunref(t);
+	return 1 + unpack(L);
+}
+
+/*
+ * Only the original handle can join the thread; its copy
+ * in a clone of the state (see lua_clonestate) is joined
+ * already.
+ */
+static int
+p9_thread_clone(lua_State *L)
+{
+	Thread **h;
+
+	h = lua_touserdata(L, 1);
+	*h = nil;
+	return 0;
+}
+
+static int
+p9_thread_gc(lua_State *L)
+{
+	Thread **h;
+
+	h = lua_touserdata(L, 1);
+	if(*h != nil)
+		threadunref(*h);
+	*h = nil;
+	return 0;
+}
+
+/*
+ * Channels
+ */
+
+static int
+p9_thread_channel(lua_State *L)
+{
+	Chan **p;
+	lua_Integer cap;
+
+	cap = luaL_optinteger(L, 1, 1);
+	luaL_argcheck(L, cap > 0 && cap == (int)cap, 1, "capacity out of range");
+	p = lua_newuserdatauv(L, sizeof(Chan*), 0);
+	*p = nil;
+	luaL_setmetatable(L, "p9-Chan");
+	if((*p = mallocz(sizeof(Chan), 1)) == nil)
+		return luaL_error(L, "out of memory");
+	(*p)->full.l = &(*p)->lk;
+	(*p)->empty.l = &(*p)->lk;
+	(*p)->ref = 1;
+	(*p)->cap = cap;
+	return 1;
+}
+
+static int
+p9_chan_send(lua_State *L)
+{
+	Chan *c;
+	Msg *m;
+
+	c = *(Chan**)luaL_checkudata(L, 1, "p9-Chan");
+	luaL_checkany(L, 2);
+	lua_settop(L, 2);
+	m = pack(L, 2);
+	qlock(&c->lk);
+	while(c->n >= c->cap && !c->closed)
+		rsleep(&c->full);
+	if(c->closed){
+		qunlock(&c->lk);
+		msgfree(m);
+		return luaL_error(L, "send on closed channel");
+	}
+	if(c->tail != nil)
+		c->tail->next = m;
+	else
+		c->head = m;
+	c->tail = m;
+	c->n++;
+	rwakeup(&c->empty);
+	qunlock(&c->lk);
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+static int
+p9_chan_recv(lua_State *L)
+{
+	Chan *c;
+	Msg **b, *m;
+
+	c = *(Chan**)luaL_checkudata(L, 1, "p9-Chan");
+	lua_settop(L, 1);
+	b = newbox(L);
+	qlock(&c->lk);
+	while(c->n == 0 && !c->closed)
+		rsleep(&c->empty);
+	if((m = c->head) == nil){
+		qunlock(&c->lk);
+		lua_pushnil(L);
+		lua_pushboolean(L, 0);
+		return 2;
+	}
+	if((c->head = m->next) == nil)
+		c->tail = nil;
+	c->n--;
+	rwakeup(&c->full);
+	qunlock(&c->lk);
+	m->next = nil;
+	*b = m;
+	unpack(L);
+	lua_pushboolean(L, 1);
+	return 2;
+}
+
+static int
+p9_chan_close(lua_State *L)
+{
+	Chan *c;
+
+	c = *(Chan**)luaL_checkudata(L, 1, "p9-Chan");
+	qlock(&c->lk);
+	c->closed = 1;
+	rwakeupall(&c->full);
+	rwakeupall(&c->empty);
+	qunlock(&c->lk);
+	return 0;
+}
+
+static int
+p9_chan_len(lua_State *L)
+{
+	Chan *c;
+	int n;
+
+	c = *(Chan**)luaL_checkudata(L, 1, "p9-Chan");
+	qlock(&c->lk);
+	n = c->n;
+	qunlock(&c->lk);
+	lua_pushinteger(L, n);
+	return 1;
+}
+
+/* A copy in a clone of the state holds its own reference */
+static int
+p9_chan_clone(lua_State *L)
+{
+	Chan *c;
+
+	c = *(Chan**)lua_touserdata(L, 1);
+	if(c != nil){
+		qlock(&c->lk);
+		c->ref++;
+		qunlock(&c->lk);
+	}
+	return 0;
+}
+
+static int
+p9_chan_gc(lua_State *L)
+{
+	Chan **p;
+
+	p = lua_touserdata(L, 1);
+	if(*p != nil)
+		chanunref(*p);
+	*p = nil;
+	return 0;
+}
+
+static luaL_Reg p9_thread_module[] = {
+	{"start", p9_thread_start},
+	{"channel", p9_thread_channel},
+	{nil, nil},
+};
+
+/*
+ * Registers the metatables used by this module, which
+ * the states of threads need even if they never load it.
+ */
+static void
+newmetatables(lua_State *L)
+{
+	static luaL_Reg threadmt[] = {
+		{"join", p9_thread_join},
+		{"__clone", p9_thread_clone},
+		{"__gc", p9_thread_gc},
+		{nil, nil},
+	};
+	static luaL_Reg chanmt[] = {
+		{"send", p9_chan_send},
+		{"recv", p9_chan_recv},
+		{"close", p9_chan_close},
+		{"__len", p9_chan_len},
+		{"__clone", p9_chan_clone},
+		{"__gc", p9_chan_gc},
+		{nil, nil},
+	};
+
+	luaL_newmetatable(L, "p9-Thread");
+	luaL_setfuncs(L, threadmt, 0);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	luaL_newmetatable(L, "p9-Chan");
+	luaL_setfuncs(L, chanmt, 0);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	luaL_newmetatable(L, "p9-Enc");
+	lua_pushcfunction(L, encgc);
+	lua_setfield(L, -2, "__gc");
+	luaL_newmetatable(L, "p9-Msgbox");
+	lua_pushcfunction(L, boxgc);
+	lua_setfield(L, -2, "__gc");
+	lua_pop(L, 4);
+}
+
+int
+luaopen_p9_thread(lua_State *L)
+{
+	newmetatables(L);
+	luaL_newlib(L, p9_thread_module);
+	return 1;
+}
@@ -0,0 +1,355 @@
+#!/bin/luix
+-- Heap snapshot analysis
+--
+-- Reads snapshots written by debug.snapshot(file) and reports what
+-- holds the memory: the retained size of an object is the memory
+-- that would be freed if that object became unreachable, computed
+-- from the dominator tree of the object graph.
+--
+--	heapsnap.lua [-n count] snap	top objects by retained size
+--	heapsnap.lua [-n count] -d old new	growth between two snapshots
+
+local typenames = {
+	[0x00] = "(root)",
+	[0x04] = "string",
+	[0x14] = "string",
+	[0x05] = "table",
+	[0x06] = "function",
+	[0x26] = "function",
+	[0x07] = "userdata",
+	[0x08] = "thread",
+	[0x09] = "upvalue",
+	[0x0a] = "proto",
+}
+
+local WEAK = 0x80
+
+local function usage()
+	io.stderr:write("usage: heapsnap.lua [-n count] snap\n")
+	io.stderr:write("       heapsnap.lua [-n count] -d old new\n")
+	os.exit(1)
+end
+
+-- Snapshot reader
+
+local function parse(file)
+	local f, err = io.open(file, "rb")
+	if not f then
+		error(err, 0)
+	end
+	local s = f:read("a")
+	f:close()
+	local pos = 1
+	local function byte()
+		local b = s:byte(pos)
+		if not b then
+			error(file .. ": truncated snapshot", 0)
+		end
+		pos = pos + 1
+		return b
+	end
+	local function size()
+		local x, b = 0
+		repeat
+			b = byte()
+			x = (x << 7) | (b & 0x7f)
+		until b & 0x80 ~= 0
+		return x
+	end
+	local function name()
+		local n = size()
+		if n == 0 then
+			return nil
+		end
+		local r = s:sub(pos, pos + n - 2)
+		pos = pos + n - 1
+		return r
+	end
+	if s:sub(1, 5) ~= "\27LuaS" then
+		error(file .. ": not a heap snapshot", 0)
+	end
+	pos = 6
+	if byte() ~= 1 then
+		error(file .. ": unknown snapshot version", 0)
+	end
+	byte() -- sizeof(size_t)
+
+	local snap = {
+		id = {},	-- node index -> object address
+		index = {},	-- object address -> node index
+		tt = {},
+		size = {},
+		name = {},
+		succ = {},	-- node index -> {node index, ...}
+		via = {},	-- node index -> {edge name, ...}, parallel to succ
+		edges = {},	-- raw edges, resolved after all nodes are known
+	}
+	while true do
+		local r = byte()
+		if r == 0x6e then -- 'n'
+			local tt, id, sz = byte(), size(), size()
+			local i = #snap.id + 1
+			snap.id[i] = id
+			snap.index[id] = i
+			snap.tt[i], snap.size[i], snap.name[i] = tt, sz, name()
+			snap.succ[i], snap.via[i] = {}, {}
+		elseif r == 0x65 then -- 'e'
+			local from, to, kind = size(), size(), byte()
+			local label = name()
+			if kind & WEAK == 0 then
+				local e = snap.edges
+				e[#e + 1] = from
+				e[#e + 1] = to
+				e[#e + 1] = label or false
+			end
+		elseif r == 0x7a then -- 'z'
+			break
+		else
+			error(file .. ": bad record", 0)
+		end
+	end
+	local e = snap.edges
+	for k = 1, #e, 3 do
+		local from, to = snap.index[e[k]], snap.index[e[k + 1]]
+		if from and to then
+			local sl, vl = snap.succ[from], snap.via[from]
+			sl[#sl + 1] = to
+			vl[#sl] = e[k + 2]
+		end
+	end
+	snap.edges = nil
+	return snap
+end
+
+-- Dominators
+--
+-- Cooper, Harvey, Kennedy, "A Simple, Fast Dominance Algorithm",
+-- iterating over the reverse postorder of the reachable graph.
+
+local function dominators(snap)
+	local succ = snap.succ
+	local root = snap.index[0]
+	local order, rpo = {}, {}
+	local pred = {}
+	-- Iterative depth-first search for the postorder
+	local visited = {[root] = true}
+	local stack, pos = {root}, {1}
+	while #stack > 0 do
+		local n = stack[#stack]
+		local i = pos[#pos]
+		local sl = succ[n]
+		if i <= #sl then
+			pos[#pos] = i + 1
+			local m = sl[i]
+			local pl = pred[m]
+			if not pl then
+				pl = {}
+				pred[m] = pl
+			end
+			pl[#pl + 1] = n
+			if not visited[m] then
+				visited[m] = true
+				stack[#stack + 1] = m
+				pos[#pos + 1] = 1
+			end
+		else
+			stack[#stack] = nil
+			pos[#pos] = nil
+			order[#order + 1] = n
+		end
+	end
+	for i = 1, #order do
+		rpo[order[i]] = #order - i + 1
+	end
+	local idom = {[root] = root}
+	local function intersect(a, b)
+		while a ~= b do
+			while rpo[a] > rpo[b] do a = idom[a] end
+			while rpo[b] > rpo[a] do b = idom[b] end
+		end
+		return a
+	end
+	local changed = true
+	while changed do
+		changed = false
+		for i = #order - 1, 1, -1 do
+			local n = order[i]
+			local new
+			for _, p in ipairs(pred[n]) do
+				if idom[p] then
+					new = new and intersect(p, new) or p
+				end
+			end
+			if idom[n] ~= new then
+				idom[n] = new
+				changed = true
+			end
+		end
+	end
+	-- Retained sizes, children before parents
+	local retained = {}
+	for i = 1, #order do
+		local n = order[i]
+		retained[n] = (retained[n] or 0) + snap.size[n]
+		if n ~= root then
+			local d = idom[n]
+			retained[d] = (retained[d] or 0) + retained[n]
+		end
+	end
+	snap.idom, snap.retained, snap.reachable = idom, retained, order
+	return snap
+end
+
+-- Reports
+
+local function label(snap, n)
+	if snap.id[n] == 0 then
+		return "(root)"
+	end
+	local s = typenames[snap.tt[n]] or string.format("type %d", snap.tt[n])
+	local name = snap.name[n]
+	if name then
+		name = name:gsub("[%c]", "?")
+		if snap.tt[n] == 0x04 or snap.tt[n] == 0x14 then
+			name = string.format("%q", name)
+		end
+		s = s .. " " .. name
+	end
+	return s
+end
+
+local function bytes(n)
+	if math.abs(n) >= 1024*1024 then
+		return string.format("%.1fM", n / (1024*1024))
+	elseif math.abs(n) >= 1024 then
+		return string.format("%.1fK", n / 1024)
+	end
+	return string.format("%d", n)
+end
+
+local function bytype(snap)
+	local count, size = {}, {}
+	for _, n in ipairs(snap.reachable) do
+		local t = typenames[snap.tt[n]] or "?"
+		count[t] = (count[t] or 0) + 1
+		size[t] = (size[t] or 0) + snap.size[n]
+	end
+	return count, size
+end
+
+local function report(snap, top)
+	local root = snap.index[0]
+	local count, size = bytype(snap)
+	local types = {}
+	for t in pairs(count) do types[#types + 1] = t end
+	table.sort(types, function(a, b) return size[a] > size[b] end)
+	print(string.format("%d objects, %s reachable, %d unreachable",
+		#snap.reachable, bytes(snap.retained[root]), #snap.id - #snap.reachable))
+	print()
+	print(string.format("%-10s %10s %10s", "type", "count", "size"))
+	for _, t in ipairs(types) do
+		print(string.format("%-10s %10d %10s", t, count[t], bytes(size[t])))
+	end
+	print()
+	local nodes = {}
+	for _, n in ipairs(snap.reachable) do
+		if n ~= root then nodes[#nodes + 1] = n end
+	end
+	table.sort(nodes, function(a, b) return snap.retained[a] > snap.retained[b] end)
+	print(string.format("%10s %10s  %s", "retained", "self", "object <- dominator"))
+	for i = 1, math.min(top, #nodes) do
+		local n = nodes[i]
+		local d = snap.idom[n]
+		local via = ""
+		for j, m in ipairs(snap.succ[d]) do
+			if m == n and snap.via[d][j] then
+				via = "." .. snap.via[d][j]:gsub("[%c]", "?")
+				break
+			end
+		end
+		print(string.format("%10s %10s  %s <- %s%s", bytes(snap.retained[n]),
+			bytes(snap.size[n]), label(snap, n), label(snap, d), via))
+	end
+end
+
+-- Objects are matched between snapshots by type and name, since
+-- addresses of objects are only stable within a single process.
+local function groups(snap)
+	local g = {}
+	for _, n in ipairs(snap.reachable) do
+		local k = label(snap, n)
+		local e = g[k]
+		if not e then
+			e = {count = 0, size = 0, retained = 0}
+			g[k] = e
+		end
+		e.count = e.count + 1
+		e.size = e.size + snap.size[n]
+		e.retained = math.max(e.retained, snap.retained[n])
+	end
+	return g
+end
+
+local function diff(old, new, top)
+	local go, gn = groups(old), groups(new)
+	local rows = {}
+	for k, e in pairs(gn) do
+		local o = go[k] or {count = 0, size = 0, retained = 0}
+		if e.size ~= o.size or e.count ~= o.count then
+			rows[#rows + 1] = {k, e.count - o.count, e.size - o.size}
+		end
+	end
+	for k, o in pairs(go) do
+		if not gn[k] then
+			rows[#rows + 1] = {k, -o.count, -o.size}
+		end
+	end
+	table.sort(rows, function(a, b) return a[3] > b[3] end)
+	local ro, rn = old.retained[old.index[0]], new.retained[new.index[0]]
+	print(string.format("reachable: %s -> %s (%+d bytes)", bytes(ro), bytes(rn), rn - ro))
+	local co, so = bytype(old)
+	local cn, sn = bytype(new)
+	print()
+	print(string.format("%-10s %10s %10s", "type", "count", "size"))
+	local types = {}
+	for t in pairs(co) do types[t] = true end
+	for t in pairs(cn) do types[t] = true end
+	for t in pairs(types) do
+		local dc = (cn[t] or 0) - (co[t] or 0)
+		local ds = (sn[t] or 0) - (so[t] or 0)
+		if dc ~= 0 or ds ~= 0 then
+			print(string.format("%-10s %+10d %10s", t, dc, bytes(ds)))
+		end
+	end
+	print()
+	print(string.format("%10s %10s  %s", "count", "size", "object"))
+	for i = 1, math.min(top, #rows) do
+		local r = rows[i]
+		print(string.format("%+10d %10s  %s", r[2], bytes(r[3]), r[1]))
+	end
+end
+
+local top, isdiff = 20, false
+local files = {}
+local i = 1
+while i <= #arg do
+	local a = arg[i]
+	if a == "-n" then
+		i = i + 1
+		top = tonumber(arg[i]) or usage()
+	elseif a == "-d" then
+		isdiff = true
+	elseif a:sub(1, 1) == "-" then
+		usage()
+	else
+		files[#files + 1] = a
+	end
+	i = i + 1
+end
+if isdiff then
+	if #files ~= 2 then usage() end
+	diff(dominators(parse(files[1])), dominators(parse(files[2])), top)
+else
+	if #files ~= 1 then usage() end
+	report(dominators(parse(files[1])), top)
+end